@@ -55,11 +55,16 @@ inline void SetMemExec(void *address, size_t size)
 
 inline void PatchRelJump32(unsigned char *target, void *callback)
 {
-	SetMemPatchable(target, 5);
+	unsigned char jump[5];
+	jump[0] = IA32_JMP_IMM32;
+	*(int32_t *)(&jump[1]) = int32_t((unsigned char *)callback - (target + 5));
 
-	target[0] = IA32_JMP_IMM32;
-	*(int32_t *)(&target[1]) = int32_t((unsigned char *)callback - (target + 5));
+	// Even an identical write would give the process its own copy of the page
+	if (memcmp(target, jump, sizeof(jump)) == 0)
+		return;
 
+	SetMemPatchable(target, 5);
+	memcpy(target, jump, sizeof(jump));
 	SetMemExec(target, 5);
 }
 
@@ -85,12 +90,21 @@ inline void PatchAbsJump64(unsigned char *target, void *callback)
 	SetMemExec(target, 14);
 }
 
-inline void DoGatePatch(unsigned char *target, void *callback)
+inline bool IsRelJump32Reachable(void *target, void *callback)
 {
 #if defined(_WIN64) || defined(__x86_64__)
 	int64_t diff = int64_t(target) - int64_t(callback) + 5;
 	int32_t upperBits = (diff >> 32);
-	if (upperBits == 0 || upperBits == -1)
+	return upperBits == 0 || upperBits == -1;
+#else
+	return true;
+#endif
+}
+
+inline void DoGatePatch(unsigned char *target, void *callback)
+{
+#if defined(_WIN64) || defined(__x86_64__)
+	if (IsRelJump32Reachable(target, callback))
 		PatchRelJump32(target, callback);
 	else
 		PatchAbsJump64(target, callback);
@@ -101,8 +115,6 @@ inline void DoGatePatch(unsigned char *target, void *callback)
 
 inline void ApplyPatch(void *address, int offset, const patch_t *patch, patch_t *restore)
 {
-	SetMemPatchable(address, sizeof(patch->patch));
-
 	unsigned char *addr = (unsigned char *)address + offset;
 	if (restore)
 	{
@@ -113,6 +125,11 @@ inline void ApplyPatch(void *address, int offset, const patch_t *patch, patch_t
 		restore->bytes = patch->bytes;
 	}
 
+	if (memcmp(addr, patch->patch, patch->bytes) == 0)
+		return;
+
+	SetMemPatchable(address, sizeof(patch->patch));
+
 	memcpy(addr, patch->patch, patch->bytes);
 
 	SetMemExec(address, sizeof(patch->patch));
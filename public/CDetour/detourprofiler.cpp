@@ -0,0 +1,289 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "detourprofiler.h"
+#include "detourthunks.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <x86intrin.h>
+
+static thread_local void *t_ProfilerState = nullptr;
+
+static inline double Now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+bool DetourProfiler::Enable(unsigned int dumpInterval)
+{
+	if (enabled_)
+		return true;
+
+	if (!EmitReturnStub(exitStub_, &DetourProfiler::Exit)) {
+		printf("Failed to create exit stub for detour profiling\n");
+		return false;
+	}
+
+	enabled_ = true;
+
+	if (dumpInterval) {
+		running_ = true;
+		dumper_ = std::thread(&DetourProfiler::DumpThread, this, dumpInterval);
+	}
+
+	return true;
+}
+
+DetourProfiler::~DetourProfiler()
+{
+	StopDumper();
+}
+
+void DetourProfiler::Shutdown()
+{
+	if (!enabled_)
+		return;
+
+	StopDumper();
+	Dump();
+}
+
+void DetourProfiler::StopDumper()
+{
+	if (!running_)
+		return;
+
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		running_ = false;
+	}
+
+	wakeup_.notify_all();
+	dumper_.join();
+}
+
+DetourProfiler::ThreadState *DetourProfiler::GetThreadState()
+{
+	ThreadState *state = static_cast<ThreadState *>(t_ProfilerState);
+	if (state)
+		return state;
+
+	// Thread states are never freed so that the counts of exited threads are still reported
+	state = new ThreadState();
+	t_ProfilerState = state;
+
+	DetourProfiler &profiler = GetInstance();
+	std::lock_guard<std::mutex> guard(profiler.lock_);
+	profiler.threads_.append(state);
+
+	return state;
+}
+
+// Called by the gate thunk before jumping to the callback. Replaces the caller's return address
+// so that the callback returns into the exit stub. If the shadow stack is full, the call is
+// counted but not timed and the callback returns directly to the caller.
+void DetourProfiler::Enter(void *context, void **returnAddress)
+{
+	DetourProfiler &profiler = GetInstance();
+	Entry *entry = static_cast<Entry *>(context);
+	ThreadState *state = GetThreadState();
+	size_t index = entry - profiler.entries_;
+
+	Counter *counter = state->counters[index].load(std::memory_order_relaxed);
+	if (!counter) {
+		counter = new Counter();
+		state->counters[index].store(counter, std::memory_order_release);
+	}
+
+	counter->calls.store(counter->calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	if (state->depth == kMaxDepth)
+		return;
+
+	Frame &frame = state->frames[state->depth++];
+	frame.returnAddress = *returnAddress;
+	frame.counter = counter;
+	*returnAddress = profiler.exitStub_.GetData();
+	frame.start = __rdtsc();
+}
+
+// Called by the exit stub after the callback returns. Must not touch the x87 stack, which may
+// hold the callback's return value on i386.
+void *DetourProfiler::Exit()
+{
+	uint64_t end = __rdtsc();
+	ThreadState *state = static_cast<ThreadState *>(t_ProfilerState);
+	Frame &frame = state->frames[--state->depth];
+	Counter *counter = frame.counter;
+	uint64_t cycles = end - frame.start;
+
+	counter->cycles.store(counter->cycles.load(std::memory_order_relaxed) + cycles, std::memory_order_relaxed);
+	counter->histogram.RecordLocal(cycles);
+
+	return frame.returnAddress;
+}
+
+void *DetourProfiler::CreateGate(GenBuffer &codegen, void *target, void *callback)
+{
+	if (!enabled_)
+		return nullptr;
+
+	size_t index = numEntries_.load(std::memory_order_relaxed);
+	if (index == kMaxDetours) {
+		printf("Detour profiling limit reached, %p will not be profiled\n", target);
+		return nullptr;
+	}
+
+	Entry *entry = &entries_[index];
+	entry->address = target;
+	entry->created = entry->lastDump = Now();
+	entry->lastCalls = 0;
+
+	Dl_info info;
+	if (dladdr(target, &info) && info.dli_fname) {
+		const char *lib = strrchr(info.dli_fname, '/');
+		lib = lib ? lib + 1 : info.dli_fname;
+
+		if (info.dli_sname && info.dli_saddr == target)
+			snprintf(entry->name, sizeof(entry->name), "%s`%s", lib, info.dli_sname);
+		else
+			snprintf(entry->name, sizeof(entry->name), "%s+0x%lx", lib,
+			         (unsigned long)((char *)target - (char *)info.dli_fbase));
+	} else {
+		snprintf(entry->name, sizeof(entry->name), "%p", target);
+	}
+
+	entry->callback = callback;
+	if (!EmitEnterThunk(codegen, &DetourProfiler::Enter, entry, &entry->callback)) {
+		printf("Failed to create profiling thunk for %s\n", entry->name);
+		return nullptr;
+	}
+
+	numEntries_.store(index + 1, std::memory_order_release);
+
+	return codegen.GetData();
+}
+
+void DetourProfiler::Collect(size_t index, uint64_t &calls, uint64_t &cycles, LatencyHistogram &histogram)
+{
+	calls = cycles = 0;
+	histogram.Reset();
+
+	std::lock_guard<std::mutex> guard(lock_);
+	for (size_t i = 0; i < threads_.length(); i++) {
+		Counter *counter = threads_[i]->counters[index].load(std::memory_order_acquire);
+		if (!counter)
+			continue;
+
+		calls += counter->calls.load(std::memory_order_relaxed);
+		cycles += counter->cycles.load(std::memory_order_relaxed);
+		histogram.Merge(counter->histogram);
+	}
+}
+
+size_t DetourProfiler::GetStats(DetourStats *stats, size_t maxStats)
+{
+	if (!enabled_)
+		return 0;
+
+	size_t count = numEntries_.load(std::memory_order_acquire);
+	LatencyHistogram *histogram = new LatencyHistogram();
+	double now = Now();
+
+	for (size_t i = 0; i < count && i < maxStats; i++) {
+		Entry &entry = entries_[i];
+		DetourStats &out = stats[i];
+		uint64_t calls, cycles;
+
+		Collect(i, calls, cycles, *histogram);
+
+		// Timed calls may be fewer than total calls if the shadow stack overflowed
+		uint64_t timed = histogram->TotalCount();
+
+		out.address = entry.address;
+		out.name = entry.name;
+		out.calls = calls;
+		out.callsPerSec = now > entry.created ? calls / (now - entry.created) : 0.0;
+		out.meanCycles = timed ? double(cycles) / timed : 0.0;
+		out.p99Cycles = histogram->Percentile(0.99);
+	}
+
+	delete histogram;
+	return count;
+}
+
+void DetourProfiler::Dump()
+{
+	size_t count = numEntries_.load(std::memory_order_acquire);
+	if (!count)
+		return;
+
+	LatencyHistogram *histogram = new LatencyHistogram();
+	double now = Now();
+
+	printf("Detour profile:\n");
+	printf("  %-48s %12s %10s %12s %12s\n", "Function", "Calls", "Calls/s", "Mean cycles", "p99 cycles");
+
+	for (size_t i = 0; i < count; i++) {
+		Entry &entry = entries_[i];
+		uint64_t calls, cycles;
+
+		Collect(i, calls, cycles, *histogram);
+
+		uint64_t timed = histogram->TotalCount();
+		double elapsed = now - entry.lastDump;
+		double rate = elapsed > 0.0 ? (calls - entry.lastCalls) / elapsed : 0.0;
+
+		printf("  %-48s %12llu %10.1f %12.0f %12llu\n", entry.name, (unsigned long long)calls, rate,
+		       timed ? double(cycles) / timed : 0.0, (unsigned long long)histogram->Percentile(0.99));
+
+		entry.lastCalls = calls;
+		entry.lastDump = now;
+	}
+
+	fflush(stdout);
+	delete histogram;
+}
+
+void DetourProfiler::DumpThread(unsigned int interval)
+{
+	std::unique_lock<std::mutex> guard(lock_);
+
+	while (running_) {
+		wakeup_.wait_for(guard, std::chrono::seconds(interval));
+		if (!running_)
+			break;
+
+		guard.unlock();
+		Dump();
+		guard.lock();
+	}
+}
@@ -0,0 +1,136 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_DETOURPROFILER_H_
+#define _INCLUDE_SRCDS_DETOURPROFILER_H_
+
+#include <sourcehook/sh_include.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "amtl/am-vector.h"
+#include "IDetour.h"
+#include "histogram.h"
+
+/**
+ * Optional call counting and cycle accounting for detours.
+ *
+ * When enabled, each detour created afterwards is gated through a generated thunk instead of
+ * jumping straight to its callback. The thunk records the call in a per-thread counter, swaps
+ * the caller's return address for a shared exit stub and reads the TSC. When the callback
+ * returns, the exit stub adds the elapsed cycles to the thread's histogram for that detour and
+ * returns to the real caller. Detours created while profiling is disabled are untouched.
+ *
+ * The exit stub has no unwind info, so a C++ exception thrown through a profiled callback ends
+ * in std::terminate and a longjmp over one leaves a stale frame on the thread's stack. Crash
+ * reports and debuggers show the exit stub instead of the real caller. Only profile detours
+ * whose callbacks neither throw nor longjmp.
+ */
+class DetourProfiler
+{
+public:
+	static constexpr size_t kMaxDetours = 128;
+	static constexpr size_t kMaxDepth = 64;
+
+	static inline DetourProfiler &GetInstance() {
+		static DetourProfiler profiler;
+		return profiler;
+	}
+
+	/* Must be called before any detours are created. An interval of 0 disables periodic dumps. */
+	bool Enable(unsigned int dumpInterval);
+	void Shutdown();
+
+	inline bool IsEnabled() const {
+		return enabled_;
+	}
+
+	/**
+	 * Generates the instrumented gate for a detour into codegen.
+	 * Returns the address the detour should jump to, or nullptr if the detour is not profiled.
+	 */
+	void *CreateGate(GenBuffer &codegen, void *target, void *callback);
+
+	size_t GetStats(DetourStats *stats, size_t maxStats);
+	void Dump();
+
+private:
+	struct Entry
+	{
+		void *address;
+		void *callback;
+		char name[128];
+		double created;
+		uint64_t lastCalls;
+		double lastDump;
+	};
+
+	struct Counter
+	{
+		std::atomic<uint64_t> calls;
+		std::atomic<uint64_t> cycles;
+		LatencyHistogram histogram;
+	};
+
+	struct Frame
+	{
+		void *returnAddress;
+		Counter *counter;
+		uint64_t start;
+	};
+
+	struct ThreadState
+	{
+		size_t depth;
+		Frame frames[kMaxDepth];
+		std::atomic<Counter *> counters[kMaxDetours];
+	};
+
+	DetourProfiler() : enabled_(false), running_(false), numEntries_(0) { }
+	~DetourProfiler();
+
+	static void Enter(void *context, void **returnAddress);
+	static void *Exit();
+	static ThreadState *GetThreadState();
+
+	void Collect(size_t index, uint64_t &calls, uint64_t &cycles, LatencyHistogram &histogram);
+	void DumpThread(unsigned int interval);
+	void StopDumper();
+
+	bool enabled_;
+	bool running_;
+	GenBuffer exitStub_;
+	Entry entries_[kMaxDetours];
+	std::atomic<size_t> numEntries_;
+	ke::Vector<ThreadState *> threads_;
+	std::mutex lock_;
+	std::condition_variable wakeup_;
+	std::thread dumper_;
+};
+
+#endif // _INCLUDE_SRCDS_DETOURPROFILER_H_
@@ -30,6 +30,7 @@
 */
 
 #include "detours.h"
+#include "detourprofiler.h"
 #include <asm/asm.h>
 
 CPageAlloc GenBuffer::ms_Allocator(16);
@@ -69,6 +70,7 @@ CDetour::CDetour(void *callbackfunction, void **trampoline)
 	detour_trampoline = NULL;
 	this->detour_callback = callbackfunction;
 	this->trampoline = trampoline;
+	this->detour_gate = callbackfunction;
 }
 
 bool CDetour::Init(void *addr)
@@ -112,34 +114,46 @@ bool CDetour::CreateDetour()
 		return false;
 	}
 
-#if defined(_WIN64) || defined(__x86_64__)
-	//int shortBytes = copy_bytes((unsigned char *)detour_address, NULL, OP_JMP_SIZE);
-	detour_restore.bytes = copy_bytes((unsigned char *)detour_address, NULL, X64_ABS_SIZE);
-#else
-	detour_restore.bytes = copy_bytes((unsigned char *)detour_address, NULL, OP_JMP_SIZE);
-#endif
+	/* Keep generated code close enough to the function to reach it with 32-bit jumps */
+	codegen.SetAllocHint(detour_address);
+	gatecode.SetAllocHint(detour_address);
 
-	codegen.alloc(detour_restore.bytes);
+	/* The gate patch has to be able to reach the profiling gate, so create it first */
+	if (void *gate = DetourProfiler::GetInstance().CreateGate(gatecode, detour_address, detour_callback))
+		detour_gate = gate;
 
 	int requiredSize = OP_JMP_SIZE;
-#if defined(_WIN64) || defined(__x86_64__)
-	if (!IsShortJump(codegen, detour_address))
+	if (!IsRelJump32Reachable(detour_address, detour_gate))
 		requiredSize = X64_ABS_SIZE;
-#endif
 
 	/*
 	 * Determine how many bytes to save from target function.
 	 * We want 5 for our detour jmp, but it could require more.
 	 */
-	detour_restore.bytes = copy_bytes((unsigned char *)detour_address, NULL, requiredSize);
+	int relocatedSize;
+	int bytes = relocate_bytes((unsigned char *)detour_address, NULL, NULL, requiredSize, &relocatedSize);
+	if (bytes < 0 || bytes > (int)sizeof(detour_restore.patch))
+	{
+		printf("Can't relocate the start of the function at %p\n", detour_address);
+		return false;
+	}
+
+	detour_restore.bytes = bytes;
+
+	/* Reserve the return jump too, so the buffer doesn't move once the code is relocated into it */
+	codegen.alloc(relocatedSize + X64_ABS_SIZE);
 
 	/* First, save restore bits */
 	memcpy(detour_restore.patch, (unsigned char *)detour_address, detour_restore.bytes);
 
 	/* Patch old bytes in */
-	copy_bytes((unsigned char *)detour_address, codegen.GetData(), detour_restore.bytes);
+	if (relocate_bytes((unsigned char *)detour_address, codegen.GetWritableData(), codegen.GetData(), bytes, &relocatedSize) < 0)
+	{
+		printf("Can't relocate the start of the function at %p\n", detour_address);
+		return false;
+	}
 
-	codegen.set_outputpos(detour_restore.bytes);
+	codegen.set_outputpos(relocatedSize);
 
 	/* Return to the original function */
 	AbsJump(codegen, (unsigned char *)detour_address + detour_restore.bytes);
@@ -170,7 +184,7 @@ void CDetour::Enable()
 {
 	if (!detoured)
 	{
-		DoGatePatch((unsigned char *)detour_address, detour_callback);
+		DoGatePatch((unsigned char *)detour_address, detour_gate);
 		detoured = true;
 	}
 }
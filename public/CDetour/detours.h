@@ -74,8 +74,11 @@ private:
 	void *detour_callback;
 	/* The function pointer used to call our trampoline */
 	void **trampoline;
+	/* Address the gate patch jumps to, either the callback or a profiling thunk */
+	void *detour_gate;
 
 	GenBuffer codegen;
+	GenBuffer gatecode;
 };
 
 #endif // _INCLUDE_SOURCEMOD_DETOURS_H_
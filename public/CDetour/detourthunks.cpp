@@ -0,0 +1,136 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "detourthunks.h"
+
+bool EmitEnterThunk(GenBuffer &codegen, ThunkEnterFn enter, void *context, void **target)
+{
+#if defined(__x86_64__)
+	// Preserve all argument registers, including al for variadic functions
+	static const jit_uint8_t argRegs[] = {REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9, REG_RAX};
+
+	for (jit_uint8_t reg : argRegs)
+		X64_Push_Reg(&codegen, reg);
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Sub_Rm_Imm32(&codegen, REG_RSP, 0x80, MOD_REG);
+	for (int i = 0; i < 8; i++)
+		SSE_Movdqu_EspDisp8_Xmm(&codegen, i * 16, i);
+
+	X64_Mov_Reg_Imm64(&codegen, REG_RDI, jit_int64_t(context));
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Lea_Reg_EspDisp32(&codegen, REG_RSI, 0x80 + sizeof(argRegs) * 8);
+	X64_Mov_Reg_Imm64(&codegen, REG_RAX, jit_int64_t(enter));
+	IA32_Call_Reg(&codegen, REG_RAX);
+
+	for (int i = 0; i < 8; i++)
+		SSE_Movdqu_Xmm_EspDisp8(&codegen, i, i * 16);
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Add_Rm_Imm32(&codegen, REG_RSP, 0x80, MOD_REG);
+	for (size_t i = sizeof(argRegs); i-- > 0;)
+		X64_Pop_Reg(&codegen, argRegs[i]);
+
+	// r11 is the only scratch register that is never used to pass arguments
+	X64_Mov_Reg_Imm64(&codegen, REG_R11, jit_int64_t(target));
+	X64_Emit_Rex(&codegen, false, 0, 0, REG_R11);
+	IA32_Jump_Rm(&codegen, REG_R11 & 7, MOD_MEM_REG);
+#else
+	IA32_Push_Reg(&codegen, REG_EAX);
+	IA32_Push_Reg(&codegen, REG_ECX);
+	IA32_Push_Reg(&codegen, REG_EDX);
+	IA32_Lea_Reg_EspDisp32(&codegen, REG_EAX, 12);
+	IA32_Sub_Rm_Imm8(&codegen, REG_ESP, 8, MOD_REG);
+	IA32_Push_Reg(&codegen, REG_EAX);
+	IA32_Push_Imm32(&codegen, jit_int32_t(context));
+	IA32_Mov_Reg_Imm32(&codegen, REG_EAX, jit_int32_t(enter));
+	IA32_Call_Reg(&codegen, REG_EAX);
+	IA32_Add_Rm_Imm8(&codegen, REG_ESP, 16, MOD_REG);
+	IA32_Pop_Reg(&codegen, REG_EDX);
+	IA32_Pop_Reg(&codegen, REG_ECX);
+	IA32_Pop_Reg(&codegen, REG_EAX);
+
+	// jmp [target]
+	IA32_Jump_Rm(&codegen, REG_EBP, MOD_MEM_REG);
+	codegen.write_int32(jit_int32_t(target));
+#endif
+
+	if (!codegen.GetData())
+		return false;
+
+	codegen.SetRE();
+	return true;
+}
+
+bool EmitReturnStub(GenBuffer &codegen, ThunkReturnFn leave)
+{
+#if defined(__x86_64__)
+	// Keep the return value in rax/rdx and xmm0/xmm1 while leave() runs, then return to the
+	// address it gives back through a reserved stack slot.
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Sub_Rm_Imm8(&codegen, REG_RSP, 8, MOD_REG);
+	X64_Push_Reg(&codegen, REG_RAX);
+	X64_Push_Reg(&codegen, REG_RDX);
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Sub_Rm_Imm8(&codegen, REG_RSP, 0x28, MOD_REG);
+	SSE_Movdqu_EspDisp8_Xmm(&codegen, 0x00, 0);
+	SSE_Movdqu_EspDisp8_Xmm(&codegen, 0x10, 1);
+	X64_Mov_Reg_Imm64(&codegen, REG_RAX, jit_int64_t(leave));
+	IA32_Call_Reg(&codegen, REG_RAX);
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Mov_ESP_Disp8_Reg(&codegen, 0x38, REG_RAX);
+	SSE_Movdqu_Xmm_EspDisp8(&codegen, 0, 0x00);
+	SSE_Movdqu_Xmm_EspDisp8(&codegen, 1, 0x10);
+	X64_Emit_Rex(&codegen, true, 0, 0, REG_RSP);
+	IA32_Add_Rm_Imm8(&codegen, REG_RSP, 0x28, MOD_REG);
+	X64_Pop_Reg(&codegen, REG_RDX);
+	X64_Pop_Reg(&codegen, REG_RAX);
+	IA32_Return(&codegen);
+#else
+	// Functions returning structures pop their hidden argument on i386, so the stack alignment
+	// is unknown here. Realign it through ebp before calling leave().
+	IA32_Sub_Rm_Imm8(&codegen, REG_ESP, 4, MOD_REG);
+	IA32_Push_Reg(&codegen, REG_EAX);
+	IA32_Push_Reg(&codegen, REG_EDX);
+	IA32_Push_Reg(&codegen, REG_EBP);
+	IA32_Mov_Reg_Rm(&codegen, REG_EBP, REG_ESP, MOD_REG);
+	IA32_And_Rm_Imm8(&codegen, REG_ESP, MOD_REG, -16);
+	IA32_Mov_Reg_Imm32(&codegen, REG_EAX, jit_int32_t(leave));
+	IA32_Call_Reg(&codegen, REG_EAX);
+	IA32_Mov_Reg_Rm(&codegen, REG_ESP, REG_EBP, MOD_REG);
+	IA32_Pop_Reg(&codegen, REG_EBP);
+	IA32_Mov_ESP_Disp8_Reg(&codegen, 8, REG_EAX);
+	IA32_Pop_Reg(&codegen, REG_EDX);
+	IA32_Pop_Reg(&codegen, REG_EAX);
+	IA32_Return(&codegen);
+#endif
+
+	if (!codegen.GetData())
+		return false;
+
+	codegen.SetRE();
+	return true;
+}
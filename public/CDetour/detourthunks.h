@@ -0,0 +1,58 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_DETOURTHUNKS_H_
+#define _INCLUDE_SRCDS_DETOURTHUNKS_H_
+
+#include <sourcehook/sh_include.h>
+
+/**
+ * Called on entry with the thunk's context and the address of the caller's return address.
+ * Replacing *returnAddress with a return stub gives control back after the function returns.
+ */
+using ThunkEnterFn = void (*)(void *context, void **returnAddress);
+
+/* Called by a return stub. Returns the address to resume execution at. */
+using ThunkReturnFn = void *(*)();
+
+/**
+ * Emits code that calls enter(context, &returnAddress) with all argument registers preserved
+ * and then jumps to the address stored in *target. Because the jump is indirect, *target may be
+ * filled in after the thunk is generated, e.g. with the trampoline of a detour that uses it.
+ */
+bool EmitEnterThunk(GenBuffer &codegen, ThunkEnterFn enter, void *context, void **target);
+
+/**
+ * Emits a stub that preserves the return value registers, calls leave() and returns to the
+ * address it gives back. The stub is shared by every thunk that returns through it.
+ *
+ * leave must not use the x87 stack since it may hold the return value on i386.
+ */
+bool EmitReturnStub(GenBuffer &codegen, ThunkReturnFn leave);
+
+#endif // _INCLUDE_SRCDS_DETOURTHUNKS_H_
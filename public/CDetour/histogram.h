@@ -0,0 +1,129 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_HISTOGRAM_H_
+#define _INCLUDE_SRCDS_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+/**
+ * Log-linear latency histogram in the style of HdrHistogram.
+ *
+ * Values below 16 get their own bucket. Larger values are grouped by their highest set bit and
+ * then split into 16 linear sub-buckets, which bounds the relative error of any reported
+ * percentile to about 6% while covering the full 64-bit range in under 1000 counters.
+ *
+ * Record() may be called concurrently from any number of threads without locking. Threads
+ * that own a histogram exclusively can use RecordLocal() to avoid the locked add.
+ */
+class LatencyHistogram
+{
+public:
+	static constexpr unsigned int kSubBucketBits = 4;
+	static constexpr unsigned int kSubBuckets = 1 << kSubBucketBits;
+	static constexpr unsigned int kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+	LatencyHistogram() {
+		Reset();
+	}
+
+	static inline unsigned int BucketIndex(uint64_t value) {
+		if (value < kSubBuckets)
+			return unsigned(value);
+
+		unsigned int exp = 63 - __builtin_clzll(value);
+		unsigned int sub = unsigned(value >> (exp - kSubBucketBits)) & (kSubBuckets - 1);
+		return (exp - kSubBucketBits + 1) * kSubBuckets + sub;
+	}
+
+	/* Smallest value that falls into the given bucket */
+	static inline uint64_t BucketValue(unsigned int index) {
+		if (index < kSubBuckets)
+			return index;
+
+		unsigned int exp = index / kSubBuckets + kSubBucketBits - 1;
+		uint64_t sub = index % kSubBuckets;
+		return (uint64_t(1) << exp) | (sub << (exp - kSubBucketBits));
+	}
+
+	inline void Record(uint64_t value) {
+		counts_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void RecordLocal(uint64_t value) {
+		std::atomic<uint64_t> &count = counts_[BucketIndex(value)];
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void Merge(const LatencyHistogram &other) {
+		for (unsigned int i = 0; i < kBuckets; i++) {
+			uint64_t n = other.counts_[i].load(std::memory_order_relaxed);
+			if (n)
+				counts_[i].fetch_add(n, std::memory_order_relaxed);
+		}
+	}
+
+	void Reset() {
+		for (unsigned int i = 0; i < kBuckets; i++)
+			counts_[i].store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t TotalCount() const {
+		uint64_t total = 0;
+		for (unsigned int i = 0; i < kBuckets; i++)
+			total += counts_[i].load(std::memory_order_relaxed);
+		return total;
+	}
+
+	/* Returns the value at or below which the given fraction (0.0 - 1.0) of samples fall */
+	uint64_t Percentile(double fraction) const {
+		uint64_t total = TotalCount();
+		if (total == 0)
+			return 0;
+
+		uint64_t target = uint64_t(fraction * double(total) + 0.5);
+		if (target == 0)
+			target = 1;
+
+		uint64_t seen = 0;
+		for (unsigned int i = 0; i < kBuckets; i++) {
+			seen += counts_[i].load(std::memory_order_relaxed);
+			if (seen >= target)
+				return BucketValue(i);
+		}
+
+		return BucketValue(kBuckets - 1);
+	}
+
+private:
+	std::atomic<uint64_t> counts_[kBuckets];
+};
+
+#endif // _INCLUDE_SRCDS_HISTOGRAM_H_
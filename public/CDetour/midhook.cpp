@@ -0,0 +1,354 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+
+#include "midhook.h"
+#include <asm/asm.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#if defined(__x86_64__)
+static constexpr int kWordSize = 8;
+static constexpr int kNumRegs = 16;
+static constexpr int kNumXmmRegs = 16;
+/* The System V ABI lets leaf functions use 128 bytes below rsp without adjusting it */
+static constexpr int kRedZone = 128;
+/* No arguments are passed on the stack */
+static constexpr int kArgArea = 0;
+/* Registers a call may clobber, in the order the thunk pushes them */
+static const jit_uint8_t kVolatileRegs[] = {REG_RAX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9, REG_R10, REG_R11};
+#else
+static constexpr int kWordSize = 4;
+static constexpr int kNumRegs = 8;
+static constexpr int kNumXmmRegs = 8;
+static constexpr int kRedZone = 0;
+/* Room for the context pointer argument, keeping the stack 16 byte aligned at the call */
+static constexpr int kArgArea = 16;
+static const jit_uint8_t kVolatileRegs[] = {REG_EAX, REG_ECX, REG_EDX};
+#endif
+
+/*
+ * The thunk steps over the red zone and a word reserved for redirected exits, pushes flags if
+ * the callback declared them and pushes eax/rax, which is then used to align the stack. From
+ * the stack pointer saved after those pushes:
+ *   [sp]                 eax/rax
+ *   [sp + W]             flags (only if declared)
+ *   [sp + ResumeSlot()]  address a redirected exit returns to
+ *   [sp + HookStack()]   rsp at the hook point
+ * The rest of the registers are kept in the context on the aligned frame.
+ */
+static inline int ResumeSlot(bool saveFlags)
+{
+	return (saveFlags ? 2 : 1) * kWordSize;
+}
+
+static inline int HookStack(bool saveFlags)
+{
+	return ResumeSlot(saveFlags) + kWordSize + kRedZone;
+}
+
+static constexpr int kContextSize = (sizeof(MidHookContext) + 15) & ~15;
+
+// Wide register operands need REX.W on x86_64
+static inline void EmitWide(GenBuffer &codegen)
+{
+#if defined(__x86_64__)
+	X64_Emit_Rex(&codegen, true, 0, 0, 0);
+#endif
+}
+
+// <op> reg, [base+disp32], with prefix (if any) placed before REX
+static void EmitRegMem(GenBuffer &codegen, jit_uint8_t prefix, jit_uint8_t opcode, bool twoByte, bool wide,
+                       jit_uint8_t reg, jit_uint8_t base, jit_int32_t disp)
+{
+	if (prefix)
+		codegen.write_ubyte(prefix);
+#if defined(__x86_64__)
+	if (wide || reg >= REG_R8 || base >= REG_R8)
+		X64_Emit_Rex(&codegen, wide, reg, 0, base);
+#endif
+	if (twoByte)
+		codegen.write_ubyte(0x0F);
+	codegen.write_ubyte(opcode);
+	codegen.write_ubyte(ia32_modrm(MOD_DISP32, reg & 7, base & 7));
+	if ((base & 7) == REG_ESP)
+		codegen.write_ubyte(ia32_sib(NOSCALE, REG_NOIDX, REG_ESP));
+	codegen.write_int32(disp);
+}
+
+static inline void EmitStore(GenBuffer &codegen, jit_uint8_t base, jit_int32_t disp, jit_uint8_t reg)
+{
+	EmitRegMem(codegen, 0, IA32_MOV_RM_REG, false, true, reg, base, disp);
+}
+
+static inline void EmitLoad(GenBuffer &codegen, jit_uint8_t reg, jit_uint8_t base, jit_int32_t disp)
+{
+	EmitRegMem(codegen, 0, IA32_MOV_REG_RM, false, true, reg, base, disp);
+}
+
+static bool IsVolatile(jit_uint8_t reg)
+{
+	for (jit_uint8_t volatileReg : kVolatileRegs) {
+		if (volatileReg == reg)
+			return true;
+	}
+
+	return false;
+}
+
+// Reloads what the call clobbered and what the callback may have changed, then unwinds the
+// stack to the reserved resume slot
+static void EmitRestore(GenBuffer &codegen, uint32_t regs, int ctx, int savedSp)
+{
+	for (jit_uint8_t reg = 0; reg < kNumRegs; reg++) {
+		if (reg != REG_EAX && reg != REG_ESP && (IsVolatile(reg) || (regs & (1 << reg))))
+			EmitLoad(codegen, reg, REG_ESP, ctx + reg * kWordSize);
+	}
+
+	EmitLoad(codegen, REG_ESP, REG_ESP, savedSp);
+	X64_Pop_Reg(&codegen, REG_EAX);
+	if (regs & MidHookReg_Flags)
+		codegen.write_ubyte(0x9D);		// popf
+}
+
+CMidHook::CMidHook(MidHookCallback callback, uint32_t regs)
+{
+	enabled_ = false;
+	patched_ = false;
+	address_ = nullptr;
+	callback_ = callback;
+	regs_ = regs;
+}
+
+bool CMidHook::Init(void *addr)
+{
+	address_ = addr;
+
+	/* Both the patch and the jump back must be rel32: anything longer would write below rsp */
+	trampoline_.SetAllocHint(addr);
+	thunk_.SetAllocHint(addr);
+
+	int relocatedSize;
+	int bytes = relocate_bytes((unsigned char *)addr, NULL, NULL, OP_JMP_SIZE, &relocatedSize);
+	if (bytes < 0 || bytes > (int)sizeof(restore_.patch)) {
+		printf("Can't relocate the instructions at %p\n", addr);
+		return false;
+	}
+
+	trampoline_.alloc(relocatedSize + OP_JMP_SIZE);
+	if (!trampoline_.GetData() ||
+	    relocate_bytes((unsigned char *)addr, trampoline_.GetWritableData(), trampoline_.GetData(), bytes,
+	                   &relocatedSize) < 0) {
+		printf("Can't relocate the instructions at %p\n", addr);
+		return false;
+	}
+
+	trampoline_.set_outputpos(relocatedSize);
+
+	unsigned char *resume = (unsigned char *)addr + bytes;
+	if (!IsRelJump32Reachable(trampoline_.GetData() + relocatedSize, resume)) {
+		printf("Couldn't allocate the trampoline for %p within reach\n", addr);
+		return false;
+	}
+
+	jitoffs_t jump = IA32_Jump_Imm32(&trampoline_, 0);
+	IA32_Write_Jump32_Abs(&trampoline_, jump, resume);
+	trampoline_.SetRE();
+
+	if (!EmitThunk() || !IsRelJump32Reachable(addr, thunk_.GetData())) {
+		printf("Couldn't generate the hook thunk for %p\n", addr);
+		return false;
+	}
+
+	restore_.bytes = bytes;
+	memcpy(restore_.patch, addr, bytes);
+
+	enabled_ = true;
+	return true;
+}
+
+bool CMidHook::EmitThunk()
+{
+	GenBuffer &codegen = thunk_;
+	const bool saveFlags = (regs_ & MidHookReg_Flags) != 0;
+	const bool saveVector = (regs_ & MidHookReg_Vector) != 0;
+	const int ctx = kArgArea;
+	const int savedSp = kArgArea + kContextSize;
+	const int xmmArea = savedSp + 16;
+	const int frameSize = xmmArea + (saveVector ? kNumXmmRegs * 16 : 0);
+	const int resumeSlot = ResumeSlot(saveFlags);
+
+	// Step over the red zone and the resume slot. Flags are only saved for callbacks that declare
+	// them since popf is slow, so the thunk is free to clobber them otherwise.
+	EmitRegMem(codegen, 0, IA32_LEA_REG_MEM, false, true, REG_ESP, REG_ESP, -(kRedZone + kWordSize));
+	if (saveFlags)
+		codegen.write_ubyte(0x9C);		// pushf
+	X64_Push_Reg(&codegen, REG_EAX);
+
+	EmitWide(codegen);
+	IA32_Mov_Reg_Rm(&codegen, REG_EAX, REG_ESP, MOD_REG);
+	EmitWide(codegen);
+	IA32_And_Rm_Imm8(&codegen, REG_ESP, MOD_REG, -16);
+	EmitWide(codegen);
+	IA32_Sub_Rm_Imm32(&codegen, REG_ESP, frameSize, MOD_REG);
+	EmitStore(codegen, REG_ESP, savedSp, REG_EAX);
+
+	// Only registers the call clobbers and those the callback declared are captured
+	for (jit_uint8_t reg = 0; reg < kNumRegs; reg++) {
+		if (reg != REG_EAX && reg != REG_ESP && (IsVolatile(reg) || (regs_ & (1 << reg))))
+			EmitStore(codegen, REG_ESP, ctx + reg * kWordSize, reg);
+	}
+	if (regs_ & MidHookReg_Rax) {
+		EmitLoad(codegen, REG_ECX, REG_EAX, 0);
+		EmitStore(codegen, REG_ESP, ctx + REG_EAX * kWordSize, REG_ECX);
+	}
+	if (regs_ & MidHookReg_Rsp) {
+		EmitRegMem(codegen, 0, IA32_LEA_REG_MEM, false, true, REG_ECX, REG_EAX, HookStack(saveFlags));
+		EmitStore(codegen, REG_ESP, ctx + REG_ESP * kWordSize, REG_ECX);
+	}
+	if (saveFlags) {
+		EmitLoad(codegen, REG_ECX, REG_EAX, kWordSize);
+		EmitStore(codegen, REG_ESP, ctx + offsetof(MidHookContext, flags), REG_ECX);
+	}
+
+	// ctx->resume = nullptr
+	EmitRegMem(codegen, 0, IA32_MOV_RM_IMM32, false, true, 0, REG_ESP, ctx + offsetof(MidHookContext, resume));
+	codegen.write_int32(0);
+
+	if (saveVector) {
+		for (jit_uint8_t xmm = 0; xmm < kNumXmmRegs; xmm++)
+			EmitRegMem(codegen, 0xF3, 0x7F, true, false, xmm, REG_ESP, xmmArea + xmm * 16);	// movdqu
+	}
+
+#if defined(__x86_64__)
+	EmitRegMem(codegen, 0, IA32_LEA_REG_MEM, false, true, REG_RDI, REG_RSP, ctx);
+	X64_Mov_Reg_Imm64(&codegen, REG_RAX, jit_int64_t(callback_));
+#else
+	EmitRegMem(codegen, 0, IA32_LEA_REG_MEM, false, true, REG_EAX, REG_ESP, ctx);
+	IA32_Mov_ESP_Disp8_Reg(&codegen, 0, REG_EAX);
+	IA32_Mov_Reg_Imm32(&codegen, REG_EAX, jit_int32_t(callback_));
+#endif
+	IA32_Call_Reg(&codegen, REG_EAX);
+
+	if (saveVector) {
+		for (jit_uint8_t xmm = 0; xmm < kNumXmmRegs; xmm++)
+			EmitRegMem(codegen, 0xF3, 0x6F, true, false, xmm, REG_ESP, xmmArea + xmm * 16);	// movdqu
+	}
+
+	// eax/rax and flags live above the aligned frame, so changes to them are written back there
+	EmitLoad(codegen, REG_ECX, REG_ESP, savedSp);
+	if (regs_ & MidHookReg_Rax) {
+		EmitLoad(codegen, REG_EAX, REG_ESP, ctx + REG_EAX * kWordSize);
+		EmitStore(codegen, REG_ECX, 0, REG_EAX);
+	}
+	if (saveFlags) {
+		EmitLoad(codegen, REG_EAX, REG_ESP, ctx + offsetof(MidHookContext, flags));
+		EmitStore(codegen, REG_ECX, kWordSize, REG_EAX);
+	}
+
+	EmitLoad(codegen, REG_EAX, REG_ESP, ctx + offsetof(MidHookContext, resume));
+	EmitWide(codegen);
+	IA32_Test_Rm_Reg(&codegen, REG_EAX, REG_EAX, MOD_REG);
+	jitoffs_t redirect = IA32_Jump_Cond_Imm32(&codegen, CC_NZ, 0);
+
+	// Usual exit: give back the stack and jump to the trampoline through a slot after the code,
+	// which unlike a ret to a pushed address doesn't unbalance the return stack predictor
+	EmitRestore(codegen, regs_, ctx, savedSp);
+	EmitRegMem(codegen, 0, IA32_LEA_REG_MEM, false, true, REG_ESP, REG_ESP, kRedZone + kWordSize);
+	codegen.write_ubyte(IA32_JMP_RM);
+	codegen.write_ubyte(ia32_modrm(MOD_MEM_REG, 4, REG_EBP));	// [rip + disp32] / [disp32]
+	jitoffs_t slotRef = codegen.get_outputpos();
+	codegen.write_int32(0);
+
+	// The callback redirected execution. There is no register left to jump through once they are
+	// all restored, so ctx->resume is returned to from the reserved slot instead.
+	IA32_Send_Jump32_Here(&codegen, redirect);
+	EmitStore(codegen, REG_ECX, resumeSlot, REG_EAX);
+	EmitRestore(codegen, regs_, ctx, savedSp);
+	if (kRedZone)
+		IA32_Return_Popstack(&codegen, kRedZone);
+	else
+		IA32_Return(&codegen);
+
+	while (codegen.get_outputpos() % kWordSize)
+		codegen.write_ubyte(IA32_INT3);
+	jitoffs_t slot = codegen.get_outputpos();
+#if defined(__x86_64__)
+	codegen.write_int64(jit_int64_t(trampoline_.GetData()));
+	codegen.rewrite(slotRef, jit_int32_t(slot - (slotRef + 4)));
+#else
+	codegen.write_int32(jit_int32_t(trampoline_.GetData()));
+#endif
+
+	if (!codegen.GetData())
+		return false;
+
+#if !defined(__x86_64__)
+	// Absolute, so only known once the buffer has stopped growing
+	codegen.rewrite(slotRef, jit_int32_t(codegen.GetData() + slot));
+#endif
+
+	codegen.SetRE();
+	return true;
+}
+
+void CMidHook::Enable()
+{
+	if (enabled_ && !patched_) {
+		PatchRelJump32((unsigned char *)address_, thunk_.GetData());
+		patched_ = true;
+	}
+}
+
+void CMidHook::Disable()
+{
+	if (patched_) {
+		ApplyPatch(address_, 0, &restore_, NULL);
+		patched_ = false;
+	}
+}
+
+bool CMidHook::IsEnabled()
+{
+	return enabled_;
+}
+
+void *CMidHook::GetTargetAddress()
+{
+	return address_;
+}
+
+void CMidHook::Destroy(bool undoPatch)
+{
+	// A patch left in place keeps jumping to the thunk, so its code has to stay around
+	if (!undoPatch && patched_)
+		return;
+
+	Disable();
+	delete this;
+}
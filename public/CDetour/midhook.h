@@ -0,0 +1,78 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+
+#ifndef _INCLUDE_SRCDS_MIDHOOK_H_
+#define _INCLUDE_SRCDS_MIDHOOK_H_
+
+#include <sourcehook/sh_include.h>
+#include "detourhelpers.h"
+#include "IDetour.h"
+
+/**
+ * Hooks an instruction boundary inside a function.
+ *
+ * The instructions under the 5 byte jump are relocated into a trampoline that jumps back after
+ * them. The jump leads to a thunk generated for the registers the callback declared: it saves
+ * what a C call clobbers, captures the declared registers into a MidHookContext on the stack,
+ * calls the callback and writes them back before jumping to the trampoline or returning to
+ * ctx->resume. Flags are only saved when declared.
+ * On x86_64 the thunk steps over the red zone first, so leaf functions can be hooked too.
+ *
+ * Unlike CDetour, Destroy(true) removes the patch. Destroy(false) leaves it and its code alive.
+ */
+class CMidHook : public IDetour
+{
+public:
+	void Enable();
+	void Disable();
+	bool IsEnabled();
+	void *GetTargetAddress();
+	void Destroy(bool undoPatch);
+
+	friend class ServerAPI;
+
+protected:
+	CMidHook(MidHookCallback callback, uint32_t regs);
+	bool Init(void *addr);
+
+private:
+	bool EmitThunk();
+
+	bool enabled_;
+	bool patched_;
+	void *address_;
+	MidHookCallback callback_;
+	uint32_t regs_;
+	patch_t restore_;
+	/* Relocated instructions from the hook point followed by a jump back */
+	GenBuffer trampoline_;
+	GenBuffer thunk_;
+};
+
+#endif // _INCLUDE_SRCDS_MIDHOOK_H_
@@ -0,0 +1,361 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "vtablehook.h"
+#include <sourcehook/sh_include.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <typeinfo>
+#include "amtl/am-vector.h"
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#else
+#include <inttypes.h>
+#endif
+
+/* Upper bound on the number of entries copied into a shadow vtable */
+static constexpr size_t kMaxVtableEntries = 1024;
+
+/* The Itanium ABI places the offset to top and the type info before the vtable's first entry */
+static constexpr size_t kVtablePrefix = 2;
+
+struct VtableShadow
+{
+	void *instance;
+	/* Vtable the object pointed to before it was given the shadow */
+	void **vtable;
+	/* Copy of the vtable including its prefix */
+	void **entries;
+	size_t count;
+	size_t refs;
+};
+
+static std::mutex g_ShadowLock;
+static ke::Vector<VtableShadow *> g_Shadows;
+
+/* Keeps a write from saving the temporary protection set by another one on the same page */
+static std::mutex g_ProtectLock;
+
+// Looks up the current protection of the page holding the address as SH_MEM_* flags
+static bool GetMemAccess(void *addr, int *access)
+{
+#if defined(__APPLE__)
+	mach_vm_address_t address = reinterpret_cast<mach_vm_address_t>(addr);
+	mach_vm_size_t size;
+	vm_region_basic_info_data_64_t info;
+	mach_msg_type_number_t count = VM_REGION_BASIC_INFO_COUNT_64;
+	mach_port_t object;
+
+	if (mach_vm_region(mach_task_self(), &address, &size, VM_REGION_BASIC_INFO_64,
+	                   reinterpret_cast<vm_region_info_t>(&info), &count, &object) != KERN_SUCCESS)
+		return false;
+
+	// The region returned is the next one up if the address isn't mapped
+	if (address > reinterpret_cast<mach_vm_address_t>(addr))
+		return false;
+
+	*access = ((info.protection & VM_PROT_READ) ? SH_MEM_READ : 0) |
+	          ((info.protection & VM_PROT_WRITE) ? SH_MEM_WRITE : 0) |
+	          ((info.protection & VM_PROT_EXECUTE) ? SH_MEM_EXEC : 0);
+	return true;
+#else
+	FILE *fp = fopen("/proc/self/maps", "rt");
+	if (!fp)
+		return false;
+
+	uintptr_t target = reinterpret_cast<uintptr_t>(addr);
+	char line[512];
+	bool found = false;
+
+	while (fgets(line, sizeof(line), fp)) {
+		uintptr_t start, end;
+		char perms[5];
+		if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " %4s", &start, &end, perms) != 3)
+			continue;
+
+		if (target >= start && target < end) {
+			*access = (perms[0] == 'r' ? SH_MEM_READ : 0) | (perms[1] == 'w' ? SH_MEM_WRITE : 0) |
+			          (perms[2] == 'x' ? SH_MEM_EXEC : 0);
+			found = true;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return found;
+#endif
+}
+
+// Vtables have no terminator, so count entries up to the first one that isn't inside a loaded
+// image. Entries after the real end are never called through the object, so overcounting is
+// harmless as long as they are readable.
+static size_t CountVtableEntries(void **vtable)
+{
+	size_t count = 0;
+	Dl_info info;
+
+	while (count < kMaxVtableEntries && vtable[count] && dladdr(vtable[count], &info) != 0)
+		count++;
+
+	return count;
+}
+
+// Itanium ABI layouts of the type info for classes with one non-virtual public base and for
+// every other class with bases. Which one a type info is follows from its vtable pointer.
+struct SiClassTypeInfo
+{
+	void *vtable;
+	const char *name;
+	const SiClassTypeInfo *base;
+};
+
+struct VmiClassTypeInfo
+{
+	void *vtable;
+	const char *name;
+	unsigned int flags;
+	unsigned int baseCount;
+	struct
+	{
+		const SiClassTypeInfo *base;
+		long offsetFlags;
+	} bases[1];
+};
+
+static constexpr long kBaseVirtualFlag = 0x1;
+
+struct NoBaseClass { virtual ~NoBaseClass() {} };
+struct SiClass : NoBaseClass {};
+struct OtherBaseClass { virtual ~OtherBaseClass() {} };
+struct VmiClass : NoBaseClass, OtherBaseClass {};
+
+static void *TypeInfoVtable(const std::type_info &info)
+{
+	return *reinterpret_cast<void *const *>(&info);
+}
+
+// Vtables of classes with virtual bases hold the virtual base and vcall offsets in front of the
+// offset to top, and how many there are isn't recorded anywhere, so Instance mode can't copy them.
+// Also returns false if typeInfo or one of its bases can't be read.
+static bool IsVtableCopyable(const SiClassTypeInfo *typeInfo, unsigned int depth = 0)
+{
+	static void *const noBase = TypeInfoVtable(typeid(NoBaseClass));
+	static void *const si = TypeInfoVtable(typeid(SiClass));
+	static void *const vmi = TypeInfoVtable(typeid(VmiClass));
+
+	if (!typeInfo || depth > 32)
+		return false;
+
+	if (typeInfo->vtable == noBase)
+		return true;
+
+	if (typeInfo->vtable == si)
+		return IsVtableCopyable(typeInfo->base, depth + 1);
+
+	if (typeInfo->vtable != vmi)
+		return false;
+
+	const VmiClassTypeInfo *vmiInfo = reinterpret_cast<const VmiClassTypeInfo *>(typeInfo);
+	for (unsigned int i = 0; i < vmiInfo->baseCount; i++) {
+		if ((vmiInfo->bases[i].offsetFlags & kBaseVirtualFlag) ||
+		    !IsVtableCopyable(vmiInfo->bases[i].base, depth + 1))
+			return false;
+	}
+
+	return true;
+}
+
+CVirtualHook::CVirtualHook(void *callback, void **original, VirtualHookMode mode) :
+	enabled_(false), mode_(mode), callback_(callback), original_(original), entry_(nullptr),
+	function_(nullptr), shadow_(nullptr)
+{
+}
+
+bool CVirtualHook::Init(void *instance, size_t index)
+{
+	if (!instance)
+		return false;
+
+	if (mode_ == VirtualHookMode::Global) {
+		void **vtable = *reinterpret_cast<void ***>(instance);
+		entry_ = &vtable[index];
+	} else {
+		shadow_ = AcquireShadow(instance, index);
+		if (!shadow_)
+			return false;
+		entry_ = &shadow_->entries[kVtablePrefix + index];
+	}
+
+	// Taking the current entry rather than the class's lets hooks on the same function chain
+	function_ = *entry_;
+	*original_ = function_;
+
+	return true;
+}
+
+VtableShadow *CVirtualHook::AcquireShadow(void *instance, size_t index)
+{
+	std::lock_guard<std::mutex> guard(g_ShadowLock);
+
+	for (size_t i = 0; i < g_Shadows.length(); i++) {
+		VtableShadow *shadow = g_Shadows[i];
+		if (shadow->instance != instance)
+			continue;
+
+		if (index >= shadow->count) {
+			printf("Virtual function index %zu is past the end of the vtable (%zu entries)\n", index,
+			       shadow->count);
+			return nullptr;
+		}
+
+		shadow->refs++;
+		return shadow;
+	}
+
+	void **vtable = *reinterpret_cast<void ***>(instance);
+	if (!IsVtableCopyable(static_cast<const SiClassTypeInfo *>(vtable[-1]))) {
+		printf("Can't copy the vtable of a class with virtual bases or without type info, use "
+		       "VirtualHookMode::Global\n");
+		return nullptr;
+	}
+
+	size_t count = CountVtableEntries(vtable);
+	if (index >= count) {
+		printf("Virtual function index %zu is past the end of the vtable (%zu entries)\n", index, count);
+		return nullptr;
+	}
+
+	VtableShadow *shadow = new VtableShadow;
+	shadow->instance = instance;
+	shadow->vtable = vtable;
+	shadow->entries = new void *[kVtablePrefix + count];
+	shadow->count = count;
+	shadow->refs = 1;
+	memcpy(shadow->entries, vtable - kVtablePrefix, (kVtablePrefix + count) * sizeof(void *));
+
+	// Until one of its hooks is enabled the shadow is identical to the original, so the object can
+	// be switched over right away.
+	__atomic_store_n(reinterpret_cast<void ***>(instance), shadow->entries + kVtablePrefix, __ATOMIC_RELEASE);
+
+	g_Shadows.append(shadow);
+	return shadow;
+}
+
+void CVirtualHook::ReleaseShadow(VtableShadow *shadow)
+{
+	std::lock_guard<std::mutex> guard(g_ShadowLock);
+
+	if (--shadow->refs > 0)
+		return;
+
+	for (size_t i = 0; i < g_Shadows.length(); i++) {
+		if (g_Shadows[i] == shadow) {
+			g_Shadows.remove(i);
+			break;
+		}
+	}
+
+	__atomic_store_n(reinterpret_cast<void ***>(shadow->instance), shadow->vtable, __ATOMIC_RELEASE);
+
+	// Another thread may still be reading from the copy while calling through the object, so the
+	// entries are leaked. They take a few kilobytes at most.
+	delete shadow;
+}
+
+void CVirtualHook::WriteEntry(void **entry, void *function, bool isShared)
+{
+	if (!isShared) {
+		__atomic_store_n(entry, function, __ATOMIC_RELEASE);
+		return;
+	}
+
+	// Vtables live in a read-only part of the library once it has been relocated, but the page
+	// may also hold writable data, so its protection is put back to what it was.
+	std::lock_guard<std::mutex> guard(g_ProtectLock);
+
+	int access;
+	if (!GetMemAccess(entry, &access)) {
+		printf("Failed to query protection of vtable entry at %p, leaving it writable\n", entry);
+		SetMemAccess(entry, sizeof(void *), SH_MEM_READ | SH_MEM_WRITE);
+		__atomic_store_n(entry, function, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (!(access & SH_MEM_WRITE))
+		SetMemAccess(entry, sizeof(void *), access | SH_MEM_WRITE);
+
+	__atomic_store_n(entry, function, __ATOMIC_RELEASE);
+
+	if (!(access & SH_MEM_WRITE))
+		SetMemAccess(entry, sizeof(void *), access);
+}
+
+void CVirtualHook::Enable()
+{
+	if (enabled_)
+		return;
+
+	WriteEntry(entry_, callback_, mode_ == VirtualHookMode::Global);
+	enabled_ = true;
+}
+
+void CVirtualHook::Disable()
+{
+	if (!enabled_)
+		return;
+
+	WriteEntry(entry_, function_, mode_ == VirtualHookMode::Global);
+	enabled_ = false;
+}
+
+bool CVirtualHook::IsEnabled()
+{
+	return enabled_;
+}
+
+void *CVirtualHook::GetTargetAddress()
+{
+	return function_;
+}
+
+void CVirtualHook::Destroy(bool undoPatch)
+{
+	// Without undoPatch, the object keeps using its shadow vtable for as long as it lives
+	if (undoPatch) {
+		Disable();
+
+		if (shadow_)
+			ReleaseShadow(shadow_);
+	}
+
+	delete this;
+}
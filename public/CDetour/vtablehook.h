@@ -0,0 +1,78 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_VTABLEHOOK_H_
+#define _INCLUDE_SRCDS_VTABLEHOOK_H_
+
+#include <stddef.h>
+#include "IDetour.h"
+
+struct VtableShadow;
+
+/**
+ * Hooks a virtual function by replacing its vtable entry instead of patching its code.
+ *
+ * In VirtualHookMode::Instance, the object's vtable pointer is redirected to a copy of its vtable
+ * so that only calls made through that object are hooked. Hooks on the same object share one
+ * copy. In VirtualHookMode::Global, the entry in the class's vtable is swapped, which hooks calls
+ * made through every object of that class.
+ *
+ * Unlike CDetour, Destroy(true) restores the original entry.
+ */
+class CVirtualHook : public IDetour
+{
+public:
+	void Enable();
+	void Disable();
+	bool IsEnabled();
+	void *GetTargetAddress();
+	void Destroy(bool undoPatch);
+
+	friend class ServerAPI;
+
+protected:
+	CVirtualHook(void *callback, void **original, VirtualHookMode mode);
+	bool Init(void *instance, size_t index);
+
+private:
+	static VtableShadow *AcquireShadow(void *instance, size_t index);
+	static void ReleaseShadow(VtableShadow *shadow);
+	static void WriteEntry(void **entry, void *function, bool isShared);
+
+	bool enabled_;
+	VirtualHookMode mode_;
+	void *callback_;
+	void **original_;
+	/* Vtable entry that is swapped, either in a shadow vtable or the class's vtable */
+	void **entry_;
+	/* Function that the entry pointed to before the hook was created */
+	void *function_;
+	VtableShadow *shadow_;
+};
+
+#endif // _INCLUDE_SRCDS_VTABLEHOOK_H_
@@ -29,6 +29,8 @@
 #ifndef _INCLUDE_SRCDS_IDETOUR_H_
 #define _INCLUDE_SRCDS_IDETOUR_H_
 
+#include <stdint.h>
+
 /**
  * CDetours class for SourceMod Extensions by pRED*
  * Modified by DS to make use of SourceHook's GenBuffer and code generation.
@@ -39,103 +41,96 @@
  * Member function pointer ideas by Don Clugston (http://www.codeproject.com/cpp/FastDelegate.asp)
  */
 
-#define DETOUR_MEMBER_CALL(name) (this->*name##_Actual)
-#define DETOUR_STATIC_CALL(name) (name##_Actual)
-
-#define DETOUR_DECL_STATIC0(name, ret) \
-ret (*name##_Actual)(void) = NULL; \
-ret name(void)
-
-#define DETOUR_DECL_STATIC1(name, ret, p1type, p1name) \
-ret (*name##_Actual)(p1type) = NULL; \
-ret name(p1type p1name)
-
-#define DETOUR_DECL_STATIC2(name, ret, p1type, p1name, p2type, p2name) \
-ret (*name##_Actual)(p1type, p2type) = NULL; \
-ret name(p1type p1name, p2type p2name)
-
-#define DETOUR_DECL_STATIC3(name, ret, p1type, p1name, p2type, p2name, p3type, p3name) \
-ret (*name##_Actual)(p1type, p2type, p3type) = NULL; \
-ret name(p1type p1name, p2type p2name, p3type p3name)
-
-#define DETOUR_DECL_STATIC4(name, ret, p1type, p1name, p2type, p2name, p3type, p3name, p4type, p4name) \
-ret (*name##_Actual)(p1type, p2type, p3type, p4type) = NULL; \
-ret name(p1type p1name, p2type p2name, p3type p3name, p4type p4name)
-
-#define DETOUR_DECL_MEMBER0(name, ret) \
-class name##Class \
-{ \
-public: \
-ret name(); \
-static ret (name##Class::* name##_Actual)(void); \
-}; \
-ret (name##Class::* name##Class::name##_Actual)(void) = NULL; \
-ret name##Class::name()
-
-#define DETOUR_DECL_MEMBER1(name, ret, p1type, p1name) \
-class name##Class \
-{ \
-public: \
-ret name(p1type p1name); \
-static ret (name##Class::* name##_Actual)(p1type); \
-}; \
-ret (name##Class::* name##Class::name##_Actual)(p1type) = NULL; \
-ret name##Class::name(p1type p1name)
-
-#define DETOUR_DECL_MEMBER2(name, ret, p1type, p1name, p2type, p2name) \
-class name##Class \
-{ \
-public: \
-ret name(p1type p1name, p2type p2name); \
-static ret (name##Class::* name##_Actual)(p1type, p2type); \
-}; \
-ret (name##Class::* name##Class::name##_Actual)(p1type, p2type) = NULL; \
-ret name##Class::name(p1type p1name, p2type p2name)
-
-#define DETOUR_DECL_MEMBER3(name, ret, p1type, p1name, p2type, p2name, p3type, p3name) \
-class name##Class \
-{ \
-public: \
-ret name(p1type p1name, p2type p2name, p3type p3name); \
-static ret (name##Class::* name##_Actual)(p1type, p2type, p3type); \
-}; \
-ret (name##Class::* name##Class::name##_Actual)(p1type, p2type, p3type) = NULL; \
-ret name##Class::name(p1type p1name, p2type p2name, p3type p3name)
-
-#define DETOUR_DECL_MEMBER4(name, ret, p1type, p1name, p2type, p2name, p3type, p3name, p4type, p4name) \
-class name##Class \
-{ \
-public: \
-ret name(p1type p1name, p2type p2name, p3type p3name, p4type p4name); \
-static ret (name##Class::* name##_Actual)(p1type, p2type, p3type, p4type); \
-}; \
-ret (name##Class::* name##Class::name##_Actual)(p1type, p2type, p3type, p4type) = NULL; \
-ret name##Class::name(p1type p1name, p2type p2name, p3type p3name, p4type p4name)
-
-#define GET_MEMBER_CALLBACK(name) (void *)GetCodeAddress(&name##Class::name)
-#define GET_MEMBER_TRAMPOLINE(name) (void **)(&name##Class::name##_Actual)
-
-#define GET_STATIC_CALLBACK(name) (void *)&name
-#define GET_STATIC_TRAMPOLINE(name) (void **)&name##_Actual
-
-#define DETOUR_CREATE_MEMBER(name, addr) g_ServerAPI->CreateDetour(GET_MEMBER_CALLBACK(name), GET_MEMBER_TRAMPOLINE(name), addr);
-#define DETOUR_CREATE_STATIC(name, addr) g_ServerAPI->CreateDetour(GET_STATIC_CALLBACK(name), GET_STATIC_TRAMPOLINE(name), addr);
+/**
+ * Per-detour statistics collected when detour profiling is enabled (-profiledetours).
+ * Cycle counts are TSC ticks spent in the callback, including calls to the original function.
+ */
+struct DetourStats
+{
+	void *address;			// Address of the detoured function
+	const char *name;		// Symbol of the detoured function or library+offset
+	uint64_t calls;			// Number of calls since the detour was created
+	double callsPerSec;		// Average call rate since the detour was created
+	double meanCycles;		// Mean cycles per call
+	uint64_t p99Cycles;		// 99th percentile of cycles per call
+};
 
-class GenericClass {};
-typedef void (GenericClass::*VoidFunc)();
+/**
+ * How IServerAPI::HookVirtual replaces a virtual function.
+ */
+enum class VirtualHookMode
+{
+	Instance,	// Give the object its own copy of its vtable, hooking calls through that object only
+	Global		// Swap the entry in the class's vtable, hooking calls through every object of the class
+};
 
-inline void *GetCodeAddr(VoidFunc mfp)
+/**
+ * Registers that a mid-function hook's callback can read or write through its MidHookContext,
+ * see IServerAPI::HookMidFunction. The first 16 (8 on i386) follow the register encoding order.
+ */
+enum MidHookRegs : uint32_t
 {
-	return *(void **)&mfp;
-}
+	MidHookReg_Rax = 1 << 0,
+	MidHookReg_Rcx = 1 << 1,
+	MidHookReg_Rdx = 1 << 2,
+	MidHookReg_Rbx = 1 << 3,
+	MidHookReg_Rsp = 1 << 4,	// Read only
+	MidHookReg_Rbp = 1 << 5,
+	MidHookReg_Rsi = 1 << 6,
+	MidHookReg_Rdi = 1 << 7,
+	MidHookReg_R8 = 1 << 8,
+	MidHookReg_R9 = 1 << 9,
+	MidHookReg_R10 = 1 << 10,
+	MidHookReg_R11 = 1 << 11,
+	MidHookReg_R12 = 1 << 12,
+	MidHookReg_R13 = 1 << 13,
+	MidHookReg_R14 = 1 << 14,
+	MidHookReg_R15 = 1 << 15,
+	MidHookReg_Flags = 1 << 16,	// Also needed to keep them intact for code after the hook point
+
+	/* Not part of the context: the callback may clobber SSE registers, so they must be preserved */
+	MidHookReg_Vector = 1 << 17,
+
+	MidHookReg_Eax = MidHookReg_Rax,
+	MidHookReg_Ecx = MidHookReg_Rcx,
+	MidHookReg_Edx = MidHookReg_Rdx,
+	MidHookReg_Ebx = MidHookReg_Rbx,
+	MidHookReg_Esp = MidHookReg_Rsp,
+	MidHookReg_Ebp = MidHookReg_Rbp,
+	MidHookReg_Esi = MidHookReg_Rsi,
+	MidHookReg_Edi = MidHookReg_Rdi,
+};
 
 /**
- * Converts a member function pointer to a void pointer.
- * This relies on the assumption that the code address lies at mfp+0
- * This is the case for both g++ and later MSVC versions on non virtual functions but may be different for other compilers
- * Based on research by Don Clugston : http://www.codeproject.com/cpp/FastDelegate.asp
+ * Registers at a mid-function hook point. Only those the hook was created with are filled in,
+ * and only those are written back when the callback returns.
  */
-#define GetCodeAddress(mfp) GetCodeAddr(reinterpret_cast<VoidFunc>(mfp))
+struct MidHookContext
+{
+	union
+	{
+#if defined(__x86_64__)
+		uintptr_t regs[16];
+		struct
+		{
+			uintptr_t rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi;
+			uintptr_t r8, r9, r10, r11, r12, r13, r14, r15;
+		};
+#else
+		uintptr_t regs[8];
+		struct
+		{
+			uintptr_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+		};
+#endif
+	};
+	uintptr_t flags;
+
+	/* Where execution continues, null to run the hooked instructions and carry on after them */
+	void *resume;
+};
+
+using MidHookCallback = void (*)(MidHookContext *ctx);
 
 class IDetour
 {
@@ -145,6 +140,10 @@ public:
 	virtual bool IsEnabled() = 0;
 	virtual void *GetTargetAddress() = 0;
 	virtual void Destroy(bool undoPatch = true) = 0;
+
+protected:
+	/* Hooks delete themselves in Destroy(). Declared last to keep the other entries' slots. */
+	virtual ~IDetour() = default;
 };
 
 #endif // _INCLUDE_SRCDS_IDETOUR_H_
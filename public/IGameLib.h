@@ -48,6 +48,16 @@ public:
 	virtual size_t ResolveHiddenSymbols(SymbolInfo *list, const char **names) = 0;
 	virtual void *FindPattern(const char *pattern, size_t len) = 0;
 	virtual void Close() = 0;
+
+	// Like FindPattern, but only searches code and ignores bytes that change between builds or
+	// loads: rel32 branch targets, RIP-relative displacements and anything the loader relocates.
+	// The signature must start on an instruction boundary.
+	virtual void *FindMaskedPattern(const char *pattern, size_t len) = 0;
+
+	// For a required signature that FindPattern and every fallback failed to find. Prints the
+	// closest matches so the signature can be fixed and, with -sigrecover, returns a unique match
+	// that differs in a single byte. Returns nullptr otherwise.
+	virtual void *FindPatternApproximate(const char *pattern, size_t len) = 0;
 };
 
 #endif // _INCLUDE_SRCDS_IGAMELIB_H_
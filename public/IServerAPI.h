@@ -29,6 +29,8 @@
 #ifndef _INCLUDE_SRCDS_ISERVERAPI_H_
 #define _INCLUDE_SRCDS_ISERVERAPI_H_
 
+#include <stddef.h>
+#include <type_traits>
 #include "IGameLib.h"
 #include "IDetour.h"
 
@@ -45,6 +47,37 @@ public:
 	virtual void FixPath(const char *path) = 0;
 	virtual void GetArgs(int &argc, char ** &argv) = 0;
 	virtual void AddSystems(AppSystemInfo_t *systems) = 0;
+
+	/**
+	 * Copies statistics for up to maxStats profiled detours into stats and returns the total
+	 * number of profiled detours. Returns 0 if detour profiling is not enabled.
+	 */
+	virtual size_t GetDetourStats(DetourStats *stats, size_t maxStats) = 0;
+
+	/**
+	 * Hooks the virtual function at the given vtable index of instance by replacing its vtable
+	 * entry, so no code is patched. original receives the function the entry pointed to. The
+	 * returned hook must be enabled before it takes effect. Returns nullptr on failure.
+	 *
+	 * VirtualHookMode::Instance only works for classes with type info and no virtual bases
+	 * anywhere in their hierarchy, since the virtual base offsets stored before such a vtable
+	 * can't be copied. Other classes are rejected and need VirtualHookMode::Global.
+	 */
+	virtual IDetour *HookVirtual(void *instance, size_t index, void *callback, void **original,
+	                             VirtualHookMode mode = VirtualHookMode::Instance) = 0;
+
+	/**
+	 * Hooks the instruction at addr, which must be an instruction boundary inside a function.
+	 * callback runs before it with the registers named by regs (MidHookRegs) in its context,
+	 * and can change them or set ctx->resume to continue somewhere else. Other registers are
+	 * preserved; the flags and vector registers only when MidHookReg_Flags and
+	 * MidHookReg_Vector are given, so pass MidHookReg_Flags if the code at addr reads them.
+	 *
+	 * The patch covers 5 bytes, so no other branch may target the instructions after addr
+	 * within them. The returned hook must be enabled before it takes effect. Returns nullptr
+	 * if the code at addr can't be moved.
+	 */
+	virtual IDetour *HookMidFunction(void *addr, MidHookCallback callback, uint32_t regs) = 0;
 protected:
 	friend class GameLibrary;
 	virtual IGameLib *LoadLibrary(const char *name) = 0;
@@ -78,4 +111,84 @@ private:
 	IGameLib *lib_;
 };
 
+/**
+ * Typed detour bound to a callback function.
+ *
+ * The callback has the exact signature of the detoured function. Member functions are
+ * declared as plain functions that take the object pointer as their first parameter, which
+ * matches the thiscall convention used by the engine on both i386 and x86_64. The trampoline
+ * to the original code is stored as a function pointer of the same type, so calling it is a
+ * single call with no member function pointer conversion.
+ *
+ * static void *Sys_LoadModule(const char *pModuleName) {
+ *     return Detour<Sys_LoadModule>::Original(pModuleName);
+ * }
+ *
+ * IDetour *det = Detour<Sys_LoadModule>::Create(api, addr);
+ */
+template <auto Callback, typename Sig = std::remove_pointer_t<decltype(Callback)>>
+class Detour;
+
+template <auto Callback, typename Ret, typename ...Args>
+class Detour<Callback, Ret(Args...)> {
+public:
+	using Function = Ret (*)(Args...);
+
+	static_assert(std::is_same_v<decltype(Callback), Function>,
+	              "Detour callback does not match the given signature");
+
+	static inline IDetour *Create(IServerAPI *api, void *addr) {
+		return api->CreateDetour(reinterpret_cast<void *>(Callback),
+		                         reinterpret_cast<void **>(&Original), addr);
+	}
+
+	static inline Function Original = nullptr;
+};
+
+/**
+ * Typed virtual function hook bound to a callback function. The callback takes the object
+ * pointer as its first parameter, as with Detour.
+ *
+ * static void CFoo_Bar(void *foo, int x) {
+ *     VirtualHook<CFoo_Bar>::Original(foo, x);
+ * }
+ *
+ * IDetour *hook = VirtualHook<CFoo_Bar>::Create(api, foo, 10);
+ */
+template <auto Callback, typename Sig = std::remove_pointer_t<decltype(Callback)>>
+class VirtualHook;
+
+template <auto Callback, typename Ret, typename ...Args>
+class VirtualHook<Callback, Ret(Args...)> {
+public:
+	using Function = Ret (*)(Args...);
+
+	static_assert(std::is_same_v<decltype(Callback), Function>,
+	              "Virtual hook callback does not match the given signature");
+
+	static inline IDetour *Create(IServerAPI *api, void *instance, size_t index,
+	                              VirtualHookMode mode = VirtualHookMode::Instance) {
+		return api->HookVirtual(instance, index, reinterpret_cast<void *>(Callback),
+		                        reinterpret_cast<void **>(&Original), mode);
+	}
+
+	static inline Function Original = nullptr;
+};
+
+/**
+ * Returns the index of function among the first maxIndex entries of instance's vtable, or -1 if
+ * it isn't one of them. A virtual function found by symbol can then be hooked with HookVirtual,
+ * which leaves the library's code pages untouched, instead of with a detour.
+ */
+inline ptrdiff_t FindVirtualIndex(void *instance, void *function, size_t maxIndex) {
+	void **vtable = *reinterpret_cast<void ***>(instance);
+
+	for (size_t i = 0; i < maxIndex; i++) {
+		if (vtable[i] == function)
+			return ptrdiff_t(i);
+	}
+
+	return -1;
+}
+
 #endif // _INCLUDE_SRCDS_ISERVERAPI_H_
@@ -1,12 +1,12 @@
 #include "asm.h"
+#include "x86insn.h"
 
 #ifndef WIN32
 #define _GNU_SOURCE
 #include <dlfcn.h>
 #include <string.h>
 #include <stdio.h>
-
-#include "libudis86/udis86.h"
+#include <stdint.h>
 
 #define REG_EAX			0
 #define REG_ECX			1
@@ -25,6 +25,11 @@
 * @noreturn
 */
 void check_thunks(unsigned char *dest, unsigned char *pc)
+{
+	check_thunks_at(dest, dest, pc);
+}
+
+void check_thunks_at(unsigned char *dest, unsigned char *destpc, unsigned char *pc)
 {
 #if defined(_WIN32) || defined(__x86_64__)
 	return;
@@ -32,7 +37,7 @@ void check_thunks(unsigned char *dest, unsigned char *pc)
 	/* Step write address back 4 to the start of the function address */
 	unsigned char *writeaddr = dest - 4;
 	unsigned char *calloffset = *(unsigned char **)writeaddr;
-	unsigned char *calladdr = (unsigned char *)(dest + (unsigned int)calloffset);
+	unsigned char *calladdr = (unsigned char *)(destpc + (unsigned int)calloffset);
 
 	/* Lookup name of function being called */
 	if ((*calladdr == 0x8B) && (*(calladdr+2) == 0x24) && (*(calladdr+3) == 0xC3))
@@ -89,53 +94,178 @@ void check_thunks(unsigned char *dest, unsigned char *pc)
 
 int copy_bytes(unsigned char *func, unsigned char *dest, int required_len)
 {
-	ud_t ud_obj;
-	ud_init(&ud_obj);
+	return relocate_bytes(func, dest, dest, required_len, NULL);
+}
+
+int copy_bytes_to(unsigned char *func, unsigned char *dest, unsigned char *destpc, int required_len)
+{
+	return relocate_bytes(func, dest, destpc, required_len, NULL);
+}
 
 #if defined(_WIN64) || defined(__x86_64__)
-	ud_set_mode(&ud_obj, 64);
+#define CODE_MODE64		1
 #else
-	ud_set_mode(&ud_obj, 32);
+#define CODE_MODE64		0
 #endif
 
-	ud_set_input_buffer(&ud_obj, func, 20);
-	unsigned int bytecount = 0;
+static inline int fits_rel32(unsigned char *target, unsigned char *next)
+{
+	int64_t diff = (int64_t)(target - next);
+	return diff == (int32_t)diff;
+}
+
+static inline unsigned char *write_abs_addr(unsigned char *dest, unsigned char *target)
+{
+	memcpy(dest, &target, sizeof(target));
+	return dest + sizeof(target);
+}
 
-	while (bytecount < required_len && ud_disassemble(&ud_obj))
+/**
+* Writes a branch to target that behaves like the relative branch insn, for code running at destpc.
+* Short forms are widened to rel32, and in long mode targets beyond rel32 reach go through an absolute jump.
+*
+* @param pc		Address of the instruction following the original branch.
+* @return			Number of bytes written, or -1 if the branch can't be moved (LOOP/JCXZ/XBEGIN).
+*/
+static int relocate_branch(unsigned char *dest, unsigned char *destpc, const struct x86_insn *insn, unsigned char *target, unsigned char *pc)
+{
+	unsigned char cond;
+	int isCall = 0;
+
+	if (insn->map == X86_MAP_PRIMARY && insn->opcode == 0xE8)
+		isCall = 1;
+	else if (insn->map == X86_MAP_PRIMARY && (insn->opcode == 0xE9 || insn->opcode == 0xEB))
+		cond = 0xFF;
+	else if (insn->map == X86_MAP_PRIMARY && (insn->opcode & 0xF0) == 0x70)
+		cond = insn->opcode & 0x0F;
+	else if (insn->map == X86_MAP_0F && (insn->opcode & 0xF0) == 0x80)
+		cond = insn->opcode & 0x0F;
+	else
+		return -1;
+
+	if (insn->imm_size == 2)
+		return -1;
+
+	if (isCall)
 	{
-		unsigned int insn_len = ud_insn_len(&ud_obj);
-		bytecount += insn_len;
+		if (!CODE_MODE64 || !dest || fits_rel32(target, destpc + 5))
+		{
+			if (dest)
+			{
+				dest[0] = 0xE8;
+				*(int32_t *)(dest + 1) = (int32_t)(target - (destpc + 5));
+				check_thunks_at(dest + 5, destpc + 5, pc);
+			}
+			if (CODE_MODE64 && !dest)
+				return 16;
+			return 5;
+		}
+
+		/* call [rip+2]; jmp +8; dq target */
+		memcpy(dest, "\xFF\x15\x02\x00\x00\x00\xEB\x08", 8);
+		write_abs_addr(dest + 8, target);
+		return 16;
+	}
+
+	if (cond == 0xFF)
+	{
+		if (!CODE_MODE64 || !dest || fits_rel32(target, destpc + 5))
+		{
+			if (dest)
+			{
+				dest[0] = OP_JMP;
+				*(int32_t *)(dest + 1) = (int32_t)(target - (destpc + 5));
+			}
+			if (CODE_MODE64 && !dest)
+				return X64_ABS_SIZE;
+			return OP_JMP_SIZE;
+		}
 
+		/* jmp [rip+0]; dq target */
+		memcpy(dest, "\xFF\x25\x00\x00\x00\x00", 6);
+		write_abs_addr(dest + 6, target);
+		return X64_ABS_SIZE;
+	}
+
+	if (!CODE_MODE64 || !dest || fits_rel32(target, destpc + 6))
+	{
 		if (dest)
 		{
-			const uint8_t *opcode = ud_insn_ptr(&ud_obj);
-			if ((opcode[0] & 0xFE) == 0xE8)	// Fix CALL/JMP offset
+			dest[0] = 0x0F;
+			dest[1] = 0x80 | cond;
+			*(int32_t *)(dest + 2) = (int32_t)(target - (destpc + 6));
+		}
+		if (CODE_MODE64 && !dest)
+			return 2 + X64_ABS_SIZE;
+		return 6;
+	}
+
+	/* j!cc +14; jmp [rip+0]; dq target */
+	dest[0] = 0x70 | (cond ^ 1);
+	dest[1] = X64_ABS_SIZE;
+	memcpy(dest + 2, "\xFF\x25\x00\x00\x00\x00", 6);
+	write_abs_addr(dest + 8, target);
+	return 2 + X64_ABS_SIZE;
+}
+
+int relocate_bytes(unsigned char *func, unsigned char *dest, unsigned char *destpc, int required_len, int *written)
+{
+	struct x86_insn insns[32];
+	int count = 0, bytecount = 0, outcount = 0;
+
+	/* Find the instruction boundary first so branches back into the copied bytes can be rejected */
+	while (bytecount < required_len)
+	{
+		if (count == sizeof(insns) / sizeof(insns[0]) || !x86_decode(func + bytecount, CODE_MODE64, &insns[count]))
+			return -1;
+		bytecount += insns[count++].length;
+	}
+
+	unsigned char *src = func;
+	for (int i = 0; i < count; i++)
+	{
+		const struct x86_insn *insn = &insns[i];
+		unsigned char *next = src + insn->length;
+
+		if (insn->flags & X86_INSN_REL)
+		{
+			int32_t rel = insn->imm_size == 1 ? *(int8_t *)(src + insn->imm) : *(int32_t *)(src + insn->imm);
+			unsigned char *target = next + rel;
+
+			if (insn->imm_size == 2 || (target >= func && target < func + bytecount))
+				return -1;
+
+			int len = relocate_branch(dest ? dest + outcount : NULL, destpc + outcount, insn, target, next);
+			if (len < 0)
+				return -1;
+			outcount += len;
+		}
+		else
+		{
+			if (dest)
 			{
-				dest[0] = func[0];
-				dest++; func++;
-				if (ud_insn_opr(&ud_obj, 0)->size == 32)
-				{
-					*(int32_t *)dest = func + *(int32_t *)func - dest;
-					check_thunks(dest+4, func+4);
-					dest += sizeof(int32_t);
-				}
-				else
+				memcpy(dest + outcount, src, insn->length);
+
+				if (insn->flags & X86_INSN_RIPREL)
 				{
-					*(int16_t *)dest = func + *(int16_t *)func - dest;
-					dest += sizeof(int16_t);
+					/* Keep [rip+disp32] pointing at the same address from the new location */
+					unsigned char *target = next + *(int32_t *)(src + insn->disp);
+					unsigned char *newnext = destpc + outcount + insn->length;
+					if (!fits_rel32(target, newnext))
+						return -1;
+					*(int32_t *)(dest + outcount + insn->disp) = (int32_t)(target - newnext);
 				}
-				func--;
-			}
-			else
-			{
-				memcpy(dest, func, insn_len);
-				dest += insn_len;
 			}
+
+			outcount += insn->length;
 		}
 
-		func += insn_len;
+		src = next;
 	}
 
+	if (written)
+		*written = outcount;
+
 	return bytecount;
 }
 
@@ -20,11 +20,23 @@ extern "C" {
 
 void check_thunks(unsigned char *dest, unsigned char *pc);
 
+//same as check_thunks, but dest is written to while destpc is where it will execute
+void check_thunks_at(unsigned char *dest, unsigned char *destpc, unsigned char *pc);
+
 //if dest is NULL, returns minimum number of bytes needed to be copied
 //if dest is not NULL, it will copy the bytes to dest as well as fix CALLs and JMPs
 //http://www.devmaster.net/forums/showthread.php?t=2311
 int copy_bytes(unsigned char *func, unsigned char* dest, int required_len);
 
+//same as copy_bytes, but CALLs and JMPs are fixed for the code to run at destpc instead of dest
+int copy_bytes_to(unsigned char *func, unsigned char* dest, unsigned char *destpc, int required_len);
+
+//copies whole instructions covering at least required_len bytes of func to dest, for them to run at destpc
+//relative branches are retargeted (short ones widened to rel32) and [rip+disp32] operands are fixed up
+//returns the number of bytes taken from func, or -1 if the code can't be decoded or moved
+//written receives the number of bytes put in dest, or an upper bound for it if dest is NULL
+int relocate_bytes(unsigned char *func, unsigned char *dest, unsigned char *destpc, int required_len, int *written);
+
 //insert a specific JMP instruction at the given location
 void inject_jmp(void* src, void* dest);
 
@@ -0,0 +1,299 @@
+#include "x86insn.h"
+
+/**
+* Table-driven instruction length decoder.
+*
+* Only the information needed to copy and relocate instructions is extracted:
+* prefix, opcode, ModRM/SIB, displacement and immediate boundaries. Each opcode
+* map has one table entry per opcode byte describing which of those parts follow it.
+*/
+
+#define M		0x0001	// ModRM byte
+#define I8		0x0002	// 8-bit immediate
+#define I16		0x0004	// 16-bit immediate
+#define IZ		0x0008	// 16/32-bit immediate depending on operand size
+#define IV		0x0010	// 16/32/64-bit immediate depending on operand size
+#define R8		0x0020	// 8-bit relative branch
+#define RZ		0x0040	// 16/32-bit relative branch
+#define X64		0x0080	// invalid in long mode
+#define BAD		0x0100	// invalid
+#define REG		0x0200	// ModRM always addresses a register (mov cr/dr)
+#define MOFFS	0x0400	// memory offset sized by address size (mov al, [moffs])
+#define FAR		0x0800	// far pointer immediate (call/jmp ptr16:32)
+#define GRP3	0x1000	// test imm if ModRM.reg is 0 or 1
+#define VEX		0x2000	// may start a VEX, EVEX or XOP prefix
+#define ESC		0x4000	// escape to another opcode map
+#define PFX		0x8000	// legacy prefix
+
+static const unsigned short s_Primary[256] =
+{
+	/* 00 */ M,   M,   M,   M,   I8,  IZ,  X64, X64, M,   M,   M,   M,   I8,  IZ,  X64, ESC,
+	/* 10 */ M,   M,   M,   M,   I8,  IZ,  X64, X64, M,   M,   M,   M,   I8,  IZ,  X64, X64,
+	/* 20 */ M,   M,   M,   M,   I8,  IZ,  PFX, X64, M,   M,   M,   M,   I8,  IZ,  PFX, X64,
+	/* 30 */ M,   M,   M,   M,   I8,  IZ,  PFX, X64, M,   M,   M,   M,   I8,  IZ,  PFX, X64,
+	/* 40 */ 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	/* 50 */ 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+	/* 60 */ X64, X64, M|VEX, M, PFX, PFX, PFX, PFX, IZ,  M|IZ, I8, M|I8, 0,   0,   0,   0,
+	/* 70 */ R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,  R8,
+	/* 80 */ M|I8, M|IZ, M|I8|X64, M|I8, M, M, M,  M,   M,   M,   M,   M,   M,   M,   M,   M|VEX,
+	/* 90 */ 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   FAR|X64, 0, 0,  0,   0,   0,
+	/* A0 */ MOFFS, MOFFS, MOFFS, MOFFS, 0, 0, 0,  0,   I8,  IZ,  0,   0,   0,   0,   0,   0,
+	/* B0 */ I8,  I8,  I8,  I8,  I8,  I8,  I8,  I8,  IV,  IV,  IV,  IV,  IV,  IV,  IV,  IV,
+	/* C0 */ M|I8, M|I8, I16, 0, M|VEX, M|VEX, M|I8, M|IZ, I16|I8, 0, I16, 0, 0,  I8,  X64, 0,
+	/* D0 */ M,   M,   M,   M,   I8|X64, I8|X64, BAD, 0, M, M,   M,   M,   M,   M,   M,   M,
+	/* E0 */ R8,  R8,  R8,  R8,  I8,  I8,  I8,  I8,  RZ,  RZ,  FAR|X64, R8, 0, 0,   0,   0,
+	/* F0 */ PFX, 0,   PFX, PFX, 0,   0,   M|GRP3, M|GRP3, 0, 0, 0,   0,   0,   0,   M,   M,
+};
+
+static const unsigned short s_Map0F[256] =
+{
+	/* 00 */ M,   M,   M,   M,   BAD, 0,   0,   0,   0,   0,   BAD, 0,   BAD, M,   0,   M|I8,
+	/* 10 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* 20 */ M|REG, M|REG, M|REG, M|REG, BAD, BAD, BAD, BAD, M, M, M, M,   M,   M,   M,   M,
+	/* 30 */ 0,   0,   0,   0,   0,   0,   BAD, 0,   ESC, BAD, ESC, BAD, BAD, BAD, BAD, BAD,
+	/* 40 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* 50 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* 60 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* 70 */ M|I8, M|I8, M|I8, M|I8, M, M,  M,   0,   M,   M,   BAD, BAD, M,  M,   M,   M,
+	/* 80 */ RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,  RZ,
+	/* 90 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* A0 */ 0,   0,   0,   M,   M|I8, M,  BAD, BAD, 0,   0,   0,   M,   M|I8, M,  M,   M,
+	/* B0 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M|I8, M,  M,   M,   M,   M,
+	/* C0 */ M,   M,   M|I8, M, M|I8, M|I8, M|I8, M, 0,   0,   0,   0,   0,   0,   0,   0,
+	/* D0 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* E0 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+	/* F0 */ M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,   M,
+};
+
+int x86_decode(const unsigned char *code, int mode64, struct x86_insn *insn)
+{
+	const unsigned char *p = code;
+	int opsize16 = 0, addrsize = mode64 ? 8 : 4, rexw = 0;
+	unsigned short flags;
+	unsigned char op;
+
+	insn->map = X86_MAP_PRIMARY;
+	insn->modrm = 0;
+	insn->disp = insn->disp_size = 0;
+	insn->imm = insn->imm_size = 0;
+	insn->flags = 0;
+
+	/* Legacy prefixes, then REX, which only counts when it immediately precedes the opcode */
+	for (;;)
+	{
+		op = *p++;
+		flags = s_Primary[op];
+
+		if (flags & PFX)
+		{
+			if (op == 0x66)
+				opsize16 = 1;
+			else if (op == 0x67)
+				addrsize = mode64 ? 4 : 2;
+			rexw = 0;
+		}
+		else if (mode64 && (op & 0xF0) == 0x40)
+		{
+			rexw = (op & 0x08) != 0;
+		}
+		else
+		{
+			break;
+		}
+
+		if (p - code >= 15)
+			return 0;
+	}
+
+	if (flags & VEX)
+	{
+		/* Outside long mode these are LES/LDS/BOUND unless ModRM.mod is 11, and POP r/m unless ModRM.reg is set */
+		int isVex = op == 0x8F ? (p[0] & 0x38) != 0 : (mode64 || (p[0] & 0xC0) == 0xC0);
+		if (isVex)
+		{
+			unsigned char map, prefix = op;
+			insn->flags |= X86_INSN_VEX;
+			rexw = 0;
+
+			if (prefix == 0xC5)
+			{
+				map = X86_MAP_0F;
+				p += 1;
+			}
+			else if (prefix == 0x62)
+			{
+				map = p[0] & 0x07;
+				p += 3;
+			}
+			else
+			{
+				map = p[0] & 0x1F;
+				rexw = (p[1] & 0x80) != 0;
+				p += 2;
+			}
+
+			insn->opcode = op = *p++;
+
+			if (prefix == 0x8F)
+			{
+				/* XOP: map 8 takes an imm8, map 9 nothing, map 10 an imm32 */
+				if (map < 8 || map > 10)
+					return 0;
+				insn->map = map;
+				flags = M | (map == 8 ? I8 : 0);
+				if (map == 10)
+				{
+					flags = M;
+					insn->imm_size = 4;
+				}
+			}
+			else if (map == X86_MAP_0F)
+			{
+				flags = s_Map0F[op] & (I8 | BAD);
+				if (flags & BAD)
+					return 0;
+				if (op != 0x77)
+					flags |= M;
+			}
+			else if (map == X86_MAP_0F38 || map == 5 || map == 6)
+			{
+				flags = M;
+			}
+			else if (map == X86_MAP_0F3A)
+			{
+				flags = M | I8;
+			}
+			else
+			{
+				return 0;
+			}
+
+			if (insn->map == X86_MAP_PRIMARY)
+				insn->map = map;
+
+			/* VEX instructions never use the 16-bit immediate forms */
+			opsize16 = 0;
+			goto modrm;
+		}
+	}
+
+	if (flags & ESC)
+	{
+		op = *p++;
+		insn->map = X86_MAP_0F;
+		flags = s_Map0F[op];
+
+		if (flags & ESC)
+		{
+			insn->map = op == 0x38 ? X86_MAP_0F38 : X86_MAP_0F3A;
+			flags = op == 0x38 ? M : (M | I8);
+			op = *p++;
+		}
+	}
+
+	insn->opcode = op;
+
+	if ((flags & BAD) || (mode64 && (flags & X64)))
+		return 0;
+
+modrm:
+	if (flags & M)
+	{
+		unsigned char modrm = *p;
+		unsigned char mod = modrm >> 6, rm = modrm & 7;
+
+		insn->modrm = (unsigned char)(p - code);
+		p++;
+
+		if (flags & REG)
+			mod = 3;
+
+		if (mod != 3)
+		{
+			int dispSize = 0;
+			if (addrsize == 2)
+			{
+				if ((mod == 0 && rm == 6) || mod == 2)
+					dispSize = 2;
+				else if (mod == 1)
+					dispSize = 1;
+			}
+			else
+			{
+				if (rm == 4)
+				{
+					unsigned char sib = *p++;
+					if (mod == 0 && (sib & 7) == 5)
+						dispSize = 4;
+				}
+
+				if (mod == 0 && rm == 5)
+				{
+					dispSize = 4;
+					if (mode64)
+						insn->flags |= X86_INSN_RIPREL;
+				}
+				else if (mod == 1)
+				{
+					dispSize = 1;
+				}
+				else if (mod == 2)
+				{
+					dispSize = 4;
+				}
+			}
+
+			if (dispSize)
+			{
+				insn->disp = (unsigned char)(p - code);
+				insn->disp_size = dispSize;
+				p += dispSize;
+			}
+		}
+
+		if (flags & GRP3)
+		{
+			if (((modrm >> 3) & 7) < 2)
+				flags |= op == 0xF6 ? I8 : IZ;
+		}
+		else if (insn->map == X86_MAP_PRIMARY && op == 0xC7 && modrm == 0xF8)
+		{
+			/* XBEGIN rel16/32 */
+			flags = M | RZ;
+		}
+	}
+
+	if (flags & (R8 | RZ))
+	{
+		insn->flags |= X86_INSN_REL;
+		insn->imm_size = (flags & R8) ? 1 : (!mode64 && opsize16) ? 2 : 4;
+	}
+	else if (flags & MOFFS)
+	{
+		insn->imm_size = addrsize;
+	}
+	else if (flags & FAR)
+	{
+		insn->imm_size = (opsize16 ? 2 : 4) + 2;
+	}
+	else if (flags & IV)
+	{
+		insn->imm_size = rexw ? 8 : opsize16 ? 2 : 4;
+	}
+	else if (flags & (I8 | I16 | IZ))
+	{
+		insn->imm_size = ((flags & I8) ? 1 : 0) + ((flags & I16) ? 2 : 0) + ((flags & IZ) ? (opsize16 ? 2 : 4) : 0);
+	}
+
+	if (insn->imm_size)
+	{
+		insn->imm = (unsigned char)(p - code);
+		p += insn->imm_size;
+	}
+
+	if (p - code > 15)
+		return 0;
+
+	insn->length = (unsigned char)(p - code);
+	return insn->length;
+}
@@ -0,0 +1,41 @@
+#ifndef __X86INSN_H__
+#define __X86INSN_H__
+
+//opcode maps
+#define X86_MAP_PRIMARY		0
+#define X86_MAP_0F			1
+#define X86_MAP_0F38		2
+#define X86_MAP_0F3A		3
+
+//x86_insn flags
+#define X86_INSN_REL		0x01	// immediate is a branch displacement relative to the next instruction
+#define X86_INSN_RIPREL		0x02	// memory operand is [rip+disp32]
+#define X86_INSN_VEX		0x04	// VEX, EVEX or XOP encoded
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//layout of a decoded instruction, offsets are from the first prefix byte
+struct x86_insn
+{
+	unsigned char length;
+	unsigned char opcode;		// opcode byte following any prefixes and escapes
+	unsigned char map;			// X86_MAP_*
+	unsigned char modrm;		// offset of the ModRM byte, 0 if there is none
+	unsigned char disp;			// offset and size of the ModRM displacement
+	unsigned char disp_size;
+	unsigned char imm;			// offset and size of the immediate (or relative branch) operand
+	unsigned char imm_size;
+	unsigned char flags;		// X86_INSN_*
+};
+
+//decode the instruction at code using table lookups only, mode64 selects long mode
+//returns the instruction length, or 0 if the bytes don't form a valid instruction
+int x86_decode(const unsigned char *code, int mode64, struct x86_insn *insn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__X86INSN_H__
@@ -10,6 +10,43 @@ This code is based on public domain code from Wei Dai's Crypto++ library. */
 #include "RotateDefs.h"
 #include "Sha256.h"
 
+/*
+The SHA extensions of x86 and ARMv8 are used when the CPU has them, and 8 buffers at a time can be
+hashed with AVX2 by Sha256_UpdateMulti. They are compiled with target attributes and picked at
+runtime, so the rest of the file doesn't need any special compiler options.
+*/
+
+#if defined(MY_CPU_X86_OR_AMD64) && (defined(__GNUC__) || defined(__clang__))
+  #define _SHA256_X86
+  #include <cpuid.h>
+  #include <immintrin.h>
+  #define ATTRIB_SHA_X86 __attribute__((target("sha,ssse3,sse4.1")))
+  #define ATTRIB_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(MY_CPU_ARM64) && (defined(__GNUC__) || defined(__clang__))
+  #define _SHA256_ARM
+  #include <arm_neon.h>
+  #if defined(__clang__)
+    #define ATTRIB_SHA_ARM __attribute__((target("crypto")))
+  #else
+    #define ATTRIB_SHA_ARM __attribute__((target("+crypto")))
+  #endif
+  #if defined(__APPLE__)
+    #include <sys/sysctl.h>
+  #elif defined(__linux__)
+    #include <sys/auxv.h>
+    #include <asm/hwcap.h>
+  #endif
+#endif
+
+typedef void (*Sha256_UpdateBlocksFunc)(UInt32 state[8], const Byte *data, size_t numBlocks);
+
+static Sha256_UpdateBlocksFunc g_UpdateBlocks;
+static unsigned g_Impl;
+static unsigned g_MultiImpl;
+static Bool g_Prepared;
+
 /* define it for speed optimization */
 #ifndef _SFX
 #define _SHA256_UNROLL
@@ -20,6 +57,8 @@ This code is based on public domain code from Wei Dai's Crypto++ library. */
 
 void Sha256_Init(CSha256 *p)
 {
+  if (!g_Prepared)
+    Sha256_Prepare();
   p->state[0] = 0x6a09e667;
   p->state[1] = 0xbb67ae85;
   p->state[2] = 0x3c6ef372;
@@ -109,11 +148,10 @@ static const UInt32 K[64] = {
   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-static void Sha256_WriteByteBlock(CSha256 *p)
+static void Sha256_WriteByteBlock(UInt32 *state, const Byte *data)
 {
   UInt32 W[16];
   unsigned j;
-  UInt32 *state;
 
   #ifdef _SHA256_UNROLL2
   UInt32 a,b,c,d,e,f,g,h;
@@ -123,15 +161,13 @@ static void Sha256_WriteByteBlock(CSha256 *p)
 
   for (j = 0; j < 16; j += 4)
   {
-    const Byte *ccc = p->buffer + j * 4;
+    const Byte *ccc = data + j * 4;
     W[j    ] = GetBe32(ccc);
     W[j + 1] = GetBe32(ccc + 4);
     W[j + 2] = GetBe32(ccc + 8);
     W[j + 3] = GetBe32(ccc + 12);
   }
 
-  state = p->state;
-
   #ifdef _SHA256_UNROLL2
   a = state[0];
   b = state[1];
@@ -170,11 +206,375 @@ static void Sha256_WriteByteBlock(CSha256 *p)
   /* memset(T, 0, sizeof(T)); */
 }
 
+static void Sha256_UpdateBlocks_Portable(UInt32 state[8], const Byte *data, size_t numBlocks)
+{
+  for (; numBlocks != 0; numBlocks--, data += 64)
+    Sha256_WriteByteBlock(state, data);
+}
+
 #undef S0
 #undef S1
 #undef s0
 #undef s1
 
+#ifdef _SHA256_X86
+
+#define SHA_X86_ROUNDS4(i, m) \
+  msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *)&K[(i) * 4])); \
+  state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+  msg = _mm_shuffle_epi32(msg, 0x0E); \
+  state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+/* m0 holds W[t-16..t-13] and becomes W[t..t+3] */
+#define SHA_X86_SCHEDULE4(i, m0, m1, m2, m3) \
+  m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3); \
+  SHA_X86_ROUNDS4(i, m0)
+
+ATTRIB_SHA_X86
+static void Sha256_UpdateBlocks_X86(UInt32 state[8], const Byte *data, size_t numBlocks)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, msg, tmp;
+  __m128i m0, m1, m2, m3;
+
+  /* The instructions want the state as ABEF and CDGH */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (; numBlocks != 0; numBlocks--, data += 64)
+  {
+    __m128i abef = state0;
+    __m128i cdgh = state1;
+
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+
+    SHA_X86_ROUNDS4(0, m0)
+    SHA_X86_ROUNDS4(1, m1)
+    SHA_X86_ROUNDS4(2, m2)
+    SHA_X86_ROUNDS4(3, m3)
+    SHA_X86_SCHEDULE4(4, m0, m1, m2, m3)
+    SHA_X86_SCHEDULE4(5, m1, m2, m3, m0)
+    SHA_X86_SCHEDULE4(6, m2, m3, m0, m1)
+    SHA_X86_SCHEDULE4(7, m3, m0, m1, m2)
+    SHA_X86_SCHEDULE4(8, m0, m1, m2, m3)
+    SHA_X86_SCHEDULE4(9, m1, m2, m3, m0)
+    SHA_X86_SCHEDULE4(10, m2, m3, m0, m1)
+    SHA_X86_SCHEDULE4(11, m3, m0, m1, m2)
+    SHA_X86_SCHEDULE4(12, m0, m1, m2, m3)
+    SHA_X86_SCHEDULE4(13, m1, m2, m3, m0)
+    SHA_X86_SCHEDULE4(14, m2, m3, m0, m1)
+    SHA_X86_SCHEDULE4(15, m3, m0, m1, m2)
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+  _mm_storeu_si128((__m128i *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+/* Turns 8 rows of 8 words into 8 columns, which is also its own inverse */
+ATTRIB_AVX2
+static void Sha256_Transpose8(__m256i r[8])
+{
+  __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+  __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+  __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+  __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+  __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+  __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+  __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+  __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+  __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+  __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+  __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+  __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+  __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+  __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+  __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+  __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define S0_8(x) _mm256_xor_si256(_mm256_xor_si256(ROTR8(x, 2), ROTR8(x, 13)), ROTR8(x, 22))
+#define S1_8(x) _mm256_xor_si256(_mm256_xor_si256(ROTR8(x, 6), ROTR8(x, 11)), ROTR8(x, 25))
+#define s0_8(x) _mm256_xor_si256(_mm256_xor_si256(ROTR8(x, 7), ROTR8(x, 18)), _mm256_srli_epi32(x, 3))
+#define s1_8(x) _mm256_xor_si256(_mm256_xor_si256(ROTR8(x, 17), ROTR8(x, 19)), _mm256_srli_epi32(x, 10))
+#define Ch8(x, y, z) _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define Maj8(x, y, z) _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+/* The same number of blocks from 8 buffers at once, one buffer in each 32-bit lane */
+ATTRIB_AVX2
+static void Sha256_UpdateBlocks_Avx2x8(UInt32 *states[8], const Byte *data[8], size_t numBlocks)
+{
+  const __m256i swap = _mm256_set_epi8(
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+      12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  __m256i v[8], W[16];
+  size_t offset;
+  unsigned i, t;
+
+  for (i = 0; i < 8; i++)
+    v[i] = _mm256_loadu_si256((const __m256i *)states[i]);
+  Sha256_Transpose8(v);
+
+  for (offset = 0; numBlocks != 0; numBlocks--, offset += 64)
+  {
+    __m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+    for (t = 0; t < 16; t += 8)
+    {
+      for (i = 0; i < 8; i++)
+        W[t + i] = _mm256_loadu_si256((const __m256i *)(data[i] + offset + t * 4));
+      Sha256_Transpose8(&W[t]);
+      for (i = 0; i < 8; i++)
+        W[t + i] = _mm256_shuffle_epi8(W[t + i], swap);
+    }
+
+    for (t = 0; t < 64; t++)
+    {
+      __m256i w, t1, t2;
+      if (t < 16)
+        w = W[t];
+      else
+      {
+        w = _mm256_add_epi32(_mm256_add_epi32(W[t & 15], s1_8(W[(t - 2) & 15])),
+                             _mm256_add_epi32(W[(t - 7) & 15], s0_8(W[(t - 15) & 15])));
+        W[t & 15] = w;
+      }
+
+      t1 = _mm256_add_epi32(_mm256_add_epi32(h, S1_8(e)),
+                            _mm256_add_epi32(Ch8(e, f, g), _mm256_add_epi32(_mm256_set1_epi32((int)K[t]), w)));
+      t2 = _mm256_add_epi32(S0_8(a), Maj8(a, b, c));
+      h = g;
+      g = f;
+      f = e;
+      e = _mm256_add_epi32(d, t1);
+      d = c;
+      c = b;
+      b = a;
+      a = _mm256_add_epi32(t1, t2);
+    }
+
+    v[0] = _mm256_add_epi32(v[0], a);
+    v[1] = _mm256_add_epi32(v[1], b);
+    v[2] = _mm256_add_epi32(v[2], c);
+    v[3] = _mm256_add_epi32(v[3], d);
+    v[4] = _mm256_add_epi32(v[4], e);
+    v[5] = _mm256_add_epi32(v[5], f);
+    v[6] = _mm256_add_epi32(v[6], g);
+    v[7] = _mm256_add_epi32(v[7], h);
+  }
+
+  Sha256_Transpose8(v);
+  for (i = 0; i < 8; i++)
+    _mm256_storeu_si256((__m256i *)states[i], v[i]);
+}
+
+#undef ROTR8
+#undef S0_8
+#undef S1_8
+#undef s0_8
+#undef s1_8
+#undef Ch8
+#undef Maj8
+
+static Bool Sha256_CpuHas(unsigned impl)
+{
+  unsigned a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d))
+    return False;
+
+  if (impl == SHA256_IMPL_SHA_X86)
+  {
+    /* SSSE3, SSE4.1 and SHA */
+    if (!(c & (1 << 9)) || !(c & (1 << 19)))
+      return False;
+    if (__get_cpuid_max(0, NULL) < 7)
+      return False;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1 << 29)) != 0;
+  }
+
+  if (impl == SHA256_MULTI_AVX2)
+  {
+    unsigned xcr0, xcr0hi;
+    /* The OS has to save the YMM registers too */
+    if (!(c & (1 << 27)) || __get_cpuid_max(0, NULL) < 7)
+      return False;
+    __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0hi) : "c" (0));
+    if ((xcr0 & 6) != 6)
+      return False;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1 << 5)) != 0;
+  }
+
+  return False;
+}
+
+#endif
+
+#ifdef _SHA256_ARM
+
+ATTRIB_SHA_ARM
+static void Sha256_UpdateBlocks_Arm(UInt32 state[8], const Byte *data, size_t numBlocks)
+{
+  uint32x4_t state0 = vld1q_u32(&state[0]);
+  uint32x4_t state1 = vld1q_u32(&state[4]);
+
+  for (; numBlocks != 0; numBlocks--, data += 64)
+  {
+    uint32x4_t abcd = state0;
+    uint32x4_t efgh = state1;
+    uint32x4_t m[4], msg, tmp;
+    unsigned i;
+
+    for (i = 0; i < 4; i++)
+      m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + i * 16)));
+
+    for (i = 0; i < 16; i++)
+    {
+      if (i >= 4)
+        m[i & 3] = vsha256su1q_u32(vsha256su0q_u32(m[i & 3], m[(i + 1) & 3]), m[(i + 2) & 3], m[(i + 3) & 3]);
+
+      msg = vaddq_u32(m[i & 3], vld1q_u32(&K[i * 4]));
+      tmp = state0;
+      state0 = vsha256hq_u32(state0, state1, msg);
+      state1 = vsha256h2q_u32(state1, tmp, msg);
+    }
+
+    state0 = vaddq_u32(state0, abcd);
+    state1 = vaddq_u32(state1, efgh);
+  }
+
+  vst1q_u32(&state[0], state0);
+  vst1q_u32(&state[4], state1);
+}
+
+static Bool Sha256_CpuHas(unsigned impl)
+{
+  if (impl != SHA256_IMPL_SHA_ARM)
+    return False;
+
+  #if defined(__APPLE__)
+  {
+    int value = 0;
+    size_t size = sizeof(value);
+    /* Every Apple CPU has it, but only newer systems have this name for it */
+    if (sysctlbyname("hw.optional.arm.FEAT_SHA256", &value, &size, NULL, 0) != 0)
+      return True;
+    return value != 0;
+  }
+  #elif defined(__linux__) && defined(HWCAP_SHA2)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+  #else
+    return False;
+  #endif
+}
+
+#endif
+
+Bool Sha256_SetImpl(unsigned impl)
+{
+  switch (impl)
+  {
+    case SHA256_IMPL_PORTABLE:
+      g_UpdateBlocks = Sha256_UpdateBlocks_Portable;
+      break;
+    #ifdef _SHA256_X86
+    case SHA256_IMPL_SHA_X86:
+      if (!Sha256_CpuHas(impl))
+        return False;
+      g_UpdateBlocks = Sha256_UpdateBlocks_X86;
+      break;
+    #endif
+    #ifdef _SHA256_ARM
+    case SHA256_IMPL_SHA_ARM:
+      if (!Sha256_CpuHas(impl))
+        return False;
+      g_UpdateBlocks = Sha256_UpdateBlocks_Arm;
+      break;
+    #endif
+    default:
+      return False;
+  }
+
+  g_Impl = impl;
+  return True;
+}
+
+Bool Sha256_SetMultiImpl(unsigned impl)
+{
+  switch (impl)
+  {
+    case SHA256_MULTI_SERIAL:
+      break;
+    #ifdef _SHA256_X86
+    case SHA256_MULTI_AVX2:
+      if (!Sha256_CpuHas(impl))
+        return False;
+      break;
+    #endif
+    default:
+      return False;
+  }
+
+  g_MultiImpl = impl;
+  return True;
+}
+
+unsigned Sha256_GetImpl(void)
+{
+  if (!g_Prepared)
+    Sha256_Prepare();
+  return g_Impl;
+}
+
+unsigned Sha256_GetMultiImpl(void)
+{
+  if (!g_Prepared)
+    Sha256_Prepare();
+  return g_MultiImpl;
+}
+
+void Sha256_Prepare(void)
+{
+  Sha256_SetImpl(SHA256_IMPL_PORTABLE);
+  Sha256_SetMultiImpl(SHA256_MULTI_SERIAL);
+
+  #ifdef _SHA256_X86
+  /* One buffer at a time with the SHA extensions is faster than 8 at a time with AVX2 */
+  if (!Sha256_SetImpl(SHA256_IMPL_SHA_X86))
+    Sha256_SetMultiImpl(SHA256_MULTI_AVX2);
+  #endif
+
+  #ifdef _SHA256_ARM
+  Sha256_SetImpl(SHA256_IMPL_SHA_ARM);
+  #endif
+
+  g_Prepared = True;
+}
+
 void Sha256_Update(CSha256 *p, const Byte *data, size_t size)
 {
   if (size == 0)
@@ -198,20 +598,113 @@ void Sha256_Update(CSha256 *p, const Byte *data, size_t size)
     data += num;
   }
 
-  for (;;)
+  g_UpdateBlocks(p->state, p->buffer, 1);
+
+  /* Whole blocks are hashed straight from data */
   {
-    Sha256_WriteByteBlock(p);
-    if (size < 64)
-      break;
-    size -= 64;
-    memcpy(p->buffer, data, 64);
-    data += 64;
+    size_t numBlocks = size >> 6;
+    g_UpdateBlocks(p->state, data, numBlocks);
+    data += numBlocks << 6;
+    size &= 0x3F;
   }
 
   if (size != 0)
     memcpy(p->buffer, data, size);
 }
 
+void Sha256_UpdateMulti(CSha256 * const *p, const Byte * const *data, const size_t *sizes, unsigned num)
+{
+  const Byte *pos[SHA256_MULTI_MAX];
+  size_t numBlocks[SHA256_MULTI_MAX];
+  size_t rest[SHA256_MULTI_MAX];
+  unsigned i;
+
+  if (!g_Prepared)
+    Sha256_Prepare();
+
+  /* Fill the partial block of each context first, so the rest of each buffer starts on a block */
+  for (i = 0; i < num; i++)
+  {
+    size_t size = sizes[i];
+    unsigned used = (unsigned)p[i]->count & 0x3F;
+
+    pos[i] = data[i];
+    if (used != 0)
+    {
+      size_t fill = 64 - used;
+      if (fill > size)
+        fill = size;
+      Sha256_Update(p[i], pos[i], fill);
+      pos[i] += fill;
+      size -= fill;
+    }
+
+    numBlocks[i] = size >> 6;
+    rest[i] = size & 0x3F;
+    p[i]->count += size;
+  }
+
+  #ifdef _SHA256_X86
+  if (g_MultiImpl == SHA256_MULTI_AVX2)
+  {
+    for (;;)
+    {
+      UInt32 *states[8];
+      const Byte *lanes[8];
+      UInt32 scratch[8];
+      unsigned active = 0, first = 0;
+      size_t common = 0;
+
+      for (i = 0; i < num; i++)
+      {
+        if (numBlocks[i] == 0)
+          continue;
+        if (active == 0 || numBlocks[i] < common)
+          common = numBlocks[i];
+        if (active == 0)
+          first = i;
+        active++;
+      }
+
+      /* A lone buffer is faster on its own */
+      if (active < 2)
+        break;
+
+      /* Lanes without a buffer hash the first buffer again into scratch space */
+      for (i = 0; i < 8; i++)
+      {
+        if (i < num && numBlocks[i] != 0)
+        {
+          states[i] = p[i]->state;
+          lanes[i] = pos[i];
+        }
+        else
+        {
+          states[i] = scratch;
+          lanes[i] = pos[first];
+        }
+      }
+
+      Sha256_UpdateBlocks_Avx2x8(states, lanes, common);
+
+      for (i = 0; i < num; i++)
+      {
+        if (numBlocks[i] == 0)
+          continue;
+        pos[i] += common << 6;
+        numBlocks[i] -= common;
+      }
+    }
+  }
+  #endif
+
+  for (i = 0; i < num; i++)
+  {
+    g_UpdateBlocks(p[i]->state, pos[i], numBlocks[i]);
+    memcpy(p[i]->buffer, pos[i] + (numBlocks[i] << 6), rest[i]);
+  }
+}
+
 void Sha256_Final(CSha256 *p, Byte *digest)
 {
   unsigned pos = (unsigned)p->count & 0x3F;
@@ -223,7 +716,7 @@ void Sha256_Final(CSha256 *p, Byte *digest)
   {
     pos &= 0x3F;
     if (pos == 0)
-      Sha256_WriteByteBlock(p);
+      g_UpdateBlocks(p->state, p->buffer, 1);
     p->buffer[pos++] = 0;
   }
 
@@ -233,7 +726,7 @@ void Sha256_Final(CSha256 *p, Byte *digest)
     SetBe32(p->buffer + 64 - 4, (UInt32)(numBits));
   }
 
-  Sha256_WriteByteBlock(p);
+  g_UpdateBlocks(p->state, p->buffer, 1);
 
   for (i = 0; i < 8; i += 2)
   {
@@ -17,10 +17,31 @@ typedef struct
   Byte buffer[64];
 } CSha256;
 
+#define SHA256_IMPL_PORTABLE  0
+#define SHA256_IMPL_SHA_X86   1  /* x86 SHA extensions */
+#define SHA256_IMPL_SHA_ARM   2  /* ARMv8 cryptography extensions */
+
+#define SHA256_MULTI_SERIAL   0  /* one buffer after another */
+#define SHA256_MULTI_AVX2     1  /* 8 buffers at a time */
+
+#define SHA256_MULTI_MAX 8
+
+/* Picks the fastest implementations the CPU supports. Called by Sha256_Init if needed. */
+void Sha256_Prepare(void);
+
+/* Return False if the CPU doesn't support the implementation, and leave the current one in use */
+Bool Sha256_SetImpl(unsigned impl);
+Bool Sha256_SetMultiImpl(unsigned impl);
+unsigned Sha256_GetImpl(void);
+unsigned Sha256_GetMultiImpl(void);
+
 void Sha256_Init(CSha256 *p);
 void Sha256_Update(CSha256 *p, const Byte *data, size_t size);
 void Sha256_Final(CSha256 *p, Byte *digest);
 
+/* Same as calling Sha256_Update for each of up to SHA256_MULTI_MAX contexts */
+void Sha256_UpdateMulti(CSha256 * const *p, const Byte * const *data, const size_t *sizes, unsigned num);
+
 EXTERN_C_END
 
 #endif
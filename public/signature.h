@@ -29,6 +29,7 @@
 #ifndef _INCLUDE_SRCDS_SIGNATURE_H_
 #define _INCLUDE_SRCDS_SIGNATURE_H_
 
+#include <stddef.h>
 #include <utility>
 
 namespace SrcDS::Signature
@@ -142,6 +143,55 @@ namespace SrcDS::Signature
 	{
 		return {};
 	}
+
+	// Parses a signature in MAKE_SIG syntax at runtime, e.g. one read from a config file.
+	// Returns the number of bytes written to out, or 0 if the text is malformed or too long.
+	inline size_t Parse(const char *text, Byte *out, size_t maxLen)
+	{
+		auto hexValue = [](char c) -> int {
+			if (c >= '0' && c <= '9')
+				return c - '0';
+			if (c >= 'A' && c <= 'F')
+				return c + 10 - 'A';
+			if (c >= 'a' && c <= 'f')
+				return c + 10 - 'a';
+			return -1;
+		};
+
+		size_t len = 0;
+		while (*text) {
+			if (*text == ' ') {
+				text++;
+				continue;
+			}
+
+			if (len == maxLen)
+				return 0;
+
+			if (text[0] == '?') {
+				out[len++] = wildcard;
+				text += (text[1] == '?') ? 2 : 1;
+			} else {
+				int high = hexValue(text[0]);
+				int low = hexValue(text[1]);
+				if (high < 0)
+					return 0;
+
+				if (low < 0) {
+					out[len++] = Byte(high);
+					text++;
+				} else {
+					out[len++] = Byte(high * 16 + low);
+					text += 2;
+				}
+			}
+
+			if (*text && *text != ' ')
+				return 0;
+		}
+
+		return len;
+	}
 }
 
 #define MAKE_SIG(LITERAL)                                                                 \
@@ -32,6 +32,7 @@
 //   - Added constructor with initialization list for |nbuckets| and |buckets|
 //   - Moved destructor logic to new Destroy() function
 //   - Added IsEmpty()
+//   - Destroy() leaves the table empty so that it can be initialized again
 //
 // Original: http://hg.alliedmods.net/sourcemod-central/file/14bb936ba41f/core/logic/sm_symtable.h
 //
@@ -61,7 +62,7 @@ struct Symbol
 class SymbolTable
 {
 public:
-	SymbolTable() : nbuckets(0), buckets(nullptr)
+	SymbolTable() : nbuckets(0), nused(0), buckets(nullptr)
 	{
 
 	}
@@ -99,6 +100,10 @@ public:
 			}
 		}
 		free(buckets);
+
+		buckets = nullptr;
+		nbuckets = 0;
+		nused = 0;
 	}
 
 	bool IsEmpty()
@@ -41,6 +41,10 @@
 #define SH_SYS	SH_SYS_APPLE
 #define SH_XP	SH_XP_POSIX
 #define SH_COMP	SH_COMP_GCC
+#elif defined __linux__
+#define SH_SYS	SH_SYS_LINUX
+#define SH_XP	SH_XP_POSIX
+#define SH_COMP	SH_COMP_GCC
 #else
 #error Unsupported platform
 #endif
@@ -101,7 +105,23 @@ inline void IA32_Send_Jump32_Here(JitWriter *jit, jitoffs_t jmp)
 	IA32_Write_Jump32(jit, jmp, curptr);
 }
 
-/* 64-bit registers */
+/* 64-bit registers, replacing glibc's <sys/ucontext.h> names for its gregs indices */
+#undef REG_RAX
+#undef REG_RCX
+#undef REG_RDX
+#undef REG_RBX
+#undef REG_RSP
+#undef REG_RBP
+#undef REG_RSI
+#undef REG_RDI
+#undef REG_R8
+#undef REG_R9
+#undef REG_R10
+#undef REG_R11
+#undef REG_R12
+#undef REG_R13
+#undef REG_R14
+#undef REG_R15
 #define REG_RAX REG_EAX
 #define REG_RCX REG_ECX
 #define REG_RDX REG_EDX
@@ -155,7 +175,7 @@ inline jitoffs_t X64_Mov_Reg_Imm64(JitWriter *jit, jit_uint8_t dest, jit_int64_t
 {
 	jitoffs_t offs;
 	X64_Emit_Rex(jit, true, 0, 0, dest);
-	jit->write_ubyte(IA32_MOV_REG_IMM+dest);
+	jit->write_ubyte(IA32_MOV_REG_IMM+(dest & 7));
 	offs = jit->get_outputpos();
 	jit->write_int64(num);
 	return offs;
@@ -170,4 +190,49 @@ inline jitoffs_t IA32_Mov_Reg_Imm32(JitWriter *jit, jit_uint8_t dest, jit_int32_
 	return offs;
 }
 
+inline void X64_Push_Reg(JitWriter *jit, jit_uint8_t reg)
+{
+	if (reg >= REG_R8)
+		X64_Emit_Rex(jit, false, 0, 0, reg);
+	IA32_Push_Reg(jit, reg & 7);
+}
+
+inline void X64_Pop_Reg(JitWriter *jit, jit_uint8_t reg)
+{
+	if (reg >= REG_R8)
+		X64_Emit_Rex(jit, false, 0, 0, reg);
+	IA32_Pop_Reg(jit, reg & 7);
+}
+
+// lea reg, [esp+disp32]
+inline void IA32_Lea_Reg_EspDisp32(JitWriter *jit, jit_uint8_t dest, jit_int32_t disp)
+{
+	jit->write_ubyte(IA32_LEA_REG_MEM);
+	jit->write_ubyte(ia32_modrm(MOD_DISP32, dest, REG_SIB));
+	jit->write_ubyte(ia32_sib(NOSCALE, REG_NOIDX, REG_ESP));
+	jit->write_int32(disp);
+}
+
+// movdqu [esp+disp8], xmm
+inline void SSE_Movdqu_EspDisp8_Xmm(JitWriter *jit, jit_int8_t disp, jit_uint8_t xmm)
+{
+	jit->write_ubyte(0xF3);
+	jit->write_ubyte(0x0F);
+	jit->write_ubyte(0x7F);
+	jit->write_ubyte(ia32_modrm(MOD_DISP8, xmm, REG_SIB));
+	jit->write_ubyte(ia32_sib(NOSCALE, REG_NOIDX, REG_ESP));
+	jit->write_byte(disp);
+}
+
+// movdqu xmm, [esp+disp8]
+inline void SSE_Movdqu_Xmm_EspDisp8(JitWriter *jit, jit_uint8_t xmm, jit_int8_t disp)
+{
+	jit->write_ubyte(0xF3);
+	jit->write_ubyte(0x0F);
+	jit->write_ubyte(0x6F);
+	jit->write_ubyte(ia32_modrm(MOD_DISP8, xmm, REG_SIB));
+	jit->write_ubyte(ia32_sib(NOSCALE, REG_NOIDX, REG_ESP));
+	jit->write_byte(disp);
+}
+
 #endif // _INCLUDE_SRCDS_OSX_SH_INCLUDE_H_
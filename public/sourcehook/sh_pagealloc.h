@@ -1,22 +1,25 @@
 #ifndef __SH_PAGEALLOC_H__
 #define __SH_PAGEALLOC_H__
 
-#include "sh_list.h"
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
 #include "sh_memory.h"
 
 # if SH_XP == SH_XP_WINAPI
 #		include <windows.h>
 # elif SH_XP == SH_XP_POSIX
 #		include <sys/mman.h>
+#		include <sys/stat.h>
+#		include <fcntl.h>
+#		include <stdio.h>
 #		include <unistd.h>
 # else
 #		error Unsupported OS/Compiler
 # endif
 
-
 namespace SourceHook
 {
-
 	/*
 	Class which lets us allocate memory regions in special pages only meant for on the fly code generation.
 
@@ -26,230 +29,489 @@ namespace SourceHook
 	Allocating one page per code generation session is usually a waste of memory and on some platforms also
 	a waste of virtual address space (Windows VirtualAlloc has a granularity of 64K).
 
-
 	IMPORTANT: the memory that Alloc() returns is not a in a defined state!
 	It could be in read+exec OR read+write mode.
 	-> call SetRE() or SetRW() before using allocated memory!
+
+	On POSIX systems, chunks are backed by a shared memory object that is mapped twice: once
+	read+exec at the address Alloc() returns and once read+write at the address GetWritable()
+	returns. Code is written through the second mapping, so SetRE() and SetRW() do nothing and no
+	page is ever writable and executable at the same address. If the shared memory object cannot
+	be created, chunks fall back to a single mapping whose access is toggled.
+
+	Memory is handed out from chunks of kChunkSize bytes that are aligned to their size. Each chunk
+	is split into slabs of kSlabSize bytes, and each slab serves a single power of two size class
+	with a bitmap of its free blocks. The first bytes of a chunk point to its bookkeeping, so both
+	Alloc() and Free() take constant time. Allocations larger than half a slab, as well as isolated
+	ones, get a chunk of their own.
+
+	Alloc(), Free(), SetRE() and SetRW() may be called from any thread.
+
+	Alloc() optionally takes an address that the memory should be close to. Such allocations come
+	from a separate pool whose chunks are placed within kPoolReach of that address if possible,
+	which lets generated code reach it with 32-bit relative jumps.
 	*/
+
 	class CPageAlloc
 	{
-		struct AllocationUnit
+		static const size_t kChunkSize = 64 * 1024;
+		static const size_t kSlabSize = 4096;
+		static const size_t kHeaderSize = 16;
+		static const size_t kMinClassShift = 4;
+		static const size_t kNumClasses = 8;		// 16 to 2048 bytes
+		static const size_t kBitmapWords = kSlabSize / (1 << kMinClassShift) / 64;
+		static const intptr_t kPoolReach = 0x40000000;
+		static const intptr_t kHintStep = 0x4000000;
+		static const int kHintAttempts = 16;
+		static const uint32_t kChunkMagic = 0x53484331;
+
+		struct Pool;
+		struct Chunk;
+
+		struct Slab
+		{
+			Chunk *chunk;
+			Slab *prev;
+			Slab *next;
+			size_t index;
+			int sizeClass;					// -1 while the slab is unused
+			size_t freeBlocks;
+			size_t usableBlocks;
+			size_t firstFreeWord;			// no word before this one has a free block
+			uint64_t bitmap[kBitmapWords];	// set bits are free blocks
+		};
+
+		struct Chunk
 		{
-			size_t begin_offset;
+			Pool *pool;
+			Chunk *prev;
+			Chunk *next;
+			char *startPtr;
+			intptr_t writeOffset;			// distance from startPtr to its read+write alias, 0 if none
 			size_t size;
+			bool large;						// holds a single allocation
+			bool isRE;						// true: RE, otherwise: RW
+			size_t freeSlabs;
+			Slab slabs[kChunkSize / kSlabSize];
+		};
 
-			AllocationUnit(size_t p_offs, size_t p_size) : begin_offset(p_offs), size(p_size)
-			{
-			}
+		// Lives at the start of every chunk so that pointers can be mapped back to it
+		struct ChunkHeader
+		{
+			Chunk *chunk;
+			uint32_t magic;
+		};
 
-			bool operator < (const AllocationUnit &other) const
-			{
-				return begin_offset < other.begin_offset;
-			}
+		struct Pool
+		{
+			Pool *next;
+			char *center;					// NULL for the default pool
+			char *nextHint;					// new chunks are placed just below this address
+			Chunk *chunks;
+			Slab *freeSlabs;
+			Slab *partial[kNumClasses];		// slabs with at least one free block
+			size_t emptyChunks;
 		};
 
-		typedef List<AllocationUnit> AUList;
-		struct AllocatedRegion
+		size_t m_MinAlignment;
+		size_t m_PageSize;
+		Pool m_DefaultPool;
+		Pool *m_Pools;
+		std::mutex m_Lock;				// code is generated from more than one thread
+
+		static void LinkSlab(Slab *&list, Slab *slab)
 		{
-			void *startPtr;
-			size_t size;
-			bool isolated;					// may contain only one AU
-			size_t minAlignment;
-			AUList allocUnits;
-			bool isRE;						// true: RE, otherwise: RW
+			slab->prev = NULL;
+			slab->next = list;
+			if (list)
+				list->prev = slab;
+			list = slab;
+		}
+
+		static void UnlinkSlab(Slab *&list, Slab *slab)
+		{
+			if (slab->prev)
+				slab->prev->next = slab->next;
+			else
+				list = slab->next;
+			if (slab->next)
+				slab->next->prev = slab->prev;
+			slab->prev = slab->next = NULL;
+		}
 
-			void CheckGap(size_t gap_begin, size_t gap_end, size_t reqsize,
-				size_t &smallestgap_pos, size_t &smallestgap_size, size_t &outAlignBytes)
+		static int ClassIndex(size_t size)
+		{
+			int index = 0;
+			size = (size - 1) >> kMinClassShift;
+			while (size)
 			{
-				size_t gapsize = gap_end - gap_begin;
-				// How many bytes do we actually need here?
-				//   = requested size + alignment bytes
-				size_t neededSize = reqsize;
-				size_t alignBytes = minAlignment - ((reinterpret_cast<intptr_t>(startPtr) + gap_begin) % minAlignment);
+				size >>= 1;
+				index++;
+			}
+			return index;
+		}
 
-				alignBytes %= minAlignment;
-				neededSize += alignBytes;
+		static size_t ClassSize(int index)
+		{
+			return size_t(1) << (index + kMinClassShift);
+		}
 
-				if (gapsize >= neededSize)
-				{
-					if (gapsize < smallestgap_size)
-					{
-						smallestgap_size = gapsize;
-						smallestgap_pos = gap_begin;
-						outAlignBytes = alignBytes;
-					}
-				}
-			}
+		static int FindFirstSet(uint64_t value)
+		{
+#if defined _MSC_VER
+			unsigned long index;
+			_BitScanForward64(&index, value);
+			return int(index);
+#else
+			return __builtin_ctzll(value);
+#endif
+		}
 
-			bool TryAlloc(size_t reqsize, void * &outAddr)
+#if SH_XP == SH_XP_POSIX
+		// Returns a file descriptor for an anonymous shared memory object of the given size
+		static int CreateSharedMemory(size_t size)
+		{
+#if defined __linux__ && defined MFD_CLOEXEC
+			int fd = memfd_create("sourcehook-jit", MFD_CLOEXEC);
+#else
+			// The name is unlinked right away, it only has to be unique for a moment
+			static unsigned int counter = 0;
+			char name[32];
+			snprintf(name, sizeof(name), "/shjit.%d.%u", getpid(), counter++);
+
+			int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+			if (fd != -1)
+				shm_unlink(name);
+#endif
+			if (fd != -1 && ftruncate(fd, size) != 0)
 			{
-				// Check for isolated
-				if (isolated && !allocUnits.empty())
-					return false;
+				close(fd);
+				fd = -1;
+			}
 
-				// Find the smallest gap where req fits
-				size_t lastend = 0;
-				size_t smallestgap_pos = size + 1;
-				size_t smallestgap_size = size + 1;
-				size_t alignmentbytes = 0;
+			return fd;
+		}
 
-				for (AUList::iterator iter = allocUnits.begin(); iter != allocUnits.end(); ++iter)
-				{
-					CheckGap(lastend, iter->begin_offset, reqsize, smallestgap_pos, smallestgap_size, alignmentbytes);
-					lastend = iter->begin_offset + iter->size;
-				}
+		// Reserves size bytes aligned to kChunkSize, preferably at hint
+		static char *Reserve(size_t size, void *hint)
+		{
+			size_t span = size + kChunkSize;
+			char *p = reinterpret_cast<char*>(mmap(hint, span, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0));
+			if (p == MAP_FAILED)
+				return NULL;
+
+			char *aligned = reinterpret_cast<char*>((uintptr_t(p) + kChunkSize - 1) & ~uintptr_t(kChunkSize - 1));
+			if (aligned > p)
+				munmap(p, aligned - p);
+			if (aligned + size < p + span)
+				munmap(aligned + size, (p + span) - (aligned + size));
+
+			return aligned;
+		}
+
+		static void Unreserve(char *base, size_t size)
+		{
+			munmap(base, size);
+		}
 
-				CheckGap(lastend, size, reqsize, smallestgap_pos, smallestgap_size, alignmentbytes);
+		// Maps the chunk's memory over the range reserved at base
+		static bool MapChunk(Chunk *chunk, char *base)
+		{
+			int fd = CreateSharedMemory(chunk->size);
+			if (fd != -1)
+			{
+				void *execPtr = mmap(base, chunk->size, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, fd, 0);
+				void *writePtr = mmap(0, chunk->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				close(fd);
 
-				if (smallestgap_pos < size)
+				if (execPtr != MAP_FAILED && writePtr != MAP_FAILED)
 				{
-					outAddr = reinterpret_cast<void*>(reinterpret_cast<char*>(startPtr) + smallestgap_pos + alignmentbytes);
-					allocUnits.push_sorted( AllocationUnit(smallestgap_pos, reqsize + alignmentbytes) );
+					chunk->startPtr = base;
+					chunk->writeOffset = reinterpret_cast<char*>(writePtr) - base;
 					return true;
 				}
-				else
-				{
-					return false;
-				}
+
+				if (writePtr != MAP_FAILED)
+					munmap(writePtr, chunk->size);
 			}
 
-			bool TryFree(void *addr)
+			if (mmap(base, chunk->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) == MAP_FAILED)
 			{
-				if (addr < startPtr || addr >= reinterpret_cast<void*>(reinterpret_cast<char*>(startPtr) + size))
-					return false;
+				munmap(base, chunk->size);
+				return false;
+			}
 
-				intptr_t start = reinterpret_cast<intptr_t>(startPtr);
+			chunk->startPtr = base;
+			chunk->writeOffset = 0;
+			return true;
+		}
 
-				for (AUList::iterator iter = allocUnits.begin(); iter != allocUnits.end(); ++iter)
-				{
-					size_t AUBegin = start + iter->begin_offset;
-					void *alignedAUBegin = reinterpret_cast<void*>(
-						AUBegin + ((minAlignment - AUBegin % minAlignment) % minAlignment)
-						);
-
-					if (addr == alignedAUBegin)
-					{
-						DebugCleanMemory(reinterpret_cast<unsigned char*>(startPtr) + iter->begin_offset,
-							iter->size);
-						allocUnits.erase(iter);
-						return true;
-					}
-				}
+		static void UnmapChunk(Chunk *chunk)
+		{
+			munmap(chunk->startPtr, chunk->size);
+			if (chunk->writeOffset)
+				munmap(chunk->startPtr + chunk->writeOffset, chunk->size);
+		}
+#elif SH_XP == SH_XP_WINAPI
+		// VirtualAlloc's allocation granularity is 64K, so its regions are always chunk aligned
+		static char *Reserve(size_t size, void *hint)
+		{
+			return reinterpret_cast<char*>(VirtualAlloc(hint, size, MEM_RESERVE, PAGE_NOACCESS));
+		}
+
+		static void Unreserve(char *base, size_t size)
+		{
+			VirtualFree(base, 0, MEM_RELEASE);
+		}
 
+		static bool MapChunk(Chunk *chunk, char *base)
+		{
+			if (!VirtualAlloc(base, chunk->size, MEM_COMMIT, PAGE_READWRITE))
+			{
+				VirtualFree(base, 0, MEM_RELEASE);
 				return false;
 			}
 
-			void DebugCleanMemory(unsigned char* start, size_t size)
+			chunk->startPtr = base;
+			chunk->writeOffset = 0;
+			return true;
+		}
+
+		static void UnmapChunk(Chunk *chunk)
+		{
+			VirtualFree(chunk->startPtr, 0, MEM_RELEASE);
+		}
+#endif
+
+		static Chunk *ChunkFromPtr(void *ptr)
+		{
+			char *base = reinterpret_cast<char*>(uintptr_t(ptr) & ~uintptr_t(kChunkSize - 1));
+			ChunkHeader *header = reinterpret_cast<ChunkHeader*>(base);
+			SH_ASSERT(header->magic == kChunkMagic, ("pointer was not allocated by CPageAlloc"));
+			return header->chunk;
+		}
+
+		static void ChunkSetRE(Chunk *chunk)
+		{
+			if (!chunk->writeOffset)
+				SetMemAccess(chunk->startPtr, chunk->size, SH_MEM_READ | SH_MEM_EXEC);
+			chunk->isRE = true;
+		}
+
+		static void ChunkSetRW(Chunk *chunk)
+		{
+			if (!chunk->writeOffset)
+				SetMemAccess(chunk->startPtr, chunk->size, SH_MEM_READ | SH_MEM_WRITE);
+			chunk->isRE = false;
+		}
+
+		static void DebugCleanMemory(Chunk *chunk, char *start, size_t size)
+		{
+			bool wasRE = chunk->isRE;
+			if (wasRE)
+				ChunkSetRW(chunk);
+
+			memset(start + chunk->writeOffset, 0xCC, size);
+
+			if (wasRE)
+				ChunkSetRE(chunk);
+		}
+
+		// Finds the pool for allocations near the given address, creating it if needed
+		Pool *GetPool(void *near)
+		{
+			if (!near)
+				return &m_DefaultPool;
+
+			char *addr = reinterpret_cast<char*>(near);
+			for (Pool *pool = m_Pools; pool; pool = pool->next)
 			{
-				bool wasRE = isRE;
-				if (isRE)
-				{
-					SetRW();
-				}
+				intptr_t distance = addr - pool->center;
+				if (distance > -kPoolReach && distance < kPoolReach)
+					return pool;
+			}
 
-				unsigned char* end = start + size;
-				for (unsigned char* p = start; p != end; ++p)
-				{
-					*p = 0xCC;
-				}
+			Pool *pool = new Pool();
+			pool->center = addr;
+			pool->nextHint = reinterpret_cast<char*>(uintptr_t(addr) & ~uintptr_t(kChunkSize - 1));
+			pool->next = m_Pools;
+			m_Pools = pool;
+			return pool;
+		}
+
+		// Reserves memory within reach of the pool's center. Chunks are packed downwards from the
+		// center first. Hints are only hints to the OS, which picks an address of its own if the
+		// range is taken, so other ranges are probed below and above the center until one is free.
+		static char *ReserveNear(Pool *pool, size_t size)
+		{
+			for (int attempt = 0; attempt < kHintAttempts; attempt++)
+			{
+				intptr_t offset = (attempt / 2) * kHintStep;
+				uintptr_t hint;
+				if (attempt % 2 == 0)
+					hint = uintptr_t(pool->nextHint) - size - offset;
+				else
+					hint = ((uintptr_t(pool->center) + kChunkSize) & ~uintptr_t(kChunkSize - 1)) + offset;
 
-				if (wasRE)
+				if (hint > uintptr_t(pool->center) + kPoolReach || hint + kPoolReach < uintptr_t(pool->center))
+					continue;
+
+				char *base = Reserve(size, reinterpret_cast<void*>(hint));
+				if (!base)
+					continue;
+
+				intptr_t distance = base - pool->center;
+				if (distance > -kPoolReach && distance < kPoolReach)
 				{
-					SetRE();
+					if (base < pool->nextHint)
+						pool->nextHint = base;
+					return base;
 				}
-			}
 
-			bool Contains(void *addr)
-			{
-				return addr >= startPtr && addr < reinterpret_cast<void*>(reinterpret_cast<char*>(startPtr) + size);
+				Unreserve(base, size);
 			}
 
-			void FreeRegion()
+			return NULL;
+		}
+
+		Chunk *AddChunk(Pool *pool, size_t size, bool large)
+		{
+			Chunk *chunk = new Chunk();
+			chunk->pool = pool;
+			chunk->size = size;
+			chunk->large = large;
+
+			char *base = pool->center ? ReserveNear(pool, size) : NULL;
+			if (!base)
+				base = Reserve(size, NULL);
+
+			if (!base || !MapChunk(chunk, base))
 			{
-#if SH_XP == SH_XP_POSIX
-				munmap(startPtr, size);
-#elif SH_XP == SH_XP_WINAPI
-				VirtualFree(startPtr, 0, MEM_RELEASE);
-#endif
+				delete chunk;
+				return NULL;
 			}
 
-			void SetRE()
+			ChunkHeader *header = reinterpret_cast<ChunkHeader*>(chunk->startPtr + chunk->writeOffset);
+			header->chunk = chunk;
+			header->magic = kChunkMagic;
+			ChunkSetRW(chunk);
+
+			chunk->next = pool->chunks;
+			if (pool->chunks)
+				pool->chunks->prev = chunk;
+			pool->chunks = chunk;
+
+			if (!large)
 			{
-				SetMemAccess(startPtr, size, SH_MEM_READ | SH_MEM_EXEC);
-				isRE = true;
+				size_t numSlabs = kChunkSize / kSlabSize;
+				for (size_t i = numSlabs; i-- > 0;)
+				{
+					Slab *slab = &chunk->slabs[i];
+					slab->chunk = chunk;
+					slab->index = i;
+					slab->sizeClass = -1;
+					LinkSlab(pool->freeSlabs, slab);
+				}
+				chunk->freeSlabs = numSlabs;
+				pool->emptyChunks++;
 			}
 
-			void SetRW()
+			return chunk;
+		}
+
+		void RemoveChunk(Chunk *chunk)
+		{
+			Pool *pool = chunk->pool;
+
+			if (!chunk->large)
 			{
-				SetMemAccess(startPtr, size, SH_MEM_READ | SH_MEM_WRITE);
-				isRE = false;
+				for (size_t i = 0; i < kChunkSize / kSlabSize; i++)
+					UnlinkSlab(pool->freeSlabs, &chunk->slabs[i]);
+				pool->emptyChunks--;
 			}
-		};
 
-		typedef List<AllocatedRegion> ARList;
+			if (chunk->prev)
+				chunk->prev->next = chunk->next;
+			else
+				pool->chunks = chunk->next;
+			if (chunk->next)
+				chunk->next->prev = chunk->prev;
 
-		size_t m_MinAlignment;
-		size_t m_PageSize;
-		ARList m_Regions;
+			UnmapChunk(chunk);
+			delete chunk;
+		}
 
-		bool AddRegion(size_t minSize, bool isolated)
+		void *AllocLarge(Pool *pool, size_t size)
 		{
-			AllocatedRegion newRegion;
-			newRegion.startPtr = 0;
-			newRegion.isolated = isolated;
-			newRegion.minAlignment = m_MinAlignment;
+			size_t chunkSize = (size + kHeaderSize + kChunkSize - 1) & ~(kChunkSize - 1);
+			Chunk *chunk = AddChunk(pool, chunkSize, true);
+			if (!chunk)
+				return NULL;
 
-			// Compute real size -> align up to m_PageSize boundary
+			return chunk->startPtr + kHeaderSize;
+		}
 
-			newRegion.size = minSize - (minSize % m_PageSize);
-			if (newRegion.size < minSize)
-				newRegion.size += m_PageSize;
+		void *AllocPriv(size_t size, bool isolated, void *near)
+		{
+			std::lock_guard<std::mutex> guard(m_Lock);
 
-#if SH_XP == SH_XP_POSIX
-# if !defined MAP_ANONYMOUS
-#  define MAP_ANONYMOUS MAP_ANON
-# endif
-			newRegion.startPtr = mmap(0, newRegion.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-#elif SH_XP == SH_XP_WINAPI
-			newRegion.startPtr = VirtualAlloc(NULL, newRegion.size, MEM_COMMIT, PAGE_READWRITE);
-#endif
+			if (size < m_MinAlignment)
+				size = m_MinAlignment;
 
-			if (newRegion.startPtr)
-			{
-				newRegion.SetRW();
-				m_Regions.push_back(newRegion);
-				return true;
-			}
-			else
+			Pool *pool = GetPool(near);
+			if (isolated || size > ClassSize(kNumClasses - 1))
+				return AllocLarge(pool, size);
+
+			int sizeClass = ClassIndex(size);
+			Slab *slab = pool->partial[sizeClass];
+
+			if (!slab)
 			{
-				return false;
-			}
+				if (!pool->freeSlabs && !AddChunk(pool, kChunkSize, false))
+					return NULL;
 
-		}
+				slab = pool->freeSlabs;
+				UnlinkSlab(pool->freeSlabs, slab);
 
-		void *AllocPriv(size_t size, bool isolated)
-		{
-			void *addr;
+				Chunk *chunk = slab->chunk;
+				if (chunk->freeSlabs-- == kChunkSize / kSlabSize)
+					pool->emptyChunks--;
 
-			if (!isolated)
-			{
-				for (ARList::iterator iter = m_Regions.begin(); iter != m_Regions.end(); ++iter)
+				size_t blocks = kSlabSize / ClassSize(sizeClass);
+				memset(slab->bitmap, 0, sizeof(slab->bitmap));
+				for (size_t i = 0; i < blocks; i++)
+					slab->bitmap[i / 64] |= uint64_t(1) << (i % 64);
+
+				// The first block of a chunk overlaps its header
+				if (slab->index == 0)
 				{
-					if (iter->TryAlloc(size, addr))
-						return addr;
+					slab->bitmap[0] &= ~uint64_t(1);
+					blocks--;
 				}
+
+				slab->sizeClass = sizeClass;
+				slab->freeBlocks = slab->usableBlocks = blocks;
+				slab->firstFreeWord = 0;
+				LinkSlab(pool->partial[sizeClass], slab);
 			}
 
-			if (!AddRegion(size, isolated))
-				return NULL;
+			size_t word = slab->firstFreeWord;
+			while (!slab->bitmap[word])
+				word++;
+			slab->firstFreeWord = word;
+
+			int bit = FindFirstSet(slab->bitmap[word]);
+			slab->bitmap[word] &= ~(uint64_t(1) << bit);
+
+			if (--slab->freeBlocks == 0)
+				UnlinkSlab(pool->partial[sizeClass], slab);
 
-			bool tmp = m_Regions.back().TryAlloc(size, addr);
-			SH_ASSERT(tmp, ("TryAlloc fails after AddRegion"));
-			return tmp ? addr : NULL;
+			size_t block = word * 64 + bit;
+			return slab->chunk->startPtr + slab->index * kSlabSize + block * ClassSize(sizeClass);
 		}
 
 	public:
-		CPageAlloc(size_t minAlignment = 4 /* power of 2 */ ) : m_MinAlignment(minAlignment)
+		CPageAlloc(size_t minAlignment = 4 /* power of 2 */ ) : m_MinAlignment(minAlignment), m_Pools(NULL)
 		{
 #if SH_XP == SH_XP_POSIX
 			m_PageSize = sysconf(_SC_PAGESIZE);
@@ -258,65 +520,119 @@ namespace SourceHook
 			GetSystemInfo(&sysInfo);
 			m_PageSize = sysInfo.dwPageSize;
 #endif
+			memset(&m_DefaultPool, 0, sizeof(m_DefaultPool));
 		}
 
 		~CPageAlloc()
 		{
-			// Free all regions
-			for (ARList::iterator iter = m_Regions.begin(); iter != m_Regions.end(); ++iter)
+			// Free all chunks
+			while (m_DefaultPool.chunks)
 			{
-				iter->FreeRegion();
+				Chunk *chunk = m_DefaultPool.chunks;
+				m_DefaultPool.chunks = chunk->next;
+				UnmapChunk(chunk);
+				delete chunk;
+			}
+
+			while (m_Pools)
+			{
+				Pool *pool = m_Pools;
+				m_Pools = pool->next;
+
+				while (pool->chunks)
+				{
+					Chunk *chunk = pool->chunks;
+					pool->chunks = chunk->next;
+					UnmapChunk(chunk);
+					delete chunk;
+				}
+
+				delete pool;
 			}
 		}
 
 		void *Alloc(size_t size)
 		{
-			return AllocPriv(size, false);
+			return AllocPriv(size, false, NULL);
+		}
+
+		// Allocates memory that is preferably within 32-bit relative jump range of near
+		void *Alloc(size_t size, void *near)
+		{
+			return AllocPriv(size, false, near);
 		}
 
 		void *AllocIsolated(size_t size)
 		{
-			return AllocPriv(size, true);
+			return AllocPriv(size, true, NULL);
 		}
 
 		void Free(void *ptr)
 		{
-			for (ARList::iterator iter = m_Regions.begin(); iter != m_Regions.end(); ++iter)
+			if (!ptr)
+				return;
+
+			std::lock_guard<std::mutex> guard(m_Lock);
+
+			Chunk *chunk = ChunkFromPtr(ptr);
+			if (chunk->large)
 			{
-				if (iter->TryFree(ptr))
-				{
-					if (iter->allocUnits.empty())
-					{
-						iter->FreeRegion();
-						m_Regions.erase(iter);
-					}
-					break;
-				}
+				RemoveChunk(chunk);
+				return;
 			}
+
+			Pool *pool = chunk->pool;
+			size_t offset = reinterpret_cast<char*>(ptr) - chunk->startPtr;
+			Slab *slab = &chunk->slabs[offset / kSlabSize];
+			int sizeClass = slab->sizeClass;
+			size_t block = (offset % kSlabSize) >> (sizeClass + kMinClassShift);
+
+			DebugCleanMemory(chunk, reinterpret_cast<char*>(ptr), ClassSize(sizeClass));
+
+			slab->bitmap[block / 64] |= uint64_t(1) << (block % 64);
+			if (block / 64 < slab->firstFreeWord)
+				slab->firstFreeWord = block / 64;
+
+			if (slab->freeBlocks++ == 0)
+				LinkSlab(pool->partial[sizeClass], slab);
+
+			if (slab->freeBlocks < slab->usableBlocks)
+				return;
+
+			// The slab is empty, so it can serve another size class
+			UnlinkSlab(pool->partial[sizeClass], slab);
+			slab->sizeClass = -1;
+			LinkSlab(pool->freeSlabs, slab);
+
+			// Keep one empty chunk around so that alternating allocs and frees don't map and unmap
+			if (++chunk->freeSlabs == kChunkSize / kSlabSize && ++pool->emptyChunks > 1)
+				RemoveChunk(chunk);
 		}
 
 		void SetRE(void *ptr)
 		{
-			for (ARList::iterator iter = m_Regions.begin(); iter != m_Regions.end(); ++iter)
-			{
-				if (iter->Contains(ptr))
-				{
-					iter->SetRE();
-					break;
-				}
-			}
+			if (!ptr)
+				return;
+
+			std::lock_guard<std::mutex> guard(m_Lock);
+			ChunkSetRE(ChunkFromPtr(ptr));
 		}
 
 		void SetRW(void *ptr)
 		{
-			for (ARList::iterator iter = m_Regions.begin(); iter != m_Regions.end(); ++iter)
-			{
-				if (iter->Contains(ptr))
-				{
-					iter->SetRW();
-					break;
-				}
-			}
+			if (!ptr)
+				return;
+
+			std::lock_guard<std::mutex> guard(m_Lock);
+			ChunkSetRW(ChunkFromPtr(ptr));
+		}
+
+		// Returns the address through which the memory at ptr can be written
+		void *GetWritable(void *ptr)
+		{
+			if (!ptr)
+				return NULL;
+			return reinterpret_cast<char*>(ptr) + ChunkFromPtr(ptr)->writeOffset;
 		}
 
 		size_t GetPageSize()
@@ -327,4 +643,3 @@ namespace SourceHook
 }
 
 #endif
-
@@ -11,6 +11,7 @@
 /*
  * Original file: http://hg.alliedmods.net/mmsource-central/file/eeea4ed7c45d/core/sourcehook/sourcehook_hookmangen.h
  * Changes: Moved most of GenBuffer::push() to new function GenBuffer::alloc().
+ *          GenBuffer writes code through the allocator's writable alias of its memory.
  */
 
 #ifndef __SOURCEHOOK_HOOKMANGEN_H__
@@ -49,11 +50,13 @@ namespace SourceHook
 			static CPageAlloc ms_Allocator;
 
 			unsigned char *m_pData;
+			unsigned char *m_pWrite;		// alias of m_pData that code is written through
+			void *m_pHint;					// address the buffer should be allocated near
 			jitoffs_t m_Size;
 			jitoffs_t m_AllocatedSize;
 
 		public:
-			GenBuffer() : m_pData(NULL), m_Size(0), m_AllocatedSize(0)
+			GenBuffer() : m_pData(NULL), m_pWrite(NULL), m_pHint(NULL), m_Size(0), m_AllocatedSize(0)
 			{
 			}
 			~GenBuffer()
@@ -68,6 +71,17 @@ namespace SourceHook
 			{
 				return m_pData;
 			}
+			// Code must be written here rather than to GetData(), but relative addresses are
+			// still computed from GetData() since that is where it runs.
+			unsigned char *GetWritableData()
+			{
+				return m_pWrite;
+			}
+			// Asks for the buffer to be placed within 32-bit relative jump range of addr
+			void SetAllocHint(void *addr)
+			{
+				m_pHint = addr;
+			}
 
 			jitoffs_t alloc(jitoffs_t size)
 			{
@@ -79,16 +93,17 @@ namespace SourceHook
 					if (m_AllocatedSize < 64)
 						m_AllocatedSize = 64;
 
-					unsigned char *newBuf;
-					newBuf = reinterpret_cast<unsigned char*>(ms_Allocator.Alloc(m_AllocatedSize));
+					unsigned char *newBuf, *newWrite;
+					newBuf = reinterpret_cast<unsigned char*>(ms_Allocator.Alloc(m_AllocatedSize, m_pHint));
 					ms_Allocator.SetRW(newBuf);
 					if (!newBuf)
 					{
 						SH_ASSERT(0, ("bad_alloc: couldn't allocate 0x%08X bytes of memory\n", m_AllocatedSize));
 						return 0;
 					}
-					memset((void*)newBuf, 0xCC, m_AllocatedSize);			// :TODO: remove this !
-					memcpy((void*)newBuf, (const void*)m_pData, m_Size);
+					newWrite = reinterpret_cast<unsigned char*>(ms_Allocator.GetWritable(newBuf));
+					memset((void*)newWrite, 0xCC, m_AllocatedSize);			// :TODO: remove this !
+					memcpy((void*)newWrite, (const void*)m_pWrite, m_Size);
 					if (m_pData)
 					{
 						ms_Allocator.SetRE(reinterpret_cast<void*>(m_pData));
@@ -96,6 +111,7 @@ namespace SourceHook
 						ms_Allocator.Free(reinterpret_cast<void*>(m_pData));
 					}
 					m_pData = newBuf;
+					m_pWrite = newWrite;
 				}
 				m_Size = newSize;
 				return start;
@@ -109,7 +125,7 @@ namespace SourceHook
 			void push(const unsigned char *data, jitoffs_t size)
 			{
 				jitoffs_t start = alloc(size);
-				memcpy((void*)(m_pData + start), (const void*)data, size);
+				memcpy((void*)(m_pWrite + start), (const void*)data, size);
 			}
 
 			template <class PT> void rewrite(jitoffs_t offset, PT what)
@@ -121,7 +137,7 @@ namespace SourceHook
 			{
 				SH_ASSERT(offset + size <= m_AllocatedSize, ("rewrite too far"));
 
-				memcpy((void*)(m_pData + offset), (const void*)data, size);
+				memcpy((void*)(m_pWrite + offset), (const void*)data, size);
 			}
 
 			void clear()
@@ -129,6 +145,7 @@ namespace SourceHook
 				if (m_pData)
 					ms_Allocator.Free(reinterpret_cast<void*>(m_pData));
 				m_pData = NULL;
+				m_pWrite = NULL;
 				m_Size = 0;
 				m_AllocatedSize = 0;
 			}
@@ -0,0 +1,387 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "FunctionTracer.h"
+#include "HSGameLib.h"
+#include "stringutil.h"
+#include "signature.h"
+#include "CDetour/detourthunks.h"
+#include <limits.h>
+#include <mach/mach_time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static thread_local void *t_TracerState = nullptr;
+
+static inline double TicksToMicroseconds(uint64_t ticks)
+{
+	static mach_timebase_info_data_t timebase;
+	if (timebase.denom == 0)
+		mach_timebase_info(&timebase);
+
+	return double(ticks) * timebase.numer / timebase.denom / 1000.0;
+}
+
+// Detour for function in dedicated library. Runs once per frame of the dedicated server's main loop.
+static void ProcessConsoleInput()
+{
+	Detour<ProcessConsoleInput>::Original();
+	FunctionTracer::GetInstance().Poll();
+}
+
+void FunctionTracer::SetConfigFile(const char *path)
+{
+	if (path[0] == '/') {
+		configPath_ = path;
+		return;
+	}
+
+	// The working directory is changed once the engine is loaded
+	char cwd[PATH_MAX];
+	if (!getcwd(cwd, sizeof(cwd))) {
+		configPath_ = path;
+		return;
+	}
+
+	char fullPath[PATH_MAX];
+	strformat(fullPath, sizeof(fullPath), "%s/%s", cwd, path);
+	configPath_ = fullPath;
+}
+
+bool FunctionTracer::Init(IServerAPI *api, IGameLib *dedicated)
+{
+	if (configPath_.length() == 0)
+		return true;
+
+	api_ = api;
+
+	if (!EmitReturnStub(returnStub_, &FunctionTracer::Leave)) {
+		printf("Failed to create return stub for function tracing\n");
+		return false;
+	}
+
+	LoadConfig();
+
+	void *consoleInput = dedicated->ResolveHiddenSymbol("_Z19ProcessConsoleInputv");
+	if (!consoleInput) {
+		printf("Failed to find symbol: _Z19ProcessConsoleInputv (trace config will not be reloaded)\n");
+		return true;
+	}
+
+	consoleInput_ = Detour<ProcessConsoleInput>::Create(api, consoleInput);
+	if (!consoleInput_) {
+		printf("Failed to create detour for ProcessConsoleInput (trace config will not be reloaded)\n");
+		return true;
+	}
+
+	consoleInput_->Enable();
+	return true;
+}
+
+void FunctionTracer::Shutdown()
+{
+	if (!api_)
+		return;
+
+	if (consoleInput_) {
+		consoleInput_->Disable();
+		consoleInput_->Destroy();
+		consoleInput_ = nullptr;
+	}
+
+	Report();
+
+	for (size_t i = 0; i < functions_.length(); i++)
+		Deactivate(functions_[i]);
+
+	api_ = nullptr;
+}
+
+void FunctionTracer::Poll()
+{
+	time_t now = time(nullptr);
+	if (now == lastPoll_)
+		return;
+
+	lastPoll_ = now;
+
+	struct stat st;
+	if (stat(configPath_.chars(), &st) == 0 && st.st_mtime != configTime_)
+		LoadConfig();
+
+	if (reportInterval_ && now - lastReport_ >= time_t(reportInterval_)) {
+		lastReport_ = now;
+		Report();
+	}
+}
+
+bool FunctionTracer::Trace(const char *library, const char *function)
+{
+	TracedFunction *traced = Add(library, function);
+	traced->wanted = true;
+	return Activate(traced);
+}
+
+void FunctionTracer::Untrace(const char *library, const char *function)
+{
+	TracedFunction *traced = Find(library, function);
+	if (!traced)
+		return;
+
+	traced->wanted = false;
+	Deactivate(traced);
+}
+
+void FunctionTracer::Report()
+{
+	bool header = false;
+
+	for (size_t i = 0; i < functions_.length(); i++) {
+		TracedFunction *traced = functions_[i];
+		uint64_t count = traced->histogram.TotalCount();
+
+		if (!traced->active || count == 0)
+			continue;
+
+		if (!header) {
+			printf("%-48s %10s %10s %10s %10s %10s %10s\n", "Function (us)", "Calls", "Mean", "p50", "p99",
+			       "p99.9", "Max");
+			header = true;
+		}
+
+		char name[256];
+		strformat(name, sizeof(name), "%s`%s", traced->library.chars(), traced->function.chars());
+
+		uint64_t total = traced->totalTicks.load(std::memory_order_relaxed);
+		printf("%-48s %10llu %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, (unsigned long long)count,
+		       TicksToMicroseconds(total) / count,
+		       TicksToMicroseconds(traced->histogram.Percentile(0.5)),
+		       TicksToMicroseconds(traced->histogram.Percentile(0.99)),
+		       TicksToMicroseconds(traced->histogram.Percentile(0.999)),
+		       TicksToMicroseconds(traced->histogram.Percentile(1.0)));
+	}
+}
+
+FunctionTracer::TracedFunction *FunctionTracer::Find(const char *library, const char *function)
+{
+	for (size_t i = 0; i < functions_.length(); i++) {
+		TracedFunction *traced = functions_[i];
+		if (strcmp(traced->library.chars(), library) == 0 && strcmp(traced->function.chars(), function) == 0)
+			return traced;
+	}
+
+	return nullptr;
+}
+
+// Functions are never removed from the list so that their statistics survive being untraced and
+// traced again.
+FunctionTracer::TracedFunction *FunctionTracer::Add(const char *library, const char *function)
+{
+	TracedFunction *traced = Find(library, function);
+	if (traced)
+		return traced;
+
+	traced = new TracedFunction();
+	traced->library = library;
+	traced->function = function;
+	traced->address = nullptr;
+	traced->original = nullptr;
+	traced->detour = nullptr;
+	traced->totalTicks = 0;
+	traced->wanted = false;
+	traced->active = false;
+	functions_.append(traced);
+
+	return traced;
+}
+
+bool FunctionTracer::Activate(TracedFunction *traced)
+{
+	if (traced->active)
+		return true;
+
+	if (traced->detour) {
+		traced->detour->Enable();
+		traced->active = true;
+		printf("Tracing %s`%s\n", traced->library.chars(), traced->function.chars());
+		return true;
+	}
+
+	if (!traced->address) {
+		HSGameLib lib(traced->library.chars());
+		if (!lib.IsValid()) {
+			printf("Failed to load and parse %s library.\n", traced->library.chars());
+			return false;
+		}
+
+		// Symbol names never contain spaces but signatures always separate their bytes with them
+		const char *function = traced->function.chars();
+		if (strchr(function, ' ') == nullptr) {
+			traced->address = lib.ResolveHiddenSymbol<void *>(function);
+		} else {
+			SrcDS::Signature::Byte pattern[256];
+			size_t len = SrcDS::Signature::Parse(function, pattern, sizeof(pattern));
+			if (len == 0) {
+				printf("Invalid signature for %s: %s\n", traced->library.chars(), function);
+				return false;
+			}
+
+			traced->address = lib.FindMaskedPattern(reinterpret_cast<const char *>(pattern), len);
+		}
+
+		if (!traced->address) {
+			printf("Failed to find %s in %s\n", function, traced->library.chars());
+			return false;
+		}
+	}
+
+	// Thunks are kept after a function is untraced since a thread may still be returning through
+	// the return stub with a frame that refers to the function
+	if (traced->thunk.GetSize() == 0 &&
+	    !EmitEnterThunk(traced->thunk, &FunctionTracer::Enter, traced, &traced->original)) {
+		printf("Failed to create tracing thunk for %s\n", traced->function.chars());
+		return false;
+	}
+
+	traced->detour = api_->CreateDetour(traced->thunk.GetData(), &traced->original, traced->address);
+	if (!traced->detour) {
+		printf("Failed to create detour for %s\n", traced->function.chars());
+		return false;
+	}
+
+	traced->detour->Enable();
+	traced->active = true;
+	printf("Tracing %s`%s\n", traced->library.chars(), traced->function.chars());
+	return true;
+}
+
+// The detour is only unpatched, never destroyed: a thread may still be inside its trampoline
+// or about to jump through it, so its code is kept and reused if the function is traced again.
+void FunctionTracer::Deactivate(TracedFunction *traced)
+{
+	if (!traced->active)
+		return;
+
+	traced->detour->Disable();
+	traced->active = false;
+}
+
+void FunctionTracer::LoadConfig()
+{
+	FILE *fp = fopen(configPath_.chars(), "rt");
+	if (!fp) {
+		printf("Failed to open trace config: %s\n", configPath_.chars());
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fileno(fp), &st) == 0)
+		configTime_ = st.st_mtime;
+
+	for (size_t i = 0; i < functions_.length(); i++)
+		functions_[i]->wanted = false;
+
+	reportInterval_ = 0;
+
+	char buffer[1024];
+	char key[256];
+	char value[768];
+
+	while (fgets(buffer, sizeof(buffer), fp)) {
+		char *pBuf = buffer;
+		pBuf = strip_comments(pBuf);
+		pBuf = strtrim(pBuf);
+
+		if (*pBuf == '\0')
+			continue;
+
+		splitkv(pBuf, key, sizeof(key), value, sizeof(value));
+
+		if (strcasecmp(key, "report") == 0) {
+			reportInterval_ = atoi(value);
+			continue;
+		}
+
+		if (value[0] == '\0') {
+			printf("Missing function for library %s in trace config\n", key);
+			continue;
+		}
+
+		Add(key, value)->wanted = true;
+	}
+
+	fclose(fp);
+
+	for (size_t i = 0; i < functions_.length(); i++) {
+		TracedFunction *traced = functions_[i];
+		if (traced->wanted)
+			Activate(traced);
+		else
+			Deactivate(traced);
+	}
+}
+
+// Called by a function's thunk before it jumps to the original function. If the shadow stack is
+// full, the call is not timed and the function returns directly to its caller.
+void FunctionTracer::Enter(void *context, void **returnAddress)
+{
+	ThreadState *state = static_cast<ThreadState *>(t_TracerState);
+	if (!state) {
+		// Thread states are never freed since they are small and threads are long-lived
+		state = new ThreadState();
+		t_TracerState = state;
+	}
+
+	if (state->depth == kMaxDepth)
+		return;
+
+	Frame &frame = state->frames[state->depth++];
+	frame.returnAddress = *returnAddress;
+	frame.traced = static_cast<TracedFunction *>(context);
+	*returnAddress = GetInstance().returnStub_.GetData();
+	frame.start = mach_absolute_time();
+}
+
+// Called by the return stub after the original function returns.
+void *FunctionTracer::Leave()
+{
+	uint64_t end = mach_absolute_time();
+	ThreadState *state = static_cast<ThreadState *>(t_TracerState);
+	Frame &frame = state->frames[--state->depth];
+	TracedFunction *traced = frame.traced;
+	uint64_t ticks = end - frame.start;
+
+	traced->histogram.Record(ticks);
+	traced->totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+
+	return frame.returnAddress;
+}
@@ -0,0 +1,127 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_FUNCTIONTRACER_H_
+#define _INCLUDE_SRCDS_FUNCTIONTRACER_H_
+
+#include "IServerAPI.h"
+#include "CDetour/histogram.h"
+#include "amtl/am-string.h"
+#include "amtl/am-vector.h"
+#include <sourcehook/sh_include.h>
+#include <time.h>
+
+/**
+ * Measures the latency of arbitrary engine functions at runtime.
+ *
+ * Functions are listed in a config file given with -trace <file>, one per line as either
+ * "<library> <symbol>" or "<library> \"<signature>\"". Signatures must start at the function and
+ * don't need wildcards for branch targets, RIP-relative operands or relocated addresses, which
+ * are ignored automatically. A "report <seconds>" line prints the collected latencies
+ * periodically. The file is re-read whenever it changes while the server is running; functions
+ * that are added get traced and functions that are removed are restored.
+ *
+ * Each traced function is detoured to a generated thunk that timestamps the call, swaps the
+ * return address for a shared return stub and continues in the original function. The return
+ * stub records the elapsed time in the function's histogram. As with DetourProfiler, exceptions
+ * and longjmp can't unwind through the return stub and stack walks stop at it, so don't trace
+ * functions that throw or longjmp.
+ */
+class FunctionTracer
+{
+public:
+	static constexpr size_t kMaxDepth = 64;
+
+	static inline FunctionTracer &GetInstance() {
+		static FunctionTracer tracer;
+		return tracer;
+	}
+
+	void SetConfigFile(const char *path);
+	bool Init(IServerAPI *api, IGameLib *dedicated);
+	void Shutdown();
+
+	/* Applies config changes. Must be called from the main thread. */
+	void Poll();
+
+	bool Trace(const char *library, const char *function);
+	void Untrace(const char *library, const char *function);
+	void Report();
+
+private:
+	struct TracedFunction
+	{
+		ke::AString library;
+		ke::AString function;
+		void *address;
+		void *original;
+		IDetour *detour;
+		GenBuffer thunk;
+		LatencyHistogram histogram;
+		std::atomic<uint64_t> totalTicks;
+		bool wanted;
+		bool active;
+	};
+
+	struct Frame
+	{
+		void *returnAddress;
+		TracedFunction *traced;
+		uint64_t start;
+	};
+
+	struct ThreadState
+	{
+		size_t depth;
+		Frame frames[kMaxDepth];
+	};
+
+	FunctionTracer() : api_(nullptr), consoleInput_(nullptr), configTime_(0), lastPoll_(0),
+	                   lastReport_(0), reportInterval_(0) { }
+
+	static void Enter(void *context, void **returnAddress);
+	static void *Leave();
+
+	TracedFunction *Find(const char *library, const char *function);
+	TracedFunction *Add(const char *library, const char *function);
+	bool Activate(TracedFunction *traced);
+	void Deactivate(TracedFunction *traced);
+	void LoadConfig();
+
+	IServerAPI *api_;
+	IDetour *consoleInput_;
+	ke::AString configPath_;
+	time_t configTime_;
+	time_t lastPoll_;
+	time_t lastReport_;
+	unsigned int reportInterval_;
+	GenBuffer returnStub_;
+	ke::Vector<TracedFunction *> functions_;
+};
+
+#endif // _INCLUDE_SRCDS_FUNCTIONTRACER_H_
@@ -29,6 +29,8 @@
 #define _DARWIN_BETTER_REALPATH
 #include "GameShared.h"
 #include "HSGameLib.h"
+#include "FunctionTracer.h"
+#include "PatchFootprint.h"
 #include <stdio.h>
 #include <mach-o/dyld.h>
 #include <dlfcn.h>
@@ -46,12 +48,12 @@ static size_t g_AppBundlePathLen;
 static IDetour *steamLoadModule;
 static IDetour *addSearchPath;
 
-DETOUR_DECL_STATIC2(Sys_SteamLoadModule, void *, const char *, pModuleName, int, flags)
+static void *Sys_SteamLoadModule(const char *pModuleName, int flags)
 {
 	if (strstr(pModuleName, "steamservice"))
 		return nullptr;
 	else
-		return DETOUR_STATIC_CALL(Sys_SteamLoadModule)(pModuleName, flags);
+		return Detour<Sys_SteamLoadModule>::Original(pModuleName, flags);
 }
 
 bool BlockSteamService()
@@ -69,7 +71,7 @@ bool BlockSteamService()
 		return false;
 	}
 
-	steamLoadModule = DETOUR_CREATE_STATIC(Sys_SteamLoadModule, loadModule);
+	steamLoadModule = Detour<Sys_SteamLoadModule>::Create(g_ServerAPI, loadModule);
 
 	if (steamLoadModule) {
 		steamLoadModule->Enable();
@@ -89,31 +91,31 @@ bool BlockSteamService()
 //
 // For example, /SteamApps/common/Counter-Strike Source/Srcds.app/Contents/MacOS/cstrike
 // Should become: /SteamApps/common/Counter-Strike Source/cstrike
-DETOUR_DECL_MEMBER3(CBaseFileSystem_AddSearchPath,
-                    void, const char *, pPath, const char *, pPathID, int, addType) {
+static void CBaseFileSystem_AddSearchPath(void *fileSystem, const char *pPath, const char *pPathID,
+                                          int addType) {
 	GameShared::FixPath(pPath);
 
 	// Call original function with the modified path
-	DETOUR_MEMBER_CALL(CBaseFileSystem_AddSearchPath)(pPath, pPathID, addType);
+	Detour<CBaseFileSystem_AddSearchPath>::Original(fileSystem, pPath, pPathID, addType);
 }
 
 // Alternate version of AddSearchPath
-DETOUR_DECL_MEMBER4(CBaseFileSystem_AddSearchPathB,
-                    void, const char *, pPath, const char *, pPathID, int, addType, bool, unknown) {
+static void CBaseFileSystem_AddSearchPathB(void *fileSystem, const char *pPath, const char *pPathID,
+                                           int addType, bool unknown) {
 	GameShared::FixPath(pPath);
 
-	DETOUR_MEMBER_CALL(CBaseFileSystem_AddSearchPathB)(pPath, pPathID, addType, unknown);
+	Detour<CBaseFileSystem_AddSearchPathB>::Original(fileSystem, pPath, pPathID, addType, unknown);
 }
 
 // Detour for function in dedicated library.
 // This detour is particularly important because it sets up many of the other detours.
-DETOUR_DECL_MEMBER1(CSys_LoadModules, bool, void *, appSystemGroup) {
+static bool CSys_LoadModules(void *sys, void *appSystemGroup) {
 	g_AppSystemGroup = appSystemGroup;
 
 	if (!g_ServerFixer->PreLoadModules(appSystemGroup))
 		return false;
 
-	if (!DETOUR_MEMBER_CALL(CSys_LoadModules)(appSystemGroup))
+	if (!Detour<CSys_LoadModules>::Original(sys, appSystemGroup))
 		return false;
 
 	if (!g_ServerFixer->PostLoadModules(appSystemGroup))
@@ -166,10 +168,10 @@ DETOUR_DECL_MEMBER1(CSys_LoadModules, bool, void *, appSystemGroup) {
 
 	switch (searchProto) {
 		case AddSearchPathType::StringStringInt:
-			addSearchPath = DETOUR_CREATE_MEMBER(CBaseFileSystem_AddSearchPath, searchPathFn);
+			addSearchPath = Detour<CBaseFileSystem_AddSearchPath>::Create(g_ServerAPI, searchPathFn);
 			break;
 		case AddSearchPathType::StringStringIntBool:
-			addSearchPath = DETOUR_CREATE_MEMBER(CBaseFileSystem_AddSearchPathB, searchPathFn);
+			addSearchPath = Detour<CBaseFileSystem_AddSearchPathB>::Create(g_ServerAPI, searchPathFn);
 			break;
 	}
 
@@ -184,11 +186,17 @@ DETOUR_DECL_MEMBER1(CSys_LoadModules, bool, void *, appSystemGroup) {
 	if (!BlockSteamService())
 		return false;
 
+	if (!FunctionTracer::GetInstance().Init(g_ServerAPI, g_Dedicated))
+		return false;
+
+	// Every fixer has applied its patches by now
+	PatchFootprint::GetInstance().Report();
+
 	return true;
 }
 
 // Detour for function in tier0 library
-DETOUR_DECL_STATIC1(Plat_DebugString, void, const char *, str)
+static void Plat_DebugString(const char *str)
 {
 	// Doing nothing here prevents duplicate message from being printed in the terminal
 }
@@ -210,7 +218,7 @@ bool GameShared::Init(IServerAPI *api, IServerFixer *fixer) {
 		return false;
 	}
 
-	sysLoadModules_ = DETOUR_CREATE_MEMBER(CSys_LoadModules, sysLoad);
+	sysLoadModules_ = Detour<CSys_LoadModules>::Create(g_ServerAPI, sysLoad);
 	if (!sysLoadModules_) {
 		printf("Failed to create detour for CSys::LoadModules\n");
 		return false;
@@ -221,7 +229,7 @@ bool GameShared::Init(IServerAPI *api, IServerFixer *fixer) {
 	GameLib tier0("tier0");
 	if (tier0.IsLoaded()) {
 		auto debugStringAddr = tier0.ResolveSymbol<void *>("Plat_DebugString");
-		debugString_ = DETOUR_CREATE_STATIC(Plat_DebugString, debugStringAddr);
+		debugString_ = Detour<Plat_DebugString>::Create(g_ServerAPI, debugStringAddr);
 
 		if (debugString_)
 			debugString_->Enable();
@@ -231,6 +239,8 @@ bool GameShared::Init(IServerAPI *api, IServerFixer *fixer) {
 }
 
 void GameShared::Shutdown() {
+	FunctionTracer::GetInstance().Shutdown();
+
 	if (steamLoadModule)
 		steamLoadModule->Destroy();
 
@@ -27,11 +27,13 @@
  */
 
 #include "HSGameLib.h"
+#include "Relocations.h"
 #include <dlfcn.h>
 #include <stdio.h>
 #include <unistd.h>
 #if defined(PLATFORM_MACOSX)
 #include <mach/task.h>
+#include <mach/vm_prot.h>
 #include <mach-o/dyld_images.h>
 #include <mach-o/loader.h>
 #elif defined(PLATFORM_LINUX)
@@ -223,13 +225,13 @@ int HSGameLib::SetLibraryPath(const char *path)
 }
 
 HSGameLib::HSGameLib()
-	: GameLib(), baseAddress_(0), lastPosition_(0), valid_(false), fileHeader_(nullptr), mapSize_(0), searchSize_(0)
+	: GameLib(), baseAddress_(0), lastPosition_(0), valid_(false), fileHeader_(nullptr), mapSize_(0), searchSize_(0), codeSize_(0)
 {
 
 }
 
 HSGameLib::HSGameLib(const char *name)
-	: GameLib(name), baseAddress_(0), lastPosition_(0), valid_(false), fileHeader_(nullptr), mapSize_(0), searchSize_(0)
+	: GameLib(name), baseAddress_(0), lastPosition_(0), valid_(false), fileHeader_(nullptr), mapSize_(0), searchSize_(0), codeSize_(0)
 {
 	if (!IsLoaded())
 		return;
@@ -358,6 +360,9 @@ void HSGameLib::Initialize()
 		if (seg->cmd == MACH_LOADCMD_SEGMENT)
 		{
 			searchSize_ += seg->vmsize;
+
+			if ((seg->initprot & VM_PROT_EXECUTE) && seg->vmaddr + seg->vmsize > uint64_t(codeSize_))
+				codeSize_ = seg->vmaddr + seg->vmsize;
 		}
 
 		seg = (MachSegment *)(uintptr_t(seg) + seg->cmdsize);
@@ -371,6 +376,8 @@ void HSGameLib::Initialize()
 	stringTable_ = (const char *)(linkEditAddr + symTableHdr->stroff - linkEditHdr->fileoff);
 	symbolCount_ = symTableHdr->nsyms;
 
+	LoadRelocations();
+
 	valid_ = true;
 #elif defined(PLATFORM_LINUX)
 #if defined(PLATFORM_X64)
@@ -445,7 +452,7 @@ void HSGameLib::Initialize()
 	/* Iterate sections while looking for ELF symbol table and string table */
 	for (uint16_t i = 0; i < section_count; i++)
 	{
-		ElfSHeader &hdr = sections[1];
+		ElfSHeader &hdr = sections[i];
 		const char *section_name = shstrtab + hdr.sh_name;
 
 		if (strcmp(section_name, ".symtab") == 0)
@@ -467,6 +474,9 @@ void HSGameLib::Initialize()
 
 		if (hdr.p_type == PT_LOAD && hdr.p_flags == (PF_X|PF_R))
 			searchSize_ += PAGE_ALIGN_UP(hdr.p_filesz);
+
+		if (hdr.p_type == PT_LOAD && (hdr.p_flags & PF_X) && hdr.p_vaddr + hdr.p_memsz > uint64_t(codeSize_))
+			codeSize_ = hdr.p_vaddr + hdr.p_memsz;
 	}
 
 	/* Uh oh, we don't have a symbol table or a string table */
@@ -482,6 +492,8 @@ void HSGameLib::Initialize()
 	stringTable_ = (const char *)(map_base + strtab_hdr->sh_offset);
 	symbolCount_ = symtab_hdr->sh_size / symtab_hdr->sh_entsize;
 
+	LoadRelocations();
+
 	valid_ = true;
 #else
 #error "Unsupported platform."
@@ -500,6 +512,9 @@ void HSGameLib::Invalidate()
 
 	fileHeader_ = nullptr;
 	mapSize_ = 0;
+	searchSize_ = 0;
+	codeSize_ = 0;
+	relocs_.clear();
 
 	valid_ = false;
 }
@@ -507,8 +522,10 @@ void HSGameLib::Invalidate()
 #if defined(PLATFORM_LINUX)
 int HSGameLib::baseaddr_callback(struct dl_phdr_info *info, size_t size, void *data)
 {
-	void *handle = dlopen(info->dlpi_name, RTLD_NOLOAD);
+	void *handle = dlopen(info->dlpi_name, RTLD_NOLOAD | RTLD_LAZY);
 	HSGameLib *lib = (HSGameLib *)data;
+	if (!handle)
+		return 0;
 	if (handle == lib->handle_)
 		lib->baseAddress_ = info->dlpi_addr;
 	dlclose(handle);
@@ -636,53 +653,191 @@ void *HSGameLib::GetHiddenSymbolAddr(const char *symbol)
 
 void *HSGameLib::FindPattern(const char *pattern, size_t len)
 {
-	// Algorithm based on Boyer-Moore-Horspool string search with addition of wildcard handling
-	// See: https://en.wikipedia.org/wiki/Boyer%E2%80%93Moore%E2%80%93Horspool_algorithm
-
-	const char wildcard = '\x2A';
-	size_t bad_shift[UCHAR_MAX + 1];
-	size_t last = len - 1;
-	size_t idx = 0;
-	size_t searchLen = searchSize_;
-	char *ptr = reinterpret_cast<char *>(baseAddress_);
-
-	// First locate the first rightmost wildcard
-	// Loop over pattern until first wildcard is found or we reach the end
-	while (idx < last && pattern[idx] != wildcard)
-		idx++;
-	// Loop over pattern wildcards until non-wildcard is reached
-	while (idx < last && pattern[idx] == wildcard)
-		idx++;
-
-	if (idx == last)
-		idx = -1;  // wildcard not found in pattern
-	else
-		idx--;	 // wildcard found in pattern, adjust index
-
-	// Initialize bad character shift table, accounting for wildcards in the pattern
-	for (size_t i = 0; i <= UCHAR_MAX; i++)
-		bad_shift[i] = last - idx;
-
-	// Set values in bad character shift table for characters in pattern
-	for (size_t i = 0; i < last; i++)
-		bad_shift[(unsigned char)pattern[i]] = last - i;
-
-	// Search memory for the pattern
-	while (searchLen >= len)
+	return SigScanner::GetInstance().Find(reinterpret_cast<void *>(baseAddress_), searchSize_, pattern, len);
+}
+
+void *HSGameLib::FindMaskedPattern(const char *pattern, size_t len)
+{
+	ke::Vector<char> masked;
+	if (!masked.resize(len))
+		return nullptr;
+	memcpy(masked.buffer(), pattern, len);
+	if (!SigScanner::MaskOperands(masked.buffer(), len))
+		return nullptr;
+
+	return SigScanner::GetInstance().Find(reinterpret_cast<void *>(baseAddress_), codeSize_, masked.buffer(), len,
+	                                      relocs_.buffer(), relocs_.length());
+}
+
+const char *HSGameLib::GetCode() const
+{
+	return reinterpret_cast<const char *>(baseAddress_);
+}
+
+size_t HSGameLib::GetCodeSize() const
+{
+	return codeSize_;
+}
+
+const ke::Vector<SigScanner::Span> &HSGameLib::GetRelocations() const
+{
+	return relocs_;
+}
+
+// A signature that stops matching after a game update is usually only a byte or two off. The
+// closest matches are printed so that it can be fixed quickly, and with -sigrecover a unique match
+// with a single mismatch is used in the meantime.
+void *HSGameLib::FindPatternApproximate(const char *pattern, size_t len)
+{
+	const size_t kShown = 4;
+	SigScanner::ApproximateMatch matches[kShown];
+
+	// Short signatures match too many places with bytes missing to say anything useful
+	if (!baseAddress_ || len < 8)
+		return nullptr;
+
+	size_t maxMismatches = len >= 16 ? 2 : 1;
+	size_t count = SigScanner::FindApproximate(reinterpret_cast<void *>(baseAddress_), searchSize_, pattern, len,
+	                                           maxMismatches, matches, kShown);
+	if (count == 0)
+		return nullptr;
+
+	printf("Signature of %zu bytes not found in %s, %zu close match%s:\n", len, GetName().chars(), count,
+	       count == 1 ? "" : "es");
+
+	for (size_t i = 0; i < count && i < kShown; i++)
+	{
+		const SigScanner::ApproximateMatch &match = matches[i];
+		printf("  %s+0x%lx:", GetName().chars(), (unsigned long)(uintptr_t(match.address) - baseAddress_));
+
+		for (size_t j = 0; j < match.mismatches; j++)
+		{
+			uint32_t pos = match.positions[j];
+			printf("%s byte %u is %02X not %02X", j ? "," : "", pos, (unsigned char)match.address[pos],
+			       (unsigned char)pattern[pos]);
+		}
+		printf("\n");
+	}
+
+	bool unique = matches[0].mismatches <= 1 && (count == 1 || matches[1].mismatches > 1);
+	if (!unique || !SigScanner::GetInstance().IsRecoveryEnabled())
+		return nullptr;
+
+	printf("********************************************************************************\n");
+	printf("WARNING: Using %s+0x%lx for a signature that no longer matches exactly.\n", GetName().chars(),
+	       (unsigned long)(uintptr_t(matches[0].address) - baseAddress_));
+	printf("         The signature needs to be updated for this version of the game.\n");
+	printf("********************************************************************************\n");
+
+	return const_cast<char *>(matches[0].address);
+}
+
+void HSGameLib::AddRelocation(uint64_t offset, uint32_t size)
+{
+	// Only code is searched by FindMaskedPattern, so relocated data doesn't need to be tracked
+	if (offset + size > uint64_t(codeSize_))
+		return;
+
+	SigScanner::Span span;
+	span.start = uint32_t(offset);
+	span.end = uint32_t(offset + size);
+	relocs_.append(span);
+}
+
+void HSGameLib::LoadRelocations()
+{
+	relocs_.clear();
+
+#if defined(PLATFORM_MACOSX)
+#if defined(PLATFORM_X64)
+	using MachHeader = struct mach_header_64;
+	using MachSegment = struct segment_command_64;
+	const uint32_t MACH_LOADCMD_SEGMENT = LC_SEGMENT_64;
+#else
+	using MachHeader = struct mach_header;
+	using MachSegment = struct segment_command;
+	const uint32_t MACH_LOADCMD_SEGMENT = LC_SEGMENT;
+#endif
+	using MachLoadCmd = struct load_command;
+	using MachDyldInfo = struct dyld_info_command;
+
+	MachHeader *fileHdr = (MachHeader *)baseAddress_;
+	MachLoadCmd *loadCmds = (MachLoadCmd *)(baseAddress_ + sizeof(MachHeader));
+	MachSegment *linkEditHdr = nullptr;
+	MachDyldInfo *dyldInfo = nullptr;
+	ke::Vector<uint64_t> segments;
+
+	// Rebase and bind opcodes refer to segments by their load command index
+	for (uint32_t i = 0; i < fileHdr->ncmds; i++)
 	{
-		// Search going backwards from last character
-		size_t i;
-		for (i = last; pattern[i] == wildcard || ptr[i] == pattern[i]; i--)
+		if (loadCmds->cmd == MACH_LOADCMD_SEGMENT)
 		{
-			if (i == 0)
-				return ptr;
+			MachSegment *seg = (MachSegment *)loadCmds;
+			segments.append(seg->vmaddr);
+
+			if (strcmp(seg->segname, "__LINKEDIT") == 0)
+				linkEditHdr = seg;
 		}
+		else if (loadCmds->cmd == LC_DYLD_INFO || loadCmds->cmd == LC_DYLD_INFO_ONLY)
+		{
+			dyldInfo = (MachDyldInfo *)loadCmds;
+		}
+
+		loadCmds = (MachLoadCmd *)(uintptr_t(loadCmds) + loadCmds->cmdsize);
+	}
 
-		// Skip ahead based on bad character shift table
-		unsigned char lastChar = ptr[i];
-		searchLen -= bad_shift[lastChar];
-		ptr += bad_shift[lastChar];
+	// Libraries that use chained fixups instead only relocate pointers in data
+	if (!linkEditHdr || !dyldInfo)
+		return;
+
+	const uint8_t *linkEdit = (const uint8_t *)(baseAddress_ + linkEditHdr->vmaddr - linkEditHdr->fileoff);
+
+	// Dylibs are linked at 0, so addresses are already offsets from baseAddress_
+	ReadDyldInfoRelocations(linkEdit + dyldInfo->rebase_off, dyldInfo->rebase_size, linkEdit + dyldInfo->bind_off,
+	                        dyldInfo->bind_size, segments, sizeof(void *), 0, codeSize_, &relocs_);
+#elif defined(PLATFORM_LINUX)
+#if defined(PLATFORM_X64)
+	using ElfHeader = Elf64_Ehdr;
+	using ElfSHeader = Elf64_Shdr;
+	using ElfRel = Elf64_Rel;
+	using ElfRela = Elf64_Rela;
+	#define ELF_R_TYPE ELF64_R_TYPE
+#else
+	using ElfHeader = Elf32_Ehdr;
+	using ElfSHeader = Elf32_Shdr;
+	using ElfRel = Elf32_Rel;
+	using ElfRela = Elf32_Rela;
+	#define ELF_R_TYPE ELF32_R_TYPE
+#endif
+
+	uintptr_t map_base = (uintptr_t)fileHeader_;
+	ElfHeader *file_hdr = (ElfHeader *)fileHeader_;
+	ElfSHeader *sections = (ElfSHeader *)(map_base + file_hdr->e_shoff);
+
+	/* .rel.dyn and .rela.dyn, plus the PLT relocations, which never point into code */
+	for (uint16_t i = 0; i < file_hdr->e_shnum; i++)
+	{
+		ElfSHeader &hdr = sections[i];
+
+		if (hdr.sh_type != SHT_REL && hdr.sh_type != SHT_RELA)
+			continue;
+
+		size_t entsize = hdr.sh_entsize ? hdr.sh_entsize : (hdr.sh_type == SHT_REL ? sizeof(ElfRel) : sizeof(ElfRela));
+		size_t count = hdr.sh_size / entsize;
+
+		for (size_t j = 0; j < count; j++)
+		{
+			ElfRel *rel = (ElfRel *)(map_base + hdr.sh_offset + j * entsize);
+			uint32_t size = sizeof(void *);
+#if defined(PLATFORM_X64)
+			uint32_t type = ELF_R_TYPE(rel->r_info);
+			if (type == R_X86_64_32 || type == R_X86_64_32S || type == R_X86_64_PC32)
+				size = 4;
+#endif
+			AddRelocation(rel->r_offset, size);
+		}
 	}
+#endif
 
-	return nullptr;
+	MergeRelocations(&relocs_);
 }
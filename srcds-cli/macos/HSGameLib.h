@@ -32,7 +32,9 @@
 #include "IGameLib.h"
 #include "GameLib.h"
 #include "sm_symtable.h"
+#include "SigScanner.h"
 #include "amtl/am-string.h"
+#include "amtl/am-vector.h"
 #include <sys/types.h>
 
 #if defined(PLATFORM_LINUX)
@@ -72,6 +74,13 @@ public:
 	size_t ResolveHiddenSymbols(SymbolInfo *list, const char **names);
 
 	void *FindPattern(const char *pattern, size_t len);
+	void *FindMaskedPattern(const char *pattern, size_t len);
+	void *FindPatternApproximate(const char *pattern, size_t len);
+
+	// The code searched by FindMaskedPattern and the spans in it that the loader relocated
+	const char *GetCode() const;
+	size_t GetCodeSize() const;
+	const ke::Vector<SigScanner::Span> &GetRelocations() const;
 
 	static int SetLibraryPath(const char *path);
 public:
@@ -84,6 +93,8 @@ private:
 	void Invalidate();
 	uintptr_t GetBaseAddress();
 	void *GetHiddenSymbolAddr(const char *symbol);
+	void LoadRelocations();
+	void AddRelocation(uint64_t offset, uint32_t size);
 #if defined(PLATFORM_LINUX)
 	static int baseaddr_callback(struct dl_phdr_info *info, size_t size, void *data);
 	friend int baseaddr_callback(struct dl_phdr_info *info, size_t size, void *data);
@@ -99,6 +110,8 @@ private:
 	void *fileHeader_;
 	off_t mapSize_;
 	off_t searchSize_;
+	off_t codeSize_;
+	ke::Vector<SigScanner::Span> relocs_;	// relocated bytes in code, sorted and merged
 };
 
 #endif // _INCLUDE_SRCDS_HSGAMELIB_H_
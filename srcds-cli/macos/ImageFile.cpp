@@ -0,0 +1,794 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "ImageFile.h"
+#include "Relocations.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The on-disk layouts are declared here rather than taken from <elf.h> and <mach-o/loader.h>,
+// since each platform only has the headers for its own format. Only little endian x86 images
+// are read, apart from the big endian header of universal binaries.
+namespace {
+
+struct Elf32Traits
+{
+	struct Ehdr { uint8_t ident[16]; uint16_t type, machine; uint32_t version, entry, phoff, shoff, flags;
+	              uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx; };
+	struct Phdr { uint32_t type, offset, vaddr, paddr, filesz, memsz, flags, align; };
+	struct Shdr { uint32_t name, type, flags, addr, offset, size, link, info, addralign, entsize; };
+	struct Sym { uint32_t name, value, size; uint8_t info, other; uint16_t shndx; };
+	struct Rel { uint32_t offset, info; };
+	struct Rela { uint32_t offset, info; int32_t addend; };
+
+	static const bool k64Bit = false;
+	static uint32_t RelType(uint32_t info) { return info & 0xFF; }
+};
+
+struct Elf64Traits
+{
+	struct Ehdr { uint8_t ident[16]; uint16_t type, machine; uint32_t version; uint64_t entry, phoff, shoff;
+	              uint32_t flags; uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx; };
+	struct Phdr { uint32_t type, flags; uint64_t offset, vaddr, paddr, filesz, memsz, align; };
+	struct Shdr { uint32_t name, type; uint64_t flags, addr, offset, size; uint32_t link, info;
+	              uint64_t addralign, entsize; };
+	struct Sym { uint32_t name; uint8_t info, other; uint16_t shndx; uint64_t value, size; };
+	struct Rel { uint64_t offset, info; };
+	struct Rela { uint64_t offset, info; int64_t addend; };
+
+	static const bool k64Bit = true;
+	static uint32_t RelType(uint64_t info) { return uint32_t(info); }
+};
+
+const uint32_t ELF_PT_LOAD = 1;
+const uint32_t ELF_PF_X = 1, ELF_PF_W = 2, ELF_PF_R = 4;
+const uint32_t ELF_SHT_SYMTAB = 2, ELF_SHT_RELA = 4, ELF_SHT_REL = 9, ELF_SHT_DYNSYM = 11;
+const uint64_t ELF_SHF_WRITE = 1, ELF_SHF_ALLOC = 2, ELF_SHF_EXECINSTR = 4;
+const uint8_t ELF_STT_OBJECT = 1, ELF_STT_FUNC = 2;
+const uint32_t ELF_R_X86_64_PC32 = 2, ELF_R_X86_64_32 = 10, ELF_R_X86_64_32S = 11;
+
+struct MachO32Traits
+{
+	struct Header { uint32_t magic; int32_t cputype, cpusubtype; uint32_t filetype, ncmds, sizeofcmds, flags; };
+	struct Segment { uint32_t cmd, cmdsize; char segname[16]; uint32_t vmaddr, vmsize, fileoff, filesize;
+	                 int32_t maxprot, initprot; uint32_t nsects, flags; };
+	struct Section { char sectname[16], segname[16]; uint32_t addr, size, offset, align, reloff, nreloc, flags,
+	                 reserved1, reserved2; };
+	struct Nlist { uint32_t strx; uint8_t type, sect; int16_t desc; uint32_t value; };
+
+	static const bool k64Bit = false;
+	static const uint32_t kMagic = 0xFEEDFACE;
+	static const uint32_t kSegmentCmd = 0x1;
+};
+
+struct MachO64Traits
+{
+	struct Header { uint32_t magic; int32_t cputype, cpusubtype; uint32_t filetype, ncmds, sizeofcmds, flags,
+	                reserved; };
+	struct Segment { uint32_t cmd, cmdsize; char segname[16]; uint64_t vmaddr, vmsize, fileoff, filesize;
+	                 int32_t maxprot, initprot; uint32_t nsects, flags; };
+	struct Section { char sectname[16], segname[16]; uint64_t addr, size; uint32_t offset, align, reloff, nreloc,
+	                 flags, reserved1, reserved2, reserved3; };
+	struct Nlist { uint32_t strx; uint8_t type, sect; int16_t desc; uint64_t value; };
+
+	static const bool k64Bit = true;
+	static const uint32_t kMagic = 0xFEEDFACF;
+	static const uint32_t kSegmentCmd = 0x19;
+};
+
+struct MachLoadCmd { uint32_t cmd, cmdsize; };
+struct MachSymtab { uint32_t cmd, cmdsize, symoff, nsyms, stroff, strsize; };
+struct MachDyldInfo { uint32_t cmd, cmdsize, rebase_off, rebase_size, bind_off, bind_size, weak_bind_off,
+                      weak_bind_size, lazy_bind_off, lazy_bind_size, export_off, export_size; };
+struct FatHeader { uint32_t magic, nfat_arch; };
+struct FatArch { int32_t cputype, cpusubtype; uint32_t offset, size, align; };
+struct FatArch64 { int32_t cputype, cpusubtype; uint64_t offset, size; uint32_t align, reserved; };
+
+const uint32_t MACH_FAT_MAGIC = 0xCAFEBABE, MACH_FAT_MAGIC_64 = 0xCAFEBABF;
+const int32_t MACH_CPU_TYPE_X86 = 7, MACH_CPU_TYPE_X86_64 = 0x01000007;
+const uint32_t MACH_LC_SYMTAB = 0x2, MACH_LC_DYLD_INFO = 0x22, MACH_LC_DYLD_INFO_ONLY = 0x80000022;
+const int32_t MACH_VM_PROT_READ = 1, MACH_VM_PROT_WRITE = 2, MACH_VM_PROT_EXECUTE = 4;
+const uint8_t MACH_N_STAB = 0xE0, MACH_NO_SECT = 0;
+
+} // namespace
+
+static inline uint32_t SwapBE32(uint32_t value)
+{
+	return __builtin_bswap32(value);
+}
+
+static inline uint64_t SwapBE64(uint64_t value)
+{
+	return __builtin_bswap64(value);
+}
+
+// Whether [offset, offset + size) lies within a file of fileSize bytes
+static inline bool InFile(uint64_t offset, uint64_t size, size_t fileSize)
+{
+	return offset <= fileSize && size <= fileSize - offset;
+}
+
+ImageFile::ImageFile()
+	: valid_(false), is64Bit_(false), machO_(false), file_(nullptr), fileSize_(0), image_(nullptr), imageSize_(0),
+	  base_(0), codeSize_(0), stringTable_(nullptr), stringTableSize_(0), lastPosition_(0)
+{
+
+}
+
+ImageFile::ImageFile(const char *path)
+	: ImageFile()
+{
+	Open(path);
+}
+
+ImageFile::~ImageFile()
+{
+	Close();
+}
+
+bool ImageFile::Open(const char *path)
+{
+	struct stat st;
+
+	Close();
+	path_ = ke::AString(path);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < 64)
+	{
+		if (fd != -1)
+			close(fd);
+		printf("Failed to open %s\n", path);
+		return false;
+	}
+
+	void *file = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (file == MAP_FAILED)
+	{
+		printf("Failed to map %s\n", path);
+		return false;
+	}
+
+	file_ = (uint8_t *)file;
+	fileSize_ = st.st_size;
+
+	if (!table_.Initialize())
+	{
+		Close();
+		return false;
+	}
+
+	bool loaded;
+	if (memcmp(file_, "\x7F" "ELF", 4) == 0)
+		loaded = LoadElf(file_, fileSize_);
+	else
+		loaded = LoadMachO(file_, fileSize_);
+
+	if (!loaded)
+	{
+		printf("Failed to read %s as an x86 ELF or Mach-O library\n", path);
+		Close();
+		return false;
+	}
+
+	FinishRelocations();
+
+	valid_ = true;
+	return true;
+}
+
+bool ImageFile::IsValid() const
+{
+	return valid_;
+}
+
+void ImageFile::Close()
+{
+	table_.Destroy();
+
+	if (image_)
+		munmap(image_, imageSize_);
+	if (file_)
+		munmap(file_, fileSize_);
+
+	valid_ = false;
+	file_ = nullptr;
+	fileSize_ = 0;
+	image_ = nullptr;
+	imageSize_ = 0;
+	base_ = 0;
+	codeSize_ = 0;
+	layout_.clear();
+	segments_.clear();
+	sections_.clear();
+	symbols_.clear();
+	stringTable_ = nullptr;
+	stringTableSize_ = 0;
+	lastPosition_ = 0;
+	relocs_.clear();
+}
+
+const char *ImageFile::GetPath() const
+{
+	return path_.chars();
+}
+
+bool ImageFile::Is64Bit() const
+{
+	return is64Bit_;
+}
+
+bool ImageFile::LoadElf(const uint8_t *file, size_t size)
+{
+	// EI_CLASS, EI_DATA and e_machine, which sit at the same offsets in both classes
+	const Elf32Traits::Ehdr *hdr = (const Elf32Traits::Ehdr *)file;
+	if (hdr->ident[5] != 1)
+		return false;
+
+	if (hdr->ident[4] == 1 && hdr->machine == 3)
+		return ParseElf<Elf32Traits>(file, size);
+	if (hdr->ident[4] == 2 && hdr->machine == 62)
+		return ParseElf<Elf64Traits>(file, size);
+
+	return false;
+}
+
+template <typename Traits>
+bool ImageFile::ParseElf(const uint8_t *file, size_t size)
+{
+	using Ehdr = typename Traits::Ehdr;
+	using Phdr = typename Traits::Phdr;
+	using Shdr = typename Traits::Shdr;
+	using Sym = typename Traits::Sym;
+	using Rel = typename Traits::Rel;
+	using Rela = typename Traits::Rela;
+
+	const Ehdr *hdr = (const Ehdr *)file;
+	is64Bit_ = Traits::k64Bit;
+	machO_ = false;
+
+	if (!InFile(hdr->phoff, uint64_t(hdr->phnum) * sizeof(Phdr), size) ||
+	    !InFile(hdr->shoff, uint64_t(hdr->shnum) * sizeof(Shdr), size) || hdr->shstrndx >= hdr->shnum)
+	{
+		return false;
+	}
+
+	const Phdr *phdr = (const Phdr *)(file + hdr->phoff);
+	const Shdr *sections = (const Shdr *)(file + hdr->shoff);
+
+	for (uint16_t i = 0; i < hdr->phnum; i++)
+	{
+		const Phdr &seg = phdr[i];
+		if (seg.type != ELF_PT_LOAD)
+			continue;
+
+		Segment entry;
+		entry.address = seg.vaddr;
+		entry.memSize = seg.memsz;
+		entry.fileOffset = seg.offset;
+		entry.fileSize = seg.filesz;
+		layout_.append(entry);
+
+		Region region;
+		region.address = nullptr;
+		region.size = seg.memsz;
+		region.prot = ((seg.flags & ELF_PF_R) ? Prot_Read : 0) | ((seg.flags & ELF_PF_W) ? Prot_Write : 0) |
+		              ((seg.flags & ELF_PF_X) ? Prot_Execute : 0);
+		segments_.append(region);
+	}
+
+	// Like the loader, the image starts at the page holding the first segment
+	if (layout_.empty())
+		return false;
+	base_ = layout_[0].address & ~uint64_t(0xFFF);
+
+	if (!MapImage(0))
+		return false;
+
+	for (size_t i = 0; i < segments_.length(); i++)
+	{
+		segments_[i].address = image_ + (layout_[i].address - base_);
+		if (segments_[i].prot & Prot_Execute)
+			codeSize_ = std::max(codeSize_, size_t(layout_[i].address + layout_[i].memSize - base_));
+	}
+
+	const Shdr &shstrtabHdr = sections[hdr->shstrndx];
+	const char *shstrtab = (const char *)(file + shstrtabHdr.offset);
+	if (!InFile(shstrtabHdr.offset, shstrtabHdr.size, size))
+		return false;
+
+	const Shdr *symtabHdr = nullptr;
+
+	for (uint16_t i = 0; i < hdr->shnum; i++)
+	{
+		const Shdr &sec = sections[i];
+
+		if (sec.type == ELF_SHT_SYMTAB || (sec.type == ELF_SHT_DYNSYM && !symtabHdr))
+			symtabHdr = &sec;
+
+		if ((sec.flags & ELF_SHF_ALLOC) && sec.addr >= base_ && sec.addr - base_ + sec.size <= imageSize_)
+		{
+			Region region;
+			region.name = ke::AString(sec.name < shstrtabHdr.size ? shstrtab + sec.name : "");
+			region.address = image_ + (sec.addr - base_);
+			region.size = sec.size;
+			region.prot = Prot_Read | ((sec.flags & ELF_SHF_WRITE) ? Prot_Write : 0) |
+			              ((sec.flags & ELF_SHF_EXECINSTR) ? Prot_Execute : 0);
+			sections_.append(region);
+		}
+
+		// .rel.dyn and .rela.dyn, plus the PLT relocations, which never point into code
+		if ((sec.type == ELF_SHT_REL || sec.type == ELF_SHT_RELA) && InFile(sec.offset, sec.size, size))
+		{
+			size_t entsize = sec.entsize ? sec.entsize : (sec.type == ELF_SHT_REL ? sizeof(Rel) : sizeof(Rela));
+			size_t count = sec.size / entsize;
+
+			for (size_t j = 0; j < count; j++)
+			{
+				const Rel *rel = (const Rel *)(file + sec.offset + j * entsize);
+				uint32_t relSize = Traits::k64Bit ? 8 : 4;
+				if (Traits::k64Bit)
+				{
+					uint32_t type = Traits::RelType(rel->info);
+					if (type == ELF_R_X86_64_32 || type == ELF_R_X86_64_32S || type == ELF_R_X86_64_PC32)
+						relSize = 4;
+				}
+				AddRelocation(rel->offset, relSize);
+			}
+		}
+	}
+
+	// Stripped libraries still have their exported symbols in .dynsym
+	if (!symtabHdr || symtabHdr->link >= hdr->shnum)
+		return false;
+
+	const Shdr &strtabHdr = sections[symtabHdr->link];
+	if (!InFile(symtabHdr->offset, symtabHdr->size, size) || !InFile(strtabHdr.offset, strtabHdr.size, size))
+		return false;
+
+	stringTable_ = (const char *)(file + strtabHdr.offset);
+	stringTableSize_ = strtabHdr.size;
+
+	const Sym *syms = (const Sym *)(file + symtabHdr->offset);
+	size_t count = symtabHdr->size / (symtabHdr->entsize ? symtabHdr->entsize : sizeof(Sym));
+
+	for (size_t i = 0; i < count; i++)
+	{
+		const Sym &sym = syms[i];
+		uint8_t type = sym.info & 0xF;
+
+		// Skip symbols that are undefined or do not refer to functions or objects
+		if (sym.shndx == 0 || (type != ELF_STT_FUNC && type != ELF_STT_OBJECT))
+			continue;
+
+		RawSymbol entry;
+		entry.name = sym.name;
+		entry.address = sym.value;
+		symbols_.append(entry);
+	}
+
+	return true;
+}
+
+bool ImageFile::LoadMachO(const uint8_t *file, size_t size)
+{
+	uint32_t magic = *(const uint32_t *)file;
+	uint64_t offset = 0, sliceSize = size;
+
+	// Universal binaries: use the slice for the architecture this process runs as
+	if (SwapBE32(magic) == MACH_FAT_MAGIC || SwapBE32(magic) == MACH_FAT_MAGIC_64)
+	{
+		bool fat64 = SwapBE32(magic) == MACH_FAT_MAGIC_64;
+		uint32_t count = SwapBE32(((const FatHeader *)file)->nfat_arch);
+#if defined(PLATFORM_X64)
+		const int32_t cputype = MACH_CPU_TYPE_X86_64;
+#else
+		const int32_t cputype = MACH_CPU_TYPE_X86;
+#endif
+		bool found = false;
+
+		if (!InFile(sizeof(FatHeader), uint64_t(count) * (fat64 ? sizeof(FatArch64) : sizeof(FatArch)), size))
+			return false;
+
+		for (uint32_t i = 0; i < count && !found; i++)
+		{
+			if (fat64)
+			{
+				const FatArch64 &arch = ((const FatArch64 *)(file + sizeof(FatHeader)))[i];
+				found = int32_t(SwapBE32(arch.cputype)) == cputype;
+				offset = SwapBE64(arch.offset);
+				sliceSize = SwapBE64(arch.size);
+			}
+			else
+			{
+				const FatArch &arch = ((const FatArch *)(file + sizeof(FatHeader)))[i];
+				found = int32_t(SwapBE32(arch.cputype)) == cputype;
+				offset = SwapBE32(arch.offset);
+				sliceSize = SwapBE32(arch.size);
+			}
+		}
+
+		if (!found || !InFile(offset, sliceSize, size) || sliceSize < sizeof(MachO64Traits::Header))
+			return false;
+
+		magic = *(const uint32_t *)(file + offset);
+	}
+
+	if (magic == MachO32Traits::kMagic && ((const MachO32Traits::Header *)(file + offset))->cputype == MACH_CPU_TYPE_X86)
+		return ParseMachO<MachO32Traits>(file + offset, sliceSize);
+	if (magic == MachO64Traits::kMagic && ((const MachO64Traits::Header *)(file + offset))->cputype == MACH_CPU_TYPE_X86_64)
+		return ParseMachO<MachO64Traits>(file + offset, sliceSize);
+
+	return false;
+}
+
+template <typename Traits>
+bool ImageFile::ParseMachO(const uint8_t *file, size_t size)
+{
+	using Header = typename Traits::Header;
+	using MachSegment = typename Traits::Segment;
+	using MachSection = typename Traits::Section;
+	using Nlist = typename Traits::Nlist;
+
+	const Header *hdr = (const Header *)file;
+	const MachSymtab *symtab = nullptr;
+	const MachDyldInfo *dyldInfo = nullptr;
+	ke::Vector<const MachSegment *> commands;
+	ke::Vector<uint64_t> segmentAddrs;
+
+	is64Bit_ = Traits::k64Bit;
+	machO_ = true;
+
+	if (!InFile(sizeof(Header), hdr->sizeofcmds, size))
+		return false;
+
+	const uint8_t *cmd = file + sizeof(Header);
+	const uint8_t *cmdsEnd = cmd + hdr->sizeofcmds;
+
+	for (uint32_t i = 0; i < hdr->ncmds; i++)
+	{
+		const MachLoadCmd *loadCmd = (const MachLoadCmd *)cmd;
+		if (cmd + sizeof(MachLoadCmd) > cmdsEnd || loadCmd->cmdsize < sizeof(MachLoadCmd) ||
+		    cmd + loadCmd->cmdsize > cmdsEnd)
+		{
+			return false;
+		}
+
+		if (loadCmd->cmd == Traits::kSegmentCmd)
+		{
+			const MachSegment *seg = (const MachSegment *)cmd;
+
+			// Rebase and bind opcodes refer to segments by their load command index
+			segmentAddrs.append(seg->vmaddr);
+
+			// __PAGEZERO only reserves address space
+			if (seg->initprot != 0 && seg->vmsize != 0)
+				commands.append(seg);
+		}
+		else if (loadCmd->cmd == MACH_LC_SYMTAB)
+		{
+			symtab = (const MachSymtab *)cmd;
+		}
+		else if (loadCmd->cmd == MACH_LC_DYLD_INFO || loadCmd->cmd == MACH_LC_DYLD_INFO_ONLY)
+		{
+			dyldInfo = (const MachDyldInfo *)cmd;
+		}
+
+		cmd += loadCmd->cmdsize;
+	}
+
+	if (commands.empty())
+		return false;
+
+	base_ = commands[0]->vmaddr;
+	for (size_t i = 0; i < commands.length(); i++)
+	{
+		const MachSegment *seg = commands[i];
+		base_ = std::min(base_, uint64_t(seg->vmaddr));
+
+		Segment entry;
+		entry.address = seg->vmaddr;
+		entry.memSize = seg->vmsize;
+		entry.fileOffset = seg->fileoff;
+		entry.fileSize = seg->filesize;
+		layout_.append(entry);
+	}
+
+	if (!MapImage(file - file_))
+		return false;
+
+	for (size_t i = 0; i < commands.length(); i++)
+	{
+		const MachSegment *seg = commands[i];
+		char segname[17] = {};
+		memcpy(segname, seg->segname, 16);
+
+		int prot = ((seg->initprot & MACH_VM_PROT_READ) ? Prot_Read : 0) |
+		           ((seg->initprot & MACH_VM_PROT_WRITE) ? Prot_Write : 0) |
+		           ((seg->initprot & MACH_VM_PROT_EXECUTE) ? Prot_Execute : 0);
+
+		Region region;
+		region.name = ke::AString(segname);
+		region.address = image_ + (seg->vmaddr - base_);
+		region.size = seg->vmsize;
+		region.prot = prot;
+		segments_.append(region);
+
+		if (prot & Prot_Execute)
+			codeSize_ = std::max(codeSize_, size_t(seg->vmaddr + seg->vmsize - base_));
+
+		if (seg->cmdsize < sizeof(MachSegment) + uint64_t(seg->nsects) * sizeof(MachSection))
+			continue;
+
+		const MachSection *sects = (const MachSection *)(seg + 1);
+		for (uint32_t j = 0; j < seg->nsects; j++)
+		{
+			const MachSection &sect = sects[j];
+			char name[34] = {};
+			memcpy(name, segname, strlen(segname));
+			strcat(name, ",");
+			strncat(name, sect.sectname, 16);
+
+			if (sect.addr < base_ || sect.addr - base_ + sect.size > imageSize_)
+				continue;
+
+			Region section;
+			section.name = ke::AString(name);
+			section.address = image_ + (sect.addr - base_);
+			section.size = sect.size;
+			section.prot = prot;
+			sections_.append(section);
+		}
+	}
+
+	if (dyldInfo)
+	{
+		const uint8_t *rebase = file + dyldInfo->rebase_off;
+		const uint8_t *bind = file + dyldInfo->bind_off;
+		size_t rebaseSize = InFile(dyldInfo->rebase_off, dyldInfo->rebase_size, size) ? dyldInfo->rebase_size : 0;
+		size_t bindSize = InFile(dyldInfo->bind_off, dyldInfo->bind_size, size) ? dyldInfo->bind_size : 0;
+
+		if (!ReadDyldInfoRelocations(rebase, rebaseSize, bind, bindSize, segmentAddrs, Traits::k64Bit ? 8 : 4, base_,
+		                             codeSize_, &relocs_))
+		{
+			return false;
+		}
+	}
+
+	if (!symtab || !InFile(symtab->symoff, uint64_t(symtab->nsyms) * sizeof(Nlist), size) ||
+	    !InFile(symtab->stroff, symtab->strsize, size))
+	{
+		return false;
+	}
+
+	stringTable_ = (const char *)(file + symtab->stroff);
+	stringTableSize_ = symtab->strsize;
+
+	const Nlist *syms = (const Nlist *)(file + symtab->symoff);
+	for (uint32_t i = 0; i < symtab->nsyms; i++)
+	{
+		const Nlist &sym = syms[i];
+
+		// Skip undefined symbols and debugging entries
+		if (sym.sect == MACH_NO_SECT || (sym.type & MACH_N_STAB))
+			continue;
+
+		RawSymbol entry;
+		entry.name = sym.strx;
+		entry.address = sym.value;
+		symbols_.append(entry);
+	}
+
+	return true;
+}
+
+// Copies each segment to its place in an anonymous mapping, leaving the rest zero filled like
+// the loader does. fileOffset is where the image starts in the file, for universal binaries.
+bool ImageFile::MapImage(uint64_t fileOffset)
+{
+	uint64_t end = 0;
+	for (size_t i = 0; i < layout_.length(); i++)
+	{
+		const Segment &seg = layout_[i];
+		if (seg.address < base_ || !InFile(fileOffset + seg.fileOffset, std::min(seg.fileSize, seg.memSize), fileSize_))
+			return false;
+		end = std::max(end, seg.address + seg.memSize);
+	}
+
+	// Corrupt headers shouldn't be able to reserve absurd amounts of memory
+	const uint64_t kMaxImageSize = uint64_t(1) << 31;
+	if (end - base_ > kMaxImageSize)
+		return false;
+
+	imageSize_ = (end - base_ + 0xFFF) & ~uint64_t(0xFFF);
+	void *image = mmap(nullptr, imageSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (image == MAP_FAILED)
+	{
+		imageSize_ = 0;
+		return false;
+	}
+
+	image_ = (char *)image;
+
+	for (size_t i = 0; i < layout_.length(); i++)
+	{
+		const Segment &seg = layout_[i];
+		memcpy(image_ + (seg.address - base_), file_ + fileOffset + seg.fileOffset, std::min(seg.fileSize, seg.memSize));
+	}
+
+	mprotect(image_, imageSize_, PROT_READ);
+	return true;
+}
+
+void ImageFile::AddRelocation(uint64_t address, uint32_t size)
+{
+	// Only code is searched by FindMaskedPattern, so relocated data doesn't need to be tracked
+	if (address < base_ || address - base_ + size > codeSize_)
+		return;
+
+	SigScanner::Span span;
+	span.start = uint32_t(address - base_);
+	span.end = uint32_t(address - base_ + size);
+	relocs_.append(span);
+}
+
+void ImageFile::FinishRelocations()
+{
+	MergeRelocations(&relocs_);
+}
+
+void *ImageFile::ResolveHiddenSymbol(const char *symbol)
+{
+	return ResolveHiddenSymbol<void *>(symbol);
+}
+
+intptr_t ImageFile::GetSymbolOffset(const char *symbol)
+{
+	char *addr = ResolveHiddenSymbol<char *>(symbol);
+	return addr ? addr - image_ : -1;
+}
+
+void *ImageFile::GetHiddenSymbolAddr(const char *symbol)
+{
+	Symbol *entry;
+
+	if (!valid_)
+		return nullptr;
+
+	// In the best case, the symbol has already been cached
+	entry = table_.FindSymbol(symbol, strlen(symbol));
+	if (entry)
+		return entry->address;
+
+	for (uint32_t i = lastPosition_; i < symbols_.length(); i++)
+	{
+		const RawSymbol &sym = symbols_[i];
+		if (sym.name >= stringTableSize_ || sym.address < base_ || sym.address - base_ >= imageSize_)
+			continue;
+
+		const char *symName = stringTable_ + sym.name;
+		size_t symLength = strnlen(symName, stringTableSize_ - sym.name);
+
+		// Ignore the prepended underscore on all Mach-O symbols to match dlsym() functionality
+		if (machO_ && symLength > 0 && symName[0] == '_')
+		{
+			symName++;
+			symLength--;
+		}
+
+		Symbol *currentSymbol;
+		currentSymbol = table_.InternSymbol(symName, symLength, image_ + (sym.address - base_));
+
+		if (symLength == strlen(symbol) && strncmp(symbol, symName, symLength) == 0)
+		{
+			entry = currentSymbol;
+			lastPosition_ = ++i;
+			break;
+		}
+	}
+
+	return entry ? entry->address : nullptr;
+}
+
+size_t ImageFile::GetSegmentCount() const
+{
+	return segments_.length();
+}
+
+const ImageFile::Region &ImageFile::GetSegment(size_t index) const
+{
+	return segments_[index];
+}
+
+const ImageFile::Region *ImageFile::FindSection(const char *name) const
+{
+	for (size_t i = 0; i < sections_.length(); i++)
+	{
+		const Region &section = sections_[i];
+		const char *sectName = section.name.chars();
+
+		if (strcmp(sectName, name) == 0)
+			return &section;
+
+		const char *comma = strchr(sectName, ',');
+		if (comma && !strchr(name, ',') && strcmp(comma + 1, name) == 0)
+			return &section;
+	}
+
+	return nullptr;
+}
+
+void *ImageFile::FindPattern(const char *pattern, size_t len)
+{
+	return SigScanner::GetInstance().Find(image_, imageSize_, pattern, len);
+}
+
+void *ImageFile::FindMaskedPattern(const char *pattern, size_t len)
+{
+	ke::Vector<char> masked;
+	if (!masked.resize(len))
+		return nullptr;
+	memcpy(masked.buffer(), pattern, len);
+	if (!SigScanner::MaskOperands(masked.buffer(), len, is64Bit_))
+		return nullptr;
+
+	return SigScanner::GetInstance().Find(image_, codeSize_, masked.buffer(), len, relocs_.buffer(),
+	                                      relocs_.length());
+}
+
+const char *ImageFile::GetImage() const
+{
+	return image_;
+}
+
+size_t ImageFile::GetImageSize() const
+{
+	return imageSize_;
+}
+
+const char *ImageFile::GetCode() const
+{
+	return image_;
+}
+
+size_t ImageFile::GetCodeSize() const
+{
+	return codeSize_;
+}
+
+const ke::Vector<SigScanner::Span> &ImageFile::GetRelocations() const
+{
+	return relocs_;
+}
@@ -0,0 +1,154 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_IMAGEFILE_H_
+#define _INCLUDE_SRCDS_IMAGEFILE_H_
+
+#include "platform.h"
+#include <stddef.h>
+#include <stdint.h>
+#include "sm_symtable.h"
+#include "SigScanner.h"
+#include "amtl/am-string.h"
+#include "amtl/am-vector.h"
+
+/**
+ * A library read straight from disk instead of being loaded with dlopen, so that it can be
+ * inspected before the engine loads it, from another thread, or on a platform that can't load it.
+ *
+ * Both ELF and Mach-O (including universal binaries) are understood on either platform. The
+ * segments are laid out at their preferred addresses relative to the first one, the same way the
+ * loader maps them, so an offset found here is the same offset from the base address of the
+ * library once it is loaded. Nothing is relocated or bound, and relocated bytes hold whatever the
+ * file has there, which FindMaskedPattern skips just like HSGameLib does.
+ *
+ * Each ImageFile can be used from one thread at a time. Different ImageFiles can be searched from
+ * different threads at once.
+ */
+class ImageFile
+{
+public:
+	enum Protection
+	{
+		Prot_Read = 1,
+		Prot_Write = 2,
+		Prot_Execute = 4,
+	};
+
+	// A segment or section, with its address in the laid out image
+	struct Region
+	{
+		ke::AString name;	// ELF segments have no name, Mach-O sections are named "segment,section"
+		char *address;
+		size_t size;
+		int prot;			// Prot_* flags
+	};
+
+	ImageFile();
+	explicit ImageFile(const char *path);
+	~ImageFile();
+
+	bool Open(const char *path);
+	bool IsValid() const;
+	void Close();
+
+	const char *GetPath() const;
+	bool Is64Bit() const;
+
+	template <typename T>
+	T ResolveHiddenSymbol(const char *symbol)
+	{
+		return reinterpret_cast<T>(GetHiddenSymbolAddr(symbol));
+	}
+
+	void *ResolveHiddenSymbol(const char *symbol);
+
+	// Offset of symbol from the start of the image, or -1 if it isn't defined
+	intptr_t GetSymbolOffset(const char *symbol);
+
+	size_t GetSegmentCount() const;
+	const Region &GetSegment(size_t index) const;
+
+	// Sections can be named either "__text" or "__TEXT,__text" in Mach-O images
+	const Region *FindSection(const char *name) const;
+
+	void *FindPattern(const char *pattern, size_t len);
+	void *FindMaskedPattern(const char *pattern, size_t len);
+
+	// The laid out image, its code, and the spans in the code that the loader relocates
+	const char *GetImage() const;
+	size_t GetImageSize() const;
+	const char *GetCode() const;
+	size_t GetCodeSize() const;
+	const ke::Vector<SigScanner::Span> &GetRelocations() const;
+private:
+	bool LoadElf(const uint8_t *file, size_t size);
+	bool LoadMachO(const uint8_t *file, size_t size);
+	template <typename Traits> bool ParseElf(const uint8_t *file, size_t size);
+	template <typename Traits> bool ParseMachO(const uint8_t *file, size_t size);
+	bool MapImage(uint64_t fileOffset);
+	void AddRelocation(uint64_t address, uint32_t size);
+	void FinishRelocations();
+	void *GetHiddenSymbolAddr(const char *symbol);
+private:
+	struct Segment
+	{
+		uint64_t address;	// preferred address
+		uint64_t memSize;
+		uint64_t fileOffset;
+		uint64_t fileSize;
+	};
+
+	struct RawSymbol
+	{
+		uint32_t name;		// offset in the string table
+		uint64_t address;	// preferred address
+	};
+
+	ke::AString path_;
+	bool valid_;
+	bool is64Bit_;
+	bool machO_;
+	uint8_t *file_;			// the whole file, mapped read only, for the headers and symbol tables
+	size_t fileSize_;
+	char *image_;			// segments laid out at their preferred addresses minus base_
+	size_t imageSize_;
+	uint64_t base_;
+	size_t codeSize_;
+	ke::Vector<Segment> layout_;
+	ke::Vector<Region> segments_;
+	ke::Vector<Region> sections_;
+	ke::Vector<RawSymbol> symbols_;
+	const char *stringTable_;
+	size_t stringTableSize_;
+	SymbolTable table_;
+	uint32_t lastPosition_;
+	ke::Vector<SigScanner::Span> relocs_;	// relocated bytes in code, sorted and merged
+};
+
+#endif // _INCLUDE_SRCDS_IMAGEFILE_H_
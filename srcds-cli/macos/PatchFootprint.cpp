@@ -0,0 +1,127 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "PatchFootprint.h"
+#include "GameShared.h"
+#include <mach-o/dyld.h>
+#include <mach-o/loader.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(PLATFORM_X64)
+using MachHeader = struct mach_header_64;
+using MachSegment = struct segment_command_64;
+static const uint32_t MACH_LOADCMD_SEGMENT = LC_SEGMENT_64;
+#else
+using MachHeader = struct mach_header;
+using MachSegment = struct segment_command;
+static const uint32_t MACH_LOADCMD_SEGMENT = LC_SEGMENT;
+#endif
+
+void PatchFootprint::CountPages(uintptr_t start, size_t size, SegmentPages &pages)
+{
+	const size_t pageSize = getpagesize();
+	const uintptr_t end = start + size;
+	char vec[256];
+
+	start &= ~(pageSize - 1);
+
+	while (start < end) {
+		size_t count = (end - start + pageSize - 1) / pageSize;
+		if (count > sizeof(vec))
+			count = sizeof(vec);
+
+		if (mincore((caddr_t)start, count * pageSize, vec) == 0) {
+			for (size_t i = 0; i < count; i++) {
+				// A page that was written is either still marked modified or now lives in an
+				// anonymous copy instead of the file
+				if (vec[i] & (MINCORE_MODIFIED | MINCORE_COPIED | MINCORE_ANONYMOUS))
+					pages.modified++;
+			}
+		}
+
+		pages.total += count;
+		start += count * pageSize;
+	}
+}
+
+void PatchFootprint::Report()
+{
+	if (!enabled_)
+		return;
+
+	const size_t pageKB = getpagesize() / 1024;
+	ke::AString gamePath = GameShared::GetExecutablePath();
+	size_t codeTotal = 0, dataTotal = 0, libraries = 0;
+
+	printf("%-40s %14s %14s\n", "Private pages", "Code", "Data");
+
+	for (uint32_t i = 0; i < _dyld_image_count(); i++) {
+		const MachHeader *hdr = (const MachHeader *)_dyld_get_image_header(i);
+		const char *path = _dyld_get_image_name(i);
+		intptr_t slide = _dyld_get_image_vmaddr_slide(i);
+
+		if (!hdr || !path)
+			continue;
+
+		SegmentPages code = {0, 0}, data = {0, 0};
+		const struct load_command *cmd = (const struct load_command *)(hdr + 1);
+
+		for (uint32_t j = 0; j < hdr->ncmds; j++) {
+			if (cmd->cmd == MACH_LOADCMD_SEGMENT) {
+				const MachSegment *seg = (const MachSegment *)cmd;
+
+				// Skips __PAGEZERO, which isn't mapped, and read-only data such as __LINKEDIT
+				if (seg->initprot & VM_PROT_EXECUTE)
+					CountPages(seg->vmaddr + slide, seg->vmsize, code);
+				else if (seg->initprot & VM_PROT_WRITE)
+					CountPages(seg->vmaddr + slide, seg->vmsize, data);
+			}
+			cmd = (const struct load_command *)((const char *)cmd + cmd->cmdsize);
+		}
+
+		// System libraries only show up when something patched their code
+		if (code.modified == 0 && strncmp(path, gamePath.chars(), gamePath.length()) != 0)
+			continue;
+
+		const char *name = strrchr(path, '/');
+		name = name ? name + 1 : path;
+
+		printf("%-40s %6zu / %-6zu %6zu / %-6zu\n", name, code.modified, code.total, data.modified,
+		       data.total);
+
+		codeTotal += code.modified;
+		dataTotal += data.modified;
+		libraries++;
+	}
+
+	printf("%zu libraries: %zu KB of private code, %zu KB of private data\n", libraries,
+	       codeTotal * pageKB, dataTotal * pageKB);
+}
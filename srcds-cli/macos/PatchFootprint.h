@@ -0,0 +1,75 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_PATCHFOOTPRINT_H_
+#define _INCLUDE_SRCDS_PATCHFOOTPRINT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Reports how many pages of each loaded library are no longer shared with other processes.
+ *
+ * Code and read-only data start out as clean pages of the mapped file, which every server
+ * instance on the host shares. The first write to such a page, such as a detour's jump, gives
+ * the process a private copy of the whole page. Enabled with -patchfootprint; the report is
+ * printed once all fixers have applied their patches.
+ */
+class PatchFootprint
+{
+public:
+	static inline PatchFootprint &GetInstance() {
+		static PatchFootprint footprint;
+		return footprint;
+	}
+
+	inline void Enable() {
+		enabled_ = true;
+	}
+
+	inline bool IsEnabled() const {
+		return enabled_;
+	}
+
+	void Report();
+
+private:
+	struct SegmentPages
+	{
+		size_t total;
+		size_t modified;
+	};
+
+	PatchFootprint() : enabled_(false) { }
+
+	static void CountPages(uintptr_t start, size_t size, SegmentPages &pages);
+
+	bool enabled_;
+};
+
+#endif // _INCLUDE_SRCDS_PATCHFOOTPRINT_H_
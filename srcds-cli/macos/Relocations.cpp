@@ -0,0 +1,270 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "Relocations.h"
+#include <algorithm>
+
+// Declared here rather than taken from <mach-o/loader.h> so that libraries can be read on Linux
+// as well, see ImageFile
+namespace {
+
+const uint8_t REBASE_TYPE_POINTER = 1, REBASE_TYPE_TEXT_ABSOLUTE32 = 2, REBASE_TYPE_TEXT_PCREL32 = 3;
+const uint8_t REBASE_OPCODE_MASK = 0xF0, REBASE_IMMEDIATE_MASK = 0x0F;
+const uint8_t REBASE_OPCODE_SET_TYPE_IMM = 0x10;
+const uint8_t REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB = 0x20;
+const uint8_t REBASE_OPCODE_ADD_ADDR_ULEB = 0x30;
+const uint8_t REBASE_OPCODE_ADD_ADDR_IMM_SCALED = 0x40;
+const uint8_t REBASE_OPCODE_DO_REBASE_IMM_TIMES = 0x50;
+const uint8_t REBASE_OPCODE_DO_REBASE_ULEB_TIMES = 0x60;
+const uint8_t REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB = 0x70;
+const uint8_t REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB = 0x80;
+
+const uint8_t BIND_TYPE_POINTER = 1;
+const uint8_t BIND_OPCODE_MASK = 0xF0, BIND_IMMEDIATE_MASK = 0x0F;
+const uint8_t BIND_OPCODE_SET_DYLIB_ORDINAL_IMM = 0x10;
+const uint8_t BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB = 0x20;
+const uint8_t BIND_OPCODE_SET_DYLIB_SPECIAL_IMM = 0x30;
+const uint8_t BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM = 0x40;
+const uint8_t BIND_OPCODE_SET_TYPE_IMM = 0x50;
+const uint8_t BIND_OPCODE_SET_ADDEND_SLEB = 0x60;
+const uint8_t BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB = 0x70;
+const uint8_t BIND_OPCODE_ADD_ADDR_ULEB = 0x80;
+const uint8_t BIND_OPCODE_DO_BIND = 0x90;
+const uint8_t BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB = 0xA0;
+const uint8_t BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED = 0xB0;
+const uint8_t BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB = 0xC0;
+
+// Collects the rewritten bytes that lie in the searched range
+class SpanList
+{
+public:
+	SpanList(uint32_t ptrSize, uint64_t base, uint64_t size, ke::Vector<SigScanner::Span> *spans)
+		: ptrSize_(ptrSize), base_(base), size_(size), spans_(spans)
+	{
+	}
+
+	// Rebase and bind types share the same values
+	void Add(uint64_t address, uint8_t type)
+	{
+		uint32_t size = (type == REBASE_TYPE_TEXT_ABSOLUTE32 || type == REBASE_TYPE_TEXT_PCREL32) ? 4 : ptrSize_;
+		if (address < base_ || address - base_ + size > size_)
+			return;
+
+		SigScanner::Span span;
+		span.start = uint32_t(address - base_);
+		span.end = uint32_t(address - base_ + size);
+		spans_->append(span);
+	}
+
+private:
+	uint32_t ptrSize_;
+	uint64_t base_;
+	uint64_t size_;
+	ke::Vector<SigScanner::Span> *spans_;
+};
+
+} // namespace
+
+static uint64_t ReadULEB128(const uint8_t *&p, const uint8_t *end)
+{
+	uint64_t result = 0;
+	int shift = 0;
+
+	while (p < end)
+	{
+		uint8_t byte = *p++;
+		if (shift < 64)
+			result |= uint64_t(byte & 0x7F) << shift;
+		shift += 7;
+
+		if (!(byte & 0x80))
+			break;
+	}
+
+	return result;
+}
+
+// Rebases: addresses inside the library that slide with it
+static bool ReadRebases(const uint8_t *p, const uint8_t *end, const ke::Vector<uint64_t> &segments,
+                        uint64_t ptrSize, SpanList &spans)
+{
+	uint8_t type = REBASE_TYPE_POINTER;
+	uint64_t addr = 0;
+
+	while (p < end)
+	{
+		uint8_t opcode = *p & REBASE_OPCODE_MASK;
+		uint8_t imm = *p & REBASE_IMMEDIATE_MASK;
+		p++;
+
+		switch (opcode)
+		{
+		case REBASE_OPCODE_SET_TYPE_IMM:
+			type = imm;
+			break;
+		case REBASE_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+			if (imm >= segments.length())
+				return false;
+			addr = segments[imm] + ReadULEB128(p, end);
+			break;
+		case REBASE_OPCODE_ADD_ADDR_ULEB:
+			addr += ReadULEB128(p, end);
+			break;
+		case REBASE_OPCODE_ADD_ADDR_IMM_SCALED:
+			addr += imm * ptrSize;
+			break;
+		case REBASE_OPCODE_DO_REBASE_IMM_TIMES:
+			for (uint8_t n = 0; n < imm; n++, addr += ptrSize)
+				spans.Add(addr, type);
+			break;
+		case REBASE_OPCODE_DO_REBASE_ULEB_TIMES:
+			for (uint64_t n = ReadULEB128(p, end); n > 0; n--, addr += ptrSize)
+				spans.Add(addr, type);
+			break;
+		case REBASE_OPCODE_DO_REBASE_ADD_ADDR_ULEB:
+			spans.Add(addr, type);
+			addr += ReadULEB128(p, end) + ptrSize;
+			break;
+		case REBASE_OPCODE_DO_REBASE_ULEB_TIMES_SKIPPING_ULEB:
+		{
+			uint64_t count = ReadULEB128(p, end);
+			uint64_t skip = ReadULEB128(p, end);
+			for (; count > 0; count--, addr += skip + ptrSize)
+				spans.Add(addr, type);
+			break;
+		}
+		default:
+			// REBASE_OPCODE_DONE or something newer than this
+			return true;
+		}
+	}
+
+	return true;
+}
+
+// Binds: addresses of symbols in other libraries
+static bool ReadBinds(const uint8_t *p, const uint8_t *end, const ke::Vector<uint64_t> &segments,
+                      uint64_t ptrSize, SpanList &spans)
+{
+	uint8_t type = BIND_TYPE_POINTER;
+	uint64_t addr = 0;
+
+	while (p < end)
+	{
+		uint8_t opcode = *p & BIND_OPCODE_MASK;
+		uint8_t imm = *p & BIND_IMMEDIATE_MASK;
+		p++;
+
+		switch (opcode)
+		{
+		case BIND_OPCODE_SET_DYLIB_ORDINAL_IMM:
+		case BIND_OPCODE_SET_DYLIB_SPECIAL_IMM:
+			break;
+		case BIND_OPCODE_SET_DYLIB_ORDINAL_ULEB:
+		case BIND_OPCODE_SET_ADDEND_SLEB:
+			// Only skipped, and a SLEB128 is as long as a ULEB128 with the same bytes
+			ReadULEB128(p, end);
+			break;
+		case BIND_OPCODE_SET_SYMBOL_TRAILING_FLAGS_IMM:
+			while (p < end && *p)
+				p++;
+			p++;
+			break;
+		case BIND_OPCODE_SET_TYPE_IMM:
+			type = imm;
+			break;
+		case BIND_OPCODE_SET_SEGMENT_AND_OFFSET_ULEB:
+			if (imm >= segments.length())
+				return false;
+			addr = segments[imm] + ReadULEB128(p, end);
+			break;
+		case BIND_OPCODE_ADD_ADDR_ULEB:
+			addr += ReadULEB128(p, end);
+			break;
+		case BIND_OPCODE_DO_BIND:
+			spans.Add(addr, type);
+			addr += ptrSize;
+			break;
+		case BIND_OPCODE_DO_BIND_ADD_ADDR_ULEB:
+			spans.Add(addr, type);
+			addr += ReadULEB128(p, end) + ptrSize;
+			break;
+		case BIND_OPCODE_DO_BIND_ADD_ADDR_IMM_SCALED:
+			spans.Add(addr, type);
+			addr += imm * ptrSize + ptrSize;
+			break;
+		case BIND_OPCODE_DO_BIND_ULEB_TIMES_SKIPPING_ULEB:
+		{
+			uint64_t count = ReadULEB128(p, end);
+			uint64_t skip = ReadULEB128(p, end);
+			for (; count > 0; count--, addr += skip + ptrSize)
+				spans.Add(addr, type);
+			break;
+		}
+		default:
+			// BIND_OPCODE_DONE or something newer than this
+			return true;
+		}
+	}
+
+	return true;
+}
+
+bool ReadDyldInfoRelocations(const uint8_t *rebase, size_t rebaseSize, const uint8_t *bind, size_t bindSize,
+                             const ke::Vector<uint64_t> &segments, uint32_t ptrSize, uint64_t base,
+                             uint64_t size, ke::Vector<SigScanner::Span> *spans)
+{
+	SpanList list(ptrSize, base, size, spans);
+
+	return ReadRebases(rebase, rebase + rebaseSize, segments, ptrSize, list) &&
+	       ReadBinds(bind, bind + bindSize, segments, ptrSize, list);
+}
+
+void MergeRelocations(ke::Vector<SigScanner::Span> *spans)
+{
+	ke::Vector<SigScanner::Span> &list = *spans;
+
+	std::sort(list.buffer(), list.buffer() + list.length(),
+	          [](const SigScanner::Span &a, const SigScanner::Span &b) { return a.start < b.start; });
+
+	size_t merged = 0;
+	for (size_t i = 0; i < list.length(); i++)
+	{
+		if (merged > 0 && list[i].start <= list[merged - 1].end)
+		{
+			if (list[i].end > list[merged - 1].end)
+				list[merged - 1].end = list[i].end;
+			continue;
+		}
+
+		list[merged++] = list[i];
+	}
+
+	while (list.length() > merged)
+		list.pop();
+}
@@ -0,0 +1,54 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_RELOCATIONS_H_
+#define _INCLUDE_SRCDS_RELOCATIONS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "SigScanner.h"
+#include "amtl/am-vector.h"
+
+/**
+ * Walks the rebase and bind opcodes of a Mach-O library's LC_DYLD_INFO, which libraries without
+ * chained fixups use to list the addresses the loader rewrites. Both tables point into the
+ * library's __LINKEDIT and either may be empty. Lazy binds only ever touch stubs in data, so
+ * they aren't read.
+ *
+ * segments holds the vmaddr of every segment in load command order, which is how the opcodes
+ * refer to them. Rewritten bytes that lie in [base, base + size) are appended to spans as offsets
+ * from base. Returns false if the opcodes refer to a segment that doesn't exist.
+ */
+bool ReadDyldInfoRelocations(const uint8_t *rebase, size_t rebaseSize, const uint8_t *bind, size_t bindSize,
+                             const ke::Vector<uint64_t> &segments, uint32_t ptrSize, uint64_t base,
+                             uint64_t size, ke::Vector<SigScanner::Span> *spans);
+
+/* Sorts spans and merges the ones that overlap or touch, since each source lists them in its own order. */
+void MergeRelocations(ke::Vector<SigScanner::Span> *spans);
+
+#endif // _INCLUDE_SRCDS_RELOCATIONS_H_
@@ -28,6 +28,9 @@
 
 #include "ServerAPI.h"
 #include "CDetour/detours.h"
+#include "CDetour/detourprofiler.h"
+#include "CDetour/midhook.h"
+#include "CDetour/vtablehook.h"
 #include "GameShared.h"
 #include "HSGameLib.h"
 
@@ -69,3 +72,30 @@ void ServerAPI::GetArgs(int &argc, char ** &argv) {
 void ServerAPI::AddSystems(AppSystemInfo_t *systems) {
 	GameShared::AddSystems(systems);
 }
+
+size_t ServerAPI::GetDetourStats(DetourStats *stats, size_t maxStats) {
+	return DetourProfiler::GetInstance().GetStats(stats, maxStats);
+}
+
+IDetour *ServerAPI::HookVirtual(void *instance, size_t index, void *callback, void **original,
+                                VirtualHookMode mode) {
+	CVirtualHook *hook = new CVirtualHook(callback, original, mode);
+
+	if (!hook->Init(instance, index)) {
+		delete hook;
+		return nullptr;
+	}
+
+	return hook;
+}
+
+IDetour *ServerAPI::HookMidFunction(void *addr, MidHookCallback callback, uint32_t regs) {
+	CMidHook *hook = new CMidHook(callback, regs);
+
+	if (!hook->Init(addr)) {
+		delete hook;
+		return nullptr;
+	}
+
+	return hook;
+}
@@ -40,6 +40,10 @@ public:
 	void FixPath(const char *path) override;
 	void GetArgs(int &argc, char ** &argv) override;
 	void AddSystems(AppSystemInfo_t *systems) override;
+	size_t GetDetourStats(DetourStats *stats, size_t maxStats) override;
+	IDetour *HookVirtual(void *instance, size_t index, void *callback, void **original,
+	                     VirtualHookMode mode) override;
+	IDetour *HookMidFunction(void *addr, MidHookCallback callback, uint32_t regs) override;
 private:
 	int argc_;
 	char **argv_;
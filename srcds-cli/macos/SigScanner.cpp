@@ -0,0 +1,671 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "SigScanner.h"
+#include "asm/x86insn.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const char kWildcard = '\x2A';
+
+/**
+ * Bytes that are most common in x86 code, most common first. A signature byte that isn't listed
+ * is assumed to be rare.
+ */
+static const unsigned char kCommonBytes[] =
+{
+	0x00, 0xFF, 0x48, 0x89, 0x8B, 0x0F, 0xE8, 0x24,
+	0x45, 0x85, 0x4C, 0x8D, 0x01, 0x74, 0x83, 0x44,
+	0x41, 0x49, 0xC7, 0x10, 0x08, 0x84, 0x75, 0x04,
+	0x20, 0x18, 0x5D, 0x40, 0xC0, 0x55, 0xE5, 0xC3,
+};
+
+// Roughly how many bits of information a match on this byte gives
+static int ByteRarity(unsigned char byte)
+{
+	for (size_t i = 0; i < sizeof(kCommonBytes); i++) {
+		if (kCommonBytes[i] == byte)
+			return i < 8 ? 2 : 4;
+	}
+
+	return 8;
+}
+
+#if defined(__x86_64__)
+// A run of one or four signature bytes that is compared with a single instruction
+struct Check
+{
+	int32_t offset;
+	int size;
+	int rarity;
+};
+
+// cmp byte/dword [base+offset], <signature bytes>
+static void EmitCheck(GenBuffer &code, jit_uint8_t base, const Check &check, const char *pattern)
+{
+	bool shortDisp = check.offset < 128;
+
+	if (base >= REG_R8)
+		X64_Emit_Rex(&code, false, 0, 0, base);
+	code.write_ubyte(check.size == 1 ? 0x80 : 0x81);
+	code.write_ubyte(ia32_modrm(shortDisp ? MOD_DISP8 : MOD_DISP32, 7, base & 7));
+	if (shortDisp)
+		code.write_byte(jit_int8_t(check.offset));
+	else
+		code.write_int32(check.offset);
+
+	if (check.size == 1) {
+		code.write_byte(pattern[check.offset]);
+	} else {
+		jit_uint32_t value;
+		memcpy(&value, &pattern[check.offset], sizeof(value));
+		code.write_uint32(value);
+	}
+}
+
+// <op> xmm, [rdi+disp32] or <op> xmm, xmm, for the SSE2 instructions with a 66/F3 0F prefix
+static void EmitSSE(GenBuffer &code, jit_uint8_t prefix, jit_uint8_t opcode, jit_uint8_t reg, jit_uint8_t rm,
+                    bool memory, jit_int32_t disp = 0)
+{
+	code.write_ubyte(prefix);
+	code.write_ubyte(0x0F);
+	code.write_ubyte(opcode);
+	code.write_ubyte(ia32_modrm(memory ? MOD_DISP32 : MOD_REG, reg, rm));
+	if (memory)
+		code.write_int32(disp);
+}
+
+// Loads xmm with 16 copies of byte
+static void EmitBroadcast(GenBuffer &code, jit_uint8_t xmm, unsigned char byte)
+{
+	code.write_ubyte(0xB8);								// mov eax, imm32
+	code.write_uint32(byte * 0x01010101u);
+	EmitSSE(code, 0x66, 0x6E, xmm, REG_EAX, false);		// movd xmm, eax
+	EmitSSE(code, 0x66, 0x70, xmm, xmm, false);			// pshufd xmm, xmm, 0
+	code.write_ubyte(0);
+}
+#endif
+
+/**
+ * Matcher layout, called as Matcher(start, end) with rdi = start and rsi = end:
+ *
+ *   rdx = last position a whole 16 byte block of candidates can be tested at
+ *   rsi = last position the signature fits at
+ * block:
+ *   compare the 16 bytes at rdi + anchor1 and rdi + anchor2 with the two rarest signature bytes,
+ *   giving a bit in ecx for every position where both match
+ *   for each set bit, check the rest of the signature at that position and return it if it matches
+ *   rdi += 16, loop
+ * tail:
+ *   check the whole signature at each position up to rsi one at a time
+ */
+bool SigScanner::Compile(GenBuffer &code, const char *pattern, size_t len)
+{
+#if defined(__x86_64__)
+	if (len == 0 || len > 0x10000)
+		return false;
+
+	ke::Vector<Check> checks;
+	int anchor1 = -1, anchor2 = -1;
+
+	for (size_t i = 0; i < len; ) {
+		if (pattern[i] == kWildcard) {
+			i++;
+			continue;
+		}
+
+		Check check;
+		check.offset = int32_t(i);
+		check.size = 1;
+		check.rarity = ByteRarity(pattern[i]);
+
+		if (i + 4 <= len && memchr(&pattern[i], kWildcard, 4) == nullptr) {
+			check.size = 4;
+			for (size_t j = 1; j < 4; j++)
+				check.rarity += ByteRarity(pattern[i + j]);
+		}
+
+		checks.append(check);
+		i += check.size;
+	}
+
+	if (checks.empty())
+		return false;
+
+	// The two rarest bytes become the anchors, as far apart as possible among equally rare ones
+	for (size_t i = 0; i < len; i++) {
+		if (pattern[i] == kWildcard)
+			continue;
+
+		int rarity = ByteRarity(pattern[i]);
+		if (anchor1 < 0 || rarity > ByteRarity(pattern[anchor1]))
+			anchor1 = int(i);
+	}
+	for (size_t i = 0; i < len; i++) {
+		if (pattern[i] == kWildcard || int(i) == anchor1)
+			continue;
+
+		int rarity = ByteRarity(pattern[i]);
+		if (anchor2 < 0 || rarity > ByteRarity(pattern[anchor2]) ||
+		    (rarity == ByteRarity(pattern[anchor2]) && abs(int(i) - anchor1) > abs(anchor2 - anchor1)))
+			anchor2 = int(i);
+	}
+	if (anchor2 < 0)
+		anchor2 = anchor1;
+
+	// Rarest checks first so that most candidates are rejected by the first comparison
+	for (size_t i = 1; i < checks.length(); i++) {
+		for (size_t j = i; j > 0 && checks[j].rarity > checks[j - 1].rarity; j--) {
+			Check tmp = checks[j];
+			checks[j] = checks[j - 1];
+			checks[j - 1] = tmp;
+		}
+	}
+
+	const jit_int32_t length = jit_int32_t(len);
+
+	EmitBroadcast(code, 0, pattern[anchor1]);
+	EmitBroadcast(code, 1, pattern[anchor2]);
+
+	// lea rdx, [rsi-(len+15)]
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	code.write_ubyte(IA32_LEA_REG_MEM);
+	code.write_ubyte(ia32_modrm(MOD_DISP32, REG_EDX, REG_ESI));
+	code.write_int32(-(length + 15));
+
+	// sub rsi, len
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	IA32_Sub_Rm_Imm32(&code, REG_ESI, length, MOD_REG);
+
+	// block: cmp rdi, rdx; ja tail
+	jitoffs_t block = code.get_outputpos();
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	IA32_Cmp_Rm_Reg(&code, REG_EDI, REG_EDX, MOD_REG);
+	jitoffs_t toTail = IA32_Jump_Cond_Imm32(&code, CC_A, 0);
+
+	EmitSSE(code, 0xF3, 0x6F, 2, REG_EDI, true, anchor1);	// movdqu xmm2, [rdi+anchor1]
+	EmitSSE(code, 0x66, 0x74, 2, 0, false);					// pcmpeqb xmm2, xmm0
+	EmitSSE(code, 0xF3, 0x6F, 3, REG_EDI, true, anchor2);	// movdqu xmm3, [rdi+anchor2]
+	EmitSSE(code, 0x66, 0x74, 3, 1, false);					// pcmpeqb xmm3, xmm1
+	EmitSSE(code, 0x66, 0xDB, 2, 3, false);					// pand xmm2, xmm3
+	EmitSSE(code, 0x66, 0xD7, REG_ECX, 2, false);			// pmovmskb ecx, xmm2
+
+	IA32_Test_Rm_Reg(&code, REG_ECX, REG_ECX, MOD_REG);
+	jitoffs_t toCandidate = IA32_Jump_Cond_Imm32(&code, CC_NZ, 0);
+
+	// next: add rdi, 16; jmp block
+	jitoffs_t next = code.get_outputpos();
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	IA32_Add_Rm_Imm8(&code, REG_EDI, 16, MOD_REG);
+	IA32_Write_Jump32(&code, IA32_Jump_Imm32(&code, 0), block);
+
+	// candidate: bsf r8d, ecx; lea r9, [rdi+r8]
+	IA32_Send_Jump32_Here(&code, toCandidate);
+	jitoffs_t candidate = code.get_outputpos();
+	X64_Emit_Rex(&code, false, REG_R8, 0, REG_ECX);
+	code.write_ubyte(0x0F);
+	code.write_ubyte(0xBC);
+	code.write_ubyte(ia32_modrm(MOD_REG, REG_R8 & 7, REG_ECX));
+	X64_Emit_Rex(&code, true, REG_R9, REG_R8, REG_EDI);
+	code.write_ubyte(IA32_LEA_REG_MEM);
+	code.write_ubyte(ia32_modrm(MOD_MEM_REG, REG_R9 & 7, REG_SIB));
+	code.write_ubyte(ia32_sib(NOSCALE, REG_R8 & 7, REG_EDI));
+
+	ke::Vector<jitoffs_t> rejects;
+	for (size_t i = 0; i < checks.length(); i++) {
+		const Check &check = checks[i];
+		if (check.size == 1 && (check.offset == anchor1 || check.offset == anchor2))
+			continue;
+
+		EmitCheck(code, REG_R9, check, pattern);
+		rejects.append(IA32_Jump_Cond_Imm32(&code, CC_NE, 0));
+	}
+
+	// mov rax, r9; ret
+	X64_Emit_Rex(&code, true, REG_R9, 0, REG_EAX);
+	code.write_ubyte(IA32_MOV_RM_REG);
+	code.write_ubyte(ia32_modrm(MOD_REG, REG_R9 & 7, REG_EAX));
+	IA32_Return(&code);
+
+	// reject: clear the lowest bit of ecx, try the next candidate or move on to the next block
+	for (size_t i = 0; i < rejects.length(); i++)
+		IA32_Send_Jump32_Here(&code, rejects[i]);
+	X64_Emit_Rex(&code, false, REG_R8, 0, REG_ECX);
+	code.write_ubyte(IA32_LEA_REG_MEM);
+	code.write_ubyte(ia32_modrm(MOD_DISP8, REG_R8 & 7, REG_ECX));
+	code.write_byte(-1);
+	X64_Emit_Rex(&code, false, REG_R8, 0, REG_ECX);
+	code.write_ubyte(0x21);									// and ecx, r8d
+	code.write_ubyte(ia32_modrm(MOD_REG, REG_R8 & 7, REG_ECX));
+	IA32_Write_Jump32(&code, IA32_Jump_Cond_Imm32(&code, CC_NZ, 0), candidate);
+	IA32_Write_Jump32(&code, IA32_Jump_Imm32(&code, 0), next);
+
+	// tail: cmp rdi, rsi; ja notFound
+	IA32_Send_Jump32_Here(&code, toTail);
+	jitoffs_t tail = code.get_outputpos();
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	IA32_Cmp_Rm_Reg(&code, REG_EDI, REG_ESI, MOD_REG);
+	jitoffs_t toNotFound = IA32_Jump_Cond_Imm32(&code, CC_A, 0);
+
+	rejects.clear();
+	for (size_t i = 0; i < checks.length(); i++) {
+		EmitCheck(code, REG_EDI, checks[i], pattern);
+		rejects.append(IA32_Jump_Cond_Imm32(&code, CC_NE, 0));
+	}
+
+	// mov rax, rdi; ret
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	IA32_Mov_Rm_Reg(&code, REG_EAX, REG_EDI, MOD_REG);
+	IA32_Return(&code);
+
+	// add rdi, 1; jmp tail
+	for (size_t i = 0; i < rejects.length(); i++)
+		IA32_Send_Jump32_Here(&code, rejects[i]);
+	X64_Emit_Rex(&code, true, 0, 0, 0);
+	IA32_Add_Rm_Imm8(&code, REG_EDI, 1, MOD_REG);
+	IA32_Write_Jump32(&code, IA32_Jump_Imm32(&code, 0), tail);
+
+	// notFound: xor eax, eax; ret
+	IA32_Send_Jump32_Here(&code, toNotFound);
+	IA32_Xor_Rm_Reg(&code, REG_EAX, REG_EAX, MOD_REG);
+	IA32_Return(&code);
+
+	code.SetRE();
+	return true;
+#else
+	return false;
+#endif
+}
+
+SigScanner::Matcher SigScanner::GetMatcher(const char *pattern, size_t len)
+{
+	std::lock_guard<std::mutex> guard(lock_);
+
+	for (size_t i = 0; i < compiled_.length(); i++) {
+		CompiledPattern *compiled = compiled_[i];
+		if (compiled->pattern.length() == len && memcmp(compiled->pattern.buffer(), pattern, len) == 0)
+			return compiled->code.GetSize() ? reinterpret_cast<Matcher>(compiled->code.GetData()) : nullptr;
+	}
+
+	// Matchers are kept for the life of the process, including those that failed to compile
+	CompiledPattern *compiled = new CompiledPattern();
+	if (!compiled->pattern.resize(len)) {
+		delete compiled;
+		return nullptr;
+	}
+	memcpy(compiled->pattern.buffer(), pattern, len);
+	compiled_.append(compiled);
+
+	if (!Compile(compiled->code, pattern, len)) {
+		compiled->code.clear();
+		return nullptr;
+	}
+
+	return reinterpret_cast<Matcher>(compiled->code.GetData());
+}
+
+void *SigScanner::Find(const void *start, size_t size, const char *pattern, size_t len)
+{
+	if (len == 0 || size < len)
+		return nullptr;
+
+	if (jit_) {
+		if (Matcher matcher = GetMatcher(pattern, len)) {
+			const char *begin = reinterpret_cast<const char *>(start);
+			return const_cast<char *>(matcher(begin, begin + size));
+		}
+	}
+
+	return FindSlow(start, size, pattern, len);
+}
+
+// Compares pattern at p, jumping over any bytes in spans. first is the first span that ends after p.
+static bool MatchSkipping(const char *start, const char *p, const char *pattern, size_t len,
+                          const SigScanner::Span *first, const SigScanner::Span *last)
+{
+	const SigScanner::Span *span = first;
+	size_t offset = p - start;
+
+	for (size_t i = 0; i < len; i++) {
+		while (span != last && span->end <= offset + i)
+			span++;
+
+		if (span != last && span->start <= offset + i) {
+			i = span->end - offset - 1;
+			continue;
+		}
+
+		if (pattern[i] != kWildcard && p[i] != pattern[i])
+			return false;
+	}
+
+	return true;
+}
+
+void *SigScanner::Find(const void *start, size_t size, const char *pattern, size_t len, const Span *spans,
+                       size_t count)
+{
+	if (len == 0 || size < len)
+		return nullptr;
+
+	const char *begin = reinterpret_cast<const char *>(start);
+	const Span *last = spans + count;
+	size_t pos = 0;
+
+	// Between spans, the signature is searched for as usual. Only the positions where it would
+	// overlap a span are compared one at a time, and those compares skip the span's bytes.
+	for (const Span *span = spans; span != last && span->start < size; span++) {
+		if (span->end <= pos)
+			continue;
+
+		if (span->start >= pos + len) {
+			if (void *found = Find(begin + pos, span->start - pos, pattern, len))
+				return found;
+			pos = span->start - len + 1;
+		}
+
+		size_t end = span->end < size - len + 1 ? span->end : size - len + 1;
+		for (; pos < end; pos++) {
+			if (MatchSkipping(begin, begin + pos, pattern, len, span, last))
+				return const_cast<char *>(begin + pos);
+		}
+	}
+
+	return pos < size ? Find(begin + pos, size - pos, pattern, len) : nullptr;
+}
+
+// Stores match in matches, which holds the best of the count matches found so far in order
+static void KeepBestMatch(SigScanner::ApproximateMatch *matches, size_t maxMatches, size_t count,
+                          const SigScanner::ApproximateMatch &match)
+{
+	size_t at = count < maxMatches ? count : maxMatches;
+	while (at > 0 && (matches[at - 1].mismatches > match.mismatches ||
+	                  (matches[at - 1].mismatches == match.mismatches && matches[at - 1].address > match.address))) {
+		if (at < maxMatches)
+			matches[at] = matches[at - 1];
+		at--;
+	}
+
+	if (at < maxMatches)
+		matches[at] = match;
+}
+
+// Counts the mismatches of the whole signature at address, which may be longer than the state
+template <size_t K>
+static bool CheckApproximate(const char *address, const char *pattern, size_t len, SigScanner::ApproximateMatch &match)
+{
+	match.address = address;
+	match.mismatches = 0;
+
+	for (size_t i = 0; i < len && match.mismatches <= K; i++) {
+		if (pattern[i] != kWildcard && address[i] != pattern[i]) {
+			if (match.mismatches < K)
+				match.positions[match.mismatches] = uint32_t(i);
+			match.mismatches++;
+		}
+	}
+
+	return match.mismatches <= K;
+}
+
+#if defined(__SSE2__)
+/**
+ * Counts mismatches for 16 positions at once: for each signature byte, the 16 bytes at that
+ * offset from the positions are compared with it and the results are added to a counter per
+ * position. Bytes are compared rarest first, and a block is abandoned as soon as every position
+ * in it has more than K mismatches, which usually takes only a few more compares than K.
+ * Positions that survive the first 64 bytes are checked in full.
+ */
+template <size_t K>
+static size_t CountMismatches(const char *begin, const char *end, const char *pattern, size_t len,
+                              SigScanner::ApproximateMatch *matches, size_t maxMatches)
+{
+	int order[64];
+	size_t fixed = 0;
+
+	for (size_t i = 0; i < len && fixed < 64; i++) {
+		if (pattern[i] == kWildcard)
+			continue;
+
+		size_t at = fixed++;
+		for (; at > 0 && ByteRarity(pattern[order[at - 1]]) < ByteRarity(pattern[i]); at--)
+			order[at] = order[at - 1];
+		order[at] = int(i);
+	}
+
+	__m128i bytes[64];
+	for (size_t i = 0; i < fixed; i++)
+		bytes[i] = _mm_set1_epi8(pattern[order[i]]);
+
+	// Last position a whole block of 16 can be tested at
+	const char *blockEnd = end - 15;
+	const char *p = begin;
+	size_t count = 0;
+
+	for (; p < blockEnd; p += 16) {
+		__m128i matched = _mm_setzero_si128();
+		int alive = 0xFFFF;
+
+		for (size_t i = 0; i < fixed; i++) {
+			__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + order[i])), bytes[i]);
+			matched = _mm_sub_epi8(matched, eq);
+
+			// Positions with matched > i - K have at most K mismatches so far
+			if (i >= K) {
+				alive = _mm_movemask_epi8(_mm_cmpgt_epi8(matched, _mm_set1_epi8(char(i - K))));
+				if (!alive)
+					break;
+			}
+		}
+
+		for (; alive; alive &= alive - 1) {
+			SigScanner::ApproximateMatch match;
+			if (CheckApproximate<K>(p + __builtin_ctz(alive), pattern, len, match))
+				KeepBestMatch(matches, maxMatches, count++, match);
+		}
+	}
+
+	for (; p < end; p++) {
+		SigScanner::ApproximateMatch match;
+		if (CheckApproximate<K>(p, pattern, len, match))
+			KeepBestMatch(matches, maxMatches, count++, match);
+	}
+
+	return count;
+}
+#else
+/**
+ * Shift-And search allowing K mismatches. Bit i of state[j] is set when the signature's first
+ * i + 1 bytes match the bytes just read with at most j of them differing. Signatures longer than
+ * 64 bytes are searched by their first 64 bytes and then checked in full.
+ */
+template <size_t K>
+static size_t CountMismatches(const char *begin, const char *end, const char *pattern, size_t len,
+                              SigScanner::ApproximateMatch *matches, size_t maxMatches)
+{
+	// Bit i of masks[c] is set when byte c can appear at position i of the signature
+	const size_t width = len < 64 ? len : 64;
+	uint64_t masks[UCHAR_MAX + 1];
+	for (size_t c = 0; c <= UCHAR_MAX; c++)
+		masks[c] = 0;
+	for (size_t i = 0; i < width; i++) {
+		if (pattern[i] == kWildcard) {
+			for (size_t c = 0; c <= UCHAR_MAX; c++)
+				masks[c] |= uint64_t(1) << i;
+		} else {
+			masks[(unsigned char)pattern[i]] |= uint64_t(1) << i;
+		}
+	}
+
+	uint64_t state[K + 1] = {};
+	const uint64_t found = uint64_t(1) << (width - 1);
+	size_t count = 0;
+
+	for (const char *p = begin; p < end + width - 1; p++) {
+		uint64_t mask = masks[(unsigned char)*p];
+		uint64_t prev = state[0];
+		state[0] = ((prev << 1) | 1) & mask;
+
+		for (size_t j = 1; j <= K; j++) {
+			uint64_t cur = state[j];
+			state[j] = (((cur << 1) | 1) & mask) | (prev << 1) | 1;
+			prev = cur;
+		}
+
+		SigScanner::ApproximateMatch match;
+		if ((state[K] & found) && CheckApproximate<K>(p - width + 1, pattern, len, match))
+			KeepBestMatch(matches, maxMatches, count++, match);
+	}
+
+	return count;
+}
+#endif
+
+size_t SigScanner::FindApproximate(const void *start, size_t size, const char *pattern, size_t len,
+                                   size_t maxMismatches, ApproximateMatch *matches, size_t maxMatches)
+{
+	if (len == 0 || size < len)
+		return 0;
+
+	// Positions where the whole signature fits
+	const char *begin = reinterpret_cast<const char *>(start);
+	const char *end = begin + size - len + 1;
+
+	switch (maxMismatches) {
+	case 0:
+		return CountMismatches<0>(begin, end, pattern, len, matches, maxMatches);
+	case 1:
+		return CountMismatches<1>(begin, end, pattern, len, matches, maxMatches);
+	case 2:
+		return CountMismatches<2>(begin, end, pattern, len, matches, maxMatches);
+	case 3:
+		return CountMismatches<3>(begin, end, pattern, len, matches, maxMatches);
+	default:
+		return CountMismatches<kMaxMismatches>(begin, end, pattern, len, matches, maxMatches);
+	}
+}
+
+bool SigScanner::MaskOperands(char *pattern, size_t len)
+{
+#if defined(__x86_64__)
+	return MaskOperands(pattern, len, true);
+#else
+	return MaskOperands(pattern, len, false);
+#endif
+}
+
+bool SigScanner::MaskOperands(char *pattern, size_t len, bool mode64)
+{
+	// The decoder may read up to an instruction's length past the end of the signature
+	ke::Vector<unsigned char> code;
+	if (len > SIZE_MAX - 16 || !code.resize(len + 16))
+		return false;
+	memset(code.buffer(), 0, code.length());
+	memcpy(code.buffer(), pattern, len);
+
+	for (size_t i = 0; i < len; ) {
+		struct x86_insn insn;
+		if (!x86_decode(&code[i], mode64, &insn))
+			break;
+
+		size_t offset = 0, size = 0;
+		if ((insn.flags & X86_INSN_REL) && insn.imm_size == 4) {
+			offset = insn.imm;
+			size = insn.imm_size;
+		} else if (insn.flags & X86_INSN_RIPREL) {
+			offset = insn.disp;
+			size = insn.disp_size;
+		}
+
+		for (size_t j = i + offset; size && j < i + offset + size && j < len; j++)
+			pattern[j] = kWildcard;
+
+		i += insn.length;
+	}
+
+	return true;
+}
+
+void *SigScanner::FindSlow(const void *start, size_t size, const char *pattern, size_t len)
+{
+	// Algorithm based on Boyer-Moore-Horspool string search with addition of wildcard handling
+	// See: https://en.wikipedia.org/wiki/Boyer%E2%80%93Moore%E2%80%93Horspool_algorithm
+
+	const char wildcard = kWildcard;
+	size_t bad_shift[UCHAR_MAX + 1];
+	size_t last = len - 1;
+	size_t idx = 0;
+	size_t searchLen = size;
+	char *ptr = reinterpret_cast<char *>(const_cast<void *>(start));
+
+	// A shift can never go past the rightmost wildcard before the last character, since any byte
+	// could sit there
+	size_t maxShift = len;
+	for (idx = 0; idx < last; idx++)
+	{
+		if (pattern[idx] == wildcard)
+			maxShift = last - idx;
+	}
+
+	// Initialize bad character shift table, accounting for wildcards in the pattern
+	for (size_t i = 0; i <= UCHAR_MAX; i++)
+		bad_shift[i] = maxShift;
+
+	// Set values in bad character shift table for characters in pattern
+	for (size_t i = 0; i < last; i++)
+	{
+		if (pattern[i] != wildcard && last - i < maxShift)
+			bad_shift[(unsigned char)pattern[i]] = last - i;
+	}
+
+	// Search memory for the pattern
+	while (searchLen >= len)
+	{
+		// Search going backwards from last character
+		size_t i;
+		for (i = last; pattern[i] == wildcard || ptr[i] == pattern[i]; i--)
+		{
+			if (i == 0)
+				return ptr;
+		}
+
+		// Skip ahead based on the byte under the last character of the pattern
+		size_t shift = bad_shift[(unsigned char)ptr[last]];
+		if (shift > searchLen)
+			break;
+		searchLen -= shift;
+		ptr += shift;
+	}
+
+	return nullptr;
+}
@@ -0,0 +1,142 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_SIGSCANNER_H_
+#define _INCLUDE_SRCDS_SIGSCANNER_H_
+
+#include "amtl/am-vector.h"
+#include <sourcehook/sh_include.h>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Finds signatures in MAKE_SIG format (0x2A bytes are wildcards) in memory.
+ *
+ * On x86_64, each signature is compiled into a matcher the first time it is searched for, and
+ * the matcher is kept for every later search, such as for the same signature in other libraries.
+ * The matcher compares 16 positions at once against the signature's two rarest bytes with SSE2,
+ * then checks the remaining bytes of each candidate with the signature's bytes as immediates,
+ * rarest first. Elsewhere, or with -nosigjit, a Boyer-Moore-Horspool search is used instead.
+ *
+ * Searches can also be told to skip spans of memory that the loader rewrites, such as relocated
+ * addresses, which is what HSGameLib::FindMaskedPattern uses.
+ *
+ * When a signature isn't found, FindApproximate looks for the places where it matches except
+ * for a few bytes, which is usually what happens to a signature after a game update.
+ */
+class SigScanner
+{
+public:
+	static inline SigScanner &GetInstance() {
+		static SigScanner scanner;
+		return scanner;
+	}
+
+	static constexpr size_t kMaxMismatches = 4;
+
+	struct ApproximateMatch
+	{
+		const char *address;
+		size_t mismatches;
+		uint32_t positions[kMaxMismatches];	// offsets of the signature bytes that differ
+	};
+
+	inline void DisableJit() {
+		jit_ = false;
+	}
+
+	/* Lets HSGameLib::FindPatternApproximate return a unique match with one mismatch (-sigrecover). */
+	inline void EnableRecovery() {
+		recover_ = true;
+	}
+
+	inline bool IsRecoveryEnabled() const {
+		return recover_;
+	}
+
+	/* Returns the first match of pattern that lies entirely within [start, start + size). */
+	void *Find(const void *start, size_t size, const char *pattern, size_t len);
+
+	/* Offsets [start, end) from the start of a search whose bytes are never compared. */
+	struct Span
+	{
+		uint32_t start;
+		uint32_t end;
+	};
+
+	/*
+	 * Like Find, but skips over the bytes covered by spans, which must be sorted and must not
+	 * overlap. Signatures that don't touch any span are still found with the compiled matcher.
+	 */
+	void *Find(const void *start, size_t size, const char *pattern, size_t len, const Span *spans, size_t count);
+
+	static void *FindSlow(const void *start, size_t size, const char *pattern, size_t len);
+
+	/*
+	 * Finds every position where pattern matches with at most maxMismatches (up to kMaxMismatches)
+	 * bytes differing. With SSE2, the mismatches of 16 positions are counted at once, giving up on
+	 * the positions as soon as they all have too many. Otherwise a bit-parallel Shift-And search
+	 * is used. The best maxMatches matches, fewest mismatches first, are stored in matches and the
+	 * total number of matches is returned.
+	 */
+	static size_t FindApproximate(const void *start, size_t size, const char *pattern, size_t len,
+	                              size_t maxMismatches, ApproximateMatch *matches, size_t maxMatches);
+
+	/*
+	 * Turns the rel32 branch targets and RIP-relative displacements in pattern into wildcards,
+	 * since they change whenever the code around them moves. The pattern must start on an
+	 * instruction boundary, and decoding stops at the first bytes that aren't a valid instruction.
+	 * Returns false, leaving pattern untouched, if there isn't enough memory to decode it.
+	 */
+	static bool MaskOperands(char *pattern, size_t len);
+
+	/* Same, for 32-bit or 64-bit code regardless of what this process is. */
+	static bool MaskOperands(char *pattern, size_t len, bool mode64);
+
+private:
+	using Matcher = const char *(*)(const char *start, const char *end);
+
+	struct CompiledPattern
+	{
+		ke::Vector<char> pattern;
+		GenBuffer code;
+	};
+
+	SigScanner() : jit_(true), recover_(false) { }
+
+	Matcher GetMatcher(const char *pattern, size_t len);
+	static bool Compile(GenBuffer &code, const char *pattern, size_t len);
+
+	bool jit_;
+	bool recover_;
+	std::mutex lock_;	// guards compiled_, since libraries can be searched from other threads
+	ke::Vector<CompiledPattern *> compiled_;
+};
+
+#endif // _INCLUDE_SRCDS_SIGSCANNER_H_
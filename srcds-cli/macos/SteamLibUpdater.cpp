@@ -27,45 +27,33 @@
  */
 
 #include "SteamLibUpdater.h"
+#include "VZipStream.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <stdio.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/time.h>
+#include <thread>
+#include <time.h>
 #include <unistd.h>
-#include "lzma/LzmaLib.h"
+#include "lzma/Alloc.h"
+#include "lzma/LzmaDec.h"
 #include "lzma/Sha256.h"
-#include "miniz/miniz.h"
 #include "cocoa_helpers.h"
 #include "stringutil.h"
 
-#pragma pack(push)
-#pragma pack(1)
-
-struct VZHeader
-{
-	char V;
-	char Z;
-	char version;
-	uint32_t rtime_created;
-};
-
-struct VZFooter
-{
-	uint32_t crc;
-	uint32_t size;
-	char z;
-	char v;
-};
-
-#pragma pack(pop)
-
 #define BASE_URL "https://steamcdn-a.akamaihd.net/client/"
 #define STEAM_MANIFEST_RELEASE	"steam_client_osx"
 #define STEAM_MANIFEST_BETA		"steam_client_publicbeta_osx"
 #define EXT_MANIFEST	".manifest"
 #define EXT_INSTALL 	".installed"
 
-SteamLibUpdater::SteamLibUpdater() : version_(0) {
+SteamLibUpdater::SteamLibUpdater() : version_(0), memoryLimit_(kDefaultMemoryLimit),
+                                     verifyInterval_(kDefaultVerifyInterval), lastVerified_(0) {
 	curl_global_init(CURL_GLOBAL_SSL);
 }
 
@@ -73,21 +61,26 @@ SteamLibUpdater::~SteamLibUpdater() {
 	curl_global_cleanup();
 }
 
+void SteamLibUpdater::SetMemoryLimit(size_t bytes) {
+	memoryLimit_ = bytes;
+}
+
+void SteamLibUpdater::SetVerifyInterval(time_t seconds) {
+	verifyInterval_ = seconds;
+}
+
 void SteamLibUpdater::Update(SteamUniverse universe) {
 	universe_ = universe;
 
-	URL_FILE *manifest = nullptr;
+	SteamManifest manifest;
 	if (!IsUpdateAvailable(universe, manifest))
 		return;
 
-	char buffer[384], key[192], value[192];
-	int level = 0;
-
-	char *shortName = nullptr;
+	// Files that are still as they were last verified don't have to be extracted again if the new
+	// vzips have the same ones
+	Vector<InstallEntry_t> unchanged = GetUnchangedFiles();
 
-	url_rewind(manifest);
 	DeleteOldVZips();
-	DeleteOldFiles();
 
 	chdir("package");
 	FILE *outFile = fopen(GetManifestName(universe_, ManifestType::Default), "wb");
@@ -96,63 +89,26 @@ void SteamLibUpdater::Update(SteamUniverse universe) {
 		return;
 	}
 
-	size_t nread;
-	char manifestBuf[1024];
-
-	do {
-		nread = url_fread(manifestBuf, 1, sizeof(manifestBuf), manifest);
-		fwrite(manifestBuf, 1, nread, outFile);
-	} while (nread);
-
+	fwrite(manifest.data.buffer(), 1, manifest.data.length(), outFile);
 	fclose(outFile);
 
 	printf("Updating Steam libraries...\n");
-	url_rewind(manifest);
 
+	chdir("package");
 	LinkedList<InstallEntry_t> list;
-
-	while (!url_feof(manifest) && url_fgets(buffer, sizeof(buffer), manifest) != nullptr) {
-		char *pBuf = buffer;
-		pBuf = strip_comments(pBuf);
-		pBuf = strtrim(pBuf);
-
-		if (*pBuf == '{')
-			level++;
-		else if (*pBuf == '}' && level > 0)
-			level--;
-		else {
-			splitkv(pBuf, key, sizeof(key), value, sizeof(value));
-
-			if (level == 1) {
-				if (strcasecmp(key, "bins_osx") == 0 ||
-					strcasecmp(key, "bins_client_osx") == 0 ||
-					strcasecmp(key, "breakpad_osx") == 0)
-					shortName = strdup(key);
-				continue;
-			}
-
-			if (shortName && level == 2) {
-				if (strcasecmp(key, "zipvz") == 0) {
-					chdir("package");
-					DownloadVZip(value, shortName);
-					LinkedList<AString> filter;
-					DecompressVZip(value, shortName, list, filter);
-					free(shortName);
-					shortName = nullptr;
-				}
-			}
-		}
+	if (!DownloadVZips(manifest.vzips, list, unchanged)) {
+		printf("Failed to download Steam libraries\n");
+		return;
 	}
 
-	if (shortName)
-		free(shortName);
-
-	url_fclose(manifest);
+	DeleteOldFiles(list);
 
-	WriteInstallList(list);
+	// Every vzip matched its SHA-256 as it was downloaded
+	vzips_ = ke::Move(manifest.vzips);
+	WriteInstallList(list, true);
 }
 
-bool SteamLibUpdater::IsUpdateAvailable(SteamUniverse universe, URL_FILE * &manifest) {
+bool SteamLibUpdater::IsUpdateAvailable(SteamUniverse universe, SteamManifest &manifest) {
 	printf("Checking for Steam library update...\n");
 
 	AString steamPath = GetSteamPath();
@@ -187,56 +143,30 @@ bool SteamLibUpdater::IsUpdateAvailable(SteamUniverse universe, URL_FILE * &mani
 	else
 		printf("Installed version: None\n");
 
-	manifest = url_fopen(GetManifestName(universe_, ManifestType::Url), "r");
-
-	if (!manifest) {
+	if (!DownloadManifest(universe_, manifest) || !ParseManifest(manifest)) {
 		printf("Failed to download Steam manifest!\n");
-		return true;
+		return false;
 	}
 
-	char buffer[256], key[128], value[128];
-	int level = 0;
+	printf("Latest version: %lu\n", manifest.version);
 
-	while (!url_feof(manifest) && url_fgets(buffer, sizeof(buffer), manifest)) {
-		char *pBuf = buffer;
-		pBuf = strip_comments(pBuf);
-		pBuf = strtrim(pBuf);
+	if (manifest.version == version_) {
+		if (universeChanged) {
+			// Special case if universe changed and version remained the same
+			const char *oldManifest = GetManifestName(prevUniverse, ManifestType::Default);
+			const char *newManifest = GetManifestName(universe, ManifestType::Default);
+			rename(oldManifest, newManifest);
+			unlink(GetManifestName(prevUniverse, ManifestType::InstallList));
+			WriteInstallList(installedFiles_, false);
+		}
+		printf("Verifying installation...\n");
 
-		if (*pBuf == '{')
-			level++;
-		else if (*pBuf == '}' && level > 0)
-			level--;
-		else {
-			splitkv(pBuf, key, sizeof(key), value, sizeof(value));
-			if (level == 1) {
-				if (strcasecmp(key, "version") == 0) {
-					unsigned long manifestVersion;
-					if (sscanf(value, "%lu", &manifestVersion) == 1) {
-						printf("Latest version: %s\n", value);
-						if (manifestVersion == version_) {
-							if (universeChanged) {
-								// Special case if universe changed and version remained the same
-								const char *oldManifest = GetManifestName(prevUniverse, ManifestType::Default);
-								const char *newManifest = GetManifestName(universe, ManifestType::Default);
-								rename(oldManifest, newManifest);
-								unlink(GetManifestName(prevUniverse, ManifestType::InstallList));
-								WriteInstallList(installedFiles_);
-							}
-							printf("Verifying installation...\n");
-
-							if (VerifyInstall()) {
-								printf("No Steam library update required\n");
-								return false;
-							}
-
-							printf("Corruption detected\n");
-							return true;
-						}
-					}
-					break;
-				}
-			}
+		if (VerifyInstall()) {
+			printf("No Steam library update required\n");
+			return false;
 		}
+
+		printf("Corruption detected\n");
 	}
 
 	return true;
@@ -259,57 +189,53 @@ bool SteamLibUpdater::IsUniverseChange(SteamUniverse &changedFrom) {
 	return false;
 }
 
+// Reads the whole manifest in one request, since rewinding a transfer would start it over
+bool SteamLibUpdater::DownloadManifest(SteamUniverse universe, SteamManifest &manifest) {
+	URL_FILE *file = url_fopen(GetManifestName(universe, ManifestType::Url), "r");
+	if (!file)
+		return false;
+
+	size_t nread;
+	char buffer[4096];
+
+	manifest.data.clear();
+
+	do {
+		nread = url_fread(buffer, 1, sizeof(buffer), file);
+		size_t used = manifest.data.length();
+		if (nread && manifest.data.resize(used + nread))
+			memcpy(&manifest.data[used], buffer, nread);
+	} while (nread);
+
+	url_fclose(file);
+
+	return manifest.data.length() != 0;
+}
+
 void SteamLibUpdater::ParseManifests(SteamUniverse universe) {
-	FILE *currentManifest = fopen(GetManifestName(universe, ManifestType::Default), "rt");
+	FILE *currentManifest = fopen(GetManifestName(universe, ManifestType::Default), "rb");
 
 	if (!currentManifest)
 		return;
 
-	int level = 0;
-	char buffer[512], key[256], value[256];
-	bool gotFile = false;
-	ManifestEntry_t manifestEntry;
-
-	while (!feof(currentManifest) && fgets(buffer, sizeof(buffer), currentManifest)) {
-		char *pBuf = buffer;
-		pBuf = strip_comments(pBuf);
-		pBuf = strtrim(pBuf);
+	SteamManifest manifest;
+	size_t nread;
+	char buffer[512];
 
-		if (*pBuf == '{')
-			level++;
-		else if (*pBuf == '}' && level > 0)
-			level--;
-		else {
-			splitkv(pBuf, key, sizeof(key), value, sizeof(value));
+	do {
+		nread = fread(buffer, 1, sizeof(buffer), currentManifest);
+		size_t used = manifest.data.length();
+		if (nread && manifest.data.resize(used + nread))
+			memcpy(&manifest.data[used], buffer, nread);
+	} while (nread);
 
-			if (level == 1) {
-				if (strcasecmp(key, "version") == 0) {
-					if (sscanf(value, "%lu", &version_) != 1) {
-						fclose(currentManifest);
-						return;
-					}
-				} else if (strcmp(key, "bins_osx") == 0 ||
-						   strcmp(key, "bins_client_osx") == 0 ||
-						   strcmp(key, "breakpad_osx") == 0) {
-					gotFile = true;
-				}
-			} else if (gotFile && level == 2) {
-				if (strcmp(key, "zipvz") == 0)
-					manifestEntry.filename = value;
-				else if (strcmp(key, "sha2vz") == 0)
-					manifestEntry.sha2 = value;
+	fclose(currentManifest);
 
-				if (manifestEntry.filename.length() && manifestEntry.sha2.length()) {
-					vzips_.append(manifestEntry);
-					manifestEntry.filename = nullptr;
-					manifestEntry.sha2 = nullptr;
-					gotFile = false;
-				}
-			}
-		}
-	}
+	if (!ParseManifest(manifest))
+		return;
 
-	fclose(currentManifest);
+	version_ = manifest.version;
+	vzips_ = ke::Move(manifest.vzips);
 
 	FILE *installList = fopen(GetManifestName(universe, ManifestType::InstallList), "rt");
 
@@ -320,6 +246,10 @@ void SteamLibUpdater::ParseManifests(SteamUniverse universe) {
 	Byte digest[32];
 	Sha256_Init(&sha256);
 
+	// Only trusted once the digest at the end of the list is found to match
+	Vector<VZipState_t> states;
+	time_t verified = 0;
+
 	while (!feof(installList) && fgets(buffer, sizeof(buffer), installList)) {
 		if (strncmp(buffer, "SHA2=", 5) == 0) {
 			AString origSha(&buffer[5], 64);
@@ -332,6 +262,8 @@ void SteamLibUpdater::ParseManifests(SteamUniverse universe) {
 			Sha256_Final(&sha256, digest);
 
 			if (memcmp(&orig, &digest, sizeof(digest)) == 0) {
+				vzipStates_ = ke::Move(states);
+				lastVerified_ = verified;
 				break;
 			} else {
 				installedFiles_.clear();
@@ -342,6 +274,24 @@ void SteamLibUpdater::ParseManifests(SteamUniverse universe) {
 
 		Sha256_Update(&sha256, (Byte *)buffer, strlen(buffer));
 
+		if (strncmp(buffer, "VERIFIED=", 9) == 0) {
+			verified = time_t(strtoll(&buffer[9], nullptr, 10));
+			continue;
+		}
+
+		if (strncmp(buffer, "VZIP=", 5) == 0) {
+			char filename[256];
+			char sha2[65];
+			VZipState_t state;
+			if (sscanf(&buffer[5], "%255[^;];%lld;%llu;%lld;%64[0-9A-Fa-f]", filename, &state.size, &state.inode,
+			           &state.changed, sha2) == 5) {
+				state.filename = filename;
+				state.sha2 = sha2;
+				states.append(state);
+			}
+			continue;
+		}
+
 		char *comma = strchr(buffer, ',');
 		if (comma)
 			*comma = '\0';
@@ -350,7 +300,8 @@ void SteamLibUpdater::ParseManifests(SteamUniverse universe) {
 
 		InstallEntry_t entry;
 		entry.filename = buffer;
-		sscanf(comma + 1, "%lld;%ld;%u", &entry.size, &entry.timestamp, &entry.crc);
+		sscanf(comma + 1, "%lld;%ld;%u;%llu;%lld", &entry.size, &entry.timestamp, &entry.crc, &entry.inode,
+		       &entry.changed);
 
 		installedFiles_.append(entry);
 	}
@@ -365,163 +316,570 @@ void SteamLibUpdater::DeleteOldVZips() {
 		unlink(vzip.filename.chars());
 }
 
-void SteamLibUpdater::DeleteOldFiles() {
+// Deletes what the previous install had that the new one in list doesn't
+void SteamLibUpdater::DeleteOldFiles(LinkedList<InstallEntry_t> &list) {
+	Vector<InstallEntry_t> current;
+	for (InstallEntry_t &entry : list)
+		current.append(entry);
+	SortInstallEntries(current);
+
+	int rootfd = open("..", O_RDONLY | O_DIRECTORY);
+	if (rootfd == -1)
+		return;
+
 	Vector<AString> directories;
 
 	// First delete all files
-	for (InstallEntry_t entry : installedFiles_) {
+	for (InstallEntry_t &entry : installedFiles_) {
 		const char *filename = entry.filename.chars();
+		if (FindInstallEntry(current, filename))
+			continue;
 
 		if (entry.size == -1)
 			directories.append(AString(filename));
 		else
-			unlink(filename);
+			unlinkat(rootfd, filename, 0);
 	}
 
 	// Then delete directories
 	for (auto it = directories.end(); it-- != directories.begin();)
-		rmdir((*it).chars());
+		unlinkat(rootfd, (*it).chars(), AT_REMOVEDIR);
+
+	close(rootfd);
+}
+
+static int64_t GetChangeTime(const struct stat &statbuf) {
+	return int64_t(statbuf.st_ctimespec.tv_sec) * 1000000000 + statbuf.st_ctimespec.tv_nsec;
+}
+
+static bool IsFileUnchanged(int rootfd, const InstallEntry_t &entry) {
+	struct stat statbuf;
+	if (fstatat(rootfd, entry.filename.chars(), &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+		return false;
+
+	// Directories change whenever anything is added to them, and only have to exist
+	if (entry.size == -1)
+		return true;
+
+	return uint64_t(statbuf.st_ino) == entry.inode && GetChangeTime(statbuf) == entry.changed &&
+	       (entry.size == -2 || (statbuf.st_size == entry.size && statbuf.st_mtimespec.tv_sec == entry.timestamp));
+}
+
+// Regular files of the previous install that haven't changed since they were last verified
+Vector<InstallEntry_t> SteamLibUpdater::GetUnchangedFiles() {
+	Vector<InstallEntry_t> unchanged;
+
+	int rootfd = open("..", O_RDONLY | O_DIRECTORY);
+	if (rootfd == -1)
+		return unchanged;
+
+	for (InstallEntry_t &entry : installedFiles_) {
+		if (entry.size >= 0 && IsFileUnchanged(rootfd, entry))
+			unchanged.append(entry);
+	}
+
+	close(rootfd);
+	SortInstallEntries(unchanged);
+	return unchanged;
 }
 
 bool SteamLibUpdater::VerifyInstall() {
 	if (vzips_.length() == 0)
 		return false;
 
-	for (ManifestEntry_t vzip : vzips_) {
-		if (!VerifyVZip(vzip.filename.chars(), vzip.sha2.chars()))
-			return false;
-	}
+	if (IsInstallUnchanged())
+		return true;
+
+	if (!VerifyVZips(vzips_))
+		return false;
 
 	chdir("..");
 	LinkedList<AString> files;
 	if (!VerifyInstalledFiles(files))
-		ExtractFiles(files);
+		return ExtractFiles(files);
 
+	WriteInstallList(installedFiles_, true);
 	return true;
 }
 
-bool SteamLibUpdater::VerifyVZip(const char *vzip, const char *shastr) {
-	int vfd = open(vzip, O_RDONLY);
-	if (vfd == -1)
+// Whether the vzips and installed files are all exactly as they were when they were last verified,
+// which takes one stat of each and no reads. Anything that writes to a file changes its change time,
+// even if the modification time is put back afterwards, and replacing it changes its inode.
+bool SteamLibUpdater::IsInstallUnchanged() {
+	time_t now = time(nullptr);
+	if (lastVerified_ == 0 || now < lastVerified_ || now - lastVerified_ >= verifyInterval_)
+		return false;
+
+	for (const ManifestEntry_t &vzip : vzips_) {
+		const VZipState_t *state = nullptr;
+		for (const VZipState_t &s : vzipStates_) {
+			if (s.filename.compare(vzip.filename.chars()) == 0) {
+				state = &s;
+				break;
+			}
+		}
+
+		struct stat statbuf;
+		if (!state || strcasecmp(state->sha2.chars(), vzip.sha2.chars()) != 0 ||
+		    stat(vzip.filename.chars(), &statbuf) != 0 || statbuf.st_size != state->size ||
+		    uint64_t(statbuf.st_ino) != state->inode || GetChangeTime(statbuf) != state->changed)
+			return false;
+	}
+
+	// Installed files are relative to the parent of the package directory
+	int rootfd = open("..", O_RDONLY | O_DIRECTORY);
+	if (rootfd == -1)
 		return false;
 
+	bool unchanged = true;
+	for (InstallEntry_t &entry : installedFiles_) {
+		if (!IsFileUnchanged(rootfd, entry)) {
+			unchanged = false;
+			break;
+		}
+	}
+
+	close(rootfd);
+	return unchanged;
+}
+
+// Hashes the vzips together with Sha256_UpdateMulti, which can interleave them on one core
+bool SteamLibUpdater::VerifyVZips(const Vector<ManifestEntry_t> &vzips) {
+	for (size_t first = 0; first < vzips.length(); first += SHA256_MULTI_MAX) {
+		size_t num = vzips.length() - first;
+		if (num > SHA256_MULTI_MAX)
+			num = SHA256_MULTI_MAX;
+
+		CSha256 sha256[SHA256_MULTI_MAX];
+		CSha256 *contexts[SHA256_MULTI_MAX];
+		const Byte *data[SHA256_MULTI_MAX];
+		size_t sizes[SHA256_MULTI_MAX];
+		bool result = true;
+
+		for (size_t i = 0; i < num; i++) {
+			contexts[i] = &sha256[i];
+			data[i] = (const Byte *)MAP_FAILED;
+			sizes[i] = 0;
+			Sha256_Init(contexts[i]);
+
+			int vfd = open(vzips[first + i].filename.chars(), O_RDONLY);
+			if (vfd == -1) {
+				result = false;
+				continue;
+			}
+
+			struct stat statbuf;
+			if (fstat(vfd, &statbuf) == 0 && statbuf.st_size > 0) {
+				sizes[i] = statbuf.st_size;
+				data[i] = (const Byte *)mmap(NULL, sizes[i], PROT_READ, MAP_PRIVATE, vfd, 0);
+			}
+			close(vfd);
+
+			if (data[i] == MAP_FAILED)
+				result = false;
+		}
+
+		if (result)
+			Sha256_UpdateMulti(contexts, data, sizes, unsigned(num));
+
+		for (size_t i = 0; i < num; i++) {
+			if (data[i] != MAP_FAILED)
+				munmap((void *)data[i], sizes[i]);
+
+			Byte digest[32];
+			Byte orig[32];
+			Sha256_Final(contexts[i], digest);
+			HexStringToBytes(vzips[first + i].sha2, orig, sizeof(orig));
+
+			// Compare digest of vzip that was downloaded to what the manifest says it should be
+			if (memcmp(&orig, &digest, sizeof(digest)) != 0)
+				result = false;
+		}
+
+		if (!result)
+			return false;
+	}
+
+	return true;
+}
+
+// Starts reading a file into the page cache, so that it is already there or on its way when a
+// worker gets to it
+static void Readahead(const InstallEntry_t &entry) {
+	if (entry.size <= 0)
+		return;
+
+	int fd = open(entry.filename.chars(), O_RDONLY);
+	if (fd == -1)
+		return;
+
+#if defined(F_RDADVISE)
+	for (int64_t offset = 0; offset < entry.size; offset += INT_MAX) {
+		int64_t count = entry.size - offset;
+		struct radvisory advice = {off_t(offset), int(count < INT_MAX ? count : INT_MAX)};
+		fcntl(fd, F_RDADVISE, &advice);
+	}
+#elif defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, 0, off_t(entry.size), POSIX_FADV_WILLNEED);
+#endif
+
+	close(fd);
+}
+
+static bool IsInstalledFileValid(const InstallEntry_t &entry) {
 	struct stat statbuf;
-	if (fstat(vfd, &statbuf) != 0)
+	const char *filename = entry.filename.chars();
+	if (lstat(filename, &statbuf) != 0)
 		return false;
 
-	unsigned char *src = (unsigned char *)mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, vfd, 0);
-	close(vfd);
-	if (src == MAP_FAILED)
+	if (entry.size == -1)
+		return true;
+
+	if (entry.size != -2 &&
+		(statbuf.st_size != entry.size || statbuf.st_mtimespec.tv_sec != entry.timestamp))
 		return false;
 
-	AString origSha(shastr);
-	CSha256 sha256;
-	Byte digest[32];
-	Sha256_Init(&sha256);
-	Sha256_Update(&sha256, src, statbuf.st_size);
-	Sha256_Final(&sha256, digest);
+	// Can't be mapped, and has nothing to check
+	if (statbuf.st_size == 0)
+		return entry.crc == MZ_CRC32_INIT;
 
-	Byte orig[32];
+	unsigned char *data;
+	if (entry.size == -2) {
+		data = new unsigned char[statbuf.st_size];
+		readlink(filename, (char*)data, statbuf.st_size);
+	} else {
+		int fd = open(filename, O_RDONLY);
+		if (fd == -1)
+			return false;
 
-	HexStringToBytes(origSha, orig, sizeof(orig));
+		data = (unsigned char *)mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
 
-	bool result = false;
+		if (data == MAP_FAILED)
+			return false;
+	}
 
-	// Compare digest of vzip that was downloaded to what the manifest says it should be
-	if (memcmp(&orig, &digest, sizeof(digest)) == 0)
-		result = true;
+	bool result = mz_crc32(MZ_CRC32_INIT, data, statbuf.st_size) == entry.crc;
 
-	munmap(src, statbuf.st_size);
+	if (entry.size == -2)
+		delete [] data;
+	else
+		munmap(data, statbuf.st_size);
 
 	return result;
 }
 
+// Files are checked on a pool of workers while this thread keeps readahead going for the files
+// just past the ones they have claimed, so that a cold page cache is read at the disk's throughput
+// instead of waiting out the latency of one file at a time. Bad files are still listed in the
+// order of the install list.
 bool SteamLibUpdater::VerifyInstalledFiles(LinkedList<AString> &files) {
 	if (installedFiles_.length() == 0) {
 		printf("Found corrupted install list. Re-extracting all Steam files\n");
 		return false;
 	}
 
-	for (InstallEntry_t entry : installedFiles_) {
-		struct stat statbuf;
-		const char *filename = entry.filename.chars();
-		if (lstat(filename, &statbuf) != 0) {
-			files.append(AString(filename));
-			continue;
+	Vector<const InstallEntry_t *> entries;
+	Vector<uint64_t> offsets;	// bytes in the files before each one
+	Vector<char> valid;
+	uint64_t total = 0;
+	for (InstallEntry_t &entry : installedFiles_) {
+		entries.append(&entry);
+		offsets.append(total);
+		valid.append(false);
+		if (entry.size > 0)
+			total += entry.size;
+	}
+
+	std::atomic<size_t> next(0);
+	std::atomic<unsigned int> running(0);
+
+	auto worker = [&]() {
+		for (size_t i; (i = next++) < entries.length(); )
+			valid[i] = IsInstalledFileValid(*entries[i]);
+		running--;
+	};
+
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	if (numThreads > entries.length())
+		numThreads = unsigned(entries.length());
+	if (numThreads == 0)
+		numThreads = 1;
+
+	Vector<std::thread> threads;
+	running = numThreads;
+	for (unsigned int i = 0; i < numThreads; i++)
+		threads.append(std::thread(worker));
+
+	// Stays at most kReadaheadBytes ahead of the workers, so what is read ahead isn't evicted
+	// before it is checked
+	for (size_t i = 0; i < entries.length() && running != 0; i++) {
+		for (;;) {
+			size_t claimed = next;
+			if (claimed >= entries.length() || i <= claimed ||
+			    offsets[i] - offsets[claimed] < kReadaheadBytes)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
 		}
 
-		if (entry.size == -1)
+		if (i >= next)
+			Readahead(*entries[i]);
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	for (size_t i = 0; i < entries.length(); i++) {
+		if (!valid[i])
+			files.append(entries[i]->filename);
+	}
+
+	return files.length() == 0;
+}
+
+struct VZipTransfer
+{
+	CURL *curl;
+	FILE *file;
+	VZipStream *stream;
+	const char *filename;
+	size_t received;
+};
+
+static size_t WriteVZip(char *data, size_t size, size_t nitems, void *userp) {
+	VZipTransfer *transfer = (VZipTransfer *)userp;
+
+	// Writing less than was received makes curl fail the transfer
+	size_t written = fwrite(data, 1, size * nitems, transfer->file);
+	transfer->stream->Write((const unsigned char *)data, written);
+	transfer->received += written;
+	return written;
+}
+
+// Downloads every vzip at the same time on one multi handle, so an update takes as long as the
+// largest download rather than all of them one after another. Each vzip is extracted as it
+// arrives, and is still saved so that the install can be verified and repaired from it later.
+bool SteamLibUpdater::DownloadVZips(const Vector<ManifestEntry_t> &vzips, LinkedList<InstallEntry_t> &list,
+                                    const Vector<InstallEntry_t> &unchanged) {
+	using namespace std::chrono;
+
+	Vector<VZipTransfer> transfers;
+	if (!transfers.resize(vzips.length()))
+		return false;
+
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return false;
+
+	size_t total = 0;
+	bool result = true;
+
+	for (size_t i = 0; i < vzips.length() && result; i++) {
+		VZipTransfer &transfer = transfers[i];
+		const char *filename = vzips[i].filename.chars();
+
+		transfer.filename = filename;
+		transfer.received = 0;
+		transfer.curl = nullptr;
+		transfer.stream = nullptr;
+		transfer.file = fopen(filename, "wb");
+		if (!transfer.file) {
+			printf("Failed to open %s for writing\n", filename);
+			result = false;
+			break;
+		}
+
+		// The size of a vzip follows the last underscore in its name
+		const char *sizePos = strrchr(filename, '_');
+		size_t size;
+		if (sizePos && sscanf(sizePos + 1, "%zu", &size) == 1)
+			total += size;
+
+		Byte sha2[32];
+		HexStringToBytes(vzips[i].sha2, sha2, sizeof(sha2));
+		transfer.stream = new VZipStream(vzips[i].name.chars(), sha2, "../", unchanged);
+
+		AString url(BASE_URL);
+		url.append(filename);
+
+		transfer.curl = curl_easy_init();
+		if (!transfer.curl) {
+			result = false;
+			break;
+		}
+
+		curl_easy_setopt(transfer.curl, CURLOPT_URL, url.chars());
+		curl_easy_setopt(transfer.curl, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(transfer.curl, CURLOPT_WRITEFUNCTION, WriteVZip);
+		curl_easy_setopt(transfer.curl, CURLOPT_WRITEDATA, &transfer);
+		curl_multi_add_handle(multi, transfer.curl);
+	}
+
+	int running = 0;
+	steady_clock::time_point lastProgress;
+
+	while (result) {
+		CURLMcode mc = curl_multi_perform(multi, &running);
+		if (mc == CURLM_OK && running)
+			mc = curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+
+		if (mc != CURLM_OK) {
+			printf("\nDownload failed: %s\n", curl_multi_strerror(mc));
+			result = false;
+			break;
+		}
+
+		// Progress is only printed a few times a second, and once more when everything is done
+		steady_clock::time_point now = steady_clock::now();
+		if (running && now - lastProgress < milliseconds(250))
 			continue;
+		lastProgress = now;
+
+		size_t received = 0;
+		for (VZipTransfer &transfer : transfers)
+			received += transfer.received;
+
+		printf("Downloading and extracting %zu files... %.2f%%\r", vzips.length(),
+		       total ? double(received) / total * 100.0 : 0.0);
+		fflush(stdout);
+
+		if (!running) {
+			printf("\n");
+			break;
+		}
+	}
 
-		if (entry.size != -2 &&
-			(statbuf.st_size != entry.size || statbuf.st_mtimespec.tv_sec != entry.timestamp)) {
-			files.append(AString(filename));
+	int remaining;
+	while (CURLMsg *msg = curl_multi_info_read(multi, &remaining)) {
+		if (msg->msg != CURLMSG_DONE || msg->data.result == CURLE_OK)
 			continue;
+
+		for (VZipTransfer &transfer : transfers) {
+			if (transfer.curl == msg->easy_handle)
+				printf("Failed to download %s: %s\n", transfer.filename, curl_easy_strerror(msg->data.result));
 		}
+		result = false;
+	}
 
-		unsigned char *data;
-		if (entry.size == -2) {
-			data = new unsigned char[statbuf.st_size];
-			readlink(filename, (char*)data, statbuf.st_size);
-		} else {
-			int fd = open(filename, O_RDONLY);
-			if (fd == -1) {
-				files.append(AString(filename));
-				continue;
-			}
+	for (VZipTransfer &transfer : transfers) {
+		if (transfer.curl) {
+			curl_multi_remove_handle(multi, transfer.curl);
+			curl_easy_cleanup(transfer.curl);
+		}
 
-			data = (unsigned char *)mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-			close(fd);
+		if (transfer.file && fclose(transfer.file) != 0)
+			result = false;
+	}
 
-			if (data == MAP_FAILED) {
-				files.append(AString(filename));
-				continue;
+	curl_multi_cleanup(multi);
+
+	for (size_t i = 0; i < transfers.length() && result; i++) {
+		VZipTransfer &transfer = transfers[i];
+
+		if (!transfer.stream->Finish()) {
+			result = false;
+			break;
+		}
+
+		if (transfer.stream->IsExtracted()) {
+			for (const InstallEntry_t &entry : transfer.stream->GetEntries()) {
+				InstallEntry_t copy = entry;
+				AddToSortedInstallList(copy, list);
 			}
+		} else {
+			// Extract the saved vzip instead, which leaves the package directory when it is done
+			result = DecompressVZip(transfer.filename, vzips[i].name.chars(), list, unchanged);
+			chdir("package");
 		}
+	}
 
-		if (mz_crc32(MZ_CRC32_INIT, data, statbuf.st_size) != entry.crc)
-			files.append(AString(filename));
+	for (VZipTransfer &transfer : transfers)
+		delete transfer.stream;
 
-		if (entry.size == -2)
-			delete [] data;
-		else
-			munmap(data, statbuf.st_size);
+	return result;
+}
+
+struct ExtractJob
+{
+	mz_uint index;
+	InstallEntry_t entry;
+	bool extracted;
+};
+
+// Spill files are read with pread so that readers on different threads don't share a file offset
+static size_t ReadSpill(void *opaque, mz_uint64 offset, void *buf, size_t n) {
+	ssize_t nread = pread(int(intptr_t(opaque)), buf, n, off_t(offset));
+	return nread < 0 ? 0 : size_t(nread);
+}
+
+static bool InitZipReader(mz_zip_archive *zip, const unsigned char *dest, FILE *spill, size_t dlen) {
+	memset(zip, 0, sizeof(*zip));
+
+	if (dest)
+		return mz_zip_reader_init_mem(zip, dest, dlen, 0);
+
+	zip->m_pRead = ReadSpill;
+	zip->m_pIO_opaque = (void *)intptr_t(fileno(spill));
+	return mz_zip_reader_init(zip, dlen, 0);
+}
+
+static size_t WriteExtracted(void *opaque, mz_uint64 offset, const void *buf, size_t n) {
+	int fd = int(intptr_t(opaque));
+	const char *pos = (const char *)buf;
+	size_t left = n;
+
+	while (left) {
+		ssize_t written = pwrite(fd, pos, left, off_t(offset));
+		if (written <= 0)
+			return 0;
+
+		pos += written;
+		left -= written;
+		offset += written;
 	}
 
-	return files.length() == 0;
+	return n;
 }
 
-void SteamLibUpdater::DownloadVZip(const char *filename, const char *shortName) {
-	AString url(BASE_URL);
-	url.append(filename);
+static bool ExtractToFile(mz_zip_archive *zip, int rootfd, const ExtractJob &job) {
+	const char *filename = job.entry.filename.chars();
 
-	URL_FILE *file = url_fopen(url.chars(), "r");
-	FILE *outf = fopen(filename, "wb");
-	size_t nread;
-	char buffer[4096];
+	// Written next to the old file and renamed over it once complete, which leaves a library that
+	// is loaded intact and never leaves a partly written one in its place
+	AString tempName(filename);
+	tempName.append(".new");
+	unlinkat(rootfd, tempName.chars(), 0);
+	int fd = openat(rootfd, tempName.chars(), O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (fd == -1)
+		return false;
 
-	const char *sizePos = strrchr(filename, '_') + 1;
-	size_t size;
-	sscanf(sizePos, "%zu", &size);
-	size_t total_read = 0;
+	// Sized up front so the file doesn't have to grow with every write
+#if defined(F_PREALLOCATE)
+	fstore_t store = {F_ALLOCATEALL, F_PEOFPOSMODE, 0, off_t(job.entry.size), 0};
+	fcntl(fd, F_PREALLOCATE, &store);
+#endif
+	ftruncate(fd, off_t(job.entry.size));
 
-	do {
-		nread = url_fread(buffer, 1, sizeof(buffer), file);
-		total_read += nread;
-		printf("Downloading %s... %.2f%%\r", shortName, double(total_read) / size * 100.0f);
-		fflush(stdout);
-		fwrite(buffer, 1, nread, outf);
-	} while (nread);
+	bool result = mz_zip_reader_extract_to_callback(zip, job.index, WriteExtracted, (void *)intptr_t(fd), 0);
 
-	printf("\n");
+	struct timeval times[2] = {{job.entry.timestamp, 0}, {job.entry.timestamp, 0}};
+	futimes(fd, times);
+	fchmod(fd, 0755);
 
-	fclose(outf);
-	url_fclose(file);
+	if (close(fd) != 0)
+		result = false;
+
+	if (result)
+		result = renameat(rootfd, tempName.chars(), rootfd, filename) == 0;
+	if (!result)
+		unlinkat(rootfd, tempName.chars(), 0);
+
+	return result;
 }
 
 bool SteamLibUpdater::DecompressVZip(const char *path, const char *shortName,
                                      LinkedList<InstallEntry_t> &list,
-                                     LinkedList<AString> &filter) {
+                                     const Vector<InstallEntry_t> &unchanged) {
 	int vfd = open(path, O_RDONLY);
 	if (vfd == -1) {
 		printf("Failed to open vzip file!\n");
@@ -543,8 +901,6 @@ bool SteamLibUpdater::DecompressVZip(const char *path, const char *shortName,
 	}
 
 	size_t dlen = *(unsigned int *)&src[statbuf.st_size - sizeof(VZFooter) + sizeof(VZFooter::crc)];
-
-	unsigned char *dest = (unsigned char *)malloc(dlen);
 	size_t slen = statbuf.st_size - sizeof(VZHeader) - sizeof(VZFooter) - LZMA_PROPS_SIZE;
 
 	bool freeName = false;
@@ -556,25 +912,56 @@ bool SteamLibUpdater::DecompressVZip(const char *path, const char *shortName,
 		shortName = p;
 		freeName = true;
 	}
-	printf("Decompressing %s... ", shortName);
-	fflush(stdout);
+	// Archives that fit in the memory limit are decoded to memory. Larger ones are decoded to a
+	// spill file that miniz reads back, which is unlinked right away so it never outlives us.
+	unsigned char *dest = nullptr;
+	FILE *spill = nullptr;
+	if (dlen <= memoryLimit_) {
+		dest = (unsigned char *)malloc(dlen);
+	} else {
+		AString spillPath(path);
+		spillPath.append(".zip");
+		spill = fopen(spillPath.chars(), "w+b");
+		unlink(spillPath.chars());
+	}
 
-	LzmaUncompress(dest, &dlen, &src[sizeof(VZHeader) + LZMA_PROPS_SIZE], &slen,
-	               &src[sizeof(VZHeader)], LZMA_PROPS_SIZE);
+	if (!dest && !spill) {
+		printf("Failed to allocate space to decompress %s\n", shortName);
+		munmap(src, statbuf.st_size);
+		if (freeName)
+			delete [] shortName;
+		return false;
+	}
 
-	printf("100.00%%\n");
+	bool decoded = DecodeVZip(&src[sizeof(VZHeader) + LZMA_PROPS_SIZE], slen, &src[sizeof(VZHeader)],
+	                          shortName, dest, spill, dlen);
+	munmap(src, statbuf.st_size);
 
 	mz_zip_archive zip_archive;
-	memset(&zip_archive, 0, sizeof(zip_archive));
-	mz_zip_reader_init_mem(&zip_archive, dest, dlen, 0);
+	if (decoded && spill)
+		decoded = fflush(spill) == 0;
+	if (decoded)
+		decoded = InitZipReader(&zip_archive, dest, spill, dlen);
+
+	if (!decoded) {
+		printf("Failed to decompress %s\n", shortName);
+		free(dest);
+		if (spill)
+			fclose(spill);
+		if (freeName)
+			delete [] shortName;
+		return false;
+	}
+
 	chdir("..");
 
+	// Directories and symbolic links are created first, so the regular files that are left can be
+	// extracted in any order by the workers
+	Vector<ExtractJob> jobs;
+
 	mz_uint numFiles = mz_zip_reader_get_num_files(&zip_archive);
 	for (mz_uint i = 0; i < numFiles; i++)
 	{
-		printf("Extracting %s... %.2f%%\r", shortName, double(i) / numFiles * 100.0f);
-		fflush(stdout);
-
 		mz_zip_archive_file_stat file_stat;
 		if (!mz_zip_reader_file_stat(&zip_archive, i, &file_stat))
 		{
@@ -589,11 +976,6 @@ bool SteamLibUpdater::DecompressVZip(const char *path, const char *shortName,
 				file_stat.m_filename[i] = '/';
 		}
 
-		for (AString name : filter) {
-			if (name.compare(file_stat.m_filename) == 0)
-				continue;
-		}
-
 		InstallEntry_t entry;
 		entry.filename = file_stat.m_filename;
 		entry.timestamp = file_stat.m_time;
@@ -627,45 +1009,231 @@ bool SteamLibUpdater::DecompressVZip(const char *path, const char *shortName,
 			}
 			else
 			{
-				mz_zip_reader_extract_to_file(&zip_archive, i, file_stat.m_filename, 0);
-				chmod(file_stat.m_filename, 0755);
 				entry.size = file_stat.m_uncomp_size;
+				if (!KeepUnchanged(unchanged, entry.filename.chars(), entry)) {
+					// Directories usually have their own entries first, but not always
+					const char *slash = strrchr(file_stat.m_filename, '/');
+					if (slash) {
+						AString parent(file_stat.m_filename, slash - file_stat.m_filename);
+						mkpath(parent.chars(), 0755);
+					}
+
+					jobs.append(ExtractJob{i, entry, false});
+					continue;
+				}
 			}
 		}
 
 		AddToSortedInstallList(entry, list);
 	}
 
+	mz_zip_reader_end(&zip_archive);
+
+	// Largest first, so that no worker is left with a big file at the end
+	std::sort(jobs.begin(), jobs.end(), [](const ExtractJob &a, const ExtractJob &b) {
+		return a.entry.size > b.entry.size;
+	});
+
+	int rootfd = open(".", O_RDONLY | O_DIRECTORY);
+	std::atomic<size_t> next(0), done(0);
+	std::atomic<unsigned int> running(0);
+	std::atomic<bool> failed(rootfd == -1);
+
+	// Each worker has its own reader, since miniz keeps per-archive state while extracting
+	auto worker = [&]() {
+		mz_zip_archive zip;
+		if (!InitZipReader(&zip, dest, spill, dlen)) {
+			failed = true;
+		} else {
+			for (size_t i; (i = next++) < jobs.length(); done++) {
+				jobs[i].extracted = ExtractToFile(&zip, rootfd, jobs[i]);
+				if (!jobs[i].extracted) {
+					printf("\nFailed to extract %s\n", jobs[i].entry.filename.chars());
+					failed = true;
+				}
+			}
+
+			mz_zip_reader_end(&zip);
+		}
+		running--;
+	};
+
+	unsigned int numThreads = std::thread::hardware_concurrency();
+	if (numThreads > jobs.length())
+		numThreads = unsigned(jobs.length());
+	if (numThreads == 0 || rootfd == -1)
+		numThreads = 0;
+
+	Vector<std::thread> threads;
+	running = numThreads;
+	for (unsigned int i = 0; i < numThreads; i++)
+		threads.append(std::thread(worker));
+
+	size_t numOther = numFiles - jobs.length();
+	for (;;) {
+		printf("Extracting %s... %.2f%%\r", shortName, double(numOther + done) / numFiles * 100.0f);
+		fflush(stdout);
+
+		if (running == 0)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	for (std::thread &thread : threads)
+		thread.join();
+
 	printf("Extracting %s... %.2f%%\n", shortName, 100.0f);
 
-	mz_zip_reader_end(&zip_archive);
+	if (rootfd != -1)
+		close(rootfd);
 
-	munmap(src, statbuf.st_size);
+	// The list only holds what is actually installed, so files that failed to extract are left out
+	for (ExtractJob &job : jobs) {
+		if (job.extracted)
+			AddToSortedInstallList(job.entry, list);
+	}
+
+	free(dest);
+	if (spill)
+		fclose(spill);
 
 	if (freeName)
 		delete [] shortName;
 
-	return true;
+	return !failed;
+}
+
+// Decodes the LZMA stream of a vzip a window at a time, so that it is either written straight into
+// dest or only a window of it is held before being written to spill. The decoder itself only
+// needs as much memory as the dictionary size the vzip was compressed with.
+bool SteamLibUpdater::DecodeVZip(const unsigned char *src, size_t slen, const unsigned char *props,
+                                 const char *shortName, unsigned char *dest, FILE *spill, size_t dlen) {
+	CLzmaDec dec;
+	LzmaDec_Construct(&dec);
+	if (LzmaDec_Allocate(&dec, props, LZMA_PROPS_SIZE, &g_Alloc) != SZ_OK)
+		return false;
+
+	LzmaDec_Init(&dec);
+
+	unsigned char *window = dest ? nullptr : (unsigned char *)malloc(kDecodeWindow);
+	size_t done = 0;
+
+	while ((dest || window) && done < dlen) {
+		SizeT outLen = dlen - done < kDecodeWindow ? dlen - done : kDecodeWindow;
+		SizeT inLen = slen;
+		ELzmaStatus status;
+
+		unsigned char *out = dest ? &dest[done] : window;
+		if (LzmaDec_DecodeToBuf(&dec, out, &outLen, src, &inLen, LZMA_FINISH_ANY, &status) != SZ_OK)
+			break;
+
+		src += inLen;
+		slen -= inLen;
+
+		if (spill && fwrite(window, 1, outLen, spill) != outLen)
+			break;
+
+		done += outLen;
+
+		printf("Decompressing %s... %.2f%%\r", shortName, double(done) / dlen * 100.0);
+		fflush(stdout);
+
+		// Nothing more can be decoded from a truncated stream
+		if (outLen == 0)
+			break;
+	}
+
+	printf("\n");
+
+	free(window);
+	LzmaDec_Free(&dec, &g_Alloc);
+
+	return done == dlen;
 }
 
-void SteamLibUpdater::ExtractFiles(LinkedList<AString> &files) {
+bool SteamLibUpdater::ExtractFiles(LinkedList<AString> &files) {
+	// Everything else was just found to be intact, so only the bad files are rewritten
+	Vector<InstallEntry_t> unchanged;
+	for (InstallEntry_t &entry : installedFiles_) {
+		bool bad = false;
+		for (AString &name : files) {
+			if (name.compare(entry.filename.chars()) == 0) {
+				bad = true;
+				break;
+			}
+		}
+
+		if (!bad && entry.size >= 0)
+			unchanged.append(entry);
+	}
+	SortInstallEntries(unchanged);
+
+	bool result = true;
 	LinkedList<InstallEntry_t> list;
 	for (ManifestEntry_t vzip : vzips_) {
 		chdir("package");
-		DecompressVZip(vzip.filename.chars(), nullptr, list, files);
+		if (!DecompressVZip(vzip.filename.chars(), nullptr, list, unchanged))
+			result = false;
+	}
+
+	if (result) {
+		WriteInstallList(list, true);
+		return true;
 	}
 
-	WriteInstallList(list);
+	// The old list still names the files that failed, and the next start checks every file again
+	lastVerified_ = 0;
+	WriteInstallList(installedFiles_, false);
+	return false;
 }
 
-void SteamLibUpdater::WriteInstallList(LinkedList<InstallEntry_t> &list) {
+// When verified, everything in the list was just checked or extracted, so it is recorded as it is
+// now for IsInstallUnchanged to compare against on later starts
+void SteamLibUpdater::WriteInstallList(LinkedList<InstallEntry_t> &list, bool verified) {
 	chdir("package");
+
+	if (verified) {
+		int rootfd = open("..", O_RDONLY | O_DIRECTORY);
+		for (InstallEntry_t &e : list) {
+			struct stat statbuf;
+			if (rootfd != -1 && fstatat(rootfd, e.filename.chars(), &statbuf, AT_SYMLINK_NOFOLLOW) == 0) {
+				e.inode = statbuf.st_ino;
+				e.changed = GetChangeTime(statbuf);
+			} else {
+				e.inode = 0;
+				e.changed = 0;
+			}
+		}
+		if (rootfd != -1)
+			close(rootfd);
+
+		vzipStates_.clear();
+		for (const ManifestEntry_t &vzip : vzips_) {
+			struct stat statbuf;
+			if (stat(vzip.filename.chars(), &statbuf) == 0) {
+				vzipStates_.append(VZipState_t{vzip.filename, vzip.sha2, statbuf.st_size, uint64_t(statbuf.st_ino),
+				                               GetChangeTime(statbuf)});
+			}
+		}
+
+		lastVerified_ = time(nullptr);
+	}
+
 	FILE *installManifest = fopen(GetManifestName(universe_, ManifestType::InstallList), "w+");
 
 	for (InstallEntry_t e : list) {
-		fprintf(installManifest, "%s,%lld;%ld;%u\n", e.filename.chars(), e.size, e.timestamp, e.crc);
+		fprintf(installManifest, "%s,%lld;%ld;%u;%llu;%lld\n", e.filename.chars(), e.size, e.timestamp, e.crc,
+		        e.inode, e.changed);
 	}
 
+	for (const VZipState_t &state : vzipStates_) {
+		fprintf(installManifest, "VZIP=%s;%lld;%llu;%lld;%s\n", state.filename.chars(), state.size, state.inode,
+		        state.changed, state.sha2.chars());
+	}
+
+	if (lastVerified_ != 0)
+		fprintf(installManifest, "VERIFIED=%lld\n", (long long)lastVerified_);
+
 	rewind(installManifest);
 	size_t read;
 	char line[1024];
@@ -716,6 +1284,68 @@ constexpr const char *SteamLibUpdater::GetManifestName(SteamUniverse universe, M
 	}
 }
 
+// Parses the version and the vzip of each package that the Steam libraries come from
+bool SteamLibUpdater::ParseManifest(SteamManifest &manifest) {
+	const char *pos = manifest.data.buffer();
+	const char *end = pos + manifest.data.length();
+
+	char buffer[512], key[256], value[256];
+	int level = 0;
+	bool gotVersion = false;
+	ManifestEntry_t manifestEntry;
+
+	manifest.version = 0;
+	manifest.vzips.clear();
+
+	while (pos < end) {
+		const char *eol = (const char *)memchr(pos, '\n', end - pos);
+		const char *next = eol ? eol + 1 : end;
+		size_t len = next - pos;
+
+		// Lines keep their newline like they would from fgets, and overly long ones are cut short
+		strncopy(buffer, pos, len + 1 < sizeof(buffer) ? len + 1 : sizeof(buffer));
+		pos = next;
+
+		char *pBuf = buffer;
+		pBuf = strip_comments(pBuf);
+		pBuf = strtrim(pBuf);
+
+		if (*pBuf == '{')
+			level++;
+		else if (*pBuf == '}' && level > 0)
+			level--;
+		else {
+			splitkv(pBuf, key, sizeof(key), value, sizeof(value));
+
+			if (level == 1) {
+				if (strcasecmp(key, "version") == 0) {
+					gotVersion = sscanf(value, "%lu", &manifest.version) == 1;
+				} else if (strcasecmp(key, "bins_osx") == 0 ||
+						   strcasecmp(key, "bins_client_osx") == 0 ||
+						   strcasecmp(key, "breakpad_osx") == 0) {
+					manifestEntry.name = key;
+					manifestEntry.filename = nullptr;
+					manifestEntry.sha2 = nullptr;
+				}
+			} else if (manifestEntry.name.length() && level == 2) {
+				if (strcasecmp(key, "zipvz") == 0)
+					manifestEntry.filename = value;
+				else if (strcasecmp(key, "sha2vz") == 0)
+					manifestEntry.sha2 = value;
+
+				if (manifestEntry.filename.length() && manifestEntry.sha2.length()) {
+					manifest.vzips.append(manifestEntry);
+					manifestEntry.name = nullptr;
+					manifestEntry.filename = nullptr;
+					manifestEntry.sha2 = nullptr;
+				}
+			}
+		}
+	}
+
+	return gotVersion;
+}
+
 void SteamLibUpdater::HexStringToBytes(AString str, unsigned char bytes[], size_t nBytes) {
 	size_t len = str.length();
 	for (size_t i = 0, j = 0; i < len && j < nBytes; i++) {
@@ -755,6 +1385,36 @@ void SteamLibUpdater::AddToSortedInstallList(InstallEntry_t &entry,
 		list.append(entry);
 }
 
+void SteamLibUpdater::SortInstallEntries(Vector<InstallEntry_t> &entries) {
+	std::sort(entries.begin(), entries.end(), [](const InstallEntry_t &a, const InstallEntry_t &b) {
+		return strcasecmp(a.filename.chars(), b.filename.chars()) < 0;
+	});
+}
+
+// Names are compared without case, like the file system does
+const InstallEntry_t *SteamLibUpdater::FindInstallEntry(const Vector<InstallEntry_t> &entries,
+                                                        const char *filename) {
+	const InstallEntry_t *end = entries.buffer() + entries.length();
+	const InstallEntry_t *it = std::lower_bound(entries.buffer(), end, filename,
+		[](const InstallEntry_t &entry, const char *name) {
+			return strcasecmp(entry.filename.chars(), name) < 0;
+		});
+
+	if (it == end || strcasecmp(it->filename.chars(), filename) != 0)
+		return nullptr;
+	return it;
+}
+
+bool SteamLibUpdater::KeepUnchanged(const Vector<InstallEntry_t> &unchanged, const char *path,
+                                    const InstallEntry_t &entry) {
+	const InstallEntry_t *old = FindInstallEntry(unchanged, entry.filename.chars());
+	if (!old || old->size != entry.size || old->crc != entry.crc)
+		return false;
+
+	struct timeval times[2] = {{entry.timestamp, 0}, {entry.timestamp, 0}};
+	return utimes(path, times) == 0;
+}
+
 int SteamLibUpdater::mkpath(const char *path, mode_t mode)
 {
 	char *tmpPath = strdup(path);
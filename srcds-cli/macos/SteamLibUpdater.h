@@ -52,16 +52,39 @@ enum class ManifestType {
 
 struct ManifestEntry_t
 {
+	AString name;
 	AString filename;
 	AString sha2;
 };
 
+// A Steam client manifest, kept in memory so it only needs to be downloaded and parsed once
+struct SteamManifest
+{
+	unsigned long version;
+	Vector<ManifestEntry_t> vzips;
+	Vector<char> data;
+};
+
 struct InstallEntry_t
 {
 	AString filename;
 	int64_t size;
 	time_t timestamp;
 	uint32_t crc;
+
+	// Inode and change time in nanoseconds when the file was last verified, or 0 if it never was
+	uint64_t inode = 0;
+	int64_t changed = 0;
+};
+
+// A vzip as it was when its SHA-256 last matched the manifest
+struct VZipState_t
+{
+	AString filename;
+	AString sha2;
+	int64_t size;
+	uint64_t inode;
+	int64_t changed;
 };
 
 class SteamLibUpdater
@@ -71,31 +94,64 @@ public:
 	~SteamLibUpdater();
 
 	void Update(SteamUniverse universe);
+
+	// Largest decompressed vzip that is held in memory while extracting it. Larger ones are
+	// decompressed to disk instead.
+	void SetMemoryLimit(size_t bytes);
+
+	// How long an install that hasn't changed since it was last verified is trusted without
+	// reading it again. 0 reads everything on every start.
+	void SetVerifyInterval(time_t seconds);
+
+	static int mkpath(const char *path, mode_t mode);
+
+	// Whether the file at path, from a previous install, can stay as it is for entry because it
+	// hasn't changed since then and has the same size and CRC. Its modification time is set to
+	// the entry's if so. unchanged must be sorted with SortInstallEntries.
+	static bool KeepUnchanged(const Vector<InstallEntry_t> &unchanged, const char *path,
+	                          const InstallEntry_t &entry);
+	static void SortInstallEntries(Vector<InstallEntry_t> &entries);
 private:
-	bool IsUpdateAvailable(SteamUniverse universe, URL_FILE * &manifest);
+	bool IsUpdateAvailable(SteamUniverse universe, SteamManifest &manifest);
 	bool IsUniverseChange(SteamUniverse &changedFrom);
+	bool DownloadManifest(SteamUniverse universe, SteamManifest &manifest);
 	void ParseManifests(SteamUniverse universe);
 	void DeleteOldVZips();
-	void DeleteOldFiles();
+	void DeleteOldFiles(LinkedList<InstallEntry_t> &list);
+	Vector<InstallEntry_t> GetUnchangedFiles();
 
 	bool VerifyInstall();
-	bool VerifyVZip(const char *vzip, const char *shastr);
+	bool IsInstallUnchanged();
+	bool VerifyVZips(const Vector<ManifestEntry_t> &vzips);
 	bool VerifyInstalledFiles(LinkedList<AString> &files);
 
-	void DownloadVZip(const char *filename, const char *shortName);
+	bool DownloadVZips(const Vector<ManifestEntry_t> &vzips, LinkedList<InstallEntry_t> &list,
+	                   const Vector<InstallEntry_t> &unchanged);
 	bool DecompressVZip(const char *path, const char *shortName, LinkedList<InstallEntry_t> &list,
-	                    LinkedList<AString> &filter);
-	void ExtractFiles(LinkedList<AString> &files);
-	void WriteInstallList(LinkedList<InstallEntry_t> &list);
+	                    const Vector<InstallEntry_t> &unchanged);
+	bool ExtractFiles(LinkedList<AString> &files);
+	void WriteInstallList(LinkedList<InstallEntry_t> &list, bool verified);
 private:
 	static constexpr const char *GetManifestName(SteamUniverse universe, ManifestType type);
+	static bool ParseManifest(SteamManifest &manifest);
+	static bool DecodeVZip(const unsigned char *src, size_t slen, const unsigned char *props,
+	                       const char *shortName, unsigned char *dest, FILE *spill, size_t dlen);
 	static void HexStringToBytes(AString str, unsigned char bytes[], size_t nBytes);
 	static void AddToSortedInstallList(InstallEntry_t &entry, LinkedList<InstallEntry_t> &list);
-	static int mkpath(const char *path, mode_t mode);
+	static const InstallEntry_t *FindInstallEntry(const Vector<InstallEntry_t> &entries, const char *filename);
 private:
+	static constexpr size_t kDefaultMemoryLimit = 64 << 20;
+	static constexpr size_t kDecodeWindow = 1 << 20;
+	static constexpr uint64_t kReadaheadBytes = 64 << 20;
+	static constexpr time_t kDefaultVerifyInterval = 7 * 24 * 60 * 60;
+
 	SteamUniverse universe_;
 	unsigned long version_;
+	size_t memoryLimit_;
+	time_t verifyInterval_;
+	time_t lastVerified_;
 	Vector<ManifestEntry_t> vzips_;
+	Vector<VZipState_t> vzipStates_;
 	LinkedList<InstallEntry_t> installedFiles_;
 };
 
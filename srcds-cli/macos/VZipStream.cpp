@@ -0,0 +1,606 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#include "VZipStream.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include "lzma/Alloc.h"
+
+#define ZIP_LOCAL_HEADER_SIG	0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG	0x02014b50
+#define ZIP_END_OF_CENTRAL_SIG	0x06054b50
+#define ZIP_DESCRIPTOR_SIG		0x08074b50
+
+#define ZIP_LOCAL_HEADER_SIZE	30
+#define ZIP_CENTRAL_HEADER_SIZE	46
+
+#define ZIP_FLAG_ENCRYPTED		0x1
+#define ZIP_FLAG_DESCRIPTOR		0x8
+
+static inline uint16_t ReadLE16(const unsigned char *p) {
+	return uint16_t(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t ReadLE32(const unsigned char *p) {
+	return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+VZipStream::VZipStream(const char *name, const unsigned char sha2[32], const char *root,
+                       const Vector<InstallEntry_t> &unchanged)
+	: name_(name), root_(root), unchanged_(unchanged), failed_(false), headerLen_(0), lzmaReady_(false),
+	  tailLen_(0), decoded_(0), zipState_(ZipState::Signature), entryFile_(nullptr), entryIsDir_(false),
+	  entryKept_(false), windowPos_(0)
+{
+	memcpy(sha2_, sha2, sizeof(sha2_));
+	Sha256_Init(&sha256_);
+	LzmaDec_Construct(&lzma_);
+
+	output_ = (unsigned char *)malloc(kOutputSize);
+	window_ = (unsigned char *)malloc(TINFL_LZ_DICT_SIZE);
+	if (!output_ || !window_)
+		Fail("out of memory");
+}
+
+VZipStream::~VZipStream() {
+	if (lzmaReady_)
+		LzmaDec_Free(&lzma_, &g_Alloc);
+	if (entryFile_) {
+		fclose(entryFile_);
+		unlink(tempPath_.chars());
+	}
+
+	RemoveNewFiles();
+
+	free(output_);
+	free(window_);
+}
+
+void VZipStream::Write(const unsigned char *data, size_t len) {
+	Sha256_Update(&sha256_, data, len);
+
+	if (failed_)
+		return;
+
+	if (headerLen_ < kHeaderSize) {
+		size_t n = len < kHeaderSize - headerLen_ ? len : kHeaderSize - headerLen_;
+		memcpy(&header_[headerLen_], data, n);
+		headerLen_ += n;
+		data += n;
+		len -= n;
+
+		if (headerLen_ < kHeaderSize)
+			return;
+
+		const VZHeader *header = (const VZHeader *)header_;
+		if (header->V != 'V' || header->Z != 'Z') {
+			Fail("not a vzip");
+			return;
+		}
+
+		if (LzmaDec_Allocate(&lzma_, &header_[sizeof(VZHeader)], LZMA_PROPS_SIZE, &g_Alloc) != SZ_OK) {
+			Fail("bad LZMA properties");
+			return;
+		}
+
+		LzmaDec_Init(&lzma_);
+		lzmaReady_ = true;
+	}
+
+	// The last bytes written might be the footer, so they are held back until more arrive
+	if (tailLen_ + len <= sizeof(tail_)) {
+		memcpy(&tail_[tailLen_], data, len);
+		tailLen_ += len;
+		return;
+	}
+
+	size_t fromTail = tailLen_ + len - sizeof(tail_);
+	if (fromTail > tailLen_)
+		fromTail = tailLen_;
+
+	Decode(tail_, fromTail);
+	memmove(tail_, &tail_[fromTail], tailLen_ - fromTail);
+	tailLen_ -= fromTail;
+
+	size_t fromData = len - (sizeof(tail_) - tailLen_);
+	Decode(data, fromData);
+	memcpy(&tail_[tailLen_], &data[fromData], len - fromData);
+	tailLen_ = sizeof(tail_);
+}
+
+bool VZipStream::Finish() {
+	Byte digest[32];
+	Sha256_Final(&sha256_, digest);
+
+	if (memcmp(digest, sha2_, sizeof(digest)) != 0) {
+		printf("%s failed SHA-256 verification\n", name_.chars());
+		failed_ = true;
+		RemoveNewFiles();
+		return false;
+	}
+
+	const VZFooter *footer = (const VZFooter *)tail_;
+	if (!failed_ && (!lzmaReady_ || tailLen_ != sizeof(tail_) || footer->z != 'z' || footer->v != 'v'))
+		Fail("bad footer");
+
+	// Flush whatever the decoder still has
+	if (!failed_)
+		Decode(nullptr, 0);
+
+	if (!failed_ && decoded_ < footer->size)
+		Fail("truncated LZMA stream");
+	if (!failed_ && zipState_ != ZipState::Done)
+		Fail("incomplete zip archive");
+
+	// A vzip that couldn't be fully extracted here is extracted again from disk, so none of its
+	// files are used
+	if (failed_)
+		RemoveNewFiles();
+	else
+		ReplaceFiles();
+
+	return true;
+}
+
+bool VZipStream::IsExtracted() const {
+	return !failed_ && zipState_ == ZipState::Done;
+}
+
+const Vector<InstallEntry_t> &VZipStream::GetEntries() const {
+	return entries_;
+}
+
+void VZipStream::Fail(const char *reason) {
+	if (!failed_)
+		printf("\nCould not extract %s while downloading: %s\n", name_.chars(), reason);
+
+	failed_ = true;
+
+	if (entryFile_) {
+		fclose(entryFile_);
+		entryFile_ = nullptr;
+		unlink(tempPath_.chars());
+	}
+}
+
+void VZipStream::Decode(const unsigned char *src, size_t srcLen) {
+	while (!failed_) {
+		SizeT inLen = srcLen;
+		SizeT outLen = kOutputSize;
+		ELzmaStatus status;
+
+		if (LzmaDec_DecodeToBuf(&lzma_, output_, &outLen, src, &inLen, LZMA_FINISH_ANY, &status) != SZ_OK) {
+			Fail("bad LZMA data");
+			return;
+		}
+
+		src += inLen;
+		srcLen -= inLen;
+		decoded_ += outLen;
+
+		Extract(output_, outLen);
+
+		if (outLen == 0 && (inLen == 0 || srcLen == 0))
+			return;
+	}
+}
+
+// Appends to the current record until it is need bytes long
+bool VZipStream::Gather(const unsigned char *&data, size_t &len, size_t need) {
+	size_t have = record_.length();
+	if (have >= need)
+		return true;
+
+	size_t n = len < need - have ? len : need - have;
+	if (n && record_.resize(have + n))
+		memcpy(&record_[have], data, n);
+
+	data += n;
+	len -= n;
+
+	return record_.length() == need;
+}
+
+void VZipStream::Extract(const unsigned char *data, size_t len) {
+	while (len > 0 && !failed_) {
+		switch (zipState_) {
+			case ZipState::Signature: {
+				if (!Gather(data, len, 4))
+					return;
+
+				uint32_t sig = ReadLE32(&record_[0]);
+				if (sig == ZIP_LOCAL_HEADER_SIG)
+					zipState_ = ZipState::LocalHeader;
+				else if (sig == ZIP_CENTRAL_HEADER_SIG)
+					zipState_ = ZipState::CentralHeader;
+				else if (sig == ZIP_END_OF_CENTRAL_SIG)
+					zipState_ = ZipState::Done;
+				else
+					Fail("unexpected zip record");
+				break;
+			}
+			case ZipState::LocalHeader: {
+				if (!Gather(data, len, ZIP_LOCAL_HEADER_SIZE))
+					return;
+
+				size_t extra = ReadLE16(&record_[26]) + ReadLE16(&record_[28]);
+				if (!Gather(data, len, ZIP_LOCAL_HEADER_SIZE + extra))
+					return;
+
+				BeginEntry();
+				break;
+			}
+			case ZipState::Data:
+				ExtractData(data, len);
+				break;
+			case ZipState::Descriptor: {
+				// The signature of a data descriptor is optional
+				if (!Gather(data, len, 4))
+					return;
+
+				size_t offset = ReadLE32(&record_[0]) == ZIP_DESCRIPTOR_SIG ? 4 : 0;
+				if (!Gather(data, len, offset + 12))
+					return;
+
+				expectedCrc_ = ReadLE32(&record_[offset]);
+				uncompSize_ = ReadLE32(&record_[offset + 8]);
+				FinishEntry();
+				break;
+			}
+			case ZipState::CentralHeader: {
+				if (!Gather(data, len, ZIP_CENTRAL_HEADER_SIZE))
+					return;
+
+				size_t extra = ReadLE16(&record_[28]) + ReadLE16(&record_[30]) + ReadLE16(&record_[32]);
+				if (!Gather(data, len, ZIP_CENTRAL_HEADER_SIZE + extra))
+					return;
+
+				ApplyCentralEntry();
+				break;
+			}
+			case ZipState::Done:
+				// The archive comment and anything after it aren't needed
+				return;
+		}
+	}
+}
+
+void VZipStream::BeginEntry() {
+	const unsigned char *header = &record_[0];
+	flags_ = ReadLE16(&header[6]);
+	method_ = ReadLE16(&header[8]);
+	entryTime_ = DosToTime(ReadLE16(&header[10]), ReadLE16(&header[12]));
+	expectedCrc_ = ReadLE32(&header[14]);
+	compRemaining_ = ReadLE32(&header[18]);
+	uncompSize_ = ReadLE32(&header[22]);
+
+	if (flags_ & ZIP_FLAG_ENCRYPTED) {
+		Fail("encrypted entry");
+		return;
+	}
+
+	if (compRemaining_ == 0xFFFFFFFF || uncompSize_ == 0xFFFFFFFF) {
+		Fail("zip64 entry");
+		return;
+	}
+
+	// A stored entry with a data descriptor doesn't say where its data ends
+	if (method_ != MZ_DEFLATED && (method_ != 0 || (flags_ & ZIP_FLAG_DESCRIPTOR))) {
+		Fail("unsupported compression method");
+		return;
+	}
+
+	// Fix slashes, ugh
+	size_t nameLen = ReadLE16(&header[26]);
+	char *name = new char[nameLen + 1];
+	memcpy(name, &header[ZIP_LOCAL_HEADER_SIZE], nameLen);
+	name[nameLen] = '\0';
+	for (size_t i = 0; i < nameLen; i++) {
+		if (name[i] == '\\')
+			name[i] = '/';
+	}
+
+	bool badName = nameLen == 0 || name[0] == '/' || strstr(name, "../");
+	entryIsDir_ = nameLen && name[nameLen - 1] == '/';
+	entryName_ = name;
+	delete [] name;
+
+	if (badName) {
+		Fail("bad entry name");
+		return;
+	}
+
+	entryPath_ = root_;
+	entryPath_.append(entryName_);
+
+	crc_ = MZ_CRC32_INIT;
+	written_ = 0;
+	windowPos_ = 0;
+	tinfl_init(&inflator_);
+
+	// Only known to be the same file up front if the header has its size and CRC
+	entryKept_ = false;
+	if (!entryIsDir_ && !(flags_ & ZIP_FLAG_DESCRIPTOR)) {
+		InstallEntry_t entry;
+		entry.filename = entryName_;
+		entry.size = int64_t(uncompSize_);
+		entry.timestamp = entryTime_;
+		entry.crc = expectedCrc_;
+		entryKept_ = SteamLibUpdater::KeepUnchanged(unchanged_, entryPath_.chars(), entry);
+	}
+
+	if (entryIsDir_) {
+		SteamLibUpdater::mkpath(entryPath_.chars(), 0755);
+	} else if (!entryKept_) {
+		// Directories usually have their own entries first, but not always
+		const char *slash = strrchr(entryPath_.chars(), '/');
+		AString parent(entryPath_.chars(), slash - entryPath_.chars());
+		SteamLibUpdater::mkpath(parent.chars(), 0755);
+
+		// Written next to the old file and renamed over it once complete, which leaves a library
+		// that is loaded intact and never leaves a partly written one in its place
+		tempPath_ = entryPath_;
+		tempPath_.append(".new");
+		unlink(tempPath_.chars());
+
+		entryFile_ = fopen(tempPath_.chars(), "wb");
+		if (!entryFile_) {
+			Fail("could not create file");
+			return;
+		}
+	}
+
+	record_.clear();
+	zipState_ = ZipState::Data;
+
+	if ((method_ == 0 || entryKept_) && compRemaining_ == 0)
+		EndEntryData();
+}
+
+void VZipStream::ExtractData(const unsigned char *&data, size_t &len) {
+	// The SHA-256 of the whole vzip still covers the data that is skipped
+	if (method_ == 0 || entryKept_) {
+		size_t n = len < compRemaining_ ? len : size_t(compRemaining_);
+		if (!entryKept_)
+			Output(data, n);
+		data += n;
+		len -= n;
+		compRemaining_ -= n;
+
+		if (compRemaining_ == 0)
+			EndEntryData();
+		return;
+	}
+
+	// Without a data descriptor the compressed size is known, so the inflater can be told where
+	// the data ends. Otherwise it gives back whatever it reads past the end of the stream.
+	bool sized = !(flags_ & ZIP_FLAG_DESCRIPTOR);
+	size_t avail = sized && compRemaining_ < len ? size_t(compRemaining_) : len;
+
+	for (;;) {
+		size_t inBytes = avail;
+		size_t outBytes = TINFL_LZ_DICT_SIZE - windowPos_;
+		mz_uint32 flags = !sized || compRemaining_ > avail ? TINFL_FLAG_HAS_MORE_INPUT : 0;
+
+		tinfl_status status = tinfl_decompress(&inflator_, data, &inBytes, window_, &window_[windowPos_],
+		                                       &outBytes, flags);
+
+		data += inBytes;
+		len -= inBytes;
+		avail -= inBytes;
+		if (sized)
+			compRemaining_ -= inBytes;
+
+		Output(&window_[windowPos_], outBytes);
+		windowPos_ = (windowPos_ + outBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+		if (failed_)
+			return;
+
+		if (status == TINFL_STATUS_DONE) {
+			if (sized && compRemaining_ != 0)
+				Fail("bad deflate data");
+			else
+				EndEntryData();
+			return;
+		}
+
+		if (status < TINFL_STATUS_DONE) {
+			Fail("bad deflate data");
+			return;
+		}
+
+		if (status == TINFL_STATUS_NEEDS_MORE_INPUT && avail == 0)
+			return;
+	}
+}
+
+void VZipStream::EndEntryData() {
+	if (flags_ & ZIP_FLAG_DESCRIPTOR)
+		zipState_ = ZipState::Descriptor;
+	else
+		FinishEntry();
+}
+
+void VZipStream::FinishEntry() {
+	InstallEntry_t entry;
+	entry.filename = entryName_;
+	entry.timestamp = entryTime_;
+	entry.crc = expectedCrc_;
+
+	if (entryIsDir_) {
+		entry.size = -1;
+	} else if (entryKept_) {
+		entry.size = int64_t(uncompSize_);
+	} else {
+		int closed = fclose(entryFile_);
+		entryFile_ = nullptr;
+
+		if (closed != 0) {
+			unlink(tempPath_.chars());
+			Fail("could not write file");
+			return;
+		}
+
+		if (written_ != uncompSize_ || crc_ != expectedCrc_) {
+			unlink(tempPath_.chars());
+			Fail("CRC mismatch");
+			return;
+		}
+
+		struct utimbuf times;
+		times.actime = entryTime_;
+		times.modtime = entryTime_;
+		utime(tempPath_.chars(), &times);
+		chmod(tempPath_.chars(), 0755);
+
+		// Left under its temporary name until the whole vzip is known to be intact
+		newFiles_.append(entryPath_);
+		entry.size = written_;
+	}
+
+	entries_.append(entry);
+
+	record_.clear();
+	zipState_ = ZipState::Signature;
+}
+
+// Symbolic links are only marked as such in the central directory, which comes after all of the
+// data, so they are extracted as regular files holding the link path and turned into links here
+void VZipStream::ApplyCentralEntry() {
+	const unsigned char *header = &record_[0];
+	mode_t attr = (ReadLE32(&header[38]) >> 16) & 0xFFFF;
+
+	if (S_ISLNK(attr)) {
+		size_t nameLen = ReadLE16(&header[28]);
+		char *name = new char[nameLen + 1];
+		memcpy(name, &header[ZIP_CENTRAL_HEADER_SIZE], nameLen);
+		name[nameLen] = '\0';
+		for (size_t i = 0; i < nameLen; i++) {
+			if (name[i] == '\\')
+				name[i] = '/';
+		}
+
+		for (InstallEntry_t &entry : entries_) {
+			if (entry.size < 0 || entry.filename.compare(name) != 0)
+				continue;
+
+			// The file holding the link path hasn't been renamed yet, so the link takes its place
+			AString path(root_);
+			path.append(name);
+			path.append(".new");
+
+			char lnkPath[PATH_MAX];
+			if (entry.size < int64_t(sizeof(lnkPath))) {
+				FILE *fp = fopen(path.chars(), "rb");
+				size_t len = fp ? fread(lnkPath, 1, size_t(entry.size), fp) : 0;
+				if (fp)
+					fclose(fp);
+
+				if (len != size_t(entry.size)) {
+					Fail("could not read symbolic link");
+					break;
+				}
+
+				// Ensure that link path name is null terminated
+				lnkPath[len] = '\0';
+
+				// Replace the file with a symbolic link
+				unlink(path.chars());
+				symlink(lnkPath, path.chars());
+			}
+
+			entry.size = -2;
+			break;
+		}
+
+		delete [] name;
+	}
+
+	record_.clear();
+	zipState_ = ZipState::Signature;
+}
+
+void VZipStream::ReplaceFiles() {
+	for (const AString &file : newFiles_) {
+		AString tempPath(file);
+		tempPath.append(".new");
+
+		if (rename(tempPath.chars(), file.chars()) != 0) {
+			Fail("could not replace file");
+			RemoveNewFiles();
+			return;
+		}
+	}
+
+	newFiles_.clear();
+}
+
+void VZipStream::RemoveNewFiles() {
+	for (const AString &file : newFiles_) {
+		AString path(file);
+		path.append(".new");
+		unlink(path.chars());
+	}
+
+	newFiles_.clear();
+}
+
+void VZipStream::Output(const unsigned char *data, size_t len) {
+	if (len == 0 || failed_)
+		return;
+
+	crc_ = (uint32_t)mz_crc32(crc_, data, len);
+	written_ += len;
+
+	if (written_ > uncompSize_ && !(flags_ & ZIP_FLAG_DESCRIPTOR)) {
+		Fail("entry larger than its header says");
+		return;
+	}
+
+	if (entryFile_ && fwrite(data, 1, len, entryFile_) != len)
+		Fail("could not write file");
+}
+
+// Same conversion that miniz uses, so timestamps match those of files extracted by DecompressVZip
+time_t VZipStream::DosToTime(int dosTime, int dosDate) {
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_isdst = -1;
+	tm.tm_year = ((dosDate >> 9) & 127) + 1980 - 1900;
+	tm.tm_mon = ((dosDate >> 5) & 15) - 1;
+	tm.tm_mday = dosDate & 31;
+	tm.tm_hour = (dosTime >> 11) & 31;
+	tm.tm_min = (dosTime >> 5) & 63;
+	tm.tm_sec = (dosTime << 1) & 62;
+	return mktime(&tm);
+}
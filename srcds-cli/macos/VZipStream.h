@@ -0,0 +1,167 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+#ifndef _INCLUDE_SRCDS_VZIPSTREAM_H_
+#define _INCLUDE_SRCDS_VZIPSTREAM_H_
+
+#include "SteamLibUpdater.h"
+#include "lzma/LzmaDec.h"
+#include "lzma/Sha256.h"
+#include "miniz/miniz.h"
+#include <stdio.h>
+#include <time.h>
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct VZHeader
+{
+	char V;
+	char Z;
+	char version;
+	uint32_t rtime_created;
+};
+
+struct VZFooter
+{
+	uint32_t crc;
+	uint32_t size;
+	char z;
+	char v;
+};
+
+#pragma pack(pop)
+
+/**
+ * Extracts a vzip while it is still being downloaded.
+ *
+ * Each chunk written is hashed, run through an incremental LZMA decoder, and the decoded zip is
+ * parsed from its local file headers, so every entry is written out as soon as its data arrives
+ * instead of after the whole archive has been downloaded and decompressed into memory. Only the
+ * LZMA dictionary and a few small buffers are kept.
+ *
+ * Files that are in unchanged with the same size and CRC are skipped over without being
+ * decompressed, and are left as they are. Others are written under a temporary name, which is
+ * only renamed over the old file once Finish has checked the SHA-256 of the whole vzip.
+ *
+ * Entries that can't be extracted this way, such as stored entries followed by a data
+ * descriptor, leave the stream unextracted. The vzip can then still be extracted from disk.
+ */
+class VZipStream
+{
+public:
+	VZipStream(const char *name, const unsigned char sha2[32], const char *root,
+	           const Vector<InstallEntry_t> &unchanged);
+	~VZipStream();
+
+	// Feeds the next bytes of the vzip as they are received
+	void Write(const unsigned char *data, size_t len);
+
+	// Checks the SHA-256 of everything written and the footer, then moves the extracted files into
+	// place if every entry was extracted. Returns false if the vzip is corrupt.
+	bool Finish();
+
+	// Whether every entry was extracted, once Finish has been called
+	bool IsExtracted() const;
+
+	const Vector<InstallEntry_t> &GetEntries() const;
+private:
+	enum class ZipState
+	{
+		Signature,
+		LocalHeader,
+		Data,
+		Descriptor,
+		CentralHeader,
+		Done
+	};
+
+	void Fail(const char *reason);
+	void Decode(const unsigned char *src, size_t srcLen);
+	void Extract(const unsigned char *data, size_t len);
+	bool Gather(const unsigned char *&data, size_t &len, size_t need);
+	void BeginEntry();
+	void ExtractData(const unsigned char *&data, size_t &len);
+	void EndEntryData();
+	void FinishEntry();
+	void ApplyCentralEntry();
+	void Output(const unsigned char *data, size_t len);
+	void ReplaceFiles();
+	void RemoveNewFiles();
+	static time_t DosToTime(int dosTime, int dosDate);
+private:
+	static constexpr size_t kHeaderSize = sizeof(VZHeader) + LZMA_PROPS_SIZE;
+	static constexpr size_t kOutputSize = 1 << 16;
+
+	AString name_;
+	AString root_;
+	const Vector<InstallEntry_t> &unchanged_;
+	unsigned char sha2_[32];
+	CSha256 sha256_;
+	bool failed_;
+
+	// LZMA stream, less the footer, which can't be told apart until the end
+	unsigned char header_[kHeaderSize];
+	size_t headerLen_;
+	CLzmaDec lzma_;
+	bool lzmaReady_;
+	unsigned char tail_[sizeof(VZFooter)];
+	size_t tailLen_;
+	unsigned char *output_;
+	uint64_t decoded_;
+
+	// Zip records, gathered until they are complete
+	ZipState zipState_;
+	Vector<unsigned char> record_;
+
+	// Entry being extracted
+	AString entryName_;
+	AString entryPath_;
+	AString tempPath_;
+	FILE *entryFile_;
+	bool entryIsDir_;
+	bool entryKept_;
+	uint16_t flags_;
+	uint16_t method_;
+	uint32_t expectedCrc_;
+	uint32_t crc_;
+	uint64_t compRemaining_;
+	uint64_t uncompSize_;
+	uint64_t written_;
+	time_t entryTime_;
+	tinfl_decompressor inflator_;
+	unsigned char *window_;
+	size_t windowPos_;
+
+	Vector<InstallEntry_t> entries_;
+
+	// Paths of extracted files that are still waiting under their temporary name
+	Vector<AString> newFiles_;
+};
+
+#endif // _INCLUDE_SRCDS_VZIPSTREAM_H_
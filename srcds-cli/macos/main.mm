@@ -37,6 +37,10 @@
 #include "GameLib.h"
 #include "GameShared.h"
 #include "SteamLibUpdater.h"
+#include "CDetour/detourprofiler.h"
+#include "FunctionTracer.h"
+#include "PatchFootprint.h"
+#include "SigScanner.h"
 #include "am-string.h"
 #include "cocoa_helpers.h"
 #include "stringutil.h"
@@ -106,7 +110,11 @@ int main(int argc, char **argv) {
 
 	bool shouldHandleCrash = false;
 	bool doSteamUpdate = true;
+	bool profileDetours = false;
+	unsigned int profileInterval = 60;
 	SteamUniverse universe = SteamUniverse::Public;
+	size_t steamMemoryLimit = 0;
+	int steamVerifyHours = -1;
 
 	for (int i = 0; i < argc; i++) {
 		if (strcmp(argv[i], "-nobreakpad") == 0) {
@@ -115,6 +123,27 @@ int main(int argc, char **argv) {
 			doSteamUpdate = false;
 		} else if (strcmp(argv[i], "-steambeta") == 0) {
 			universe = SteamUniverse::PublicBeta;
+		} else if (strcmp(argv[i], "-steammemory") == 0 && i + 1 < argc) {
+			// Megabytes of memory that Steam library updates may decompress into
+			steamMemoryLimit = size_t(atoi(argv[++i])) << 20;
+		} else if (strcmp(argv[i], "-steamverify") == 0 && i + 1 < argc) {
+			// Hours that Steam libraries which haven't changed are trusted before being read again
+			steamVerifyHours = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-profiledetours") == 0) {
+			// Optional dump interval in seconds, 0 to only dump on shutdown. Profiled callbacks
+			// must not throw or longjmp and crash stacks show the exit stub as their caller.
+			profileDetours = true;
+			if (i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9')
+				profileInterval = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+			// Traced functions must not throw or longjmp, see FunctionTracer
+			FunctionTracer::GetInstance().SetConfigFile(argv[++i]);
+		} else if (strcmp(argv[i], "-patchfootprint") == 0) {
+			PatchFootprint::GetInstance().Enable();
+		} else if (strcmp(argv[i], "-nosigjit") == 0) {
+			SigScanner::GetInstance().DisableJit();
+		} else if (strcmp(argv[i], "-sigrecover") == 0) {
+			SigScanner::GetInstance().EnableRecovery();
 		}
 	}
 
@@ -162,6 +191,10 @@ int main(int argc, char **argv) {
 
 	if (doSteamUpdate) {
 		SteamLibUpdater updater;
+		if (steamMemoryLimit)
+			updater.SetMemoryLimit(steamMemoryLimit);
+		if (steamVerifyHours >= 0)
+			updater.SetVerifyInterval(time_t(steamVerifyHours) * 60 * 60);
 		updater.Update(universe);
 	} else {
 		printf("NOTE: Update check for steam libraries is disabled.\n");
@@ -223,6 +256,9 @@ int main(int argc, char **argv) {
 		argv[0] = execPath;
 	}
 
+	if (profileDetours && !DetourProfiler::GetInstance().Enable(profileInterval))
+		printf("Warning: Detour profiling could not be enabled\n");
+
 	ServerAPI api(argc, argv);
 	GameShared &gameShared = GameShared::GetInstance();
 
@@ -252,6 +288,8 @@ int main(int argc, char **argv) {
 	fixer->Shutdown();
 	gameShared.Shutdown();
 
+	DetourProfiler::GetInstance().Shutdown();
+
 	dlclose(fixLib);
 
 	return result;
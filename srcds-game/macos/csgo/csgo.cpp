@@ -50,7 +50,14 @@ static void **g_pHWConfig;
 
 static IDetour *detSetShaderApi;
 
-DETOUR_DECL_MEMBER1(CMaterialSystem_SetShaderAPI, void, const char *, pModuleName) {
+// Where Host_PrintStatus continues after the code that prints the player's location
+static void *g_StatusSkipTarget;
+
+static void Host_PrintStatus_SkipLocation(MidHookContext *ctx) {
+	ctx->resume = g_StatusSkipTarget;
+}
+
+static void CMaterialSystem_SetShaderAPI(void *materialSystem, const char *pModuleName) {
 	CreateInterfaceFn shaderFactory;
 
 	g_EmptyShader.Load(g_ServerAPI, "shaderapiempty");
@@ -83,28 +90,26 @@ DETOUR_DECL_MEMBER1(CMaterialSystem_SetShaderAPI, void, const char *, pModuleNam
 	detSetShaderApi->Destroy();
 }
 
-DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
+static void *Sys_LoadModule(const char *pModuleName) {
 	void *handle = nullptr;
 
 	// The matchmaking_ds lib is not shipped, so replace with matchmaking.dylib
 	if (char *libName = strstr(const_cast<char *>(pModuleName), "matchmaking_ds.dylib"))
 	{
 		strcpy(libName, "matchmaking.dylib");
-		return DETOUR_STATIC_CALL(Sys_LoadModule)(pModuleName);
+		return Detour<Sys_LoadModule>::Original(pModuleName);
 	}
 
-	handle = DETOUR_STATIC_CALL(Sys_LoadModule)(pModuleName);
+	handle = Detour<Sys_LoadModule>::Original(pModuleName);
 
 	if (handle && strstr(pModuleName, "materialsystem")) {
 		GameLibrary matsys(g_ServerAPI, "materialsystem");
-		void *setShaderApi = nullptr;
-		void ***vptr = (void ***)matsys->GetFactory()("VMaterialSystem080", nullptr);
-		void **vtable = *vptr;
-		setShaderApi = vtable[10]; // IMaterialSystem::SetShaderAPI
+		void *materialSystem = matsys->GetFactory()("VMaterialSystem080", nullptr);
 
-		detSetShaderApi = DETOUR_CREATE_MEMBER(CMaterialSystem_SetShaderAPI, setShaderApi);
+		// IMaterialSystem::SetShaderAPI
+		detSetShaderApi = VirtualHook<CMaterialSystem_SetShaderAPI>::Create(g_ServerAPI, materialSystem, 10);
 		if (!detSetShaderApi) {
-			printf("Failed to create detour for CMaterialSystem::SetShaderAPI\n");
+			printf("Failed to hook CMaterialSystem::SetShaderAPI\n");
 			return NULL;
 		}
 
@@ -115,6 +120,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 48 8B 3D ? ? ? ? 48 8B 07 48 8B 80 A8 00 00 00");
 			constexpr int offset = sig.offsetOfWild();
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderAPI\n");
 				return nullptr;
@@ -128,6 +135,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 48 8D 05 ? ? ? ? 48 8B 38 48 8B 07 48 8B 80 38 03 00 00");
 			constexpr int offset = sig.offsetOfWild();
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderAPIDX8\n");
 				return nullptr;
@@ -141,6 +150,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 48 8D 05 ? ? ? ? 48 8B 38 48 8B 07 48 8B 80 C0 00 00 00");
 			constexpr int offset = sig.offsetOfWild();
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderDevice\n");
 				return nullptr;
@@ -154,6 +165,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 41 57 41 56 53 50 41 89 D6 89 F3 49 89 FF 48 8D 05 ? ? ? ? 48 8B 38 48 8B 07 FF 90 30 01 00 00");
 			constexpr int offset = sig.offsetOfWild();
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderDeviceDx8\n");
 				return nullptr;
@@ -167,6 +180,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 48 8D 05 ? ? ? ? 48 8B 38 48 8B 07 48 8B 40 60");
 			constexpr int offset = sig.offsetOfWild();
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderDeviceMgr\n");
 				return nullptr;
@@ -180,6 +195,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 41 57 41 56 53 50 48 89 FB E8 ? ? ? ? 48 8D 05 ? ? ? ? 48 8B 38 48 8B 07 8B 73 08");
 			constexpr int offset = sig.offsetOfWild(5);
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderDeviceMgrDx8\n");
 				return nullptr;
@@ -193,6 +210,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 41 57 41 56 53 50 49 89 FF 48 8D 05 ? ? ? ? 48 8B 38 48 8B 07 FF 90 88 00 00 00 83 F8 5C 7C 33 4C 8D 35 ? ? ? ? 49");
 			constexpr int offset = sig.offsetOfWild(5);
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderShadow\n");
 				return nullptr;
@@ -206,6 +225,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 41 56 53 48 89 FB 4C 8D B3 78 34 00 00 4C 89 F7 E8 ? ? ? ? 48 8D 05 ? ? ? ? 48");
 			constexpr int offset = sig.offsetOfWild(5);
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pShaderShadowDx8\n");
 				return nullptr;
@@ -219,6 +240,8 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			constexpr auto sig = MAKE_SIG("55 48 89 E5 48 8B 3D ? ? ? ? 48 8B 07 48 8B 80 68 01 00 00");
 			constexpr int offset = sig.offsetOfWild();
 			char *p = (char *)matsys->FindPattern(sig.pattern, sig.length);
+			if (!p)
+				p = (char *)matsys->FindPatternApproximate(sig.pattern, sig.length);
 			if (!p) {
 				printf("Failed to find signature to locate g_pHWConfig\n");
 				return nullptr;
@@ -250,7 +273,7 @@ bool CSGO::PreLoadModules(void *appSystemGroup) {
 			return false;
 		}
 		if (loadModule) {
-			fsLoadModule_ = DETOUR_CREATE_STATIC(Sys_LoadModule, loadModule);
+			fsLoadModule_ = Detour<Sys_LoadModule>::Create(g_ServerAPI, loadModule);
 			if (fsLoadModule_)
 				fsLoadModule_->Enable();
 			else {
@@ -293,6 +316,8 @@ bool CSGO::PostLoadModules(void *appSystemGroup) {
 	constexpr int offset = sig.offsetOfWild();
 	//void **engineSdl = engine.ResolveHiddenSymbol<void **>("g_pLauncherMgr");
 	char *p = (char *)engine->FindPattern(sig.pattern, sig.length);
+	if (!p)
+		p = (char *)engine->FindPatternApproximate(sig.pattern, sig.length);
 	if (!p) {
 		printf("Failed to find signature for engine.dylib\n");
 		printf("g_pLauncherMgr");
@@ -317,18 +342,22 @@ void CSGO::PatchMapStatus(GameLibrary engine)
 	if (p) {
 		p += 7;
 
-		constexpr char JUMP_OFFS = 0x25;
-		constexpr char SHORT_JMP_SIZE = 2;
+		constexpr int SKIP_OFFS = 0x27;
 		constexpr auto check = MAKE_SIG("49 8B 45 00"); // mov rax, [r13+0]
 
-		// Make sure the place we're jumping to matches what we expect
-		if (memcmp(p + JUMP_OFFS + SHORT_JMP_SIZE, check.pattern, check.length) != 0)
+		// Make sure the place we're skipping to matches what we expect
+		if (memcmp(p + SKIP_OFFS, check.pattern, check.length) != 0)
 			return;
 
-		SetMemPatchable(p, SHORT_JMP_SIZE);
-		*(char *)p++ = 0xEB;      // jmp
-		*(char *)p = JUMP_OFFS;   // offset
-		SetMemExec(p, SHORT_JMP_SIZE);
+		// Skip printing the location, which needs a local player
+		g_StatusSkipTarget = p + SKIP_OFFS;
+		mapStatus_ = g_ServerAPI->HookMidFunction(p, Host_PrintStatus_SkipLocation, 0);
+		if (!mapStatus_) {
+			printf("Failed to hook Host_PrintStatus\n");
+			return;
+		}
+
+		mapStatus_->Enable();
 
 		// Patch the map string to remove the location
 		const char mapString[] = "map     : %s at";
@@ -352,6 +381,9 @@ const char *CSGO::GetAddSearchPath(PatternType &type, size_t &len, AddSearchPath
 void CSGO::Shutdown() {
 	if (fsLoadModule_)
 		fsLoadModule_->Destroy();
+
+	if (mapStatus_)
+		mapStatus_->Destroy();
 }
 
 IServerFixer *GetGameFixer() {
@@ -47,6 +47,7 @@ private:
 	void PatchMapStatus(GameLibrary engine);
 private:
 	IDetour *fsLoadModule_;
+	IDetour *mapStatus_;
 };
 
 #endif // _INCLUDE_SRCDS_CSGO_H_
@@ -36,10 +36,17 @@
 
 static IServerAPI *g_ServerAPI = nullptr;
 
+// Where the status command continues after the code that prints the player's location
+static void *g_StatusSkipTarget;
+
+static void Status_SkipLocation(MidHookContext *ctx) {
+	ctx->resume = g_StatusSkipTarget;
+}
+
 #if defined(PLATFORM_X64)
 static IDetour *detMatSysLoadModule;
 
-DETOUR_DECL_STATIC1(MaterialSys_LoadModule, void *, const char *, pModuleName) {
+static void *MaterialSys_LoadModule(const char *pModuleName) {
 	pModuleName = "engine/doi/shaderapiempty.ovrd.dylib";
 
 	void *handle = dlopen(pModuleName, RTLD_NOW);
@@ -50,10 +57,10 @@ DETOUR_DECL_STATIC1(MaterialSys_LoadModule, void *, const char *, pModuleName) {
 	return handle;
 }
 
-DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
+static void *Sys_LoadModule(const char *pModuleName) {
 	void *handle;
 
-	handle = DETOUR_STATIC_CALL(Sys_LoadModule)(pModuleName);
+	handle = Detour<Sys_LoadModule>::Original(pModuleName);
 
 	if (handle && strstr(pModuleName, "materialsystem")) {
 		GameLibrary matsys(g_ServerAPI, "materialsystem");
@@ -63,7 +70,7 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			return nullptr;
 		}
 
-		detMatSysLoadModule = DETOUR_CREATE_STATIC(MaterialSys_LoadModule, matLoadModule);
+		detMatSysLoadModule = Detour<MaterialSys_LoadModule>::Create(g_ServerAPI, matLoadModule);
 		if (!detMatSysLoadModule) {
 			printf("Failed to create detour for materialsystem`Sys_LoadModule\n");
 			return nullptr;
@@ -76,17 +83,17 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 }
 #endif
 
-DETOUR_DECL_MEMBER2(CBaseFileSystem_FindFirst,
-                    const char *, const char *, pWildcard, int *, pHandle) {
+static const char *CBaseFileSystem_FindFirst(void *fileSystem, const char *pWildcard, int *pHandle) {
 	g_ServerAPI->FixPath(pWildcard);
 
-	return DETOUR_MEMBER_CALL(CBaseFileSystem_FindFirst)(pWildcard, pHandle);
+	return Detour<CBaseFileSystem_FindFirst>::Original(fileSystem, pWildcard, pHandle);
 }
 
 bool DayOfInfamy::Init(IServerAPI *api) {
 	g_ServerAPI = api;
 	fileFindFirst_ = nullptr;
 	sysLoadModule_ = nullptr;
+	mapStatus_ = nullptr;
 
 #if defined(PLATFORM_X64)
 	GameLibrary dedicated(api, "dedicated");
@@ -101,7 +108,7 @@ bool DayOfInfamy::Init(IServerAPI *api) {
 		return false;
 	}
 
-	sysLoadModule_ = DETOUR_CREATE_STATIC(Sys_LoadModule, loadModule);
+	sysLoadModule_ = Detour<Sys_LoadModule>::Create(g_ServerAPI, loadModule);
 	if (!sysLoadModule_) {
 		printf("Failed to create detour for Sys_LoadModule\n");
 		return false;
@@ -136,7 +143,7 @@ bool DayOfInfamy::PreLoadModules(void *appSystemGroup) {
 		return false;
 	}
 
-	fileFindFirst_ = DETOUR_CREATE_MEMBER(CBaseFileSystem_FindFirst, findFirst);
+	fileFindFirst_ = Detour<CBaseFileSystem_FindFirst>::Create(g_ServerAPI, findFirst);
 	if (!fileFindFirst_) {
 		printf("Failed to create detour for CBaseFileSystem::FindFirst\n");
 		return false;
@@ -163,30 +170,33 @@ void DayOfInfamy::PatchMapStatus(GameLibrary engine) {
 	// Signature in middle of status command for printing the current map
 #if defined (PLATFORM_X86)
 	constexpr auto sig = MAKE_SIG("8B BB ? ? ? ? 80 BF");
-	constexpr char PATCH_OFFS = 6;
-	constexpr char JUMP_OFFS = 0x12;
-	constexpr char SHORT_JMP_SIZE = 2;
+	constexpr int HOOK_OFFS = 6;
+	constexpr int SKIP_OFFS = 0x14;
 	constexpr auto check = MAKE_SIG("8B 83"); // mov eax, [ebx+0x????] ; g_MainViewOrigin
 #elif defined (PLATFORM_X64)
 	constexpr auto sig = MAKE_SIG("4C 8D 25 ? ? ? ? 41 80");
-	constexpr char PATCH_OFFS = 7;
-	constexpr char JUMP_OFFS = 0x17;
-	constexpr char SHORT_JMP_SIZE = 2;
+	constexpr int HOOK_OFFS = 7;
+	constexpr int SKIP_OFFS = 0x19;
 	constexpr auto check = MAKE_SIG("48 8D 05"); // lea eax, [g_MainViewOrigin]
 #endif
 
 	char *p = (char *)engine->FindPattern(sig.pattern, sig.length);
 	if (p) {
-		p += PATCH_OFFS;
+		p += HOOK_OFFS;
 
-		// Make sure the place we're jumping to matches what we expect
-		if (memcmp(p + JUMP_OFFS + SHORT_JMP_SIZE, check.pattern, check.length) != 0)
+		// Make sure the place we're skipping to matches what we expect
+		if (memcmp(p + SKIP_OFFS, check.pattern, check.length) != 0)
 			return;
 
-		SetMemPatchable(p, SHORT_JMP_SIZE);
-		*(char *)p++ = 0xEB;      // jmp
-		*(char *)p = JUMP_OFFS;   // offset
-		SetMemExec(p, SHORT_JMP_SIZE);
+		// Skip printing the location, which needs a local player
+		g_StatusSkipTarget = p + SKIP_OFFS;
+		mapStatus_ = g_ServerAPI->HookMidFunction(p, Status_SkipLocation, 0);
+		if (!mapStatus_) {
+			printf("Failed to hook the status command\n");
+			return;
+		}
+
+		mapStatus_->Enable();
 
 		// Patch the map string to remove the location
 		const char mapString[] = "map     : %s at";
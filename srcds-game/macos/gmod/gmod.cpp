@@ -55,14 +55,14 @@ DepotGetList g_GetDepotList;
 DepotLoad g_LoadDepots;
 FillDepotList g_FillDepotList;
 
-DETOUR_DECL_MEMBER0(GameDepotSys_Clear, void) {
+static void GameDepotSys_Clear(void *depotSystem) {
 	static bool initialized = false;
 
 	if (!initialized) {
 		initialized = true;
 
 		// Fill depot list with supported games
-		std::list<GameDepotInfo> &depots = g_GetDepotList(this);
+		std::list<GameDepotInfo> &depots = g_GetDepotList(depotSystem);
 		g_FillDepotList(depots);
 
 		// Dedicated servers on Linux and Windows set these for all games
@@ -71,19 +71,19 @@ DETOUR_DECL_MEMBER0(GameDepotSys_Clear, void) {
 			depot.installed = true;
 		}
 
-		g_LoadDepots(this);
+		g_LoadDepots(depotSystem);
 	}
 }
 
-DETOUR_DECL_MEMBER2(GameDepotSys_Mount, bool, GameDepotInfo &, info, bool, unknown) {
+static bool GameDepotSys_Mount(void *depotSystem, GameDepotInfo &info, bool unknown) {
 	return true;
 }
 
-DETOUR_DECL_MEMBER3(CBaseFileSystem_AddVPKFile,
-					void, const char *, pszName, const char *, pPathID, unsigned int, addType) {
+static void CBaseFileSystem_AddVPKFile(void *fileSystem, const char *pszName, const char *pPathID,
+                                       unsigned int addType) {
 	g_ServerAPI->FixPath(pszName);
 
-	DETOUR_MEMBER_CALL(CBaseFileSystem_AddVPKFile)(pszName, pPathID, addType);
+	Detour<CBaseFileSystem_AddVPKFile>::Original(fileSystem, pszName, pPathID, addType);
 }
 
 static inline void dumpUnknownSymbols(const SymbolInfo *info, size_t len) {
@@ -167,7 +167,7 @@ bool GarrysMod::PreLoadModules(void *appSystemGroup) {
 	g_FillDepotList = (FillDepotList)info[4].address;
 	addVPK = info[5].address;
 
-	depotSetup_ = DETOUR_CREATE_MEMBER(GameDepotSys_Clear, depotClear);
+	depotSetup_ = Detour<GameDepotSys_Clear>::Create(g_ServerAPI, depotClear);
 	if (depotSetup_) {
 		depotSetup_->Enable();
 	} else {
@@ -175,7 +175,7 @@ bool GarrysMod::PreLoadModules(void *appSystemGroup) {
 		return false;
 	}
 
-	depotMount_ = DETOUR_CREATE_MEMBER(GameDepotSys_Mount, depotMount);
+	depotMount_ = Detour<GameDepotSys_Mount>::Create(g_ServerAPI, depotMount);
 	if (depotMount_) {
 		depotMount_->Enable();
 	} else {
@@ -183,7 +183,7 @@ bool GarrysMod::PreLoadModules(void *appSystemGroup) {
 		return false;
 	}
 
-	addVPK_ = DETOUR_CREATE_MEMBER(CBaseFileSystem_AddVPKFile, addVPK);
+	addVPK_ = Detour<CBaseFileSystem_AddVPKFile>::Create(g_ServerAPI, addVPK);
 	if (addVPK_) {
 		addVPK_->Enable();
 	} else {
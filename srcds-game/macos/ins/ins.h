@@ -48,6 +48,8 @@ private:
 private:
 	GameLibrary launcher_;
 	IDetour *sdlInit_;
+protected:
+	IDetour *mapStatus_;
 };
 
 #endif // _INCLUDE_SRCDS_INS_H_
@@ -35,7 +35,14 @@
 
 static IServerAPI *g_ServerAPI = nullptr;
 
-DETOUR_DECL_MEMBER0(CSDLMgr_Init, int) {
+// Where the status command continues after the code that prints the player's location
+static void *g_StatusSkipTarget;
+
+static void Status_SkipLocation(MidHookContext *ctx) {
+	ctx->resume = g_StatusSkipTarget;
+}
+
+static int CSDLMgr_Init(void *sdlMgr) {
 	return 1;
 }
 
@@ -49,6 +56,7 @@ static inline void dumpUnknownSymbols(const SymbolInfo *info, size_t len) {
 bool Insurgency::Init(IServerAPI *api) {
 	g_ServerAPI = api;
 	sdlInit_ = nullptr;
+	mapStatus_ = nullptr;
 	return true;
 }
 
@@ -82,7 +90,7 @@ bool Insurgency::SetupLauncher(void *appSystemGroup) {
 	CreateSDLMgrFn CreateSDLMgr = (CreateSDLMgrFn)info[1].address;
 	void *initSDL = info[2].address;
 
-	sdlInit_ = DETOUR_CREATE_MEMBER(CSDLMgr_Init, initSDL);
+	sdlInit_ = Detour<CSDLMgr_Init>::Create(g_ServerAPI, initSDL);
 	if (!sdlInit_) {
 		printf("Failed to create detour for CSDLMgr::Init!\n");
 		return false;
@@ -121,18 +129,22 @@ void Insurgency::PatchMapStatus(GameLibrary engine) {
 	if (p) {
 		p += 6;
 
-		constexpr char JUMP_OFFS = 0x15;
-		constexpr char SHORT_JMP_SIZE = 2;
+		constexpr int SKIP_OFFS = 0x17;
 		constexpr auto check = MAKE_SIG("8B 07"); // mov eax, [edi]
 
-		// Make sure the place we're jumping to matches what we expect
-		if (memcmp(p + JUMP_OFFS + SHORT_JMP_SIZE, check.pattern, check.length) != 0)
+		// Make sure the place we're skipping to matches what we expect
+		if (memcmp(p + SKIP_OFFS, check.pattern, check.length) != 0)
 			return;
 
-		SetMemPatchable(p, SHORT_JMP_SIZE);
-		*(char *)p++ = 0xEB;      // jmp
-		*(char *)p = JUMP_OFFS;   // offset
-		SetMemExec(p, SHORT_JMP_SIZE);
+		// Skip printing the location, which needs a local player
+		g_StatusSkipTarget = p + SKIP_OFFS;
+		mapStatus_ = g_ServerAPI->HookMidFunction(p, Status_SkipLocation, 0);
+		if (!mapStatus_) {
+			printf("Failed to hook the status command\n");
+			return;
+		}
+
+		mapStatus_->Enable();
 
 		// Patch the map string to remove the location
 		const char mapString[] = "map     : %s at";
@@ -148,4 +160,7 @@ void Insurgency::PatchMapStatus(GameLibrary engine) {
 void Insurgency::Shutdown() {
 	if (sdlInit_)
 		sdlInit_->Destroy();
+
+	if (mapStatus_)
+		mapStatus_->Destroy();
 }
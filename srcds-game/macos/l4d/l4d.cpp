@@ -37,22 +37,25 @@ static IServerAPI *g_ServerAPI = nullptr;
 static IDetour *detSetShaderApi;
 
 // void CMaterialSystem::SetShaderAPI(const char *)
-DETOUR_DECL_MEMBER1(CMaterialSystem_SetShaderAPI, void, const char *, pModuleName) {
+static void CMaterialSystem_SetShaderAPI(void *materialSystem, const char *pModuleName) {
 	char module[PATH_MAX];
 	pModuleName = Left4Dead::FixLibraryExt(pModuleName, module, sizeof(module));
 
-	DETOUR_MEMBER_CALL(CMaterialSystem_SetShaderAPI)(pModuleName);
+	if (VirtualHook<CMaterialSystem_SetShaderAPI>::Original)
+		VirtualHook<CMaterialSystem_SetShaderAPI>::Original(materialSystem, pModuleName);
+	else
+		Detour<CMaterialSystem_SetShaderAPI>::Original(materialSystem, pModuleName);
 
 	detSetShaderApi->Destroy();
 	detSetShaderApi = nullptr;
 }
 
-DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
+static void *Sys_LoadModule(const char *pModuleName) {
 	void *handle;
 	char module[PATH_MAX];
 	pModuleName = Left4Dead::FixLibraryExt(pModuleName, module, sizeof(module));
 
-	handle = DETOUR_STATIC_CALL(Sys_LoadModule)(pModuleName);
+	handle = Detour<Sys_LoadModule>::Original(pModuleName);
 
 	if (handle && strstr(module, "materialsystem")) {
 		GameLibrary matsys(g_ServerAPI, "materialsystem");
@@ -62,7 +65,16 @@ DETOUR_DECL_STATIC1(Sys_LoadModule, void *, const char *, pModuleName) {
 			return nullptr;
 		}
 
-		detSetShaderApi = DETOUR_CREATE_MEMBER(CMaterialSystem_SetShaderAPI, setShaderApi);
+		// Prefer hooking IMaterialSystem::SetShaderAPI through the material system's vtable so
+		// that no code in materialsystem is patched
+		void *materialSystem = matsys->GetFactory()("VMaterialSystem080", nullptr);
+		ptrdiff_t index = materialSystem ? FindVirtualIndex(materialSystem, setShaderApi, 32) : -1;
+
+		if (index >= 0)
+			detSetShaderApi = VirtualHook<CMaterialSystem_SetShaderAPI>::Create(g_ServerAPI, materialSystem, index);
+		else
+			detSetShaderApi = Detour<CMaterialSystem_SetShaderAPI>::Create(g_ServerAPI, setShaderApi);
+
 		if (!detSetShaderApi) {
 			printf("Failed to create detour for CMaterialsSystem::SetShaderAPI\n");
 			return nullptr;
@@ -113,7 +125,7 @@ bool Left4Dead::Init(IServerAPI *api) {
 	void *fileSystemStdio = info[1].address;
 	void **pBaseFileSystem = (void **)info[2].address;
 
-	sysLoadModule_ = DETOUR_CREATE_STATIC(Sys_LoadModule, loadModule);
+	sysLoadModule_ = Detour<Sys_LoadModule>::Create(g_ServerAPI, loadModule);
 	if (!sysLoadModule_) {
 		printf("Failed to create detour for Sys_LoadModule\n");
 		return false;
@@ -35,11 +35,11 @@ static IServerAPI *g_ServerAPI = nullptr;
 
 static IDetour *detMatSysLoadModule;
 
-DETOUR_DECL_MEMBER0(CUploadGameStats_UpdateConnection, void) {
+static void CUploadGameStats_UpdateConnection(void *gameStats) {
 	// Do nothing
 }
 
-DETOUR_DECL_STATIC2(MaterialSys_LoadModule, void *, const char *, pModuleName, int, flags) {
+static void *MaterialSys_LoadModule(const char *pModuleName, int flags) {
 	pModuleName = "engine/nd/shaderapiempty.ovrd.dylib";
 
 	void *handle = dlopen(pModuleName, RTLD_NOW);
@@ -50,10 +50,10 @@ DETOUR_DECL_STATIC2(MaterialSys_LoadModule, void *, const char *, pModuleName, i
 	return handle;
 }
 
-DETOUR_DECL_STATIC2(Sys_LoadModule, void *, const char *, pModuleName, int, flags) {
+static void *Sys_LoadModule(const char *pModuleName, int flags) {
 	void *handle;
 
-	handle = DETOUR_STATIC_CALL(Sys_LoadModule)(pModuleName, flags);
+	handle = Detour<Sys_LoadModule>::Original(pModuleName, flags);
 
 	if (handle && strstr(pModuleName, "materialsystem")) {
 		GameLibrary matsys(g_ServerAPI, "materialsystem");
@@ -63,7 +63,7 @@ DETOUR_DECL_STATIC2(Sys_LoadModule, void *, const char *, pModuleName, int, flag
 			return nullptr;
 		}
 
-		detMatSysLoadModule = DETOUR_CREATE_STATIC(MaterialSys_LoadModule, matLoadModule);
+		detMatSysLoadModule = Detour<MaterialSys_LoadModule>::Create(g_ServerAPI, matLoadModule);
 		if (!detMatSysLoadModule) {
 			printf("Failed to create detour for materialsystem`Sys_LoadModule\n");
 			return nullptr;
@@ -100,7 +100,7 @@ bool NuclearDawn::Init(IServerAPI *api) {
 		return false;
 	}
 
-	sysLoadModule_ = DETOUR_CREATE_STATIC(Sys_LoadModule, loadModule);
+	sysLoadModule_ = Detour<Sys_LoadModule>::Create(g_ServerAPI, loadModule);
 	if (!sysLoadModule_) {
 		printf("Failed to create detour for Sys_LoadModule\n");
 		return false;
@@ -171,7 +171,7 @@ bool NuclearDawn::PostLoadModules(void *appSystemGroup) {
 		return false;
 	}
 
-	gameStatsUpdate_ = DETOUR_CREATE_MEMBER(CUploadGameStats_UpdateConnection, updateGameStats);
+	gameStatsUpdate_ = Detour<CUploadGameStats_UpdateConnection>::Create(g_ServerAPI, updateGameStats);
 	if (!gameStatsUpdate_) {
 		printf("Failed to create detour for CUploadGameStats::UpdateConnection\n");
 		return false;
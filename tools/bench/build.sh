@@ -0,0 +1,52 @@
+#!/bin/sh
+# Builds the standalone benchmarks in this directory. They need no game files or Xcode and run
+# on Linux and macOS, except insnlen which reads ELF libraries and needs Linux, and detourcall
+# and sigscan which need x86_64.
+#
+#   tools/bench/build.sh [output dir]
+
+set -e
+
+cd "$(dirname "$0")"
+OUT="${1:-.}"
+PUBLIC=../../public
+CC="${CC:-cc}"
+CXX="${CXX:-c++}"
+CFLAGS="${CFLAGS:--O2} -I$PUBLIC"
+CXXFLAGS="${CXXFLAGS:--O2} -std=c++17 -I$PUBLIC -I$PUBLIC/sourcehook"
+
+mkdir -p "$OUT"
+$CXX $CXXFLAGS codealloc.cpp -o "$OUT/codealloc"
+
+$CC $CFLAGS -c $PUBLIC/lzma/Sha256.c -o "$OUT/Sha256.o"
+$CXX $CXXFLAGS sha256.cpp "$OUT/Sha256.o" -o "$OUT/sha256"
+
+$CC $CFLAGS -c $PUBLIC/miniz/miniz.c -o "$OUT/miniz.o"
+$CXX $CXXFLAGS crc32.cpp "$OUT/miniz.o" -o "$OUT/crc32"
+
+ASM_OBJS=""
+for src in $PUBLIC/asm/asm.c $PUBLIC/asm/x86insn.c; do
+	obj="$OUT/$(basename "$src" .c).o"
+	$CC $CFLAGS -c "$src" -o "$obj"
+	ASM_OBJS="$ASM_OBJS $obj"
+done
+
+if [ "$(uname -m)" = "x86_64" ]; then
+	$CXX $CXXFLAGS -I$PUBLIC/amtl detourcall.cpp $PUBLIC/CDetour/detours.cpp $PUBLIC/CDetour/detourprofiler.cpp \
+		$PUBLIC/CDetour/detourthunks.cpp $PUBLIC/CDetour/midhook.cpp $PUBLIC/CDetour/vtablehook.cpp \
+		$ASM_OBJS -lpthread -o "$OUT/detourcall"
+	$CXX $CXXFLAGS -I$PUBLIC/amtl -I../../srcds-cli/macos sigscan.cpp ../../srcds-cli/macos/SigScanner.cpp \
+		$ASM_OBJS -o "$OUT/sigscan"
+fi
+
+if [ "$(uname)" = "Linux" ]; then
+	OBJS="$ASM_OBJS"
+	for src in $PUBLIC/libudis86/*.c; do
+		obj="$OUT/$(basename "$src" .c).o"
+		$CC $CFLAGS -c "$src" -o "$obj"
+		OBJS="$OBJS $obj"
+	done
+	$CXX $CXXFLAGS insnlen.cpp $OBJS -o "$OUT/insnlen"
+fi
+
+echo "Built benchmarks in $OUT"
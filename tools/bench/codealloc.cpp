@@ -0,0 +1,115 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Benchmark for the executable memory allocator behind GenBuffer.
+//
+// Creates and destroys thousands of detour-sized code buffers the way CDetour and the
+// profiling/tracing thunks do, then churns a fixed working set with random frees. Timings are
+// printed per operation. Runs on Linux and macOS without any game files; see build.sh.
+
+#include <sourcehook/sh_include.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+CPageAlloc GenBuffer::ms_Allocator(16);
+
+using Clock = std::chrono::steady_clock;
+
+static double NanosecondsPer(Clock::time_point start, size_t count)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / count;
+}
+
+// Roughly what CDetour::CreateDetour emits: the stolen prologue and a jump back
+static void EmitTrampoline(GenBuffer &codegen, void *target)
+{
+	static const unsigned char prologue[] = {0x55, 0x48, 0x89, 0xE5, 0x41, 0x57, 0x41, 0x56, 0x53, 0x50};
+	codegen.push(prologue, sizeof(prologue));
+	X64_Mov_Reg_Imm64(&codegen, REG_RAX, jit_int64_t(target));
+	IA32_Jump_Reg(&codegen, REG_RAX);
+	codegen.SetRE();
+}
+
+static void Run(const char *name, size_t count, size_t churnOps, void *hint)
+{
+	std::vector<GenBuffer *> buffers(count);
+	std::mt19937 rng(1234);
+
+	Clock::time_point start = Clock::now();
+	for (size_t i = 0; i < count; i++) {
+		buffers[i] = new GenBuffer();
+		if (hint)
+			buffers[i]->SetAllocHint(hint);
+		EmitTrampoline(*buffers[i], hint);
+	}
+	double create = NanosecondsPer(start, count);
+
+	size_t near = 0;
+	for (GenBuffer *buffer : buffers) {
+		intptr_t distance = reinterpret_cast<char *>(buffer->GetData()) - reinterpret_cast<char *>(hint);
+		if (hint && distance > -0x7FFFFFFFLL && distance < 0x7FFFFFFFLL)
+			near++;
+	}
+
+	start = Clock::now();
+	for (size_t i = 0; i < churnOps; i++) {
+		GenBuffer *&buffer = buffers[rng() % count];
+		delete buffer;
+		buffer = new GenBuffer();
+		if (hint)
+			buffer->SetAllocHint(hint);
+		EmitTrampoline(*buffer, hint);
+	}
+	double churn = NanosecondsPer(start, churnOps);
+
+	std::shuffle(buffers.begin(), buffers.end(), rng);
+	start = Clock::now();
+	for (GenBuffer *buffer : buffers)
+		delete buffer;
+	double destroy = NanosecondsPer(start, count);
+
+	printf("%-8s count=%zu create_ns=%.1f churn_ns=%.1f destroy_ns=%.1f rel32_reachable=%zu\n", name, count,
+	       create, churn, destroy, near);
+}
+
+int main(int argc, char **argv)
+{
+	size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+	size_t churnOps = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100000;
+
+	for (int round = 0; round < 3; round++) {
+		Run("default", count, churnOps, nullptr);
+		Run("hinted", count, churnOps, reinterpret_cast<void *>(&main));
+	}
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Benchmark and self-check for mz_crc32 in miniz/miniz.c.
+//
+// Files are read into memory and checksummed with mz_crc32 and with miniz's original byte at a
+// time table loop, which is copied here as the reference. Every file must give the same CRC both
+// ways, also when fed to mz_crc32 in random pieces. Throughput of each is printed in GB/s over the
+// whole set. Point it at an installed game, e.g. the bin directory, to measure what the verifier
+// and the extractor see. With no paths, random buffers of vzip entry sizes are used instead.
+//
+//   crc32 [file or directory...]
+
+#include "miniz/miniz.h"
+#include <chrono>
+#include <ftw.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct File
+{
+	const char *path;
+	std::vector<unsigned char> data;
+};
+
+static std::vector<std::string> paths;
+static std::vector<File> files;
+
+static double SecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static uint32_t ReferenceCrc32(uint32_t crc, const unsigned char *data, size_t len)
+{
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = (c >> 1) ^ (0xEDB88320 & (0 - (c & 1)));
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while (len >= 4) {
+		crc = (crc >> 8) ^ table[(crc ^ data[0]) & 0xFF];
+		crc = (crc >> 8) ^ table[(crc ^ data[1]) & 0xFF];
+		crc = (crc >> 8) ^ table[(crc ^ data[2]) & 0xFF];
+		crc = (crc >> 8) ^ table[(crc ^ data[3]) & 0xFF];
+		data += 4;
+		len -= 4;
+	}
+	while (len--)
+		crc = (crc >> 8) ^ table[(crc ^ *data++) & 0xFF];
+	return ~crc;
+}
+
+static int AddPath(const char *path, const struct stat *st, int type, struct FTW *)
+{
+	if (type == FTW_F && S_ISREG(st->st_mode))
+		paths.push_back(path);
+	return 0;
+}
+
+static bool ReadFile(const char *path, std::vector<unsigned char> &data)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return false;
+	}
+
+	unsigned char buffer[1 << 16];
+	size_t len;
+	while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		data.insert(data.end(), buffer, buffer + len);
+
+	fclose(fp);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	std::mt19937 rng(1234);
+	size_t errors = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (nftw(argv[i], AddPath, 16, FTW_PHYS) != 0) {
+			fprintf(stderr, "Could not read %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	for (const std::string &path : paths) {
+		File file;
+		file.path = path.c_str();
+		if (!ReadFile(file.path, file.data))
+			return 1;
+		files.push_back(std::move(file));
+	}
+
+	if (argc < 2) {
+		// Mostly small files with a few large libraries, like a game's bin directory
+		for (int i = 0; i < 400; i++) {
+			File file;
+			file.path = "random";
+			file.data.resize(i % 20 ? rng() % 65536 : rng() % (16 << 20));
+			for (unsigned char &b : file.data)
+				b = (unsigned char)rng();
+			files.push_back(std::move(file));
+		}
+	}
+
+	size_t total = 0;
+	std::vector<uint32_t> expected;
+	for (const File &file : files) {
+		total += file.data.size();
+		expected.push_back(ReferenceCrc32(0, file.data.data(), file.data.size()));
+	}
+
+	if (mz_crc32(MZ_CRC32_INIT, nullptr, 0) != MZ_CRC32_INIT) {
+		printf("mismatch empty\n");
+		errors++;
+	}
+
+	for (size_t i = 0; i < files.size(); i++) {
+		const std::vector<unsigned char> &data = files[i].data;
+		mz_ulong crc = mz_crc32(MZ_CRC32_INIT, data.data(), data.size());
+
+		// Pieces of every length and alignment, as the extractor gets them from tinfl
+		mz_ulong pieces = MZ_CRC32_INIT;
+		for (size_t pos = 0; pos < data.size(); ) {
+			size_t piece = rng() % 3 ? rng() % 200 : rng() % 70000;
+			if (piece > data.size() - pos)
+				piece = data.size() - pos;
+			pieces = mz_crc32(pieces, &data[pos], piece);
+			pos += piece;
+		}
+
+		if (crc != expected[i] || pieces != expected[i]) {
+			printf("mismatch file=%s size=%zu\n", files[i].path, data.size());
+			errors++;
+		}
+	}
+
+	uint32_t sum = 0;
+	Clock::time_point start = Clock::now();
+	for (const File &file : files)
+		sum += ReferenceCrc32(0, file.data.data(), file.data.size());
+	double refSeconds = SecondsSince(start);
+
+	start = Clock::now();
+	for (const File &file : files)
+		sum += (uint32_t)mz_crc32(MZ_CRC32_INIT, file.data.data(), file.data.size());
+	double seconds = SecondsSince(start);
+
+	printf("crc32 files=%zu size=%zu errors=%zu ref_gbps=%.2f mz_gbps=%.2f speedup=%.1f sum=%08x\n", files.size(),
+	       total, errors, total / refSeconds / 1e9, total / seconds / 1e9, refSeconds / seconds, sum);
+	return errors ? 1 : 0;
+}
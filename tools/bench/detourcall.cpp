@@ -0,0 +1,533 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Call overhead benchmark for CDetour and the other hook types.
+//
+// Hooks synthetic functions of different arities and prologue shapes and times, per call, the
+// unhooked function, the hooked path through a callback that calls the original, and the
+// trampoline on its own. Creating and destroying each kind of hook is timed separately. Every
+// result is printed as one line of key=value pairs so runs can be compared by script. Runs on
+// x86_64 Linux and macOS without any game files; see build.sh.
+//
+//   detourcall [calls per measurement]
+
+#include "IServerAPI.h"
+#include "CDetour/detours.h"
+#include "CDetour/detourprofiler.h"
+#include "CDetour/midhook.h"
+#include "CDetour/vtablehook.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if !defined(__x86_64__)
+#error "detourcall only supports x86_64"
+#endif
+
+#if defined(__APPLE__)
+#define ASM_SYMBOL(name) "_" #name
+#else
+#define ASM_SYMBOL(name) #name
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int kRounds = 3;
+static constexpr size_t kLifetimeOps = 2000;
+
+static size_t g_Calls = 5000000;
+static volatile long g_Sink;
+
+// Creates hooks the same way as srcds-cli's ServerAPI, without any of the game support
+class ServerAPI : public IServerAPI
+{
+public:
+	IDetour *CreateDetour(void *callbackfunction, void **trampoline, void *addr) override {
+		CDetour *detour = new CDetour(callbackfunction, trampoline);
+		if (!detour->Init(addr)) {
+			delete detour;
+			return nullptr;
+		}
+		return detour;
+	}
+
+	IDetour *HookVirtual(void *instance, size_t index, void *callback, void **original,
+	                     VirtualHookMode mode) override {
+		CVirtualHook *hook = new CVirtualHook(callback, original, mode);
+		if (!hook->Init(instance, index)) {
+			delete hook;
+			return nullptr;
+		}
+		return hook;
+	}
+
+	IDetour *HookMidFunction(void *addr, MidHookCallback callback, uint32_t regs) override {
+		CMidHook *hook = new CMidHook(callback, regs);
+		if (!hook->Init(addr)) {
+			delete hook;
+			return nullptr;
+		}
+		return hook;
+	}
+
+	size_t GetDetourStats(DetourStats *stats, size_t maxStats) override {
+		return DetourProfiler::GetInstance().GetStats(stats, maxStats);
+	}
+
+	void FixPath(const char *) override { }
+	void GetArgs(int &, char ** &) override { }
+	void AddSystems(AppSystemInfo_t *) override { }
+	IGameLib *LoadLibrary(const char *) override { return nullptr; }
+};
+
+/**
+ * Prologue shapes, written in assembly so the compiler can't change them:
+ * frame  - standard frame setup, long enough for the 14 byte absolute jump
+ * leaf   - no frame, just enough bytes for a rel32 jump
+ * riprel - RIP-relative load in the first instruction
+ * branch - short conditional branch within the first 5 bytes
+ */
+extern "C" long g_Bias;
+long g_Bias = 3;
+
+extern "C" long shape_frame(long a, long b);
+extern "C" long shape_leaf(long a, long b);
+extern "C" long shape_riprel(long a, long b);
+extern "C" long shape_branch(long a, long b);
+
+asm(
+	".intel_syntax noprefix\n"
+	".text\n"
+	".globl " ASM_SYMBOL(shape_frame) "\n"
+	".p2align 4\n"
+	ASM_SYMBOL(shape_frame) ":\n"
+	"	push rbp\n"
+	"	mov rbp, rsp\n"
+	"	push rbx\n"
+	"	mov rbx, rdi\n"
+	"	lea rax, [rbx+rsi]\n"
+	"	add rax, rbx\n"
+	"	pop rbx\n"
+	"	pop rbp\n"
+	"	ret\n"
+	".globl " ASM_SYMBOL(shape_leaf) "\n"
+	".p2align 4\n"
+	ASM_SYMBOL(shape_leaf) ":\n"
+	"	lea rax, [rdi+rdi*2]\n"
+	"	add rax, rsi\n"
+	"	ret\n"
+	".globl " ASM_SYMBOL(shape_riprel) "\n"
+	".p2align 4\n"
+	ASM_SYMBOL(shape_riprel) ":\n"
+	"	mov rax, qword ptr [rip+" ASM_SYMBOL(g_Bias) "]\n"
+	"	add rax, rdi\n"
+	"	add rax, rsi\n"
+	"	ret\n"
+	".globl " ASM_SYMBOL(shape_branch) "\n"
+	".p2align 4\n"
+	ASM_SYMBOL(shape_branch) ":\n"
+	"	test rdi, rdi\n"
+	"	je 1f\n"
+	"	lea rax, [rdi+rsi]\n"
+	"	ret\n"
+	"1:\n"
+	"	mov rax, rsi\n"
+	"	ret\n"
+	".att_syntax prefix\n"
+);
+
+struct Big
+{
+	long a, b, c, d;
+};
+
+__attribute__((noinline)) static long arity0()
+{
+	asm volatile("");
+	return g_Bias * 3 + 1;
+}
+
+__attribute__((noinline)) static long arity3(long a, long b, long c)
+{
+	asm volatile("");
+	return a * b + c * g_Bias;
+}
+
+__attribute__((noinline)) static long arity6(long a, long b, long c, long d, long e, long f)
+{
+	asm volatile("");
+	return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f;
+}
+
+__attribute__((noinline)) static long arity8(long a, long b, long c, long d, long e, long f, long g, long h)
+{
+	asm volatile("");
+	return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h;
+}
+
+__attribute__((noinline)) static double floats(double x, double y, int z)
+{
+	asm volatile("");
+	return x * y + z;
+}
+
+__attribute__((noinline)) static Big bigReturn(long x)
+{
+	asm volatile("");
+	return Big{x, x + 1, x + 2, x * g_Bias};
+}
+
+static inline long Consume(long value) { return value; }
+static inline long Consume(double value) { return long(value); }
+static inline long Consume(const Big &value) { return value.d; }
+
+enum Role
+{
+	Role_Detour,
+	Role_Abs64,
+	Role_Chain,
+	Role_Lifetime,
+	Role_Profiled
+};
+
+// Callback that only calls the original function, one per target and role
+template <auto Target, int R, typename Sig = std::remove_pointer_t<decltype(Target)>>
+struct Passthrough;
+
+template <auto Target, int R, typename Ret, typename ...Args>
+struct Passthrough<Target, R, Ret(Args...)>
+{
+	static Ret Hook(Args... args) {
+		return Detour<&Hook>::Original(args...);
+	}
+
+	using Hooked = Detour<&Hook>;
+};
+
+static void EmptyMidHook(MidHookContext *)
+{
+}
+
+class Widget
+{
+public:
+	virtual long Get(long a, long b);
+	// Declared after Get so that Get keeps the first vtable slot
+	virtual ~Widget() { }
+};
+
+__attribute__((noinline)) long Widget::Get(long a, long b)
+{
+	asm volatile("");
+	return a * b + g_Bias;
+}
+
+static long Widget_Get(void *widget, long a, long b)
+{
+	return VirtualHook<Widget_Get>::Original(widget, a, b);
+}
+
+// Calls a trampoline through a member function pointer, the way detours used to call the original
+class MemberCaller { };
+using MemberTrampoline = long (MemberCaller::*)(long);
+
+template <typename Body>
+static double TimeLoop(Body body)
+{
+	double best = 0;
+
+	for (int round = 0; round < kRounds; round++) {
+		long sum = 0;
+		Clock::time_point start = Clock::now();
+		for (size_t i = 0; i < g_Calls; i++)
+			sum += body();
+		double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / g_Calls;
+		g_Sink = sum;
+
+		if (round == 0 || ns < best)
+			best = ns;
+	}
+
+	return best;
+}
+
+template <typename Fn, typename ...Args>
+static double TimeCalls(Fn fn, Args... args)
+{
+	// Calling through a volatile pointer keeps the call from being inlined or hoisted
+	Fn volatile function = fn;
+	return TimeLoop([&]() { return Consume(function(args...)); });
+}
+
+static void ReportCall(const char *target, const char *path, double ns)
+{
+	printf("call target=%s path=%s ns_per_call=%.2f\n", target, path, ns);
+}
+
+static void ReportLifetime(const char *target, const char *hook, double create, double destroy)
+{
+	printf("lifetime target=%s hook=%s create_ns=%.0f destroy_ns=%.0f\n", target, hook, create, destroy);
+}
+
+static void ReportFailure(const char *target, const char *path)
+{
+	printf("call target=%s path=%s failed=1\n", target, path);
+}
+
+// Creates, enables, disables and destroys a hook kLifetimeOps times
+template <typename Create>
+static void TimeLifetime(const char *target, const char *hook, Create create)
+{
+	std::chrono::duration<double, std::nano> created(0), destroyed(0);
+
+	for (size_t i = 0; i < kLifetimeOps; i++) {
+		Clock::time_point start = Clock::now();
+		IDetour *detour = create();
+		if (!detour) {
+			ReportFailure(target, hook);
+			return;
+		}
+		detour->Enable();
+
+		Clock::time_point middle = Clock::now();
+		detour->Disable();
+		detour->Destroy();
+		Clock::time_point end = Clock::now();
+
+		created += middle - start;
+		destroyed += end - middle;
+	}
+
+	ReportLifetime(target, hook, created.count() / kLifetimeOps, destroyed.count() / kLifetimeOps);
+}
+
+// Maps a stub more than 2GB away from near that jumps to function, so that a detour gated through
+// it has to use the absolute jump. The stub adds one indirect jump to the hooked path.
+static void *MakeFarStub(void *near, void *function)
+{
+	const size_t size = 4096;
+	const uintptr_t distances[] = {uintptr_t(1) << 33, uintptr_t(1) << 34, uintptr_t(1) << 36};
+
+	for (uintptr_t distance : distances) {
+		for (int sign = 0; sign < 2; sign++) {
+			uintptr_t hint = sign ? uintptr_t(near) - distance : uintptr_t(near) + distance;
+			void *stub = mmap((void *)(hint & ~uintptr_t(size - 1)), size, PROT_READ | PROT_WRITE | PROT_EXEC,
+			                  MAP_PRIVATE | MAP_ANON, -1, 0);
+			if (stub == MAP_FAILED)
+				continue;
+
+			if (!IsRelJump32Reachable(near, stub)) {
+				unsigned char *code = (unsigned char *)stub;
+				code[0] = 0x48;		// mov rax, imm64
+				code[1] = 0xB8;
+				memcpy(&code[2], &function, sizeof(function));
+				code[10] = 0xFF;	// jmp rax
+				code[11] = 0xE0;
+				return stub;
+			}
+
+			munmap(stub, size);
+		}
+	}
+
+	return nullptr;
+}
+
+enum Paths
+{
+	Path_Abs64 = 1 << 0,	// Target has at least 14 bytes to patch
+	Path_Member = 1 << 1,	// Target is long (long, long), so its trampoline can be called as a member
+};
+
+static void BenchMember(const char *name, long (*trampoline)(long, long), long a, long b)
+{
+	MemberTrampoline member;
+	struct { void *function; ptrdiff_t adjust; } raw = {reinterpret_cast<void *>(trampoline), 0};
+	static_assert(sizeof(raw) == sizeof(member), "Unexpected member function pointer size");
+	memcpy(&member, &raw, sizeof(member));
+
+	// The first argument becomes the this pointer
+	MemberTrampoline volatile function = member;
+	// Volatile too, or the compiler sees that a isn't the address of any object
+	MemberCaller *volatile object = reinterpret_cast<MemberCaller *>(a);
+	ReportCall(name, "trampoline_member", TimeLoop([&]() {
+		MemberTrampoline call = function;
+		return (object->*call)(b);
+	}));
+}
+
+template <auto Target, typename ...Args>
+static void BenchTarget(ServerAPI &api, const char *name, unsigned int paths, Args... args)
+{
+	using Hook = Passthrough<Target, Role_Detour>;
+	void *address = reinterpret_cast<void *>(Target);
+
+	ReportCall(name, "original", TimeCalls(Target, args...));
+
+	IDetour *detour = Hook::Hooked::Create(&api, address);
+	if (!detour) {
+		ReportFailure(name, "detour");
+		return;
+	}
+
+	detour->Enable();
+	ReportCall(name, "detour", TimeCalls(Target, args...));
+	ReportCall(name, "trampoline", TimeCalls(Hook::Hooked::Original, args...));
+
+	if constexpr (sizeof...(Args) == 2) {
+		if (paths & Path_Member)
+			BenchMember(name, Hook::Hooked::Original, args...);
+	}
+
+	// A second detour on top of the first one, which relocates the first one's jump
+	using Outer = Passthrough<Target, Role_Chain>;
+	IDetour *outer = Outer::Hooked::Create(&api, address);
+	if (outer) {
+		outer->Enable();
+		ReportCall(name, "detour_chain2", TimeCalls(Target, args...));
+		outer->Disable();
+		outer->Destroy();
+	} else {
+		ReportFailure(name, "detour_chain2");
+	}
+
+	detour->Disable();
+	detour->Destroy();
+
+	if (paths & Path_Abs64) {
+		using Far = Passthrough<Target, Role_Abs64>;
+		void *stub = MakeFarStub(address, reinterpret_cast<void *>(&Far::Hook));
+		IDetour *far = stub ? api.CreateDetour(stub, reinterpret_cast<void **>(&Far::Hooked::Original), address)
+		                    : nullptr;
+		if (far) {
+			far->Enable();
+			ReportCall(name, "detour_abs64", TimeCalls(Target, args...));
+			far->Disable();
+			far->Destroy();
+		} else {
+			ReportFailure(name, "detour_abs64");
+		}
+	}
+
+	IDetour *mid = api.HookMidFunction(address, EmptyMidHook, 0);
+	if (mid) {
+		mid->Enable();
+		ReportCall(name, "midhook", TimeCalls(Target, args...));
+		mid->Disable();
+		mid->Destroy();
+	} else {
+		ReportFailure(name, "midhook");
+	}
+
+	mid = api.HookMidFunction(address, EmptyMidHook, MidHookReg_Rdi | MidHookReg_Rsi | MidHookReg_Vector);
+	if (mid) {
+		mid->Enable();
+		ReportCall(name, "midhook_vector", TimeCalls(Target, args...));
+		mid->Disable();
+		mid->Destroy();
+	} else {
+		ReportFailure(name, "midhook_vector");
+	}
+
+	TimeLifetime(name, "detour", [&]() {
+		return Passthrough<Target, Role_Lifetime>::Hooked::Create(&api, address);
+	});
+
+	TimeLifetime(name, "midhook", [&]() {
+		return api.HookMidFunction(address, EmptyMidHook, 0);
+	});
+}
+
+static void BenchVirtual(ServerAPI &api)
+{
+	Widget *volatile widget = new Widget();
+
+	ReportCall("virtual", "original", TimeLoop([&]() { return widget->Get(3, 4); }));
+
+	IDetour *hook = VirtualHook<Widget_Get>::Create(&api, widget, 0);
+	if (!hook) {
+		ReportFailure("virtual", "vtable");
+		return;
+	}
+
+	hook->Enable();
+	ReportCall("virtual", "vtable", TimeLoop([&]() { return widget->Get(3, 4); }));
+	hook->Destroy();
+
+	TimeLifetime("virtual", "vtable", [&]() {
+		return VirtualHook<Widget_Get>::Create(&api, widget, 0);
+	});
+
+	delete widget;
+}
+
+// Detours created after the profiler is enabled are gated through its counting thunk
+static void BenchProfiled(ServerAPI &api)
+{
+	if (!DetourProfiler::GetInstance().Enable(0)) {
+		ReportFailure("frame", "detour_profiled");
+		return;
+	}
+
+	using Hook = Passthrough<shape_frame, Role_Profiled>;
+	IDetour *detour = Hook::Hooked::Create(&api, reinterpret_cast<void *>(shape_frame));
+	if (!detour) {
+		ReportFailure("frame", "detour_profiled");
+		return;
+	}
+
+	detour->Enable();
+	ReportCall("frame", "detour_profiled", TimeCalls(shape_frame, 3L, 4L));
+	detour->Disable();
+	detour->Destroy();
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		g_Calls = strtoul(argv[1], nullptr, 10);
+
+	ServerAPI api;
+
+	BenchTarget<shape_frame>(api, "frame", Path_Abs64 | Path_Member, 3L, 4L);
+	BenchTarget<shape_leaf>(api, "leaf", Path_Member, 3L, 4L);
+	BenchTarget<shape_riprel>(api, "riprel", Path_Member, 3L, 4L);
+	BenchTarget<shape_branch>(api, "branch", Path_Member, 3L, 4L);
+	BenchTarget<arity0>(api, "arity0", 0);
+	BenchTarget<arity3>(api, "arity3", 0, 1L, 2L, 3L);
+	BenchTarget<arity6>(api, "arity6", 0, 1L, 2L, 3L, 4L, 5L, 6L);
+	BenchTarget<arity8>(api, "arity8", Path_Abs64, 1L, 2L, 3L, 4L, 5L, 6L, 7L, 8L);
+	BenchTarget<floats>(api, "floats", 0, 3.0, 4.0, 1);
+	BenchTarget<bigReturn>(api, "bigreturn", 0, 5L);
+	BenchVirtual(api);
+	BenchProfiled(api);
+
+	return 0;
+}
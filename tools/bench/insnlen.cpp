@@ -0,0 +1,312 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Checks and benchmarks the table-driven instruction decoder behind copy_bytes against udis86.
+//
+// Every function symbol in the given x86-64 ELF libraries is decoded instruction by instruction
+// with both decoders and the lengths compared. Each prologue is then relocated the way CDetour
+// does it and the branch and [rip+disp32] targets of the copy are checked with udis86. Finally,
+// the time to size a 14 byte prologue is measured for both decoders.
+//
+//   insnlen /path/to/server.so [more libraries...]
+
+#include <asm/asm.h>
+#include <asm/x86insn.h>
+#include <libudis86/udis86.h>
+#include <chrono>
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Function
+{
+	unsigned char *code;
+	size_t size;
+};
+
+// Maps the file and collects the code of every sized function symbol in an executable section
+static bool LoadFunctions(const char *path, std::vector<Function> &functions)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return false;
+	}
+
+	struct stat st;
+	fstat(fd, &st);
+	void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror(path);
+		return false;
+	}
+
+	unsigned char *file = static_cast<unsigned char *>(base);
+	const Elf64_Ehdr *ehdr = reinterpret_cast<const Elf64_Ehdr *>(file);
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+	    ehdr->e_machine != EM_X86_64) {
+		fprintf(stderr, "%s: not an x86-64 ELF file\n", path);
+		return false;
+	}
+
+	const Elf64_Shdr *sections = reinterpret_cast<const Elf64_Shdr *>(file + ehdr->e_shoff);
+	size_t before = functions.size();
+
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		if (sections[i].sh_type != SHT_SYMTAB && sections[i].sh_type != SHT_DYNSYM)
+			continue;
+
+		const Elf64_Sym *syms = reinterpret_cast<const Elf64_Sym *>(file + sections[i].sh_offset);
+		size_t count = sections[i].sh_size / sizeof(Elf64_Sym);
+
+		for (size_t j = 0; j < count; j++) {
+			const Elf64_Sym &sym = syms[j];
+			if (ELF64_ST_TYPE(sym.st_info) != STT_FUNC || !sym.st_size || sym.st_shndx >= ehdr->e_shnum)
+				continue;
+
+			const Elf64_Shdr &text = sections[sym.st_shndx];
+			if (!(text.sh_flags & SHF_EXECINSTR) || text.sh_type != SHT_PROGBITS ||
+			    sym.st_value < text.sh_addr || sym.st_value + sym.st_size > text.sh_addr + text.sh_size)
+				continue;
+
+			functions.push_back({file + text.sh_offset + (sym.st_value - text.sh_addr), sym.st_size});
+		}
+
+		// The full symbol table is a superset of the dynamic one
+		if (sections[i].sh_type == SHT_SYMTAB)
+			break;
+	}
+
+	printf("library=%s functions=%zu\n", path, functions.size() - before);
+	return true;
+}
+
+static void InitUdis(ud_t &ud, const unsigned char *code, size_t size, uint64_t pc)
+{
+	ud_init(&ud);
+	ud_set_mode(&ud, 64);
+	ud_set_input_buffer(&ud, code, size);
+	ud_set_pc(&ud, pc);
+}
+
+// Address a branch or [rip+disp32] operand of the current udis86 instruction refers to, or 0
+static uint64_t UdisTarget(const ud_t &ud)
+{
+	uint64_t next = ud_insn_off(&ud) + ud_insn_len(&ud);
+	for (unsigned int i = 0; i < 3; i++) {
+		const ud_operand *op = ud_insn_opr(&ud, i);
+		if (!op)
+			break;
+		if (op->type == UD_OP_JIMM)
+			return next + (op->size == 8 ? op->lval.sbyte : op->size == 16 ? op->lval.sword : op->lval.sdword);
+		if (op->type == UD_OP_MEM && op->base == UD_R_RIP)
+			return next + (op->offset == 8 ? op->lval.sbyte : op->lval.sdword);
+	}
+	return 0;
+}
+
+static void CompareLengths(const std::vector<Function> &functions)
+{
+	size_t insns = 0, mismatches = 0, udisInvalid = 0, tableInvalid = 0;
+
+	for (const Function &func : functions) {
+		ud_t ud;
+		InitUdis(ud, func.code, func.size, 0);
+
+		size_t offset = 0;
+		while (offset < func.size) {
+			unsigned int udisLen = ud_disassemble(&ud);
+			if (!udisLen)
+				break;
+
+			x86_insn insn;
+			int len = x86_decode(func.code + offset, 1, &insn);
+
+			if (ud_insn_mnemonic(&ud) == UD_Iinvalid) {
+				// Mostly newer extensions udis86 predates; resync on our length if we have one
+				udisInvalid++;
+				if (!len)
+					break;
+				offset += len;
+				InitUdis(ud, func.code + offset, func.size - offset, offset);
+				continue;
+			}
+
+			insns++;
+			if (!len) {
+				tableInvalid++;
+				break;
+			}
+
+			if ((unsigned int)len != udisLen) {
+				if (mismatches++ < 10) {
+					printf("mismatch at %p: udis86=%u table=%d bytes=", func.code + offset, udisLen, len);
+					for (unsigned int i = 0; i < udisLen; i++)
+						printf("%02X", func.code[offset + i]);
+					printf(" (%s)\n", ud_insn_asm(&ud));
+				}
+				break;
+			}
+
+			offset += len;
+		}
+	}
+
+	printf("lengths instructions=%zu mismatches=%zu table_invalid=%zu udis_invalid=%zu\n", insns, mismatches,
+	       tableInvalid, udisInvalid);
+}
+
+static void CheckRelocation(const std::vector<Function> &functions)
+{
+	size_t relocated = 0, rejected = 0, operands = 0, errors = 0;
+	unsigned char copy[256];
+
+	for (const Function &func : functions) {
+		if (func.size < X64_ABS_SIZE)
+			continue;
+
+		// Pretend the copy runs 256MB away, like a trampoline that didn't land next to its function
+		unsigned char *destpc = func.code + 0x10000000;
+		int written;
+		int bytes = relocate_bytes(func.code, copy, destpc, X64_ABS_SIZE, &written);
+		if (bytes < 0) {
+			rejected++;
+			continue;
+		}
+
+		relocated++;
+
+		ud_t src, dst;
+		InitUdis(src, func.code, bytes, (uint64_t)func.code);
+		InitUdis(dst, copy, written, (uint64_t)destpc);
+
+		while (ud_disassemble(&src)) {
+			if (!ud_disassemble(&dst)) {
+				errors++;
+				break;
+			}
+
+			uint64_t target = UdisTarget(src);
+			if (!target)
+				continue;
+
+			// Widened far branches go through an absolute address instead
+			operands++;
+			uint64_t moved = UdisTarget(dst);
+			const ud_operand *op = ud_insn_opr(&dst, 0);
+			if (op && op->type == UD_OP_MEM && op->base == UD_R_RIP && ud_insn_mnemonic(&src) != ud_insn_mnemonic(&dst))
+				moved = *(uint64_t *)(copy + (moved - (uint64_t)destpc));
+
+			if (moved != target && errors++ < 10)
+				printf("relocation error at %p: target %llx became %llx\n", func.code, (unsigned long long)target,
+				       (unsigned long long)moved);
+		}
+	}
+
+	printf("relocation prologues=%zu rejected=%zu pc_relative=%zu errors=%zu\n", relocated, rejected, operands,
+	       errors);
+}
+
+template <class Sizer>
+static double TimePrologues(std::vector<unsigned char> &prologues, Sizer sizer)
+{
+	size_t count = prologues.size() / 32, total = 0;
+	Clock::time_point start = Clock::now();
+	for (int round = 0; round < 10; round++) {
+		for (size_t i = 0; i < count; i++)
+			total += sizer(&prologues[i * 32]);
+	}
+	double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+	// Keep the loop from being optimized away
+	if (!total)
+		printf("\n");
+
+	return ns / (count * 10);
+}
+
+static int UdisCopyBytes(unsigned char *func)
+{
+	// What copy_bytes did before: a full udis86 decode per instruction
+	ud_t ud;
+	ud_init(&ud);
+	ud_set_mode(&ud, 64);
+	ud_set_input_buffer(&ud, func, 20);
+
+	int bytecount = 0;
+	while (bytecount < X64_ABS_SIZE && ud_disassemble(&ud))
+		bytecount += ud_insn_len(&ud);
+
+	return bytecount;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <library.so> [...]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<Function> functions;
+	for (int i = 1; i < argc; i++)
+		LoadFunctions(argv[i], functions);
+
+	// Prologue sizing reads up to 20 bytes, skip anything shorter
+	std::vector<Function> prologues;
+	for (const Function &func : functions) {
+		if (func.size >= 20)
+			prologues.push_back(func);
+	}
+
+	if (prologues.empty())
+		return 1;
+
+	CompareLengths(functions);
+	CheckRelocation(prologues);
+
+	// Time the decoders rather than cache misses on the libraries by packing the prologues together
+	std::vector<unsigned char> packed(prologues.size() * 32);
+	for (size_t i = 0; i < prologues.size(); i++)
+		memcpy(&packed[i * 32], prologues[i].code, 20);
+
+	double udis = TimePrologues(packed, UdisCopyBytes);
+	double table = TimePrologues(packed, [](unsigned char *func) { return copy_bytes(func, nullptr, X64_ABS_SIZE); });
+	printf("prologue_sizing count=%zu udis86_ns=%.1f table_ns=%.1f speedup=%.1f\n", prologues.size(), udis, table,
+	       udis / table);
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Benchmark and self-check for the SHA-256 implementations in lzma/Sha256.c.
+//
+// Every implementation the CPU supports is checked against the portable one, hashing random
+// buffers fed in random pieces, and Sha256_UpdateMulti is checked against hashing the same
+// buffers one at a time. Throughput is printed in GB/s for one buffer at a time with each
+// implementation and for 8 vzip-sized buffers with each multi-buffer mode. Runs on Linux and
+// macOS without any game files; see build.sh.
+//
+//   sha256 [megabytes per buffer]
+
+#include "lzma/Sha256.h"
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static const char *const kImplNames[] = {"portable", "sha_x86", "sha_arm"};
+static const char *const kMultiNames[] = {"serial", "avx2"};
+
+static double SecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void Hash(const Byte *data, size_t size, Byte digest[SHA256_DIGEST_SIZE])
+{
+	CSha256 sha;
+	Sha256_Init(&sha);
+	Sha256_Update(&sha, data, size);
+	Sha256_Final(&sha, digest);
+}
+
+// Hashes in random pieces so partial blocks are carried between updates
+static void HashPieces(const Byte *data, size_t size, std::mt19937 &rng, Byte digest[SHA256_DIGEST_SIZE])
+{
+	CSha256 sha;
+	Sha256_Init(&sha);
+	for (size_t pos = 0; pos < size; ) {
+		size_t piece = rng() % 3 ? rng() % 200 : rng() % 5000;
+		if (piece > size - pos)
+			piece = size - pos;
+		Sha256_Update(&sha, data + pos, piece);
+		pos += piece;
+	}
+	Sha256_Final(&sha, digest);
+}
+
+int main(int argc, char **argv)
+{
+	size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+	size_t size = megabytes << 20;
+	std::mt19937 rng(1234);
+	size_t errors = 0;
+
+	std::vector<Byte> data(size + 64);
+	for (Byte &b : data)
+		b = Byte(rng());
+
+	Sha256_Prepare();
+	unsigned bestImpl = Sha256_GetImpl();
+	unsigned bestMulti = Sha256_GetMultiImpl();
+
+	// The NIST example of two blocks
+	static const char kAbc[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	static const Byte kAbcDigest[SHA256_DIGEST_SIZE] = {
+		0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+		0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1
+	};
+
+	// Reference digests of random lengths and offsets from the portable implementation
+	struct Case { size_t offset, size; Byte digest[SHA256_DIGEST_SIZE]; };
+	std::vector<Case> cases(200);
+	Sha256_SetImpl(SHA256_IMPL_PORTABLE);
+	for (Case &c : cases) {
+		c.offset = rng() % 64;
+		c.size = rng() % 4 ? rng() % 3000 : rng() % (1 << 20);
+		Hash(&data[c.offset], c.size, c.digest);
+	}
+
+	std::vector<double> gbps;
+	for (unsigned impl = SHA256_IMPL_PORTABLE; impl <= SHA256_IMPL_SHA_ARM; impl++) {
+		if (!Sha256_SetImpl(impl)) {
+			gbps.push_back(0);
+			continue;
+		}
+
+		Byte digest[SHA256_DIGEST_SIZE];
+		Hash((const Byte *)kAbc, strlen(kAbc), digest);
+		if (memcmp(digest, kAbcDigest, sizeof(digest)) != 0) {
+			printf("mismatch impl=%s nist\n", kImplNames[impl]);
+			errors++;
+		}
+
+		for (size_t n = 0; n < cases.size(); n++) {
+			const Case &c = cases[n];
+			HashPieces(&data[c.offset], c.size, rng, digest);
+			if (memcmp(digest, c.digest, sizeof(digest)) != 0) {
+				printf("mismatch impl=%s case=%zu size=%zu\n", kImplNames[impl], n, c.size);
+				errors++;
+			}
+		}
+
+		Clock::time_point start = Clock::now();
+		Hash(&data[0], size, digest);
+		gbps.push_back(size / SecondsSince(start) / 1e9);
+	}
+
+	Sha256_SetImpl(bestImpl);
+
+	// 8 buffers of different lengths, each continuing from a different partial block
+	const size_t bufSize = size / SHA256_MULTI_MAX;
+	std::vector<double> multiGbps;
+	for (unsigned multi = SHA256_MULTI_SERIAL; multi <= SHA256_MULTI_AVX2; multi++) {
+		if (!Sha256_SetMultiImpl(multi)) {
+			multiGbps.push_back(0);
+			continue;
+		}
+
+		for (int round = 0; round < 20; round++) {
+			CSha256 shas[SHA256_MULTI_MAX], *ctx[SHA256_MULTI_MAX];
+			const Byte *bufs[SHA256_MULTI_MAX];
+			size_t sizes[SHA256_MULTI_MAX], prefixes[SHA256_MULTI_MAX];
+			unsigned num = 1 + rng() % SHA256_MULTI_MAX;
+
+			for (unsigned i = 0; i < num; i++) {
+				prefixes[i] = rng() % 100;
+				sizes[i] = rng() % (bufSize / 4);
+				bufs[i] = &data[i * bufSize + prefixes[i]];
+				ctx[i] = &shas[i];
+				Sha256_Init(ctx[i]);
+				Sha256_Update(ctx[i], &data[i * bufSize], prefixes[i]);
+			}
+
+			Sha256_UpdateMulti(ctx, bufs, sizes, num);
+
+			for (unsigned i = 0; i < num; i++) {
+				Byte digest[SHA256_DIGEST_SIZE], expected[SHA256_DIGEST_SIZE];
+				Sha256_Final(ctx[i], digest);
+				Hash(&data[i * bufSize], prefixes[i] + sizes[i], expected);
+				if (memcmp(digest, expected, sizeof(digest)) != 0) {
+					printf("mismatch multi=%s round=%d lane=%u size=%zu\n", kMultiNames[multi], round, i,
+					       prefixes[i] + sizes[i]);
+					errors++;
+				}
+			}
+		}
+
+		CSha256 shas[SHA256_MULTI_MAX], *ctx[SHA256_MULTI_MAX];
+		const Byte *bufs[SHA256_MULTI_MAX];
+		size_t sizes[SHA256_MULTI_MAX];
+		for (unsigned i = 0; i < SHA256_MULTI_MAX; i++) {
+			ctx[i] = &shas[i];
+			bufs[i] = &data[i * bufSize];
+			sizes[i] = bufSize;
+			Sha256_Init(ctx[i]);
+		}
+
+		Clock::time_point start = Clock::now();
+		Sha256_UpdateMulti(ctx, bufs, sizes, SHA256_MULTI_MAX);
+		multiGbps.push_back(bufSize * SHA256_MULTI_MAX / SecondsSince(start) / 1e9);
+	}
+
+	printf("sha256 size=%zu errors=%zu best=%s multi=%s", size, errors, kImplNames[bestImpl], kMultiNames[bestMulti]);
+	for (unsigned impl = 0; impl < gbps.size(); impl++) {
+		if (gbps[impl] > 0)
+			printf(" %s_gbps=%.2f", kImplNames[impl], gbps[impl]);
+	}
+	for (unsigned multi = 0; multi < multiGbps.size(); multi++) {
+		if (multiGbps[multi] > 0)
+			printf(" multi_%s_gbps=%.2f", kMultiNames[multi], multiGbps[multi]);
+	}
+	printf("\n");
+
+	return errors ? 1 : 0;
+}
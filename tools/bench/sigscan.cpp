@@ -0,0 +1,228 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Benchmark and self-check for SigScanner.
+//
+// Takes signatures from random places in a file, replaces some of their bytes with wildcards and
+// searches the whole file for them with both the compiled matchers and the Boyer-Moore-Horspool
+// fallback. Every result is checked against a naive search. Throughput is printed in GB/s next
+// to a plain SSE2 read of the same buffer, which is about what memory bandwidth allows. Any
+// binary will do as input, such as a game library. Searches that skip spans of relocated bytes
+// are checked the same way, with a random span at every few kilobytes, and so are approximate
+// searches allowing two mismatches. Runs on Linux and macOS; see build.sh.
+//
+//   sigscan <file> [signatures]
+
+#include "SigScanner.h"
+#include <chrono>
+#include <emmintrin.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+CPageAlloc GenBuffer::ms_Allocator(16);
+
+using Clock = std::chrono::steady_clock;
+
+static const char kWildcard = '\x2A';
+
+static double SecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static const char *FindNaive(const char *start, size_t size, const char *pattern, size_t len)
+{
+	for (const char *p = start; p + len <= start + size; p++) {
+		size_t i = 0;
+		while (i < len && (pattern[i] == kWildcard || p[i] == pattern[i]))
+			i++;
+		if (i == len)
+			return p;
+	}
+
+	return nullptr;
+}
+
+static const char *FindNaiveSkipping(const char *start, size_t size, const char *pattern, size_t len,
+                                     const std::vector<SigScanner::Span> &spans)
+{
+	std::vector<bool> skipped(size);
+	for (const SigScanner::Span &span : spans) {
+		for (size_t i = span.start; i < span.end && i < size; i++)
+			skipped[i] = true;
+	}
+
+	for (size_t p = 0; p + len <= size; p++) {
+		size_t i = 0;
+		while (i < len && (skipped[p + i] || pattern[i] == kWildcard || start[p + i] == pattern[i]))
+			i++;
+		if (i == len)
+			return start + p;
+	}
+
+	return nullptr;
+}
+
+// Number of positions where pattern matches with at most maxMismatches bytes differing
+static size_t CountNaiveApproximate(const char *start, size_t size, const char *pattern, size_t len,
+                                    size_t maxMismatches)
+{
+	size_t count = 0;
+	for (size_t p = 0; p + len <= size; p++) {
+		size_t mismatches = 0;
+		for (size_t i = 0; i < len && mismatches <= maxMismatches; i++) {
+			if (pattern[i] != kWildcard && start[p + i] != pattern[i])
+				mismatches++;
+		}
+		if (mismatches <= maxMismatches)
+			count++;
+	}
+
+	return count;
+}
+
+static double ReadBandwidth(const char *data, size_t size)
+{
+	Clock::time_point start = Clock::now();
+	__m128i acc = _mm_setzero_si128();
+	for (size_t i = 0; i + 16 <= size; i += 16)
+		acc = _mm_or_si128(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&data[i]), _mm_set1_epi8(0x5A)));
+	double seconds = SecondsSince(start);
+
+	volatile int sink = _mm_movemask_epi8(acc);
+	(void)sink;
+	return size / seconds / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <file> [signatures]\n", argv[0]);
+		return 1;
+	}
+
+	FILE *fp = fopen(argv[1], "rb");
+	if (!fp) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	std::vector<char> data;
+	char chunk[65536];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+		data.insert(data.end(), chunk, chunk + read);
+	fclose(fp);
+
+	if (data.size() < 4096) {
+		fprintf(stderr, "%s is too small\n", argv[1]);
+		return 1;
+	}
+
+	size_t count = argc > 2 ? strtoul(argv[2], nullptr, 10) : 50;
+	SigScanner &scanner = SigScanner::GetInstance();
+	std::mt19937 rng(1234);
+	size_t errors = 0;
+	double jitSeconds = 0, slowSeconds = 0, spanSeconds = 0, approxSeconds = 0;
+
+	std::vector<SigScanner::Span> spans;
+	for (size_t pos = rng() % 4096; pos + 8 < data.size(); pos += 8 + rng() % 4096) {
+		SigScanner::Span span;
+		span.start = uint32_t(pos);
+		span.end = uint32_t(pos + (rng() % 2 ? 4 : 8));
+		spans.push_back(span);
+	}
+
+	for (size_t n = 0; n < count; n++) {
+		size_t len = 8 + rng() % 33;
+		size_t pos = rng() % (data.size() - len);
+		std::vector<char> pattern(&data[pos], &data[pos] + len);
+
+		// Wildcards where addresses would be, and every third signature made unlikely to match
+		for (char &byte : pattern) {
+			if (rng() % 6 == 0)
+				byte = kWildcard;
+		}
+		if (n % 3 == 0)
+			pattern[rng() % len] ^= 0x5A;
+
+		const char *expected = FindNaive(data.data(), data.size(), pattern.data(), len);
+
+		Clock::time_point start = Clock::now();
+		void *found = scanner.Find(data.data(), data.size(), pattern.data(), len);
+		jitSeconds += SecondsSince(start);
+
+		start = Clock::now();
+		void *slow = SigScanner::FindSlow(data.data(), data.size(), pattern.data(), len);
+		slowSeconds += SecondsSince(start);
+
+		if (found != expected || slow != expected) {
+			if (errors++ < 10)
+				printf("mismatch signature=%zu offset=%zu len=%zu expected=%p jit=%p slow=%p\n", n, pos, len,
+				       expected, found, slow);
+		}
+
+		// The naive search with spans is slow, so only every tenth signature is checked against it
+		start = Clock::now();
+		found = scanner.Find(data.data(), data.size(), pattern.data(), len, spans.data(), spans.size());
+		spanSeconds += SecondsSince(start);
+
+		if (n % 10 == 0) {
+			expected = FindNaiveSkipping(data.data(), data.size(), pattern.data(), len, spans);
+			if (found != expected && errors++ < 10)
+				printf("mismatch signature=%zu offset=%zu len=%zu expected=%p spans=%p\n", n, pos, len, expected, found);
+		}
+
+		// Two more bytes changed, as if the game had been updated since the signature was made
+		pattern[rng() % len] ^= 0x11;
+		pattern[rng() % len] ^= 0x22;
+
+		SigScanner::ApproximateMatch matches[4];
+		start = Clock::now();
+		size_t approx = SigScanner::FindApproximate(data.data(), data.size(), pattern.data(), len, 2, matches, 4);
+		approxSeconds += SecondsSince(start);
+
+		if (n % 10 == 0) {
+			size_t naive = CountNaiveApproximate(data.data(), data.size(), pattern.data(), len, 2);
+			if (approx != naive && errors++ < 10)
+				printf("mismatch signature=%zu offset=%zu len=%zu approximate=%zu expected=%zu\n", n, pos, len,
+				       approx, naive);
+		}
+	}
+
+	// Bytes covered per second, counting a search that stops early as a search of the whole file
+	double bytes = double(data.size()) * count;
+	printf("sigscan size=%zu signatures=%zu spans=%zu errors=%zu jit_gbps=%.2f slow_gbps=%.2f span_gbps=%.2f "
+	       "approx_gbps=%.2f read_gbps=%.2f\n", data.size(), count, spans.size(), errors, bytes / jitSeconds / 1e9,
+	       bytes / slowSeconds / 1e9, bytes / spanSeconds / 1e9, bytes / approxSeconds / 1e9,
+	       ReadBandwidth(data.data(), data.size()));
+
+	return errors ? 1 : 0;
+}
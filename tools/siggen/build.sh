@@ -0,0 +1,21 @@
+#!/bin/sh
+# Builds siggen, which reads game libraries of either platform from disk.
+#
+#   tools/siggen/build.sh [output dir]
+
+set -e
+
+cd "$(dirname "$0")"
+OUT="${1:-.}"
+PUBLIC=../../public
+SRCDS=../../srcds-cli/macos
+CC="${CC:-cc}"
+CXX="${CXX:-c++}"
+CFLAGS="${CFLAGS:--O2} -I$PUBLIC"
+CXXFLAGS="${CXXFLAGS:--O2} -std=c++17 -I$PUBLIC -I$PUBLIC/amtl -I$PUBLIC/sourcehook -I$SRCDS"
+
+mkdir -p "$OUT"
+$CC $CFLAGS -c $PUBLIC/asm/x86insn.c -o "$OUT/x86insn.o"
+$CXX $CXXFLAGS siggen.cpp $SRCDS/ImageFile.cpp $SRCDS/Relocations.cpp $SRCDS/SigScanner.cpp "$OUT/x86insn.o" -o "$OUT/siggen"
+
+echo "Built siggen in $OUT"
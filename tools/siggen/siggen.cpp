@@ -0,0 +1,350 @@
+/**
+ * vim: set ts=4 :
+ * =============================================================================
+ * Source Dedicated Server NX
+ * Copyright (C) 2011-2017 Scott Ehlert and AlliedModders LLC.
+ * All rights reserved.
+ * =============================================================================
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License, version 3.0, as published by the
+ * Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * As a special exception, AlliedModders LLC gives you permission to link the
+ * code of this program (as well as its derivative works) to "Half-Life 2," the
+ * "Source Engine," the "Steamworks SDK," and any Game MODs that run on software
+ * by the Valve Corporation.  You must obey the GNU General Public License in
+ * all respects for all other code used.  Additionally, AlliedModders LLC grants
+ * this exception to all derivative works.
+ */
+
+// Generates the shortest unique signature for functions in a game library.
+//
+// The library is read from disk with ImageFile, which also finds the functions by symbol name and
+// reads the library's relocations, so it doesn't need to be loadable here: Mach-O libraries work
+// on Linux and the other way around. Starting at each function, whole instructions are added to the
+// signature until nothing else in the library's code matches it. Relocated bytes, rel32 branch
+// targets and RIP-relative displacements are wildcards, so the signature survives code moving
+// around between builds. The output can be given to MAKE_SIG, FindPattern or FindMaskedPattern,
+// and "<library> <signature>" lines work as -trace config entries.
+//
+// Uniqueness is checked over the whole image, which is what FindPattern scans, rather than just
+// the code FindMaskedPattern scans, so a signature is unique for either of them. Data is compared
+// as it is in the file, before any pointers in it are relocated, and relocated bytes in code are
+// skipped as FindMaskedPattern does. The check uses a suffix array of the image sorted by the
+// first kDepth bytes of each suffix. The rarest run of fixed bytes in a signature gives the few
+// places that could match, which are then compared in full.
+//
+//   siggen <library file> <symbol> [more symbols...]
+
+#include "ImageFile.h"
+#include "asm/x86insn.h"
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+CPageAlloc GenBuffer::ms_Allocator(16);
+
+using Clock = std::chrono::steady_clock;
+
+static const char kWildcard = '\x2A';
+static const size_t kDepth = 64;		// suffixes are only sorted by this many bytes
+static const size_t kMinLength = 6;		// shorter signatures tend to break on the next update
+static const size_t kMaxLength = 128;	// longest signature that is tried
+
+static double SecondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+class CodeIndex
+{
+public:
+	CodeIndex(const unsigned char *code, size_t size) : code_(code), size_(size)
+	{
+		Build();
+	}
+
+	// Range of suffixes in the array that start with the given bytes, up to kDepth of them
+	void Find(const unsigned char *bytes, size_t len, size_t *first, size_t *last) const
+	{
+		if (len > kDepth)
+			len = kDepth;
+
+		size_t lo = 0, hi = sa_.size();
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (Compare(sa_[mid], bytes, len) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		*first = lo;
+
+		hi = sa_.size();
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (Compare(sa_[mid], bytes, len) <= 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		*last = lo;
+	}
+
+	uint32_t operator[](size_t i) const
+	{
+		return sa_[i];
+	}
+
+private:
+	int Compare(uint32_t pos, const unsigned char *bytes, size_t len) const
+	{
+		size_t avail = size_ - pos;
+		int cmp = memcmp(code_ + pos, bytes, avail < len ? avail : len);
+		if (cmp == 0 && avail < len)
+			return -1;
+		return cmp;
+	}
+
+	// Prefix doubling with counting sorts: after the round with step h, suffixes are ordered and
+	// grouped into classes by their first 2h bytes. A sentinel below every byte value ends each
+	// suffix, so sorting cyclic shifts of the code plus the sentinel sorts the suffixes.
+	void Build()
+	{
+		const size_t n = size_ + 1;
+		std::vector<uint32_t> cls(n), order(n), tmp(n), counts(n > 257 ? n : 257);
+
+		for (size_t i = 0; i < n; i++)
+			counts[i < size_ ? code_[i] + 1 : 0]++;
+		for (size_t i = 1; i < 257; i++)
+			counts[i] += counts[i - 1];
+		for (size_t i = n; i-- > 0; )
+			order[--counts[i < size_ ? code_[i] + 1 : 0]] = uint32_t(i);
+
+		uint32_t classes = 1;
+		cls[order[0]] = 0;
+		for (size_t i = 1; i < n; i++) {
+			uint32_t a = order[i], b = order[i - 1];
+			if ((a < size_ ? code_[a] + 1 : 0) != (b < size_ ? code_[b] + 1 : 0))
+				classes++;
+			cls[a] = classes - 1;
+		}
+
+		for (size_t h = 1; h < kDepth && classes < n; h *= 2) {
+			// Already sorted by the second half, so a stable sort by the first half finishes it
+			for (size_t i = 0; i < n; i++)
+				tmp[i] = uint32_t(order[i] >= h ? order[i] - h : order[i] + n - h);
+
+			std::fill(counts.begin(), counts.begin() + classes, 0);
+			for (size_t i = 0; i < n; i++)
+				counts[cls[tmp[i]]]++;
+			for (size_t i = 1; i < classes; i++)
+				counts[i] += counts[i - 1];
+			for (size_t i = n; i-- > 0; )
+				order[--counts[cls[tmp[i]]]] = tmp[i];
+
+			tmp[order[0]] = 0;
+			classes = 1;
+			for (size_t i = 1; i < n; i++) {
+				uint32_t a = order[i], b = order[i - 1];
+				if (cls[a] != cls[b] || cls[(a + h) % n] != cls[(b + h) % n])
+					classes++;
+				tmp[a] = classes - 1;
+			}
+			cls.swap(tmp);
+		}
+
+		// The sentinel's own suffix always sorts first
+		sa_.assign(order.begin() + 1, order.end());
+	}
+
+	const unsigned char *code_;
+	size_t size_;
+	std::vector<uint32_t> sa_;
+};
+
+using Spans = ke::Vector<SigScanner::Span>;
+
+// Whether sig matches at pos, where like in FindMaskedPattern the bytes of relocs count as wildcards
+static bool MatchesAt(const unsigned char *code, const char *sig, size_t len, size_t pos, const Spans &relocs)
+{
+	// First span that ends after pos
+	size_t lo = 0, hi = relocs.length();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (relocs[mid].end <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (size_t j = 0; j < len; j++) {
+		while (lo < relocs.length() && relocs[lo].end <= pos + j)
+			lo++;
+		if (lo < relocs.length() && relocs[lo].start <= pos + j)
+			continue;
+		if (sig[j] != kWildcard && code[pos + j] != (unsigned char)sig[j])
+			return false;
+	}
+
+	return true;
+}
+
+// Whether sig matches anywhere but at self, trying only the places its rarest run of fixed
+// bytes occurs and the places where that run would overlap relocated bytes
+static bool IsUnique(const CodeIndex &index, const unsigned char *code, size_t size, const Spans &relocs,
+                     const char *sig, size_t len, size_t self)
+{
+	size_t bestStart = 0, bestEnd = 0, bestFirst = 0, bestLast = 0;
+	bool haveRun = false;
+
+	for (size_t i = 0; i < len; ) {
+		if (sig[i] == kWildcard) {
+			i++;
+			continue;
+		}
+
+		size_t end = i;
+		while (end < len && sig[end] != kWildcard)
+			end++;
+
+		size_t first, last;
+		index.Find(reinterpret_cast<const unsigned char *>(sig + i), end - i, &first, &last);
+		if (!haveRun || last - first < bestLast - bestFirst) {
+			bestStart = i;
+			bestEnd = end;
+			bestFirst = first;
+			bestLast = last;
+			haveRun = true;
+		}
+
+		i = end;
+	}
+
+	// A signature of nothing but wildcards matches everywhere
+	if (!haveRun)
+		return false;
+
+	for (size_t i = bestFirst; i < bestLast; i++) {
+		size_t pos = index[i];
+		if (pos < bestStart || pos - bestStart == self || pos - bestStart + len > size)
+			continue;
+
+		if (MatchesAt(code, sig, len, pos - bestStart, relocs))
+			return false;
+	}
+
+	// The index holds the bytes as they are in the file, so it misses matches where the run
+	// falls on relocated bytes that differ
+	for (size_t i = 0; i < relocs.length(); i++) {
+		size_t first = relocs[i].start + 1 > bestEnd ? relocs[i].start + 1 - bestEnd : 0;
+		for (size_t pos = first; pos + bestStart < relocs[i].end && pos + len <= size; pos++) {
+			if (pos != self && MatchesAt(code, sig, len, pos, relocs))
+				return false;
+		}
+	}
+
+	return true;
+}
+
+// Finds the shortest signature of whole instructions starting at offset in code that is unique in
+// the image
+static size_t Generate(const CodeIndex &index, ImageFile &lib, size_t offset, char *sig)
+{
+	const unsigned char *image = reinterpret_cast<const unsigned char *>(lib.GetImage());
+	const unsigned char *code = reinterpret_cast<const unsigned char *>(lib.GetCode());
+	size_t size = lib.GetCodeSize();
+	size_t avail = size - offset < kMaxLength ? size - offset : kMaxLength;
+
+	memcpy(sig, code + offset, avail);
+	if (!SigScanner::MaskOperands(sig, avail, lib.Is64Bit()))
+		return 0;
+
+	const Spans &relocs = lib.GetRelocations();
+	for (size_t i = 0; i < relocs.length(); i++) {
+		for (size_t j = relocs[i].start; j < relocs[i].end; j++) {
+			if (j >= offset && j < offset + avail)
+				sig[j - offset] = kWildcard;
+		}
+	}
+
+	// The decoder may read past the last instruction
+	unsigned char insns[kMaxLength + 16] = {};
+	memcpy(insns, code + offset, avail);
+
+	const int mode64 = lib.Is64Bit();
+
+	for (size_t len = 0; len < avail; ) {
+		struct x86_insn insn;
+		if (!x86_decode(&insns[len], mode64, &insn) || len + insn.length > avail)
+			break;
+
+		len += insn.length;
+		if (len >= kMinLength &&
+		    IsUnique(index, image, lib.GetImageSize(), relocs, sig, len, code + offset - image))
+			return len;
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <library file> <symbol> [more symbols...]\n", argv[0]);
+		return 1;
+	}
+
+	ImageFile lib(argv[1]);
+	if (!lib.IsValid())
+		return 1;
+
+	Clock::time_point start = Clock::now();
+	const unsigned char *image = reinterpret_cast<const unsigned char *>(lib.GetImage());
+	CodeIndex index(image, lib.GetImageSize());
+	fprintf(stderr, "Indexed %zu bytes of image in %.2f s\n", lib.GetImageSize(), SecondsSince(start));
+
+	start = Clock::now();
+	int failed = 0;
+
+	for (int i = 2; i < argc; i++) {
+		const char *symbol = argv[i];
+		const char *address = lib.ResolveHiddenSymbol<const char *>(symbol);
+		if (!address || address < lib.GetCode() || address >= lib.GetCode() + lib.GetCodeSize()) {
+			fprintf(stderr, "%s: not found in code\n", symbol);
+			failed++;
+			continue;
+		}
+
+		char sig[kMaxLength];
+		size_t len = Generate(index, lib, address - lib.GetCode(), sig);
+		if (len == 0) {
+			fprintf(stderr, "%s: no unique signature within %zu bytes\n", symbol, kMaxLength);
+			failed++;
+			continue;
+		}
+
+		printf("%s \"", symbol);
+		for (size_t j = 0; j < len; j++) {
+			if (sig[j] == kWildcard && (unsigned char)address[j] != 0x2A)
+				printf(j ? " ?" : "?");
+			else
+				printf(j ? " %02X" : "%02X", (unsigned char)sig[j]);
+		}
+		printf("\"\n");
+	}
+
+	fprintf(stderr, "Generated %d signatures in %.3f s\n", argc - 2 - failed, SecondsSince(start));
+	return failed ? 1 : 0;
+}